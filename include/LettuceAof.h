@@ -0,0 +1,174 @@
+#ifndef LETTUCE_AOF_H
+#define LETTUCE_AOF_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+// where a snapshot sits in the append only file - written into the snapshot so a restart only
+// replays the commands that came after it
+struct LettuceAofPosition
+{
+  uint64_t generation = 0; // random id of the log file, 0 means no log
+  uint64_t offset = 0;     // byte offset into that file
+};
+
+struct LettuceAofStats
+{
+  bool enabled;
+  std::string fsync;
+  uint64_t size;          // bytes logged, including the ones still buffered
+  uint64_t bufferLength;  // bytes not written to the file yet
+  uint64_t fsyncs;
+  bool lastWriteOk;
+  uint64_t baseSize; // size after the last rewrite (or at open), auto rewrites compare against it
+  bool rewriteInProgress;
+  uint64_t rewriteBufferLength; // writes kept aside for the running rewrite
+  uint64_t rewrites;
+  bool lastRewriteOk;
+};
+
+// buffered output for a rewrite - used by the forked child, so it shares no state with LettuceAof
+class LettuceAofWriter
+{
+public:
+  static constexpr size_t bufferSize = 1 << 20;
+
+  ~LettuceAofWriter();
+  bool open(const std::string &filename, uint64_t generation); // writes the LETTUCE-AOF header
+  void append(const std::vector<std::string> &tokens);
+  bool finish(); // flush and fsync
+
+private:
+  int fd = -1;
+  std::string buffer;
+  bool failed = false;
+
+  void flush();
+};
+
+// append only command log
+// write commands are appended (as RESP arrays) to an in memory buffer while the caller still holds
+// db_mutex, so the log order is the execution order. a dedicated thread writes the buffer out and
+// fsyncs it - everything that piles up while it is busy goes out in the next write and fsync, which
+// is the group commit that keeps `always` close to in memory speed with many clients
+// the file starts with a LETTUCE-AOF generation record, so a snapshot can tell whether it belongs to it
+class LettuceAof
+{
+public:
+  enum class Fsync
+  {
+    Always,   // a write is only acknowledged once it is fsynced
+    Everysec, // fsync at most once a second, up to a second of writes can be lost
+    No        // leave it to the kernel
+  };
+
+  static constexpr const char *defaultFilename = "appendonly.aof";
+
+  static LettuceAof &getInstance(); // singleton
+
+  // appendonly config - at runtime turning it on starts a fresh log (startedFresh, the caller should
+  // snapshot right away so the log has a base) and turning it off closes it. during startup it is
+  // only recorded until finishStartup
+  void setAppendOnly(bool enabled, bool &startedFresh);
+  bool appendOnly();
+  void beginStartup();
+  // replays the log on top of the loaded snapshot through apply, then opens it for appending
+  bool finishStartup(const std::string &filename, const LettuceAofPosition &snapshot,
+                     const std::function<void(std::vector<std::string> &)> &apply, size_t &replayed, std::string &error);
+
+  bool setFsync(const std::string &policy);
+  std::string getFsync();
+
+  // reads filename, skips everything the snapshot already holds and hands each command to apply
+  // a record cut short by a crash ends the replay and is dropped when the file is opened again
+  bool replay(const std::string &filename, const LettuceAofPosition &snapshot,
+              const std::function<void(std::vector<std::string> &)> &apply, size_t &replayed, std::string &error);
+  // continues the file if it has a LETTUCE-AOF header (minus any torn tail replay found), otherwise starts a new one
+  bool open(const std::string &filename, std::string &error);
+  void close(); // writes and fsyncs whatever is buffered
+
+  bool active() const { return isActive.load(std::memory_order_relaxed); }
+  uint64_t append(const std::vector<std::string> &tokens); // caller holds db_mutex, returns the end offset
+  void waitDurable(uint64_t offset); // with `always` blocks until offset is fsynced
+  LettuceAofPosition position();
+  LettuceAofStats stats();
+
+  // background rewrite (driven by LettuceDatabase::bgrewriteaof, which forks the child)
+  // beginRewrite is called under db_mutex right before the fork, from then on every append is also
+  // kept in a diff buffer. once the child has written the dataset to <file>.rewrite.<pid> the writer
+  // thread appends the diff and renames the file over the log
+  bool beginRewrite(uint64_t &newGeneration, std::string &logPath);
+  static std::string rewriteFilename(const std::string &logPath, pid_t child);
+  void rewriteStarted(pid_t child);
+  void finishRewrite(pid_t child, bool ok);
+  void abortRewrite(); // the fork failed
+  bool waitForRewrite(); // blocks until a running rewrite is done, returns whether it worked
+  bool takeRewriteRequest(); // true once the log has grown past the auto rewrite threshold
+
+  // auto-aof-rewrite-percentage / auto-aof-rewrite-min-size, 0 turns auto rewrites off
+  void setRewritePercentage(size_t percentage);
+  size_t getRewritePercentage();
+  void setRewriteMinSize(uint64_t bytes);
+  uint64_t getRewriteMinSize();
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable durable;
+  std::thread writer;
+  std::atomic<bool> isActive{false};
+  bool enabled = false;
+  bool startingUp = false;
+  bool stopping = false;
+  Fsync policy = Fsync::Everysec;
+
+  int fd = -1;
+  std::string path;
+  uint64_t generation = 0;
+  std::string buffer;
+  uint64_t appended = 0; // end of the log file, buffer included
+  // bytes ever logged and how many of them are fsynced - unlike file offsets these survive a rewrite,
+  // so they're what clients wait on
+  uint64_t logged = 0;
+  uint64_t loggedSynced = 0;
+  uint64_t fsyncCount = 0;
+  bool lastWriteOk = true;
+
+  bool rewriting = false;
+  bool rewriteFinished = false; // the child is done, the writer thread still has to switch files
+  pid_t rewriteChild = -1;
+  uint64_t rewriteGeneration = 0;
+  std::string rewriteDiff;
+  std::condition_variable rewriteDone;
+  std::atomic<bool> rewriteWanted{false};
+  uint64_t baseSize = 0;
+  size_t rewritePercentage = 100;
+  uint64_t rewriteMinSize = 64 * 1024 * 1024;
+  uint64_t rewriteCount = 0;
+  bool lastRewriteOk = true;
+
+  // what replay found, so open can continue the same file
+  std::string replayedPath;
+  uint64_t replayedGeneration = 0;
+  uint64_t replayedLength = 0;
+
+  void run();
+  bool openLocked(const std::string &filename, bool fresh, std::string &error);
+  void closeLocked(std::unique_lock<std::mutex> &lock);
+  void switchToRewrite(std::unique_lock<std::mutex> &lock);
+
+  LettuceAof() = default;
+  ~LettuceAof();
+  LettuceAof(const LettuceAof &) = delete;
+  LettuceAof &operator=(const LettuceAof &) = delete;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef LETTUCE_BITMAP_H
+#define LETTUCE_BITMAP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// bitmaps are plain string values, bit 0 is the most significant bit of the first byte (same as redis)
+
+enum class BitOp
+{
+  And,
+  Or,
+  Xor,
+  Not
+};
+
+// number of set bits in data[0..length)
+uint64_t bitmapPopcount(const uint8_t *data, size_t length);
+
+// set bits between bit offsets [startBit, endBit] inclusive
+uint64_t bitmapPopcountBits(const uint8_t *data, size_t length, uint64_t startBit, uint64_t endBit);
+
+// dest[i] = dest[i] op src[i] over length bytes (BitOp::Not ignores src and inverts dest)
+void bitmapOp(BitOp op, uint8_t *dest, const uint8_t *src, size_t length);
+
+// first bit equal to bit between bit offsets [startBit, endBit] inclusive, -1 if there is none
+int64_t bitmapPos(const uint8_t *data, size_t length, int bit, uint64_t startBit, uint64_t endBit);
+
+// resolves redis style start/end (negative counts from the end) against size, false if the range is empty
+bool bitmapRange(int64_t start, int64_t end, int64_t size, int64_t &first, int64_t &last);
+
+#endif
@@ -3,14 +3,63 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
+class LettuceDatabase;
+
+// an entry in the command table
+struct LettuceCommand
+{
+  static constexpr int write = 1 << 0;
+  static constexpr int readonly = 1 << 1;
+  static constexpr int admin = 1 << 2;
+  static constexpr int loading = 1 << 3; // allowed while the dataset is still loading
+  static constexpr int denyoom = 1 << 4; // may grow the dataset, refused once maxmemory can't be met
+  static constexpr int readsValue = 1 << 5; // uses the stored string of its keys, one on disk is read back first
+
+  std::string (*function)(const std::vector<std::string> &, LettuceDatabase &);
+  int flags;
+  int firstKey; // 0 if the command takes no keys
+  int lastKey;  // -1 means the last argument
+  int keyStep;
+
+  std::vector<std::string> keys(const std::vector<std::string> &tokens) const;
+};
+
+// one handler per connection - it holds the connection's protocol, MULTI queue and WATCHed keys
 class LettuceCommandHandler
 {
 public:
   LettuceCommandHandler();
+  ~LettuceCommandHandler();
   std::string handleCommand(const std::string& commandLine);
+  std::string execute(std::vector<std::string> tokens); // an already parsed command, used to replay the append only file
+  std::string pendingPushes(); // invalidation messages to send even if the client is idle
+  uint64_t id() const;
+
+private:
+  struct QueuedCommand
+  {
+    const LettuceCommand *command;
+    std::vector<std::string> tokens;
+  };
+
+  uint64_t clientId;
+  int protocol = 2; // RESP version, switched with HELLO
+  bool tracking = false;
+  bool inTransaction = false;
+  bool transactionFailed = false; // an unknown command was queued, EXEC will abort
+  std::vector<QueuedCommand> queuedCommands;
+  std::vector<std::pair<std::string, uint64_t>> watchedKeys; // key and its version when WATCHed
+  uint64_t unsyncedOffset = 0; // end of this client's last logged write, waited on before replying
+
+  void unwatchAll();
+  std::string dispatch(std::vector<std::string> tokens);
+  std::string run(const LettuceCommand &command, const std::vector<std::string> &tokens, LettuceDatabase &db);
+  std::string handleHello(const std::vector<std::string> &tokens);
+  std::string handleClient(const std::vector<std::string> &tokens);
 };
 
 std::vector<std::string> parseRespCommand(const std::string& input);
 
-#endif
\ No newline at end of file
+#endif
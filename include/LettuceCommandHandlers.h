@@ -6,13 +6,27 @@
 std::string handlePing(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleEcho(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleFlushAll(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleInfo(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleConfig(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSave(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleBgsave(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleLastsave(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleBgrewriteaof(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleMemory(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleSet(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleGet(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleKeys(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleScan(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleType(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleDel(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleUnlink(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleExpire(const std::vector<std::string>&, LettuceDatabase&);
+std::string handlePexpireat(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleRename(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleCopy(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleMget(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleMset(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleMsetnx(const std::vector<std::string>&, LettuceDatabase&);
 
 std::string handleLget(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleLlen(const std::vector<std::string>&, LettuceDatabase&);
@@ -32,4 +46,25 @@ std::string handleHgetall(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleHkeys(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleHvals(const std::vector<std::string>&, LettuceDatabase&);
 std::string handleHlen(const std::vector<std::string>&, LettuceDatabase&);
-std::string handleHmset(const std::vector<std::string>&, LettuceDatabase&);
\ No newline at end of file
+std::string handleHscan(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleHmset(const std::vector<std::string>&, LettuceDatabase&);
+
+std::string handleSadd(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSrem(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSismember(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleScard(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSmembers(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSscan(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSinter(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSunion(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleSdiff(const std::vector<std::string>&, LettuceDatabase&);
+
+std::string handlePfadd(const std::vector<std::string>&, LettuceDatabase&);
+std::string handlePfcount(const std::vector<std::string>&, LettuceDatabase&);
+std::string handlePfmerge(const std::vector<std::string>&, LettuceDatabase&);
+
+std::string handleSetbit(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleGetbit(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleBitcount(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleBitpos(const std::vector<std::string>&, LettuceDatabase&);
+std::string handleBitop(const std::vector<std::string>&, LettuceDatabase&);
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef LETTUCE_CONFIG_H
+#define LETTUCE_CONFIG_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// runtime configuration, settable with CONFIG SET or as --name value on the command line
+// each parameter reads and writes the setting where it actually lives (usually LettuceDatabase)
+class LettuceConfig
+{
+public:
+  static LettuceConfig &getInstance(); // singleton
+
+  bool set(const std::string &name, const std::string &value, std::string &error);
+  bool get(const std::string &name, std::string &value) const;
+  std::vector<std::pair<std::string, std::string>> getMatching(const std::string &pattern) const;
+
+  // parses "--name value" pairs starting at argv[first]
+  bool parseArgs(int argc, char *argv[], int first, std::string &error);
+
+private:
+  struct Parameter
+  {
+    std::string name;
+    std::function<bool(const std::string &, std::string &)> set; // value, error
+    std::function<std::string()> get;
+  };
+  std::vector<Parameter> parameters;
+
+  LettuceConfig();
+  const Parameter *find(const std::string &name) const;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef LETTUCE_COW_H
+#define LETTUCE_COW_H
+
+#include <memory>
+#include <utility>
+#include <cstddef>
+
+// reference counted copy on write value, used for the aggregate types (lists, hashes, sets)
+// copying one only bumps a counter, the first write to a shared value clones it
+// reads go through * and ->, writes have to go through mutate()
+template <typename T>
+class LettuceCow
+{
+public:
+  LettuceCow() : value(std::make_shared<T>()) {}
+
+  // no converting constructor on purpose, it would make store[key] = {{...}} ambiguous
+  LettuceCow &operator=(T replacement)
+  {
+    value = std::make_shared<T>(std::move(replacement));
+    return *this;
+  }
+
+  const T &operator*() const { return *value; }
+  const T *operator->() const { return value.get(); }
+
+  T &mutate()
+  {
+    if (value.use_count() > 1)
+      value = std::make_shared<T>(*value);
+    return *value;
+  }
+
+  bool shared() const { return value.use_count() > 1; }
+
+  // container shortcuts so a LettuceCow can mostly be used like the value it holds
+  size_t size() const { return value->size(); }
+  bool empty() const { return value->empty(); }
+  template <typename Key>
+  auto &operator[](Key &&key) { return mutate()[std::forward<Key>(key)]; }
+
+private:
+  std::shared_ptr<T> value;
+};
+
+#endif
@@ -6,36 +6,253 @@
 #include <mutex>
 #include <chrono>
 #include <unordered_map>
+#include <optional>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <random>
+#include <sys/types.h>
+
+#include "LettuceSet.h"
+#include "LettuceCow.h"
+#include "LettuceDict.h"
+#include "LettuceField.h"
+#include "LettuceBitmap.h"
+#include "LettuceRadixTree.h"
+#include "LettuceSnapshot.h"
+#include "LettuceAof.h"
+#include "LettuceEviction.h"
+#include "LettuceTier.h"
+
+struct LettuceKeyIndexStats
+{
+  bool enabled;
+  size_t keys;
+  size_t nodes;
+  size_t memoryBytes;
+};
+
+struct LettuceSaveStats
+{
+  bool inProgress;
+  time_t lastSave; // unix time of the last successful SAVE or BGSAVE
+  bool lastBgsaveOk;
+  int64_t lastBgsaveSeconds;    // -1 before the first BGSAVE finishes
+  int64_t currentBgsaveSeconds; // -1 when no BGSAVE is running
+  uint64_t keysSaved;           // progress of the running (or last) BGSAVE
+  uint64_t keysTotal;
+  uint64_t bytesWritten;
+  uint64_t changesSinceSave;    // writes not yet in a snapshot
+};
+
+// save <seconds> <changes> - snapshot once at least changes writes are older than seconds
+struct LettuceSaveRule
+{
+  int64_t seconds;
+  uint64_t changes;
+};
+
+struct LettuceLoadStats
+{
+  bool loading;
+  time_t startTime;     // unix time the current (or last) load started
+  uint64_t bytesTotal;  // snapshot size
+  uint64_t bytesLoaded;
+  uint64_t keysTotal;   // from the snapshot header, 0 for version 1 files
+  uint64_t keysLoaded;
+  int64_t etaSeconds;   // -1 until there is enough progress to guess
+};
+
+// active defrag, see LettuceDefrag.h - fragmentation is rss over used memory, in percent above 100
+struct LettuceDefragConfig
+{
+  bool enabled = false;
+  size_t ignoreBytes = 100 << 20; // less wasted memory than this is left alone
+  int thresholdLower = 10;        // fragmentation percent that starts a pass
+  int thresholdUpper = 100;       // fragmentation percent that gets the most effort
+  int cycleMin = 1;               // percent of the time spent moving values at the lower threshold
+  int cycleMax = 25;              // and at the upper one
+};
+
+struct LettuceDefragStats
+{
+  bool running;
+  int effort;         // percent of the time the running pass gets
+  uint64_t hits;      // blocks moved
+  uint64_t misses;    // blocks that stayed where they were
+  uint64_t keyHits;   // keys with at least one block moved
+  uint64_t keyMisses;
+  uint64_t passes;    // complete walks over the keyspace
+};
+
+struct LettuceCompressionStats
+{
+  size_t threshold;  // 0 when compression is off
+  uint64_t strings;  // values currently stored compressed
+  uint64_t bytesSaved;
+  uint64_t skipped;  // values over the threshold kept as they were because they didn't compress well
+};
+
+// tiered storage, see LettuceTier.h - string values nobody has touched for idleSeconds move to segment
+// files under prefix, only their key and location stay in memory
+struct LettuceTierConfig
+{
+  bool enabled = false;
+  std::string prefix = "lettuce-tier";
+  uint32_t idleSeconds = 600;
+  size_t minSize = 1024;           // smaller values aren't worth a disk read
+  uint64_t segmentSize = 64 << 20; // a segment is closed and a new one started once it's this big
+};
+
+struct LettuceTierStats
+{
+  bool enabled;
+  uint64_t keys;           // values currently on disk
+  uint64_t liveBytes;      // their size there
+  uint64_t fileBytes;      // the segments' size, live or not
+  uint64_t segments;
+  uint64_t spills;         // values moved to disk
+  uint64_t reads;          // values read back into memory
+  uint64_t compactedBytes; // live bytes moved out of mostly dead segments
+};
+
 class LettuceDatabase
 {
 public:
-  std::unordered_map<std::string, std::string> keyValueStore;
-  std::unordered_map<std::string, std::vector<std::string>> listStore;
-  std::unordered_map<std::string, std::unordered_map<std::string, std::string>> hashStore;
+  LettuceDict<std::string, std::string> keyValueStore;
+  // aggregates are copy on write so COPY is O(1) until one side is written
+  LettuceDict<std::string, LettuceCow<std::vector<std::string>>> listStore;
+  LettuceDict<std::string, LettuceCow<LettuceHash>> hashStore; // field names are interned, see LettuceField.h
+  LettuceDict<std::string, LettuceCow<LettuceSet>> setStore;
   std::unordered_map<std::string, std::chrono::steady_clock::time_point> expiryMap;
 
   static LettuceDatabase &getInstance(); // singleton
 
+  // binary snapshot, see LettuceSnapshot.h - load leaves the keyspace untouched if the file is corrupt
+  // and reports the append only file position the snapshot was taken at
   bool dump(const std::string &filename);
-  bool load(const std::string &filename);
+  bool load(const std::string &filename, LettuceAofPosition *aofPosition = nullptr);
+  // forks a child that writes the snapshot from its copy on write view of memory, so clients
+  // are only held up for the fork itself - false if a BGSAVE is already running or fork fails
+  bool bgsave(const std::string &filename);
+  bool waitForBgsave(); // blocks until a running BGSAVE finishes, returns whether the last one succeeded
+  // save rules, checked once a second by main - saveIfDue starts a BGSAVE when one of them is met
+  void setSaveRules(std::vector<LettuceSaveRule> rules);
+  std::vector<LettuceSaveRule> getSaveRules();
+  bool saveIfDue(const std::string &filename);
+  // snapshot-compression - segments are lz compressed when that saves space
+  void setSnapshotCompression(bool enabled);
+  bool getSnapshotCompression();
+  // snapshot-key-delay - a BGSAVE child waits this long (microseconds) before each key, for testing
+  void setKeySaveDelay(uint64_t micros);
+  uint64_t getKeySaveDelay();
+  time_t lastSave();
+  LettuceSaveStats saveStats();
+  // forks a child that writes the smallest command stream rebuilding the keyspace, which then
+  // replaces the append only file - false if the log is off, a rewrite is running or fork fails
+  bool bgrewriteaof();
+
+  // startup marks the dataset as loading while the snapshot is read and the log replayed, clients
+  // get -LOADING until it is done and no snapshot may be written over the file being loaded
+  void setLoading(bool loading);
+  bool isLoading() const { return loadingFlag.load(std::memory_order_relaxed); }
+  LettuceLoadStats loadStats();
 
-  bool flushAll();
+  bool flushAll(bool async = false); // async hands the old keyspace to the lazy free thread
   void purgeExpired();
 
   // key values
   void set(const std::string &key, const std::string &value);
   bool get(const std::string &key, std::string &value);
   std::vector<std::string> keys();
+  std::vector<std::string> keys(const std::string &pattern); // glob, uses the key index for the literal prefix when enabled
+  // cursor based iteration, each call returns the next cursor and 0 once the iteration is complete
+  // empty pattern or type means no filter, count is a hint for how much work to do per call
+  uint64_t scan(uint64_t cursor, size_t count, const std::string &pattern, const std::string &type, std::vector<std::string> &keys);
   std::string type(const std::string &key);
   bool del(const std::string &key);
+  bool unlink(const std::string &key); // like del, but the value is always destroyed in the background
   bool expire(const std::string &key, int seconds);
-  bool rename(const std::string &oldKey, const std::string &newKey);
+  bool expireAt(const std::string &key, uint64_t unixMillis); // absolute, so it replays the same from the append only file
+  bool rename(const std::string &oldKey, const std::string &newKey); // moves the value, never copies it
+  bool copy(const std::string &sourceKey, const std::string &destKey, bool replace); // false if source is missing or dest exists without replace
+
+  // optimistic locking for MULTI/EXEC - watch returns the key's current version, and exec only
+  // runs the batch (under a single lock acquisition) if none of the watched versions changed
+  uint64_t watch(const std::string &key);
+  void unwatch(const std::string &key);
+  bool exec(const std::vector<std::pair<std::string, uint64_t>> &watched, const std::function<void()> &batch);
+
+  // values whose free effort (elements) exceeds this are destroyed in the background on del, overwrite
+  // and expiry, 0 turns that off
+  void setLazyFreeThreshold(size_t threshold);
+  size_t getLazyFreeThreshold();
+
+  // maxmemory, 0 means no limit - commands that can grow the dataset call freeMemoryIfNeeded first,
+  // which evicts keys chosen by the policy from a few random samples until used memory is under the limit
+  void setMaxMemory(uint64_t bytes);
+  uint64_t getMaxMemory() const { return maxMemory.load(std::memory_order_relaxed); }
+  void setEvictionPolicy(LettuceEvictionPolicy policy);
+  LettuceEvictionPolicy getEvictionPolicy();
+  void setEvictionSamples(size_t samples);
+  size_t getEvictionSamples();
+  bool freeMemoryIfNeeded(); // false if memory is still over the limit (noeviction, or nothing left to evict)
+  // the lru and lfu policies need to know when keys are used, accessTracked says whether touch does anything
+  bool accessTracked() const { return accessTracking.load(std::memory_order_relaxed); }
+  void touch(const std::vector<std::string> &keys);
+  uint64_t evictedKeyCount() const { return evictedKeys.load(std::memory_order_relaxed); }
+
+  // bytes used by key - its node in the store, payload, containers and allocator rounding - false if it
+  // doesn't exist. aggregates are estimated from samples of their elements, 0 measures every element
+  bool memoryUsage(const std::string &key, size_t samples, size_t &bytes);
+
+  // active defrag - main calls activeDefragCycle every interval, it walks the keyspace moving values
+  // to lower addresses while fragmentation is over the lower threshold, in slices of at most 1ms under
+  // the lock and for between cycle-min and cycle-max percent of the interval
+  void setDefragConfig(const LettuceDefragConfig &config);
+  LettuceDefragConfig getDefragConfig();
+  void activeDefragCycle(std::chrono::milliseconds interval);
+  bool defragStep(std::chrono::steady_clock::time_point deadline); // true once a pass over the keyspace is complete
+  LettuceDefragStats defragStats();
+
+  // string values of at least threshold bytes are kept lz compressed (see LettuceLz.h) and decoded on
+  // read, unless they compress to more than 3/4 of their size - 0 turns it off, existing values stay as
+  // they are until they're written again
+  void setStringCompressionThreshold(size_t threshold);
+  size_t getStringCompressionThreshold();
+  LettuceCompressionStats compressionStats();
+
+  // tiered storage - main calls tierCycle every interval, it walks the strings moving cold values to disk
+  // and compacts the segment with the most dead space once a pass is done. commands call promote for
+  // their keys first, which reads those values back without holding the lock during the read (other
+  // clients carry on), anything else that needs a value on disk reads it under the lock
+  void setTierConfig(const LettuceTierConfig &config); // turned off, tierCycle reads the values back before the files go
+  LettuceTierConfig getTierConfig();
+  bool tieringEnabled() const { return tiering.load(std::memory_order_relaxed); }
+  void promote(const std::vector<std::string> &keys);
+  void tierCycle(std::chrono::milliseconds interval);
+  bool tierStep(std::chrono::steady_clock::time_point deadline); // true once a pass over the strings is complete
+  LettuceTierStats tierStats();
+
+  // optional radix tree index on key names, maintained on every write once enabled
+  void setKeyIndexEnabled(bool enabled);
+  LettuceKeyIndexStats keyIndexStats();
+
+  // batched key values - one lock acquisition and expiry purge for the whole batch
+  std::vector<std::optional<std::string>> mget(const std::vector<std::string> &keys);
+  void mset(const std::vector<std::pair<std::string, std::string>> &pairs);
+  bool msetnx(const std::vector<std::pair<std::string, std::string>> &pairs); // false (and sets nothing) if any key exists
 
   // list
   std::vector<std::string> lget(const std::string &key);
   size_t llen(const std::string &key);
   void lpush(const std::string &key, const std::string &value);
+  void lpush(const std::string &key, const std::vector<std::string> &values); // same order as pushing them one by one
   void rpush(const std::string &key, const std::string &value);
+  void rpush(const std::string &key, const std::vector<std::string> &values);
   bool lpop(const std::string &key, std::string &value);
   bool rpop(const std::string &key, std::string &value);
   int lrem(const std::string &key, int count, const std::string &value);
@@ -52,9 +269,168 @@ public:
   std::vector<std::string> hvals(const std::string &key);
   size_t hlen(const std::string &key);
   bool hmset(const std::string &key, const std::vector<std::pair<std::string, std::string>> &pairs);
+  uint64_t hscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern, std::vector<std::pair<std::string, std::string>> &fields);
+
+  // sets
+  int sadd(const std::string &key, const std::vector<std::string> &members);
+  int srem(const std::string &key, const std::vector<std::string> &members);
+  bool sismember(const std::string &key, const std::string &member);
+  size_t scard(const std::string &key);
+  std::vector<std::string> smembers(const std::string &key);
+  uint64_t sscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern, std::vector<std::string> &members);
+  std::vector<std::string> sinter(const std::vector<std::string> &keys);
+  std::vector<std::string> sunion(const std::vector<std::string> &keys);
+  std::vector<std::string> sdiff(const std::vector<std::string> &keys);
+
+  // hyperloglog - stored as string values, false if a key holds a string that is not a HyperLogLog
+  bool pfadd(const std::string &key, const std::vector<std::string> &elements, bool &updated);
+  bool pfcount(const std::vector<std::string> &keys, uint64_t &count);
+  bool pfmerge(const std::string &destKey, const std::vector<std::string> &sourceKeys);
+
+  // bitmaps - stored as string values
+  int setbit(const std::string &key, uint64_t offset, int bit); // returns the previous bit
+  int getbit(const std::string &key, uint64_t offset);
+  uint64_t bitcount(const std::string &key);
+  uint64_t bitcount(const std::string &key, int64_t start, int64_t end, bool bitUnit);
+  int64_t bitpos(const std::string &key, int bit, int64_t start, int64_t end, bool endGiven, bool bitUnit);
+  size_t bitop(BitOp op, const std::string &destKey, const std::vector<std::string> &sourceKeys); // returns the dest length
 
 private:
-  std::mutex db_mutex;
+  // recursive so a transaction can hold it while the queued commands lock it again
+  std::recursive_mutex db_mutex;
+  std::unique_ptr<LettuceRadixTree> keyIndex;
+  // where each SCAN over the key index stopped, by cursor id - a cursor can't hold a key name. past
+  // indexScanCursorLimit the oldest are dropped, and a dropped cursor starts its scan over
+  static constexpr size_t indexScanCursorLimit = 1024;
+  std::unordered_map<uint64_t, std::string> indexScanCursors;
+  std::deque<uint64_t> indexScanOrder;
+  uint64_t indexScanCursorId = 0;
+  uint64_t saveIndexScanCursor(std::string last);
+
+  // versions are only tracked for keys somebody is watching, so unwatched writes stay free
+  struct WatchedKey
+  {
+    uint64_t version = 0;
+    size_t watchers = 0;
+  };
+  std::unordered_map<std::string, WatchedKey> watchedKeys;
+  uint64_t keyVersionCounter = 0;
+
+  size_t lazyFreeThreshold = 64;
+  bool snapshotCompression = true;
+
+  // BGSAVE state, guarded by save_mutex (taken after db_mutex when both are needed)
+  std::mutex save_mutex;
+  std::condition_variable bgsaveDone;
+  pid_t bgsaveChild = -1;
+  std::chrono::steady_clock::time_point bgsaveStarted;
+  uint64_t bgsaveKeysTotal = 0;
+  uint64_t bgsaveDirtyAtFork = 0; // taken off dirty when the child succeeds, a SAVE zeroes both
+  LettuceSnapshotProgress *saveProgress = nullptr; // shared with the child
+  uint64_t keySaveDelay = 0;
+  time_t lastSaveTime = time(nullptr);
+  bool lastBgsaveOk = true;
+  int64_t lastBgsaveSeconds = -1;
+  time_t lastBgsaveTry = 0;
+  static constexpr int saveRetrySeconds = 5;
+  std::vector<LettuceSaveRule> saveRules{{3600, 1}, {300, 100}, {60, 10000}};
+  // writes since the last successful save, bumped by signalModifiedKey under db_mutex but read
+  // and reduced by the BGSAVE reaper without it
+  std::atomic<uint64_t> dirty{0};
+
+  // eviction, guarded by db_mutex - keyMeta holds the packed lru/lfu data (see LettuceEviction.h) of every
+  // key, but is only kept while maxmemory is set with a policy that reads it (or tiered storage is on)
+  std::atomic<uint64_t> maxMemory{0};
+  LettuceEvictionPolicy evictionPolicy = LettuceEvictionPolicy::NoEviction;
+  size_t evictionSamples = 5;
+  std::atomic<bool> accessTracking{false};
+  bool keyMetaLfu = false; // which of the two encodings keyMeta holds
+  std::unordered_map<std::string, uint32_t> keyMeta;
+  struct EvictionCandidate
+  {
+    uint64_t score; // higher is a better candidate
+    std::string key;
+  };
+  std::vector<EvictionCandidate> evictionPool; // best candidates sampled so far, sorted by score
+  static constexpr size_t evictionPoolSize = 16;
+  std::atomic<uint64_t> evictedKeys{0};
+  std::mt19937_64 evictionRandom{std::random_device{}()};
+
+  // active defrag, guarded by db_mutex - the cursor walks the stores like SCAN does, aggregates
+  // bigger than a chunk are queued and done a chunk per step
+  struct DefragPending
+  {
+    std::string key;
+    uint64_t position; // list index or hash bucket cursor of the next chunk
+    bool moved;
+  };
+  static constexpr size_t defragChunk = 1000;
+  LettuceDefragConfig defragConfig;
+  bool defragRunning = false;
+  int defragEffort = 0;
+  uint64_t defragCursor = 0;
+  std::deque<DefragPending> defragLater;
+  uint64_t defragHits = 0;
+  uint64_t defragMisses = 0;
+  uint64_t defragKeyHits = 0;
+  uint64_t defragKeyMisses = 0;
+  uint64_t defragPasses = 0;
+
+  // string compression, guarded by db_mutex - a compressed value is stored as its lz bytes, and
+  // compressedStrings has the raw length of each one
+  size_t compressionThreshold = 0;
+  std::unordered_map<std::string, size_t> compressedStrings;
+  uint64_t compressionSavedBytes = 0;
+  uint64_t compressionSkipped = 0;
+
+  // tiered storage, guarded by db_mutex - a value on disk is an empty string in keyValueStore, and
+  // tieredStrings has where its stored (possibly compressed) bytes are
+  std::atomic<bool> tiering{false};
+  LettuceTierConfig tierConfig;
+  std::unique_ptr<LettuceTierStore> tierStore;
+  LettuceDict<std::string, LettuceTierLocation> tieredStrings;
+  uint64_t tierCursor = 0;
+  uint32_t tierCompacting = 0; // segment being compacted, 0 when none is
+  uint64_t tierCompactCursor = 0;
+  uint64_t tierSpills = 0;
+  uint64_t tierReads = 0;
+  uint64_t tierCompactedBytes = 0;
+
+  // load progress, guarded by load_mutex - updated once per merged segment
+  std::atomic<bool> loadingFlag{false};
+  std::mutex load_mutex;
+  time_t loadStartTime = 0;
+  std::chrono::steady_clock::time_point loadStarted;
+  uint64_t loadBytesTotal = 0;
+  uint64_t loadBytesLoaded = 0;
+  uint64_t loadKeysTotal = 0;
+  uint64_t loadKeysLoaded = 0;
+
+  bool keyExists(const std::string &key) const;
+  // caller holds db_mutex - aofPosition is taken by the caller too, a forked child can't lock the log
+  bool saveSnapshot(const std::string &filename, const LettuceAofPosition &aofPosition, LettuceSnapshotProgress *progress = nullptr);
+  bool writeAofRewrite(const std::string &filename, uint64_t generation); // caller holds db_mutex
+  bool detachKey(const std::string &key, bool async); // removes key from every store
+  void indexKey(const std::string &key);
+  void unindexKey(const std::string &key); // only drops the key once no store holds it
+  void signalModifiedKey(const std::string &key); // called after every write to a key
+  void updateAccessTracking(); // caller holds db_mutex, (re)builds keyMeta after a maxmemory or policy change
+  uint32_t newKeyMeta() const;
+  uint64_t evictionScore(const std::string &key);
+  void considerForEviction(const std::string &key);
+  void evictKey(const std::string &key);
+  uint64_t defragValue(const std::string &key, uint64_t position, bool &moved); // next chunk's position, 0 when done
+  void storeString(const std::string &key, const std::string &value); // compresses it when it's worth it
+  void compressStoredString(const std::string &key, std::string &value);
+  void forgetCompressed(const std::string &key); // before the value is removed or overwritten
+  size_t storedSize(const std::pair<const std::string, std::string> &entry) const; // on disk or in memory
+  void forgetTiered(const std::string &key); // before the value is removed or overwritten
+  void compactSegment(uint32_t segment);
+  bool drainTiered(std::chrono::steady_clock::time_point deadline); // reads values back once tiering is off
+  // value of a string entry, read from disk and/or decoded into scratch (and returned) when it has to be
+  const std::string &stringValue(const std::pair<const std::string, std::string> &entry, std::string &scratch) const;
+  // reads the value back and decompresses it in place - bitmaps and HyperLogLogs are read and written where they are
+  std::string &rawString(LettuceDict<std::string, std::string>::iterator it);
   LettuceDatabase() = default;                                  // default constructor
   ~LettuceDatabase() = default;                                 // default destructor
   LettuceDatabase(const LettuceDatabase &) = delete;            // deletes copy constructor
@@ -0,0 +1,39 @@
+#ifndef LETTUCE_DEFRAG_H
+#define LETTUCE_DEFRAG_H
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <cstddef>
+
+// relocation helpers for active defrag. glibc has no way to ask how full the page behind a block is
+// (jemalloc's defrag hint), so a block is moved when the allocator can place a copy of it at a lower
+// address - packing live data towards the start of the heap empties the pages above it, which
+// releaseFreePages then hands back to the os
+namespace LettuceDefrag
+{
+  // blocks this large are mmapped by glibc on their own and never fragment the heap
+  constexpr size_t largeBlock = 128 * 1024;
+
+  bool movable(const void *block);
+  bool relocate(std::string &value); // true if the buffer moved
+  bool releaseFreePages();           // malloc_trim, true if any memory went back to the os
+
+  // moves only the vector's buffer, the elements are moved into it without reallocating
+  template <typename T>
+  bool relocate(std::vector<T> &values)
+  {
+    if (values.empty() || !movable(values.data()))
+      return false;
+    std::vector<T> moved;
+    moved.reserve(values.size());
+    if (moved.data() > values.data())
+      return false;
+    std::move(values.begin(), values.end(), std::back_inserter(moved));
+    values.swap(moved);
+    return true;
+  }
+}
+
+#endif
@@ -0,0 +1,439 @@
+#ifndef LETTUCE_DICT_H
+#define LETTUCE_DICT_H
+
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <tuple>
+#include <type_traits>
+#include <cstddef>
+
+// chained hash table with power of two bucket counts, used for the keyspace, hashes and sets
+//
+// scan cursors (LettuceScan.h) walk the buckets in reverse binary order, which only survives a
+// resize when bucket = hash & (count - 1) - then every old bucket splits into (or merges from) a
+// fixed set of new ones. the standard containers use prime bucket counts, so a rehash between two
+// SCAN calls would reshuffle everything. this keeps the parts of the unordered_map / unordered_set
+// interface the database uses: each element is its own node (references stay valid across a
+// rehash, iterators don't), the hash is kept in the node, the table doubles once it holds more
+// elements than buckets and never shrinks on its own, and extract() hands out a node that
+// owns the element
+
+template <typename Value, typename Key, typename KeyOf, typename Hash, typename Equal>
+class LettuceDictTable
+{
+protected:
+  struct Node
+  {
+    Node *next = nullptr;
+    size_t hash;
+    Value value;
+
+    template <typename... Args>
+    explicit Node(size_t hash, Args &&...args) : hash(hash), value(std::forward<Args>(args)...) {}
+  };
+
+public:
+  using key_type = Key;
+  using value_type = Value;
+  using size_type = size_t;
+  using difference_type = std::ptrdiff_t;
+  using hasher = Hash;
+  using key_equal = Equal;
+
+  template <bool Const>
+  class Iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::conditional_t<Const, const Value &, Value &>;
+    using pointer = std::conditional_t<Const, const Value *, Value *>;
+
+    Iterator() = default;
+    // iterator converts to const_iterator, not the other way round
+    template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+    Iterator(const Iterator<OtherConst> &other) : table(other.table), bucket(other.bucket), node(other.node) {}
+
+    reference operator*() const { return node->value; }
+    pointer operator->() const { return &node->value; }
+    Iterator &operator++()
+    {
+      node = node->next;
+      if (node == nullptr)
+        node = table->firstFrom(bucket + 1, bucket);
+      return *this;
+    }
+    Iterator operator++(int)
+    {
+      Iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+    bool operator==(const Iterator &other) const { return node == other.node; }
+    bool operator!=(const Iterator &other) const { return node != other.node; }
+
+  private:
+    friend class LettuceDictTable;
+    const LettuceDictTable *table = nullptr;
+    size_t bucket = 0;
+    Node *node = nullptr;
+
+    Iterator(const LettuceDictTable *table, size_t bucket, Node *node) : table(table), bucket(bucket), node(node) {}
+  };
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  // the elements of one bucket, for scanBuckets and sampling
+  template <bool Const>
+  class LocalIterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::conditional_t<Const, const Value &, Value &>;
+    using pointer = std::conditional_t<Const, const Value *, Value *>;
+
+    LocalIterator() = default;
+    explicit LocalIterator(Node *node) : node(node) {}
+
+    reference operator*() const { return node->value; }
+    pointer operator->() const { return &node->value; }
+    LocalIterator &operator++()
+    {
+      node = node->next;
+      return *this;
+    }
+    bool operator==(const LocalIterator &other) const { return node == other.node; }
+    bool operator!=(const LocalIterator &other) const { return node != other.node; }
+
+  private:
+    Node *node = nullptr;
+  };
+  using local_iterator = LocalIterator<false>;
+  using const_local_iterator = LocalIterator<true>;
+
+  // an element taken out of the table, destroyed with the handle unless it's put back
+  class node_type
+  {
+  public:
+    node_type() = default;
+    node_type(node_type &&other) noexcept : node(other.node) { other.node = nullptr; }
+    node_type &operator=(node_type &&other) noexcept
+    {
+      std::swap(node, other.node);
+      return *this;
+    }
+    ~node_type() { delete node; }
+
+    bool empty() const { return node == nullptr; }
+    explicit operator bool() const { return node != nullptr; }
+    Value &value() const { return node->value; }
+    const Key &key() const { return KeyOf()(node->value); }
+    auto &mapped() const { return node->value.second; }
+
+  private:
+    friend class LettuceDictTable;
+    Node *node = nullptr;
+    explicit node_type(Node *node) : node(node) {}
+  };
+
+  LettuceDictTable() = default;
+  LettuceDictTable(const LettuceDictTable &other)
+  {
+    buckets.assign(other.buckets.size(), nullptr);
+    for (const_iterator it = other.begin(); it != other.end(); ++it)
+      link(new Node(it.node->hash, it.node->value));
+  }
+  LettuceDictTable(LettuceDictTable &&other) noexcept { swap(other); }
+  LettuceDictTable &operator=(LettuceDictTable other) noexcept
+  {
+    swap(other);
+    return *this;
+  }
+  ~LettuceDictTable() { clear(); }
+
+  void swap(LettuceDictTable &other) noexcept
+  {
+    buckets.swap(other.buckets);
+    std::swap(elements, other.elements);
+  }
+
+  size_t size() const { return elements; }
+  bool empty() const { return elements == 0; }
+  size_t bucket_count() const { return buckets.size(); }
+
+  iterator begin() { return iteratorFrom(0); }
+  iterator end() { return iterator(this, buckets.size(), nullptr); }
+  const_iterator begin() const { return const_cast<LettuceDictTable *>(this)->begin(); }
+  const_iterator end() const { return const_cast<LettuceDictTable *>(this)->end(); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+  local_iterator begin(size_t bucket) { return local_iterator(buckets[bucket]); }
+  local_iterator end(size_t) { return local_iterator(); }
+  const_local_iterator begin(size_t bucket) const { return const_local_iterator(buckets[bucket]); }
+  const_local_iterator end(size_t) const { return const_local_iterator(); }
+
+  iterator find(const Key &key) { return findHashed(Hash()(key), key); }
+  const_iterator find(const Key &key) const { return const_cast<LettuceDictTable *>(this)->find(key); }
+  size_t count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args &&...args)
+  {
+    // the key only exists once the element is built
+    Node *node = new Node(0, std::forward<Args>(args)...);
+    node->hash = Hash()(KeyOf()(node->value));
+    iterator existing = findHashed(node->hash, KeyOf()(node->value));
+    if (existing != end())
+    {
+      delete node;
+      return {existing, false};
+    }
+    return {link(node), true};
+  }
+
+  // drops every element, keeps the buckets
+  void clear()
+  {
+    for (Node *&head : buckets)
+    {
+      while (head != nullptr)
+      {
+        Node *next = head->next;
+        delete head;
+        head = next;
+      }
+    }
+    elements = 0;
+  }
+
+  iterator erase(const_iterator position)
+  {
+    iterator next(this, position.bucket, position.node);
+    ++next;
+    delete unlink(position.bucket, position.node);
+    return next;
+  }
+  iterator erase(iterator position) { return erase(const_iterator(position)); }
+  size_t erase(const Key &key)
+  {
+    const_iterator it = find(key);
+    if (it == end())
+      return 0;
+    erase(it);
+    return 1;
+  }
+
+  node_type extract(const_iterator position) { return node_type(unlink(position.bucket, position.node)); }
+  node_type extract(const Key &key)
+  {
+    const_iterator it = find(key);
+    return it == end() ? node_type() : extract(it);
+  }
+
+  void reserve(size_t elements)
+  {
+    size_t wanted = 4;
+    while (wanted < elements)
+      wanted <<= 1;
+    if (wanted > buckets.size())
+      rehash(wanted);
+  }
+
+protected:
+  std::vector<Node *> buckets;
+  size_t elements = 0;
+
+  size_t mask() const { return buckets.size() - 1; }
+
+  iterator findHashed(size_t hash, const Key &key)
+  {
+    if (elements == 0)
+      return end();
+    size_t bucket = hash & mask();
+    for (Node *node = buckets[bucket]; node != nullptr; node = node->next)
+    {
+      if (node->hash == hash && Equal()(KeyOf()(node->value), key))
+        return iterator(this, bucket, node);
+    }
+    return end();
+  }
+
+  // the first node in bucket or any after it, found says which bucket that was
+  Node *firstFrom(size_t bucket, size_t &found) const
+  {
+    while (bucket < buckets.size() && buckets[bucket] == nullptr)
+      bucket++;
+    found = bucket;
+    return bucket < buckets.size() ? buckets[bucket] : nullptr;
+  }
+  Node *firstFrom(size_t bucket) const
+  {
+    size_t found;
+    return firstFrom(bucket, found);
+  }
+  iterator iteratorFrom(size_t bucket)
+  {
+    Node *node = firstFrom(bucket, bucket);
+    return iterator(this, bucket, node);
+  }
+
+  iterator link(Node *node)
+  {
+    if (elements + 1 > buckets.size())
+      rehash(buckets.empty() ? 4 : buckets.size() * 2);
+    size_t bucket = node->hash & mask();
+    node->next = buckets[bucket];
+    buckets[bucket] = node;
+    elements++;
+    return iterator(this, bucket, node);
+  }
+
+  Node *unlink(size_t bucket, Node *node)
+  {
+    Node **slot = &buckets[bucket];
+    while (*slot != node)
+      slot = &(*slot)->next;
+    *slot = node->next;
+    node->next = nullptr;
+    elements--;
+    return node;
+  }
+
+  void rehash(size_t size)
+  {
+    std::vector<Node *> old(size, nullptr);
+    old.swap(buckets);
+    for (Node *head : old)
+    {
+      while (head != nullptr)
+      {
+        Node *next = head->next;
+        size_t bucket = head->hash & mask();
+        head->next = buckets[bucket];
+        buckets[bucket] = head;
+        head = next;
+      }
+    }
+  }
+};
+
+namespace LettuceDictKeys
+{
+  struct First
+  {
+    template <typename Pair>
+    const auto &operator()(const Pair &pair) const { return pair.first; }
+  };
+  struct Itself
+  {
+    template <typename T>
+    const T &operator()(const T &value) const { return value; }
+  };
+}
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+class LettuceDict : public LettuceDictTable<std::pair<const Key, Value>, Key, LettuceDictKeys::First, Hash, Equal>
+{
+  using Table = LettuceDictTable<std::pair<const Key, Value>, Key, LettuceDictKeys::First, Hash, Equal>;
+
+public:
+  using mapped_type = Value;
+  using typename Table::iterator;
+  using typename Table::const_iterator;
+  using typename Table::value_type;
+
+  LettuceDict() = default;
+  LettuceDict(std::initializer_list<value_type> values)
+  {
+    this->reserve(values.size());
+    for (const auto &value : values)
+      this->emplace(value);
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args)
+  {
+    return tryEmplace(key, std::forward<Args>(args)...);
+  }
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(Key &&key, Args &&...args)
+  {
+    return tryEmplace(std::move(key), std::forward<Args>(args)...);
+  }
+
+  Value &operator[](const Key &key) { return try_emplace(key).first->second; }
+  Value &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
+
+  std::pair<iterator, bool> insert(const value_type &value) { return this->emplace(value); }
+  std::pair<iterator, bool> insert(value_type &&value) { return this->emplace(std::move(value)); }
+
+  bool operator==(const LettuceDict &other) const
+  {
+    if (this->size() != other.size())
+      return false;
+    for (const auto &[key, value] : *this)
+    {
+      auto it = other.find(key);
+      if (it == other.end() || !(it->second == value))
+        return false;
+    }
+    return true;
+  }
+  bool operator!=(const LettuceDict &other) const { return !(*this == other); }
+
+private:
+  // only builds the element when the key is missing
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> tryEmplace(K &&key, Args &&...args)
+  {
+    size_t hash = Hash()(key);
+    iterator existing = Table::findHashed(hash, key);
+    if (existing != this->end())
+      return {existing, false};
+    return {this->link(new typename Table::Node(hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                                std::forward_as_tuple(std::forward<Args>(args)...))),
+            true};
+  }
+};
+
+template <typename Key, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>>
+class LettuceDictSet : public LettuceDictTable<Key, Key, LettuceDictKeys::Itself, Hash, Equal>
+{
+  using Table = LettuceDictTable<Key, Key, LettuceDictKeys::Itself, Hash, Equal>;
+
+public:
+  using typename Table::iterator;
+  using typename Table::const_iterator;
+
+  LettuceDictSet() = default;
+  LettuceDictSet(std::initializer_list<Key> values)
+  {
+    this->reserve(values.size());
+    for (const auto &value : values)
+      this->emplace(value);
+  }
+
+  std::pair<iterator, bool> insert(const Key &value) { return this->emplace(value); }
+  std::pair<iterator, bool> insert(Key &&value) { return this->emplace(std::move(value)); }
+
+  bool operator==(const LettuceDictSet &other) const
+  {
+    if (this->size() != other.size())
+      return false;
+    for (const auto &value : *this)
+    {
+      if (other.find(value) == other.end())
+        return false;
+    }
+    return true;
+  }
+  bool operator!=(const LettuceDictSet &other) const { return !(*this == other); }
+};
+
+#endif
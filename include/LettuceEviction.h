@@ -0,0 +1,36 @@
+#ifndef LETTUCE_EVICTION_H
+#define LETTUCE_EVICTION_H
+
+#include <string>
+#include <cstdint>
+
+// maxmemory-policy
+enum class LettuceEvictionPolicy
+{
+  NoEviction,  // writes that add data fail with -OOM once maxmemory is reached
+  AllKeysLru,  // evict the least recently used key
+  AllKeysLfu,  // evict the least frequently used key
+  VolatileLru, // least recently used among keys with an expiry
+  VolatileTtl  // the key with an expiry closest to now
+};
+
+bool parseEvictionPolicy(const std::string &name, LettuceEvictionPolicy &policy);
+std::string evictionPolicyName(LettuceEvictionPolicy policy);
+
+// per key access metadata packed into 32 bits, the same trick as redis' 24 bit lru field
+// lru: low 24 bits are the access clock in seconds (wraps every ~194 days)
+// lfu: high 16 bits are the last decrement time in minutes, low 8 bits a logarithmic access counter
+namespace LettuceKeyMeta
+{
+  constexpr uint32_t clockMax = (1u << 24) - 1;
+  constexpr uint8_t lfuInitialCount = 5; // new keys get a few accesses of credit so they survive their first eviction round
+
+  uint32_t lruClock(); // seconds, masked to 24 bits
+  uint32_t lruIdleSeconds(uint32_t meta);
+  uint32_t lfuNew();
+  uint32_t lfuTouch(uint32_t meta); // decays the counter for the time since the last access, then maybe bumps it
+  uint8_t lfuCount(uint32_t meta);  // counter after decay, without recording an access
+  uint32_t lfuIdleSeconds(uint32_t meta); // time since the last access, only to the minute
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LETTUCE_FIELD_H
+#define LETTUCE_FIELD_H
+
+#include <string>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#include "LettuceDict.h"
+
+// interned, reference counted hash field name - every hash with an "email" field points at the
+// same string, so a field costs one pointer instead of a string per hash. the name is freed with
+// its last handle. names are unique in the table, so handles compare and hash by address
+class LettuceField
+{
+public:
+  LettuceField() = default; // null, matches no field
+  LettuceField(const std::string &name); // interns name, implicit so hashes can be written like string maps
+  LettuceField(const char *name);
+  LettuceField(const LettuceField &other);
+  LettuceField(LettuceField &&other) noexcept;
+  LettuceField &operator=(LettuceField other) noexcept;
+  ~LettuceField();
+
+  // the handle of a name some hash already has, null otherwise - lookups use this so a read never
+  // adds to the table
+  static LettuceField find(const std::string &name);
+
+  const std::string &str() const;
+  operator const std::string &() const { return str(); }
+  explicit operator bool() const { return entry != nullptr; }
+  bool operator==(const LettuceField &other) const { return entry == other.entry; }
+  bool operator!=(const LettuceField &other) const { return entry != other.entry; }
+
+  // this handle's part of the name's memory (the name, its table entry), split evenly between handles
+  size_t memoryShare() const;
+
+  static size_t interned();      // distinct names in the table
+  static size_t internedBytes(); // total length of those names
+
+private:
+  struct Entry;
+  struct Table;
+  Entry *entry = nullptr;
+
+  explicit LettuceField(Entry *entry) : entry(entry) {}
+  static Table &table();
+  static Entry *intern(const std::string &name);
+  static void release(Entry *entry);
+  friend struct std::hash<LettuceField>;
+};
+
+// addresses are aligned, so their low bits are always zero - mixed (murmur3's finalizer) so a
+// power of two table (LettuceDict.h) spreads fields over all of its buckets
+template <>
+struct std::hash<LettuceField>
+{
+  size_t operator()(const LettuceField &field) const noexcept
+  {
+    uint64_t value = reinterpret_cast<uintptr_t>(field.entry);
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return static_cast<size_t>(value);
+  }
+};
+
+using LettuceHash = LettuceDict<LettuceField, std::string>;
+
+#endif
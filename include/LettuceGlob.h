@@ -0,0 +1,12 @@
+#ifndef LETTUCE_GLOB_H
+#define LETTUCE_GLOB_H
+
+#include <string>
+
+// redis style glob matching: * any run, ? any single char, [abc] [^abc] [a-z] classes, \ escapes the next char
+bool globMatch(const std::string &pattern, const std::string &str);
+
+// the literal text every match must start with, e.g. "session:user42:" for "session:user42:*"
+std::string globLiteralPrefix(const std::string &pattern);
+
+#endif
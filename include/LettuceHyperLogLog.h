@@ -0,0 +1,50 @@
+#ifndef LETTUCE_HYPERLOGLOG_H
+#define LETTUCE_HYPERLOGLOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// HyperLogLog counters stored as plain string values (like redis), so they live in keyValueStore
+// layout: "HYLL" | encoding (1) | cache valid (1) | unused (2) | cached cardinality (8, little endian) | payload
+// - dense payload: 16384 registers of 6 bits each, 12288 bytes
+// - sparse payload: sorted 3 byte entries (register index hi, lo, value) for non zero registers only
+class LettuceHyperLogLog
+{
+public:
+  static constexpr int precision = 14;
+  static constexpr size_t registerCount = 1 << precision;
+  static constexpr int registerBits = 6;
+  static constexpr size_t headerSize = 16;
+  static constexpr size_t denseSize = headerSize + (registerCount * registerBits + 7) / 8;
+  static constexpr size_t sparseEntrySize = 3;
+  static constexpr size_t sparseMaxBytes = 3000; // sparse counters are promoted to dense past this
+
+  static constexpr uint8_t encodingDense = 0;
+  static constexpr uint8_t encodingSparse = 1;
+
+  static std::string create();
+  static bool isValid(const std::string &value); // checks the header and every sparse entry
+  static bool isSparse(const std::string &value);
+
+  // returns true if any register changed
+  static bool add(std::string &value, const std::string &element);
+  // uses (and refreshes) the cached cardinality in the header
+  static uint64_t count(std::string &value);
+  // union of several counters without modifying them
+  static uint64_t countUnion(const std::vector<const std::string *> &values);
+  // dest becomes the union of itself and sources
+  static void merge(std::string &dest, const std::vector<const std::string *> &sources);
+
+  // unpacks registers into one byte each, registers must hold registerCount bytes
+  static void toRegisters(const std::string &value, uint8_t *registers);
+
+  static uint64_t hash(const void *key, size_t length, uint64_t seed);
+};
+
+// registers[i] = max(registers[i], other[i]) over registerCount bytes
+void hllMergeRegisters(uint8_t *registers, const uint8_t *other);
+uint64_t hllEstimate(const uint8_t *registers);
+
+#endif
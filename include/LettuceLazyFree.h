@@ -0,0 +1,61 @@
+#ifndef LETTUCE_LAZY_FREE_H
+#define LETTUCE_LAZY_FREE_H
+
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+#include "LettuceMemory.h"
+
+// background reclaimer - values are detached from the keyspace under db_mutex in O(1) and
+// handed over here, so their destructors run on another thread instead of blocking clients
+class LettuceLazyFree
+{
+public:
+  static LettuceLazyFree &getInstance(); // singleton
+
+  // takes ownership of value and destroys it on the reclaimer thread, its memory stays charged
+  // to category until then
+  template <typename T>
+  void free(T &&value, LettuceMemory::Category category = LettuceMemory::Untracked)
+  {
+    LettuceMemory::Scope scope(category);
+    enqueue({std::make_shared<std::decay_t<T>>(std::forward<T>(value)), category});
+  }
+
+  size_t pending() const;
+  size_t freed() const;
+  void waitUntilIdle(); // blocks until everything queued so far has been destroyed
+
+private:
+  struct Item
+  {
+    std::shared_ptr<void> value;
+    LettuceMemory::Category category;
+  };
+  std::deque<Item> queue;
+  mutable std::mutex queueMutex;
+  std::condition_variable queueReady;
+  std::condition_variable queueIdle;
+  std::thread worker;
+  bool stopping = false;
+  bool busy = false;
+  std::atomic<size_t> pendingCount{0};
+  std::atomic<size_t> freedCount{0};
+
+  void enqueue(Item item);
+  void run();
+
+  LettuceLazyFree() = default;
+  ~LettuceLazyFree();
+  LettuceLazyFree(const LettuceLazyFree &) = delete;
+  LettuceLazyFree &operator=(const LettuceLazyFree &) = delete;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef LETTUCE_LZ_H
+#define LETTUCE_LZ_H
+
+#include <cstdint>
+#include <cstddef>
+
+// small LZ77 codec in the lz4 block layout, used for snapshot segments
+// a sequence is token (literal length << 4 | match length - 4), [more literal length], literals,
+// offset (2 bytes little endian), [more match length] - lengths of 15 continue in 255 steps
+// the last sequence is literals only, so the last 5 bytes of the input are never part of a match
+
+// worst case output size for length input bytes
+inline size_t lzBound(size_t length)
+{
+  return length + length / 255 + 16;
+}
+
+// returns the compressed size, 0 if it doesn't fit in capacity
+size_t lzCompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+// out must be exactly the original length, false on malformed input (every read and copy is bounds checked)
+bool lzDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t outLength);
+
+#endif
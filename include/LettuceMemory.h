@@ -0,0 +1,52 @@
+#ifndef LETTUCE_MEMORY_H
+#define LETTUCE_MEMORY_H
+
+#include <string>
+#include <cstddef>
+
+// the global operator new/delete are replaced (LettuceMemory.cpp) so every heap allocation made
+// through them is counted with its real allocator size, reading it is a single atomic load
+namespace LettuceMemory
+{
+  // what the allocations made on a thread are charged to, set with a Scope around the code that
+  // touches a store - untracked allocations only count towards the total
+  enum Category
+  {
+    Untracked,
+    Strings,
+    Lists,
+    Hashes,
+    Sets,
+    Expires,
+    Categories
+  };
+
+  // charges this thread's allocations and frees to category until it goes out of scope, nests
+  class Scope
+  {
+  public:
+    explicit Scope(Category category);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Category previous;
+  };
+
+  size_t used();                   // bytes currently allocated through operator new
+  // the part of it charged to category - a block allocated outside any scope but freed inside one
+  // takes it below zero, so it wraps and only differences of it are meaningful in that case
+  size_t used(Category category);
+  size_t peak();                   // highest used() so far
+  size_t rss();                    // resident set size of the process, 0 if it can't be read
+  const char *categoryName(Category category);
+
+  // what the allocator really hands out for a request of size bytes (glibc rounds up to 16 byte
+  // chunks with an 8 byte header), and the heap block behind a string, 0 if it is stored inline
+  size_t allocationSize(size_t size);
+  size_t heapSize(const std::string &value);
+  size_t heapSize(const void *pointer); // usable size of a block from operator new, 0 for nullptr
+}
+
+#endif
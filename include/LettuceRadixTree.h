@@ -0,0 +1,52 @@
+#ifndef LETTUCE_RADIX_TREE_H
+#define LETTUCE_RADIX_TREE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+
+// path compressed trie of key names, used as an optional secondary index so prefix
+// lookups cost O(prefix + matches) instead of a walk over the whole keyspace
+class LettuceRadixTree
+{
+public:
+  LettuceRadixTree();
+  ~LettuceRadixTree();
+
+  bool insert(const std::string &key); // false if the key was already present
+  bool remove(const std::string &key); // false if the key was not present
+  bool contains(const std::string &key) const;
+  void clear();
+
+  // visits every key starting with prefix in lexicographic order, stops early when visit returns false
+  void forEachWithPrefix(const std::string &prefix, const std::function<bool(const std::string &)> &visit) const;
+  // same, but only keys that sort strictly after *after (all of them for nullptr) - subtrees that
+  // sort before it are skipped whole, so resuming doesn't walk the keys already visited
+  void forEachWithPrefix(const std::string &prefix, const std::string *after, const std::function<bool(const std::string &)> &visit) const;
+
+  size_t size() const;
+  size_t nodeCount() const;
+  size_t memoryUsage() const; // approximate bytes held by the tree (nodes, child pointers, edge labels)
+
+private:
+  struct Node
+  {
+    std::string label; // edge label from the parent
+    bool isKey = false;
+    std::vector<std::unique_ptr<Node>> children; // sorted by the first char of their label
+  };
+
+  std::unique_ptr<Node> root;
+  size_t keys = 0;
+  size_t nodes = 1;
+  size_t labelBytes = 0;
+
+  static std::vector<std::unique_ptr<Node>>::iterator findChild(Node *node, char c);
+  static void collect(const Node *start, std::string &path, const std::string *after, const std::function<bool(const std::string &)> &visit);
+  static void destroy(std::unique_ptr<Node> node);
+  void mergeWithOnlyChild(Node *node);
+};
+
+#endif
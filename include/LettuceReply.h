@@ -0,0 +1,47 @@
+#ifndef LETTUCE_REPLY_H
+#define LETTUCE_REPLY_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// builds a reply in a single buffer for either RESP2 or RESP3
+// the RESP3 only types (maps, sets, pushes, doubles, booleans, null) fall back to their RESP2
+// equivalents when the connection hasn't switched protocols with HELLO 3
+class LettuceReply
+{
+public:
+  explicit LettuceReply(int protocol = currentProtocol());
+
+  LettuceReply &simple(std::string_view value);
+  LettuceReply &error(std::string_view message); // message without the leading '-'
+  LettuceReply &integer(int64_t value);
+  LettuceReply &bulk(std::string_view value);
+  LettuceReply &null();      // $-1 on RESP2
+  LettuceReply &nullArray(); // *-1 on RESP2
+  LettuceReply &array(size_t count);
+  LettuceReply &map(size_t pairs); // followed by 2 * pairs elements, a flat array on RESP2
+  LettuceReply &set(size_t count);
+  LettuceReply &push(size_t count); // out of band message, only meaningful on RESP3
+  LettuceReply &doubleValue(double value);
+  LettuceReply &boolean(bool value);
+
+  void reserve(size_t bytes);
+  std::string take(); // moves the reply out
+  int protocol() const;
+
+  // the protocol of the connection whose command is being run on this thread
+  // set by LettuceCommandHandler before dispatching, handlers just construct a LettuceReply
+  static int currentProtocol();
+  static void setCurrentProtocol(int protocol);
+
+private:
+  int version;
+  std::string buffer;
+
+  void header(char type, size_t count);
+  void number(int64_t value);
+};
+
+#endif
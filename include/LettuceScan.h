@@ -0,0 +1,65 @@
+#ifndef LETTUCE_SCAN_H
+#define LETTUCE_SCAN_H
+
+#include <cstdint>
+#include <cstddef>
+
+// stateless cursor iteration over the buckets of an unordered container
+//
+// buckets are visited in reverse binary order (high bit incremented first, like redis' dictScan).
+// with power of two bucket counts (LettuceDict.h) a full iteration returns every element that was
+// present for the whole scan even when the table grows or shrinks between calls: growing splits
+// every bucket into ones the cursor hasn't reached yet, shrinking merges them into one it still
+// visits. elements may be returned more than once. any other bucket count is rounded up to a power
+// of two with empty virtual buckets past the real ones, which only holds while nothing rehashes
+
+inline uint64_t reverseBits(uint64_t value)
+{
+  value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+  value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+  value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  return __builtin_bswap64(value);
+}
+
+inline uint64_t scanMask(size_t bucketCount)
+{
+  uint64_t size = 1;
+  while (size < bucketCount)
+    size <<= 1;
+  return size - 1;
+}
+
+// calls visit(element) for elements in the next buckets until count elements (or 10x count buckets)
+// have been visited, returns the next cursor or 0 once every bucket has been visited
+template <typename Container, typename Visit>
+uint64_t scanBuckets(const Container &container, uint64_t cursor, size_t count, Visit visit)
+{
+  if (container.empty())
+    return 0;
+  if (count == 0)
+    count = 1;
+  size_t buckets = container.bucket_count();
+  uint64_t mask = scanMask(buckets);
+  size_t visited = 0;
+  size_t maxBuckets = count * 10;
+  do
+  {
+    uint64_t bucket = cursor & mask;
+    if (bucket < buckets)
+    {
+      for (auto it = container.begin(bucket); it != container.end(bucket); ++it)
+      {
+        visit(*it);
+        visited++;
+      }
+    }
+    // increment the reversed cursor
+    cursor |= ~mask;
+    cursor = reverseBits(cursor);
+    cursor++;
+    cursor = reverseBits(cursor);
+  } while (cursor != 0 && visited < count && --maxBuckets > 0);
+  return cursor;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LETTUCE_SET_H
+#define LETTUCE_SET_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "LettuceDict.h"
+
+// a set of strings with two encodings:
+// - intset: sorted vector of int64, used while every member is a canonical integer
+// - hashtable: set of strings (LettuceDict.h), used once a non integer member is added or the set grows large
+class LettuceSet
+{
+public:
+  static constexpr size_t maxIntsetEntries = 8192;
+
+  bool add(const std::string &member);
+  bool remove(const std::string &member);
+  bool contains(const std::string &member) const;
+  size_t size() const;
+  bool empty() const;
+  bool isIntset() const;
+  std::vector<std::string> members() const;
+  // appends roughly count members to out, returns the next cursor (0 when done) - see LettuceScan.h
+  // an intset is returned whole whatever the cursor, so a cursor never outlives an encoding change
+  uint64_t scan(uint64_t cursor, size_t count, std::vector<std::string> &out) const;
+
+  static std::vector<std::string> intersect(const std::vector<const LettuceSet *> &sets);
+  static std::vector<std::string> unite(const std::vector<const LettuceSet *> &sets);
+  static std::vector<std::string> difference(const std::vector<const LettuceSet *> &sets);
+
+  // only accepts integers that print back to the same string (no "+1", "01", " 1")
+  static bool parseInteger(const std::string &member, int64_t &value);
+
+  // raw encodings for the snapshot code, so sets are saved and loaded without going through strings
+  const std::vector<int64_t> &intsetValues() const; // only meaningful while isIntset()
+  const LettuceDictSet<std::string> &hashtableValues() const; // only meaningful while !isIntset()
+  static LettuceSet fromIntset(std::vector<int64_t> values); // values must be sorted and duplicate free
+  static LettuceSet fromHashtable(LettuceDictSet<std::string> values);
+  // moves the intset to a lower address if the allocator has room (see LettuceDefrag.h), true if it
+  // moved - hashtable members are node keys, they can't move without reallocating their nodes
+  bool defrag();
+
+private:
+  bool intsetEncoded = true;
+  std::vector<int64_t> intset;
+  LettuceDictSet<std::string> hashtable;
+
+  void convertToHashtable();
+};
+
+// intersection kernels for sorted, duplicate free int64 arrays - appends matches to out
+void intersectSortedMerge(const int64_t *a, size_t aSize, const int64_t *b, size_t bSize, std::vector<int64_t> &out);
+void intersectSortedGallop(const int64_t *small, size_t smallSize, const int64_t *large, size_t largeSize, std::vector<int64_t> &out);
+void intersectSorted(const std::vector<int64_t> &a, const std::vector<int64_t> &b, std::vector<int64_t> &out);
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef LETTUCE_SNAPSHOT_H
+#define LETTUCE_SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// binary snapshot format (dump.ldb)
+// "LETTUCE" version(3)
+// [opAux name value ...] - named metadata, e.g. the append only file position the snapshot covers
+// opSizes strings lists hashes sets expiries - key counts so the loader can size its tables up front
+// segments: opSegment keys length records - records never straddle a segment, so each one can be
+//   decoded on its own thread. opSegmentLz keys raw-length length lz-bytes is the same segment
+//   compressed with LettuceLz, used when that saves at least an eighth. a record is
+//   [opExpiry unix-ms(8)] type key value
+//   (lengths are LEB128 varints, everything binary safe)
+//   string    - len bytes
+//   list      - count, count strings
+//   hash      - count, count field/value string pairs
+//   intset    - count, count little endian int64s (the encoding is kept so loading doesn't re-parse members)
+//   hashset   - count, count strings
+// opEof crc64(8) - jones crc64 (same as redis) of every byte before it
+// version 2 files have no compressed segments, version 1 files have no opSizes or segment framing
+// either, the records follow the aux fields
+
+namespace LettuceSnapshot
+{
+  constexpr char magic[] = "LETTUCE";
+  constexpr size_t magicSize = 7;
+  constexpr uint8_t version = 3;
+  constexpr uint8_t oldestVersion = 1;
+  constexpr size_t headerSize = magicSize + 1;
+  constexpr size_t footerSize = 1 + 8;
+
+  constexpr uint8_t typeString = 0;
+  constexpr uint8_t typeList = 1;
+  constexpr uint8_t typeHash = 2;
+  constexpr uint8_t typeIntset = 3;
+  constexpr uint8_t typeHashset = 4;
+  constexpr uint8_t opSegmentLz = 0xf8;
+  constexpr uint8_t opSegment = 0xf9;
+  constexpr uint8_t opAux = 0xfa;
+  constexpr uint8_t opSizes = 0xfb;
+  constexpr uint8_t opExpiry = 0xfc;
+  constexpr uint8_t opEof = 0xff;
+}
+
+// updated while a snapshot is written so INFO can report how far along a BGSAVE is
+// it lives in memory shared with the forked child, so it has to stay lock free
+struct LettuceSnapshotProgress
+{
+  std::atomic<uint64_t> keys{0};
+  std::atomic<uint64_t> bytes{0};
+  // snapshot-key-delay, read while the child runs so lowering it lets a waiting child carry on
+  std::atomic<uint64_t> keyDelayMicros{0};
+};
+
+uint64_t crc64(uint64_t crc, const uint8_t *data, size_t length);
+// crc of A followed by B from the crcs of the two halves, so chunks can be checksummed in parallel
+uint64_t crc64Combine(uint64_t crcA, uint64_t crcB, size_t lengthB);
+// crc64(0, data, length) spread over up to threads threads
+uint64_t crc64Parallel(const uint8_t *data, size_t length, unsigned threads);
+
+// buffered writer - records are appended to a large buffer that is written out in big chunks
+// the file is written as filename.tmp.<pid> and only renamed over filename by finish()
+// after beginSegments writes collect in a segment that is framed and written out once it passes
+// segmentSize, endRecord marks where a segment may be cut. with compression on a segment is stored
+// compressed when that pays off
+class LettuceSnapshotWriter
+{
+public:
+  static constexpr size_t bufferSize = 1 << 20;
+  static constexpr size_t segmentSize = 1 << 20;
+
+  ~LettuceSnapshotWriter();
+  bool open(const std::string &filename);
+  void writeByte(uint8_t value);
+  void writeLength(uint64_t length);
+  void writeString(std::string_view value);
+  void writeUint64(uint64_t value);
+  void writeBytes(const void *data, size_t length);
+  void beginSegments();
+  void endRecord();
+  void setCompression(bool enabled);
+  bool finish(); // footer, fsync and rename, false if any write failed
+  size_t bytesWritten() const;
+
+private:
+  int fd = -1;
+  std::string path;
+  std::string tempPath;
+  std::vector<uint8_t> buffer;
+  size_t used = 0;
+  size_t written = 0;
+  uint64_t crc = 0;
+  bool failed = false;
+  bool segmenting = false;
+  std::vector<uint8_t> segment;
+  uint64_t segmentKeys = 0;
+  bool compression = false;
+  std::vector<uint8_t> compressed;
+
+  void flush();
+  void flushSegment();
+};
+
+// reads straight out of a buffer holding the whole file, every read is bounds checked
+class LettuceSnapshotReader
+{
+public:
+  LettuceSnapshotReader(const uint8_t *data, size_t length);
+
+  bool readByte(uint8_t &value);
+  bool readLength(uint64_t &length);
+  bool readString(std::string &value);
+  bool readUint64(uint64_t &value);
+  bool readBytes(void *out, size_t length);
+  bool peekByte(uint8_t &value) const;
+  bool skip(size_t length);
+  size_t position() const;
+  size_t remaining() const;
+
+private:
+  const uint8_t *data;
+  size_t length;
+  size_t offset = 0;
+};
+
+// read only mapping of a whole file, loading decodes straight out of the page cache
+class LettuceMappedFile
+{
+public:
+  LettuceMappedFile() = default;
+  LettuceMappedFile(const LettuceMappedFile &) = delete;
+  LettuceMappedFile &operator=(const LettuceMappedFile &) = delete;
+  ~LettuceMappedFile();
+
+  bool open(const std::string &filename);
+  const uint8_t *data() const { return mapped; }
+  size_t size() const { return length; }
+
+private:
+  uint8_t *mapped = nullptr;
+  size_t length = 0;
+};
+
+// reads the whole file with large reads
+bool readSnapshotFile(const std::string &filename, std::vector<uint8_t> &contents);
+// checks the header and crc footer, on success [headerSize, payloadEnd) holds the records
+// threads > 1 checksums the file in parallel chunks
+bool verifySnapshot(const uint8_t *data, size_t length, size_t &payloadEnd, unsigned threads = 1);
+
+#endif
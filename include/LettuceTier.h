@@ -0,0 +1,82 @@
+#ifndef LETTUCE_TIER_H
+#define LETTUCE_TIER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// where a value moved out of memory lives - offsets are never reused within a segment and segment
+// ids only grow, so a location names one write for good
+struct LettuceTierLocation
+{
+  uint32_t segment;
+  uint32_t length;
+  uint64_t offset;
+
+  bool operator==(const LettuceTierLocation &other) const
+  {
+    return segment == other.segment && offset == other.offset && length == other.length;
+  }
+  bool operator!=(const LettuceTierLocation &other) const { return !(*this == other); }
+};
+
+// a value on disk that couldn't be read back - thrown out of the database so the command fails
+// without touching the key, the location stays put and a later read can try again
+class LettuceTierError : public std::runtime_error
+{
+public:
+  LettuceTierError() : std::runtime_error("can't read the value back from tiered storage") {}
+};
+
+struct LettuceTierFileStats
+{
+  size_t segments;
+  uint64_t fileBytes; // everything written to the segments still on disk
+  uint64_t liveBytes; // the part of it some key still points at
+};
+
+// values moved out of memory, appended to segment files named <prefix>.<id> - a segment is closed
+// once it reaches segmentSize and a new one started. dead space is reclaimed by moving the live
+// values of a mostly dead segment to the active one (the database does that, it knows where the
+// values are), a segment with nothing live left is deleted
+// writes must be serialised by the caller (the database holds db_mutex), reads can run alongside
+// them - a reader keeps the segment it got open, even if it's deleted meanwhile
+class LettuceTierStore
+{
+public:
+  class Segment;
+
+  LettuceTierStore(const std::string &prefix, uint64_t segmentSize);
+  ~LettuceTierStore(); // deletes the segment files, what's in them only matters while the process runs
+  LettuceTierStore(const LettuceTierStore &) = delete;
+  LettuceTierStore &operator=(const LettuceTierStore &) = delete;
+
+  bool append(const std::string &bytes, LettuceTierLocation &location); // false if the write failed
+  void retain(const LettuceTierLocation &location);                     // another key points at the bytes too
+  void release(const LettuceTierLocation &location);                    // one less key points at them
+  std::shared_ptr<const Segment> segment(uint32_t id) const;            // nullptr if it's gone
+  static bool read(const Segment &segment, const LettuceTierLocation &location, std::string &bytes);
+  bool read(const LettuceTierLocation &location, std::string &bytes) const;
+
+  // a closed segment less than half live, the one with the most dead bytes - 0 if none
+  uint32_t compactionCandidate() const;
+  void setSegmentSize(uint64_t bytes);
+  std::vector<int> fds() const; // kept open by forked children that read values back
+  LettuceTierFileStats stats() const;
+
+private:
+  std::string prefix;
+  uint64_t segmentSize;
+  uint32_t nextId = 1;
+  std::map<uint32_t, std::shared_ptr<Segment>> segments;
+  std::shared_ptr<Segment> active;
+
+  bool startSegment();
+  void drop(uint32_t id);
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef LETTUCE_TRACKING_H
+#define LETTUCE_TRACKING_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+struct LettuceTrackingStats
+{
+  size_t clients;
+  size_t keys;
+  size_t prefixes;
+};
+
+// server assisted client side caching (CLIENT TRACKING)
+// default mode remembers which keys each client read and tells it once when one of them changes
+// broadcast mode skips the table and tells the client about every change under its prefixes
+class LettuceTracking
+{
+public:
+  static LettuceTracking &getInstance(); // singleton
+
+  void enable(uint64_t clientId, bool broadcast, const std::vector<std::string> &prefixes);
+  void disable(uint64_t clientId);
+  bool isTracking(uint64_t clientId);
+
+  void rememberKeys(uint64_t clientId, const std::vector<std::string> &keys); // after a read only command
+  void invalidateKey(const std::string &key);                                 // called after every write
+  void invalidateAll();                                                       // flushall
+
+  // RESP3 invalidate push messages waiting for this client, empty if there are none
+  std::string takePending(uint64_t clientId);
+
+  // cheap check so the write path doesn't take the tracking lock when nobody is tracking
+  bool active() const { return activeClients.load(std::memory_order_relaxed) > 0; }
+
+  void setMaxKeys(size_t keys);
+  size_t getMaxKeys();
+  LettuceTrackingStats stats();
+
+private:
+  struct Client
+  {
+    bool broadcast = false;
+    std::vector<std::string> prefixes; // broadcast only, empty means every key
+    std::unordered_set<std::string> keys; // default only, the table entries naming this client
+    std::vector<std::string> pendingKeys;
+    bool pendingFlush = false;
+  };
+
+  std::mutex trackingMutex;
+  std::unordered_map<uint64_t, Client> clients;
+  // key -> clients that may have it cached, bounded by maxKeys
+  std::unordered_map<std::string, std::unordered_set<uint64_t>> table;
+  size_t maxKeys = 1000000;
+  std::atomic<size_t> activeClients{0};
+
+  void invalidateLocked(const std::string &key);
+  void forgetKeysLocked(uint64_t clientId, Client &client); // drops the client from the table
+  void evictLocked();
+
+  LettuceTracking() = default;
+  LettuceTracking(const LettuceTracking &) = delete;
+  LettuceTracking &operator=(const LettuceTracking &) = delete;
+};
+
+#endif
@@ -0,0 +1,679 @@
+#include "../include/LettuceAof.h"
+#include "../include/LettuceSnapshot.h"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char *headerCommand = "LETTUCE-AOF";
+
+LettuceAof &LettuceAof::getInstance()
+{
+  static LettuceAof instance;
+  return instance;
+}
+
+LettuceAof::~LettuceAof()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  closeLocked(lock);
+}
+
+static void appendResp(std::string &out, const std::vector<std::string> &tokens)
+{
+  out += '*';
+  out += std::to_string(tokens.size());
+  out += "\r\n";
+  for (const auto &token : tokens)
+  {
+    out += '$';
+    out += std::to_string(token.size());
+    out += "\r\n";
+    out += token;
+    out += "\r\n";
+  }
+}
+
+static bool writeAll(int fd, const std::string &data)
+{
+  size_t offset = 0;
+  while (offset < data.size())
+  {
+    ssize_t result = ::write(fd, data.data() + offset, data.size() - offset);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return false;
+    offset += result;
+  }
+  return true;
+}
+
+// one RESP array of bulk strings starting at position, false if it is cut short
+// (or malformed, which sets corrupt)
+static bool parseResp(const std::vector<uint8_t> &data, size_t &position, std::vector<std::string> &tokens, bool &corrupt)
+{
+  auto readNumber = [&](char prefix, uint64_t &value)
+  {
+    if (position >= data.size())
+      return false;
+    if (data[position] != prefix)
+    {
+      corrupt = true;
+      return false;
+    }
+    size_t cursor = position + 1;
+    value = 0;
+    while (cursor < data.size() && data[cursor] != '\r')
+    {
+      if (data[cursor] < '0' || data[cursor] > '9' || value > UINT32_MAX)
+      {
+        corrupt = true;
+        return false;
+      }
+      value = value * 10 + (data[cursor] - '0');
+      cursor++;
+    }
+    if (cursor + 1 >= data.size())
+      return false;
+    position = cursor + 2;
+    return true;
+  };
+
+  tokens.clear();
+  uint64_t count;
+  if (!readNumber('*', count))
+    return false;
+  for (uint64_t i = 0; i < count; i++)
+  {
+    uint64_t length;
+    if (!readNumber('$', length))
+      return false;
+    if (data.size() - position < length + 2)
+      return false;
+    tokens.emplace_back(reinterpret_cast<const char *>(data.data() + position), length);
+    position += length + 2;
+  }
+  return true;
+}
+
+static uint64_t newGeneration()
+{
+  std::random_device random;
+  uint64_t generation;
+  do
+    generation = (static_cast<uint64_t>(random()) << 32) ^ random();
+  while (generation == 0);
+  return generation;
+}
+
+/* Rewrite output */
+LettuceAofWriter::~LettuceAofWriter()
+{
+  if (fd != -1)
+    ::close(fd);
+}
+
+bool LettuceAofWriter::open(const std::string &filename, uint64_t generation)
+{
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return false;
+  buffer.reserve(bufferSize);
+  append({headerCommand, std::to_string(generation)});
+  return true;
+}
+
+void LettuceAofWriter::append(const std::vector<std::string> &tokens)
+{
+  appendResp(buffer, tokens);
+  if (buffer.size() >= bufferSize)
+    flush();
+}
+
+void LettuceAofWriter::flush()
+{
+  size_t offset = 0;
+  while (!failed && offset < buffer.size())
+  {
+    ssize_t result = ::write(fd, buffer.data() + offset, buffer.size() - offset);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      failed = true;
+    else
+      offset += result;
+  }
+  buffer.clear();
+}
+
+bool LettuceAofWriter::finish()
+{
+  flush();
+  bool ok = !failed && fsync(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  fd = -1;
+  return ok;
+}
+
+/* Startup */
+void LettuceAof::beginStartup()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  startingUp = true;
+}
+
+bool LettuceAof::finishStartup(const std::string &filename, const LettuceAofPosition &snapshot,
+                               const std::function<void(std::vector<std::string> &)> &apply, size_t &replayed, std::string &error)
+{
+  replayed = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    startingUp = false;
+    if (!enabled)
+      return true;
+  }
+  if (!replay(filename, snapshot, apply, replayed, error))
+    return false;
+  return open(filename, error);
+}
+
+void LettuceAof::setAppendOnly(bool on, bool &startedFresh)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  startedFresh = false;
+  enabled = on;
+  if (startingUp)
+    return;
+  if (on && fd == -1)
+  {
+    std::string error;
+    if (openLocked(defaultFilename, true, error))
+      startedFresh = true;
+    else
+      std::cerr << "-ERR: " << error << std::endl;
+  }
+  else if (!on && fd != -1)
+  {
+    closeLocked(lock);
+  }
+}
+
+bool LettuceAof::appendOnly()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return enabled;
+}
+
+bool LettuceAof::setFsync(const std::string &value)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (value == "always")
+    policy = Fsync::Always;
+  else if (value == "everysec")
+    policy = Fsync::Everysec;
+  else if (value == "no")
+    policy = Fsync::No;
+  else
+    return false;
+  wake.notify_one();
+  return true;
+}
+
+std::string LettuceAof::getFsync()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return policy == Fsync::Always ? "always" : policy == Fsync::Everysec ? "everysec" : "no";
+}
+
+/* Rewrite */
+std::string LettuceAof::rewriteFilename(const std::string &path, pid_t child)
+{
+  return path + ".rewrite." + std::to_string(child);
+}
+
+bool LettuceAof::beginRewrite(uint64_t &newGeneration, std::string &logPath)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd == -1 || rewriting)
+    return false;
+  logPath = path;
+  rewriting = true;
+  rewriteWanted = false;
+  rewriteDiff.clear();
+  rewriteGeneration = ::newGeneration();
+  newGeneration = rewriteGeneration;
+  return true;
+}
+
+void LettuceAof::rewriteStarted(pid_t child)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rewriteChild = child;
+}
+
+void LettuceAof::finishRewrite(pid_t child, bool ok)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  // the log was closed (and maybe reopened) while the child ran, its file is useless now
+  if (!rewriting || child != rewriteChild || !ok)
+  {
+    unlink(rewriteFilename(path, child).c_str());
+    if (child == rewriteChild)
+    {
+      rewriting = false;
+      rewriteChild = -1;
+      rewriteDiff.clear();
+      lastRewriteOk = false;
+      rewriteDone.notify_all();
+    }
+    return;
+  }
+  // the writer thread owns fd, so it does the switch
+  rewriteFinished = true;
+  wake.notify_one();
+}
+
+void LettuceAof::abortRewrite()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rewriting = false;
+  rewriteDiff.clear();
+  lastRewriteOk = false;
+  rewriteDone.notify_all();
+}
+
+// called by the writer thread with the lock held - appends the diff to the child's file and
+// renames it over the log. big diffs are written in rounds without the lock so clients keep
+// appending, only the last bit is written while they wait
+void LettuceAof::switchToRewrite(std::unique_lock<std::mutex> &lock)
+{
+  rewriteFinished = false;
+  std::string temp = rewriteFilename(path, rewriteChild);
+  int newFd = ::open(temp.c_str(), O_WRONLY | O_APPEND);
+  bool ok = newFd != -1;
+  std::string diff;
+  while (ok && rewriteDiff.size() > 65536)
+  {
+    diff.swap(rewriteDiff);
+    lock.unlock();
+    ok = writeAll(newFd, diff);
+    diff.clear();
+    lock.lock();
+  }
+  ok = ok && writeAll(newFd, rewriteDiff) && fdatasync(newFd) == 0 && rename(temp.c_str(), path.c_str()) == 0;
+  if (!ok)
+  {
+    std::cerr << "-ERR: append only file rewrite failed, keeping the old file" << std::endl;
+    if (newFd != -1)
+      ::close(newFd);
+    unlink(temp.c_str());
+  }
+  else
+  {
+    // everything still buffered for the old file is in the diff, and now on disk
+    ::close(fd);
+    fd = newFd;
+    generation = rewriteGeneration;
+    appended = baseSize = lseek(fd, 0, SEEK_END);
+    buffer.clear();
+    loggedSynced = logged;
+    rewriteCount++;
+    durable.notify_all();
+  }
+  lastRewriteOk = ok;
+  rewriting = false;
+  rewriteChild = -1;
+  rewriteDiff.clear();
+  rewriteDone.notify_all();
+}
+
+bool LettuceAof::waitForRewrite()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  rewriteDone.wait(lock, [this]()
+                   { return !rewriting; });
+  return lastRewriteOk;
+}
+
+bool LettuceAof::takeRewriteRequest()
+{
+  return rewriteWanted.exchange(false, std::memory_order_relaxed);
+}
+
+void LettuceAof::setRewritePercentage(size_t percentage)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rewritePercentage = percentage;
+}
+
+size_t LettuceAof::getRewritePercentage()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return rewritePercentage;
+}
+
+void LettuceAof::setRewriteMinSize(uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  rewriteMinSize = bytes;
+}
+
+uint64_t LettuceAof::getRewriteMinSize()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return rewriteMinSize;
+}
+
+/* Replay */
+bool LettuceAof::replay(const std::string &filename, const LettuceAofPosition &snapshot,
+                        const std::function<void(std::vector<std::string> &)> &apply, size_t &replayed, std::string &error)
+{
+  replayed = 0;
+  std::vector<uint8_t> data;
+  if (!readSnapshotFile(filename, data))
+  {
+    // no log yet is fine, open starts one
+    if (errno == ENOENT)
+      return true;
+    error = "can't read " + filename;
+    return false;
+  }
+
+  size_t position = 0;
+  std::vector<std::string> tokens;
+  bool corrupt = false;
+  uint64_t fileGeneration = 0;
+  size_t from = 0;
+  if (parseResp(data, position, tokens, corrupt) && tokens.size() == 2 && tokens[0] == headerCommand)
+  {
+    fileGeneration = strtoull(tokens[1].c_str(), nullptr, 10);
+    from = position;
+    // the snapshot already holds everything before its offset - any other snapshot is older
+    // than this log, so all of it is replayed
+    if (snapshot.generation == fileGeneration && snapshot.offset > from)
+      from = snapshot.offset;
+  }
+  if (corrupt)
+  {
+    error = filename + " is not an append only file";
+    return false;
+  }
+
+  position = fileGeneration ? position : 0;
+  size_t validEnd = position;
+  while (position < data.size())
+  {
+    size_t start = position;
+    if (!parseResp(data, position, tokens, corrupt))
+    {
+      if (corrupt)
+      {
+        error = filename + " is corrupt at offset " + std::to_string(start);
+        return false;
+      }
+      std::cerr << "-ERR: " << filename << " ends with a partial command, dropping " << data.size() - start << " bytes" << std::endl;
+      break;
+    }
+    validEnd = position;
+    if (start < from || tokens.empty())
+      continue;
+    apply(tokens);
+    replayed++;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  replayedPath = filename;
+  replayedGeneration = fileGeneration;
+  replayedLength = validEnd;
+  return true;
+}
+
+/* Writing */
+bool LettuceAof::open(const std::string &filename, std::string &error)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  enabled = true;
+  return openLocked(filename, false, error);
+}
+
+bool LettuceAof::openLocked(const std::string &filename, bool fresh, std::string &error)
+{
+  if (fd != -1)
+    return true;
+  fd = ::open(filename.c_str(), O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), 0644);
+  if (fd == -1)
+  {
+    error = "can't open " + filename + " for appending";
+    return false;
+  }
+
+  // an existing file with our header is continued, anything else starts a new generation
+  uint64_t fileGeneration = 0;
+  off_t fileSize = lseek(fd, 0, SEEK_END);
+  if (!fresh && fileSize > 0)
+  {
+    std::vector<uint8_t> head(std::min<off_t>(fileSize, 128));
+    bool corrupt = false;
+    size_t position = 0;
+    std::vector<std::string> tokens;
+    if (pread(fd, head.data(), head.size(), 0) == static_cast<ssize_t>(head.size()) &&
+        parseResp(head, position, tokens, corrupt) && tokens.size() == 2 && tokens[0] == headerCommand)
+      fileGeneration = strtoull(tokens[1].c_str(), nullptr, 10);
+  }
+
+  path = filename;
+  buffer.clear();
+  if (fileGeneration != 0)
+  {
+    // replay already found where the last whole command ends, past it is a torn write
+    uint64_t length = fileSize;
+    if (replayedPath == filename && replayedGeneration == fileGeneration && replayedLength < length)
+      length = replayedLength;
+    if (ftruncate(fd, length) != 0 || lseek(fd, 0, SEEK_END) == -1)
+    {
+      ::close(fd);
+      fd = -1;
+      error = "can't truncate " + filename;
+      return false;
+    }
+    generation = fileGeneration;
+    appended = length;
+  }
+  else
+  {
+    if (fileSize > 0 && ftruncate(fd, 0) != 0)
+    {
+      ::close(fd);
+      fd = -1;
+      error = "can't truncate " + filename;
+      return false;
+    }
+    generation = newGeneration();
+    appendResp(buffer, {headerCommand, std::to_string(generation)});
+    appended = buffer.size();
+    logged += buffer.size();
+  }
+  baseSize = appended;
+  replayedPath.clear();
+  lastWriteOk = true;
+  stopping = false;
+  writer = std::thread(&LettuceAof::run, this);
+  isActive = true;
+  return true;
+}
+
+void LettuceAof::close()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  enabled = false;
+  closeLocked(lock);
+}
+
+void LettuceAof::closeLocked(std::unique_lock<std::mutex> &lock)
+{
+  if (fd == -1)
+    return;
+  isActive = false;
+  stopping = true;
+  wake.notify_one();
+  lock.unlock();
+  writer.join();
+  lock.lock();
+  ::close(fd);
+  fd = -1;
+  // a running rewrite child is left to finish, finishRewrite throws its file away
+  rewriting = false;
+  rewriteFinished = false;
+  rewriteDiff.clear();
+  durable.notify_all();
+  rewriteDone.notify_all();
+}
+
+uint64_t LettuceAof::append(const std::vector<std::string> &tokens)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd == -1)
+    return 0;
+  size_t before = buffer.size();
+  appendResp(buffer, tokens);
+  appended += buffer.size() - before;
+  logged += buffer.size() - before;
+  // commands that arrive while a rewrite runs are kept aside too, the rewritten file only holds
+  // the dataset as it was when the child was forked
+  if (rewriting)
+    appendResp(rewriteDiff, tokens);
+  else if (!rewriteWanted && rewriteMinSize > 0 && appended >= rewriteMinSize && rewritePercentage > 0 &&
+           appended >= baseSize + baseSize * rewritePercentage / 100)
+    rewriteWanted = true;
+  // everysec and no let commands pile up until the writer wakes up on its own
+  if (policy == Fsync::Always)
+    wake.notify_one();
+  return logged;
+}
+
+void LettuceAof::waitDurable(uint64_t offset)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if (policy != Fsync::Always)
+    return;
+  durable.wait(lock, [&]()
+               { return loggedSynced >= offset || fd == -1 || !lastWriteOk; });
+}
+
+// the writer thread - takes whatever is buffered, writes it with one call and fsyncs it as the
+// policy asks. commands appended meanwhile wait for the next round and share its fsync
+void LettuceAof::run()
+{
+  auto lastSync = std::chrono::steady_clock::now();
+  std::string writing;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true)
+  {
+    if (policy == Fsync::Always)
+      wake.wait(lock, [this]()
+                { return stopping || rewriteFinished || !buffer.empty() || policy != Fsync::Always; });
+    else
+      wake.wait_for(lock, std::chrono::milliseconds(100), [this]()
+                    { return stopping || rewriteFinished || policy == Fsync::Always; });
+
+    // before taking the buffer - a successful switch drops it (it is all in the diff already),
+    // a failed one leaves it for the old file
+    if (rewriteFinished)
+    {
+      switchToRewrite(lock);
+      continue;
+    }
+    bool stop = stopping;
+    Fsync currentPolicy = policy;
+    writing.swap(buffer);
+    uint64_t target = logged;
+    bool needsSync = target > loggedSynced;
+    lock.unlock();
+
+    bool ok = true;
+    size_t offset = 0;
+    while (offset < writing.size())
+    {
+      ssize_t result = ::write(fd, writing.data() + offset, writing.size() - offset);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result <= 0)
+      {
+        ok = false;
+        break;
+      }
+      offset += result;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool sync = ok && needsSync &&
+                (currentPolicy == Fsync::Always || stop ||
+                 (currentPolicy == Fsync::Everysec && now - lastSync >= std::chrono::seconds(1)));
+    if (sync)
+    {
+      ok = fdatasync(fd) == 0;
+      lastSync = now;
+    }
+
+    lock.lock();
+    // a failed write keeps its tail in front of anything appended since, and is retried
+    writing.erase(0, offset);
+    if (!writing.empty())
+    {
+      buffer.insert(0, writing);
+      writing.clear();
+    }
+    if (sync && ok)
+    {
+      loggedSynced = target;
+      fsyncCount++;
+    }
+    if (ok != lastWriteOk)
+      std::cerr << (ok ? "append only file writes recovered" : "-ERR: writing the append only file failed") << std::endl;
+    lastWriteOk = ok;
+    durable.notify_all();
+    if (stop)
+      return;
+    if (!ok)
+    {
+      // don't spin on a full or broken disk
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      lock.lock();
+    }
+  }
+}
+
+LettuceAofPosition LettuceAof::position()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fd == -1)
+    return {};
+  return {generation, appended};
+}
+
+LettuceAofStats LettuceAof::stats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  LettuceAofStats stats;
+  stats.enabled = fd != -1;
+  stats.fsync = policy == Fsync::Always ? "always" : policy == Fsync::Everysec ? "everysec" : "no";
+  stats.size = appended;
+  stats.bufferLength = buffer.size();
+  stats.fsyncs = fsyncCount;
+  stats.lastWriteOk = lastWriteOk;
+  stats.baseSize = baseSize;
+  stats.rewriteInProgress = rewriting;
+  stats.rewriteBufferLength = rewriteDiff.size();
+  stats.rewrites = rewriteCount;
+  stats.lastRewriteOk = lastRewriteOk;
+  return stats;
+}
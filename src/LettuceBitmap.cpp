@@ -0,0 +1,231 @@
+#include "../include/LettuceBitmap.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LETTUCE_X86 1
+#endif
+
+/* Popcount */
+// inlined into both the popcnt and the portable entry points below, so the same loop
+// compiles to the hardware instruction when the cpu has it and to a bit trick otherwise
+static inline __attribute__((always_inline)) uint64_t popcountWords(const uint8_t *data, size_t length)
+{
+  uint64_t counts[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    uint64_t words[4];
+    memcpy(words, data + i, sizeof(words));
+    counts[0] += __builtin_popcountll(words[0]);
+    counts[1] += __builtin_popcountll(words[1]);
+    counts[2] += __builtin_popcountll(words[2]);
+    counts[3] += __builtin_popcountll(words[3]);
+  }
+  for (; i + 8 <= length; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    counts[0] += __builtin_popcountll(word);
+  }
+  for (; i < length; i++)
+    counts[0] += __builtin_popcount(data[i]);
+  return counts[0] + counts[1] + counts[2] + counts[3];
+}
+
+#ifdef LETTUCE_X86
+__attribute__((target("popcnt"))) static uint64_t popcountHardware(const uint8_t *data, size_t length)
+{
+  return popcountWords(data, length);
+}
+#endif
+
+static uint64_t popcountPortable(const uint8_t *data, size_t length)
+{
+  return popcountWords(data, length);
+}
+
+uint64_t bitmapPopcount(const uint8_t *data, size_t length)
+{
+#ifdef LETTUCE_X86
+  static const bool hasPopcnt = __builtin_cpu_supports("popcnt");
+  if (hasPopcnt)
+    return popcountHardware(data, length);
+#endif
+  return popcountPortable(data, length);
+}
+
+uint64_t bitmapPopcountBits(const uint8_t *data, size_t length, uint64_t startBit, uint64_t endBit)
+{
+  if (length == 0 || startBit > endBit)
+    return 0;
+  size_t firstByte = startBit >> 3;
+  size_t lastByte = endBit >> 3;
+  if (firstByte >= length)
+    return 0;
+  if (lastByte >= length)
+  {
+    lastByte = length - 1;
+    endBit = lastByte * 8 + 7;
+  }
+
+  // mask off the bits outside the range in the two edge bytes (msb first)
+  uint8_t firstMask = 0xff >> (startBit & 7);
+  uint8_t lastMask = static_cast<uint8_t>(0xff << (7 - (endBit & 7)));
+  if (firstByte == lastByte)
+    return __builtin_popcount(data[firstByte] & firstMask & lastMask);
+
+  uint64_t count = __builtin_popcount(data[firstByte] & firstMask);
+  count += bitmapPopcount(data + firstByte + 1, lastByte - firstByte - 1);
+  count += __builtin_popcount(data[lastByte] & lastMask);
+  return count;
+}
+
+/* Bitwise operations */
+static void bitmapOpWords(BitOp op, uint8_t *dest, const uint8_t *src, size_t i, size_t length)
+{
+  for (; i + 8 <= length; i += 8)
+  {
+    uint64_t a, b;
+    memcpy(&a, dest + i, 8);
+    memcpy(&b, src + i, 8);
+    switch (op)
+    {
+    case BitOp::And:
+      a &= b;
+      break;
+    case BitOp::Or:
+      a |= b;
+      break;
+    case BitOp::Xor:
+      a ^= b;
+      break;
+    case BitOp::Not:
+      a = ~a;
+      break;
+    }
+    memcpy(dest + i, &a, 8);
+  }
+  for (; i < length; i++)
+  {
+    switch (op)
+    {
+    case BitOp::And:
+      dest[i] &= src[i];
+      break;
+    case BitOp::Or:
+      dest[i] |= src[i];
+      break;
+    case BitOp::Xor:
+      dest[i] ^= src[i];
+      break;
+    case BitOp::Not:
+      dest[i] = ~dest[i];
+      break;
+    }
+  }
+}
+
+#ifdef LETTUCE_X86
+// 32 bytes per step, the word loop finishes the tail
+__attribute__((target("avx2"))) static void bitmapOpAvx2(BitOp op, uint8_t *dest, const uint8_t *src, size_t length)
+{
+  size_t i = 0;
+  const __m256i ones = _mm256_set1_epi8(-1);
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dest + i));
+    __m256i b = op == BitOp::Not ? ones : _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    switch (op)
+    {
+    case BitOp::And:
+      a = _mm256_and_si256(a, b);
+      break;
+    case BitOp::Or:
+      a = _mm256_or_si256(a, b);
+      break;
+    case BitOp::Xor:
+    case BitOp::Not:
+      a = _mm256_xor_si256(a, b);
+      break;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), a);
+  }
+  bitmapOpWords(op, dest, src, i, length);
+}
+#endif
+
+void bitmapOp(BitOp op, uint8_t *dest, const uint8_t *src, size_t length)
+{
+#ifdef LETTUCE_X86
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  if (hasAvx2)
+  {
+    bitmapOpAvx2(op, dest, src, length);
+    return;
+  }
+#endif
+  bitmapOpWords(op, dest, src, 0, length);
+}
+
+/* Bit search */
+int64_t bitmapPos(const uint8_t *data, size_t length, int bit, uint64_t startBit, uint64_t endBit)
+{
+  if (length == 0 || startBit > endBit)
+    return -1;
+  if (endBit >= length * 8)
+    endBit = length * 8 - 1;
+
+  // bytes that can't contain a match are skipped a word at a time
+  uint64_t skipWord = bit ? 0 : ~0ULL;
+  uint8_t skipByte = bit ? 0 : 0xff;
+  uint64_t position = startBit;
+  while (position <= endBit)
+  {
+    if ((position & 7) == 0)
+    {
+      size_t byte = position >> 3;
+      while (position + 64 <= endBit + 1)
+      {
+        uint64_t word;
+        memcpy(&word, data + byte, 8);
+        if (word != skipWord)
+          break;
+        byte += 8;
+        position += 64;
+      }
+      while (position + 8 <= endBit + 1 && data[byte] == skipByte)
+      {
+        byte++;
+        position += 8;
+      }
+      if (position > endBit)
+        break;
+    }
+    int value = (data[position >> 3] >> (7 - (position & 7))) & 1;
+    if (value == bit)
+      return static_cast<int64_t>(position);
+    position++;
+  }
+  return -1;
+}
+
+bool bitmapRange(int64_t start, int64_t end, int64_t size, int64_t &first, int64_t &last)
+{
+  if (start < 0)
+    start = size + start;
+  if (end < 0)
+    end = size + end;
+  if (start < 0)
+    start = 0;
+  if (end < 0)
+    end = 0;
+  if (end >= size)
+    end = size - 1;
+  if (size == 0 || start > end)
+    return false;
+  first = start;
+  last = end;
+  return true;
+}
@@ -1,10 +1,17 @@
 #include <../include/LettuceCommandHandler.h>
 #include <../include/LettuceCommandHandlers.h>
 #include <../include/LettuceDatabase.h>
+#include <../include/LettuceReply.h>
+#include <../include/LettuceTracking.h>
+#include <../include/LettuceAof.h>
 
 #include <vector>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
 
 // RESP (Redis Serialization Protocol)
 // e.g *2\r\n$4\r\nPING\r\n$4\r\nTEST\r\n
@@ -80,12 +87,215 @@ std::vector<std::string> parseRespCommand(const std::string &input)
   return tokens;
 }
 
-LettuceCommandHandler::LettuceCommandHandler() {}
+// one hash lookup per command instead of walking a chain of string compares
+// flags and key positions (first, last, step - last -1 means up to the end) like redis' command table
+static const std::unordered_map<std::string, LettuceCommand> &commandTable()
+{
+  static const std::unordered_map<std::string, LettuceCommand> table = {
+    {"PING", {handlePing, LettuceCommand::loading, 0, 0, 0}},
+    {"ECHO", {handleEcho, LettuceCommand::loading, 0, 0, 0}},
+    {"FLUSHALL", {handleFlushAll, LettuceCommand::write, 0, 0, 0}},
+    {"INFO", {handleInfo, LettuceCommand::admin | LettuceCommand::loading, 0, 0, 0}},
+    {"CONFIG", {handleConfig, LettuceCommand::admin | LettuceCommand::loading, 0, 0, 0}},
+    {"SAVE", {handleSave, LettuceCommand::admin, 0, 0, 0}},
+    {"BGSAVE", {handleBgsave, LettuceCommand::admin, 0, 0, 0}},
+    {"LASTSAVE", {handleLastsave, LettuceCommand::loading, 0, 0, 0}},
+    {"BGREWRITEAOF", {handleBgrewriteaof, LettuceCommand::admin, 0, 0, 0}},
+    {"MEMORY", {handleMemory, LettuceCommand::readonly, 2, 2, 1}},
+    {"SET", {handleSet, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"GET", {handleGet, LettuceCommand::readonly | LettuceCommand::readsValue, 1, 1, 1}},
+    {"KEYS", {handleKeys, LettuceCommand::readonly, 0, 0, 0}},
+    {"SCAN", {handleScan, LettuceCommand::readonly, 0, 0, 0}},
+    {"TYPE", {handleType, LettuceCommand::readonly, 1, 1, 1}},
+    {"DEL", {handleDel, LettuceCommand::write, 1, 1, 1}},
+    {"UNLINK", {handleUnlink, LettuceCommand::write, 1, -1, 1}},
+    {"EXPIRE", {handleExpire, LettuceCommand::write, 1, 1, 1}},
+    {"PEXPIREAT", {handlePexpireat, LettuceCommand::write, 1, 1, 1}},
+    {"RENAME", {handleRename, LettuceCommand::write, 1, 2, 1}},
+    {"COPY", {handleCopy, LettuceCommand::write | LettuceCommand::denyoom, 1, 2, 1}},
+    {"MGET", {handleMget, LettuceCommand::readonly | LettuceCommand::readsValue, 1, -1, 1}},
+    {"MSET", {handleMset, LettuceCommand::write | LettuceCommand::denyoom, 1, -1, 2}},
+    {"MSETNX", {handleMsetnx, LettuceCommand::write | LettuceCommand::denyoom, 1, -1, 2}},
+    {"LGET", {handleLget, LettuceCommand::readonly, 1, 1, 1}},
+    {"LLEN", {handleLlen, LettuceCommand::readonly, 1, 1, 1}},
+    {"LPUSH", {handleLpush, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"RPUSH", {handleRpush, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"LPOP", {handleLpop, LettuceCommand::write, 1, 1, 1}},
+    {"RPOP", {handleRpop, LettuceCommand::write, 1, 1, 1}},
+    {"LREM", {handleLrem, LettuceCommand::write, 1, 1, 1}},
+    {"LINDEX", {handleLindex, LettuceCommand::readonly, 1, 1, 1}},
+    {"LSET", {handleLset, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"HSET", {handleHset, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"HGET", {handleHget, LettuceCommand::readonly, 1, 1, 1}},
+    {"HEXISTS", {handleHexists, LettuceCommand::readonly, 1, 1, 1}},
+    {"HDEL", {handleHdel, LettuceCommand::write, 1, 1, 1}},
+    {"HGETALL", {handleHgetall, LettuceCommand::readonly, 1, 1, 1}},
+    {"HKEYS", {handleHkeys, LettuceCommand::readonly, 1, 1, 1}},
+    {"HVALS", {handleHvals, LettuceCommand::readonly, 1, 1, 1}},
+    {"HLEN", {handleHlen, LettuceCommand::readonly, 1, 1, 1}},
+    {"HSCAN", {handleHscan, LettuceCommand::readonly, 1, 1, 1}},
+    {"HMSET", {handleHmset, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"SADD", {handleSadd, LettuceCommand::write | LettuceCommand::denyoom, 1, 1, 1}},
+    {"SREM", {handleSrem, LettuceCommand::write, 1, 1, 1}},
+    {"SISMEMBER", {handleSismember, LettuceCommand::readonly, 1, 1, 1}},
+    {"SCARD", {handleScard, LettuceCommand::readonly, 1, 1, 1}},
+    {"SMEMBERS", {handleSmembers, LettuceCommand::readonly, 1, 1, 1}},
+    {"SSCAN", {handleSscan, LettuceCommand::readonly, 1, 1, 1}},
+    {"SINTER", {handleSinter, LettuceCommand::readonly, 1, -1, 1}},
+    {"SUNION", {handleSunion, LettuceCommand::readonly, 1, -1, 1}},
+    {"SDIFF", {handleSdiff, LettuceCommand::readonly, 1, -1, 1}},
+    {"PFADD", {handlePfadd, LettuceCommand::write | LettuceCommand::denyoom | LettuceCommand::readsValue, 1, 1, 1}},
+    {"PFCOUNT", {handlePfcount, LettuceCommand::readonly | LettuceCommand::readsValue, 1, -1, 1}},
+    {"PFMERGE", {handlePfmerge, LettuceCommand::write | LettuceCommand::denyoom | LettuceCommand::readsValue, 1, -1, 1}},
+    {"SETBIT", {handleSetbit, LettuceCommand::write | LettuceCommand::denyoom | LettuceCommand::readsValue, 1, 1, 1}},
+    {"GETBIT", {handleGetbit, LettuceCommand::readonly | LettuceCommand::readsValue, 1, 1, 1}},
+    {"BITCOUNT", {handleBitcount, LettuceCommand::readonly | LettuceCommand::readsValue, 1, 1, 1}},
+    {"BITPOS", {handleBitpos, LettuceCommand::readonly | LettuceCommand::readsValue, 1, 1, 1}},
+    {"BITOP", {handleBitop, LettuceCommand::write | LettuceCommand::denyoom | LettuceCommand::readsValue, 2, -1, 1}},
+  };
+  return table;
+}
+
+std::vector<std::string> LettuceCommand::keys(const std::vector<std::string> &tokens) const
+{
+  std::vector<std::string> result;
+  if (firstKey <= 0)
+    return result;
+  size_t last = lastKey < 0 ? tokens.size() - 1 : std::min<size_t>(lastKey, tokens.size() - 1);
+  for (size_t i = firstKey; i <= last; i += keyStep)
+    result.push_back(tokens[i]);
+  return result;
+}
+
+static std::atomic<uint64_t> nextClientId{1};
+
+LettuceCommandHandler::LettuceCommandHandler() : clientId(nextClientId++) {}
+
+LettuceCommandHandler::~LettuceCommandHandler()
+{
+  unwatchAll();
+  LettuceTracking::getInstance().disable(clientId);
+}
+
+uint64_t LettuceCommandHandler::id() const
+{
+  return clientId;
+}
+
+std::string LettuceCommandHandler::pendingPushes()
+{
+  return LettuceTracking::getInstance().takePending(clientId);
+}
+
+// relative times would drift every time the log is replayed, so they're logged as absolute ones
+static std::vector<std::string> replayableForm(const std::vector<std::string> &tokens)
+{
+  std::string command = tokens[0];
+  std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+  if (command == "EXPIRE" && tokens.size() >= 3)
+  {
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return {"PEXPIREAT", tokens[1], std::to_string(now + std::stoll(tokens[2]) * 1000)};
+  }
+  return tokens;
+}
+
+// a value on disk that can't be read fails just the command, the key is left as it was
+static std::string callCommand(const LettuceCommand &command, const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  try
+  {
+    return command.function(tokens, db);
+  }
+  catch (const LettuceTierError &error)
+  {
+    return std::string("-ERR: ") + error.what() + "\r\n";
+  }
+}
+
+std::string LettuceCommandHandler::run(const LettuceCommand &command, const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if ((command.flags & LettuceCommand::denyoom) && !db.freeMemoryIfNeeded())
+    return "-OOM: command not allowed when used memory > 'maxmemory'\r\n";
+  // values moved to disk are read back before the command runs, without holding up other clients -
+  // only for commands that use them, a SET or DEL would just throw the read away
+  if ((command.flags & LettuceCommand::readsValue) && db.tieringEnabled())
+    db.promote(command.keys(tokens));
+  // the lru/lfu eviction policies rank keys by when and how often they're used, new keys get
+  // their first access when they're created
+  if (db.accessTracked() && command.firstKey > 0)
+    db.touch(command.keys(tokens));
+
+  // remember what a tracking client reads before reading it, so a write racing with the read
+  // costs a spurious invalidation instead of a stale cache entry
+  if ((command.flags & LettuceCommand::readonly) && tracking)
+    LettuceTracking::getInstance().rememberKeys(clientId, command.keys(tokens));
+
+  LettuceAof &aof = LettuceAof::getInstance();
+  if (!(command.flags & LettuceCommand::write) || !aof.active())
+    return callCommand(command, tokens, db);
+
+  // logged under the same lock the write ran under, so the log order is the execution order
+  std::string response;
+  db.exec({}, [&]()
+          {
+    response = callCommand(command, tokens, db);
+    if (response[0] != '-')
+      unsyncedOffset = aof.append(replayableForm(tokens)); });
+  return response;
+}
+
+std::string LettuceCommandHandler::execute(std::vector<std::string> tokens)
+{
+  return dispatch(std::move(tokens));
+}
+
+void LettuceCommandHandler::unwatchAll()
+{
+  LettuceDatabase &db = LettuceDatabase::getInstance();
+  for (const auto &[key, version] : watchedKeys)
+    db.unwatch(key);
+  watchedKeys.clear();
+}
+
+// while startup loads the dataset clients only get the commands flagged as safe, the rest see
+// -LOADING and can retry. the log replay itself goes through execute, which skips this
+static bool allowedWhileLoading(const std::vector<std::string> &tokens)
+{
+  if (tokens.empty())
+    return true;
+  std::string command = tokens[0];
+  std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+  if (command == "HELLO" || command == "CLIENT")
+    return true;
+  auto it = commandTable().find(command);
+  return it != commandTable().end() && (it->second.flags & LettuceCommand::loading);
+}
 
 std::string LettuceCommandHandler::handleCommand(const std::string &commandLine)
 {
   std::vector<std::string> tokens = parseRespCommand(commandLine);
+  if (LettuceDatabase::getInstance().isLoading() && !allowedWhileLoading(tokens))
+    return "-LOADING: Lettuce is loading the dataset in memory\r\n";
+  std::string response = dispatch(std::move(tokens));
+  // with appendfsync always the reply waits until the writes it acknowledges are on disk
+  if (unsyncedOffset != 0)
+  {
+    LettuceAof &aof = LettuceAof::getInstance();
+    aof.waitDurable(unsyncedOffset);
+    unsyncedOffset = 0;
+    // the log grew past auto-aof-rewrite-percentage, compact it in the background
+    if (aof.takeRewriteRequest())
+      LettuceDatabase::getInstance().bgrewriteaof();
+  }
+  if (!tracking)
+    return response;
+  // invalidations caused by this command (or by others since the last one) go out first
+  return pendingPushes() + response;
+}
 
+std::string LettuceCommandHandler::dispatch(std::vector<std::string> tokens)
+{
   if (tokens.empty())
   {
     return "-ERR: empty command\r\n";
@@ -94,65 +304,174 @@ std::string LettuceCommandHandler::handleCommand(const std::string &commandLine)
   std::string command = tokens[0];
   std::cout << "Got command: " << command << std::endl;
   std::transform(command.begin(), command.end(), command.begin(), ::toupper);
-  std::ostringstream response;
 
   LettuceDatabase &db = LettuceDatabase::getInstance();
+  // replies built on this thread use this connection's protocol
+  LettuceReply::setCurrentProtocol(protocol);
+
+  if (command == "HELLO")
+    return handleHello(tokens);
+  if (command == "CLIENT")
+    return handleClient(tokens);
+
+  /* Transactions - these change the state of this connection so they're handled here */
+  if (command == "MULTI")
+  {
+    if (inTransaction)
+      return "-ERR: MULTI calls can not be nested\r\n";
+    inTransaction = true;
+    transactionFailed = false;
+    queuedCommands.clear();
+    return "+OK\r\n";
+  }
+  if (command == "DISCARD")
+  {
+    if (!inTransaction)
+      return "-ERR: DISCARD without MULTI\r\n";
+    inTransaction = false;
+    queuedCommands.clear();
+    unwatchAll();
+    return "+OK\r\n";
+  }
+  if (command == "EXEC")
+  {
+    if (!inTransaction)
+      return "-ERR: EXEC without MULTI\r\n";
+    inTransaction = false;
+    std::vector<QueuedCommand> queued;
+    queued.swap(queuedCommands);
+    if (transactionFailed)
+    {
+      unwatchAll();
+      return "-EXECABORT: Transaction discarded because of previous errors\r\n";
+    }
+
+    std::string response = "*" + std::to_string(queued.size()) + "\r\n";
+    LettuceAof &aof = LettuceAof::getInstance();
+    bool logged = aof.active() && std::any_of(queued.begin(), queued.end(), [](const QueuedCommand &queuedCommand)
+                                              { return queuedCommand.command->flags & LettuceCommand::write; });
+    bool executed = db.exec(watchedKeys, [&]()
+                            {
+      // wrapped in MULTI/EXEC in the log too, so a replay never stops half way through it
+      if (logged)
+        aof.append({"MULTI"});
+      for (const auto &queuedCommand : queued)
+        response += run(*queuedCommand.command, queuedCommand.tokens, db);
+      if (logged)
+        unsyncedOffset = aof.append({"EXEC"}); });
+    unwatchAll();
+    // a watched key changed, so nothing ran
+    if (!executed)
+      return LettuceReply().nullArray().take();
+    return response;
+  }
+  if (command == "WATCH")
+  {
+    if (inTransaction)
+      return "-ERR: WATCH inside MULTI is not allowed\r\n";
+    if (tokens.size() < 2)
+      return "-ERR: WATCH requires at least one key\r\n";
+    for (size_t i = 1; i < tokens.size(); i++)
+      watchedKeys.emplace_back(tokens[i], db.watch(tokens[i]));
+    return "+OK\r\n";
+  }
+  if (command == "UNWATCH")
+  {
+    unwatchAll();
+    return "+OK\r\n";
+  }
+
+  auto it = commandTable().find(command);
+  if (it == commandTable().end())
+  {
+    // an unknown command poisons the whole transaction, like redis
+    if (inTransaction)
+      transactionFailed = true;
+    return "-ERR: Unknown command\r\n";
+  }
+
+  if (inTransaction)
+  {
+    // the handler is resolved now so EXEC doesn't have to look it up again
+    queuedCommands.push_back({&it->second, std::move(tokens)});
+    return "+QUEUED\r\n";
+  }
+  return run(it->second, tokens, db);
+}
+
+std::string LettuceCommandHandler::handleHello(const std::vector<std::string> &tokens)
+{
+  if (inTransaction)
+    return "-ERR: HELLO inside MULTI is not allowed\r\n";
+  if (tokens.size() >= 2)
+  {
+    if (tokens[1] == "2")
+      protocol = 2;
+    else if (tokens[1] == "3")
+      protocol = 3;
+    else
+      return "-NOPROTO: unsupported protocol version\r\n";
+    LettuceReply::setCurrentProtocol(protocol);
+  }
+
+  LettuceReply reply;
+  reply.map(7);
+  reply.bulk("server").bulk("lettuce");
+  reply.bulk("version").bulk("1.0.0");
+  reply.bulk("proto").integer(protocol);
+  reply.bulk("id").integer(static_cast<int64_t>(clientId));
+  reply.bulk("mode").bulk("standalone");
+  reply.bulk("role").bulk("master");
+  reply.bulk("modules").array(0);
+  return reply.take();
+}
 
-  if (command == "PING")
-    return handlePing(tokens, db);
-  else if (command == "ECHO")
-    return handleEcho(tokens, db);
-  else if (command == "FLUSHALL")
-    return handleFlushAll(tokens, db);
-  else if (command == "SET")
-    return handleSet(tokens, db);
-  else if (command == "GET")
-    return handleGet(tokens, db);
-  else if (command == "KEYS")
-    return handleKeys(tokens, db);
-  else if (command == "TYPE")
-    return handleType(tokens, db);
-  else if (command == "DEL")
-    return handleDel(tokens, db);
-  else if (command == "EXPIRE")
-    return handleExpire(tokens, db);
-  else if (command == "RENAME")
-    return handleRename(tokens, db);
-  else if (command == "LGET")
-    return handleLget(tokens, db);
-  else if (command == "LLEN")
-    return handleLlen(tokens, db);
-  else if (command == "LPUSH")
-    return handleLpush(tokens, db);
-  else if (command == "RPUSH")
-    return handleRpush(tokens, db);
-  else if (command == "LPOP")
-    return handleLpop(tokens, db);
-  else if (command == "RPOP")
-    return handleRpop(tokens, db);
-  else if (command == "LREM")
-    return handleLrem(tokens, db);
-  else if (command == "LINDEX")
-    return handleLindex(tokens, db);
-  else if (command == "LSET")
-    return handleLset(tokens, db);
-  else if (command == "HSET")
-    return handleHset(tokens, db);
-  else if (command == "HGET")
-    return handleHget(tokens, db);
-  else if (command == "HEXISTS")
-    return handleHexists(tokens, db);
-  else if (command == "HDEL")
-    return handleHdel(tokens, db);
-  else if (command == "HGETALL")
-    return handleHgetall(tokens, db);
-  else if (command == "HKEYS")
-    return handleHkeys(tokens, db);
-  else if (command == "HVALS")
-    return handleHvals(tokens, db);
-  else if (command == "HLEN")
-    return handleHlen(tokens, db);
-  else if (command == "HMSET")
-    return handleHmset(tokens, db);
-  return "-ERR: Unknown command\r\n";
-}
\ No newline at end of file
+std::string LettuceCommandHandler::handleClient(const std::vector<std::string> &tokens)
+{
+  if (tokens.size() < 2)
+    return "-ERR: CLIENT requires a subcommand\r\n";
+  std::string subcommand = tokens[1];
+  std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+
+  if (subcommand == "ID")
+    return LettuceReply().integer(static_cast<int64_t>(clientId)).take();
+
+  if (subcommand == "TRACKING")
+  {
+    if (tokens.size() < 3)
+      return "-ERR: CLIENT TRACKING requires ON or OFF\r\n";
+    std::string mode = tokens[2];
+    std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+    if (mode == "OFF")
+    {
+      tracking = false;
+      LettuceTracking::getInstance().disable(clientId);
+      return "+OK\r\n";
+    }
+    if (mode != "ON")
+      return "-ERR: CLIENT TRACKING requires ON or OFF\r\n";
+    // invalidations are push messages, so there's no way to deliver them on RESP2
+    if (protocol < 3)
+      return "-ERR: CLIENT TRACKING needs RESP3, send HELLO 3 first\r\n";
+
+    bool broadcast = false;
+    std::vector<std::string> prefixes;
+    for (size_t i = 3; i < tokens.size(); i++)
+    {
+      std::string option = tokens[i];
+      std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+      if (option == "BCAST")
+        broadcast = true;
+      else if (option == "PREFIX" && i + 1 < tokens.size())
+        prefixes.push_back(tokens[++i]);
+      else
+        return "-ERR: syntax error\r\n";
+    }
+    if (!prefixes.empty() && !broadcast)
+      return "-ERR: PREFIX requires BCAST\r\n";
+    tracking = true;
+    LettuceTracking::getInstance().enable(clientId, broadcast, prefixes);
+    return "+OK\r\n";
+  }
+  return "-ERR: unknown CLIENT subcommand '" + tokens[1] + "'\r\n";
+}
@@ -1,11 +1,20 @@
 
 #include <../include/LettuceCommandHandler.h>
 #include <../include/LettuceDatabase.h>
+#include <../include/LettuceConfig.h>
+#include <../include/LettuceLazyFree.h>
+#include <../include/LettuceReply.h>
+#include <../include/LettuceTracking.h>
+#include <../include/LettuceAof.h>
+#include <../include/LettuceMemory.h>
 
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <cstdio>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 
 std::string handlePing(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
@@ -23,10 +32,244 @@ std::string handleEcho(const std::vector<std::string> &tokens, LettuceDatabase &
 
 std::string handleFlushAll(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
-  db.flushAll();
+  bool async = false;
+  if (tokens.size() >= 2)
+  {
+    std::string mode = tokens[1];
+    std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+    if (mode == "ASYNC")
+      async = true;
+    else if (mode != "SYNC")
+      return "-ERR: FLUSHALL only takes ASYNC or SYNC\r\n";
+  }
+  db.flushAll(async);
+  return "+OK\r\n";
+}
+
+std::string handleInfo(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  std::string section = tokens.size() >= 2 ? tokens[1] : "default";
+  std::transform(section.begin(), section.end(), section.begin(), ::tolower);
+  bool all = section == "default" || section == "all" || section == "everything";
+
+  std::ostringstream info;
+  if (all || section == "keyindex")
+  {
+    LettuceKeyIndexStats stats = db.keyIndexStats();
+    info << "# Keyindex\r\n"
+         << "keyindex_enabled:" << (stats.enabled ? 1 : 0) << "\r\n"
+         << "keyindex_keys:" << stats.keys << "\r\n"
+         << "keyindex_nodes:" << stats.nodes << "\r\n"
+         << "keyindex_memory_bytes:" << stats.memoryBytes << "\r\n";
+  }
+  if (all || section == "memory")
+  {
+    size_t used = LettuceMemory::used();
+    size_t rss = LettuceMemory::rss();
+    char fragmentation[16];
+    snprintf(fragmentation, sizeof(fragmentation), "%.2f", used ? static_cast<double>(rss) / used : 0.0);
+    info << "# Memory\r\n"
+         << "used_memory:" << used << "\r\n"
+         << "used_memory_peak:" << LettuceMemory::peak() << "\r\n"
+         << "used_memory_rss:" << rss << "\r\n"
+         << "mem_fragmentation_ratio:" << fragmentation << "\r\n";
+    // what the stores hold, charged by allocator hooks as they're written (a wrapped counter shows as 0)
+    for (int category = LettuceMemory::Strings; category < LettuceMemory::Categories; category++)
+    {
+      size_t bytes = LettuceMemory::used(static_cast<LettuceMemory::Category>(category));
+      info << "used_memory_" << LettuceMemory::categoryName(static_cast<LettuceMemory::Category>(category)) << ":"
+           << (bytes > used ? 0 : bytes) << "\r\n";
+    }
+    info << "maxmemory:" << db.getMaxMemory() << "\r\n"
+         << "maxmemory_policy:" << evictionPolicyName(db.getEvictionPolicy()) << "\r\n"
+         << "evicted_keys:" << db.evictedKeyCount() << "\r\n";
+    info << "hash_field_names_interned:" << LettuceField::interned() << "\r\n"
+         << "hash_field_names_bytes:" << LettuceField::internedBytes() << "\r\n";
+    LettuceCompressionStats compression = db.compressionStats();
+    info << "string_compression_threshold:" << compression.threshold << "\r\n"
+         << "compressed_strings:" << compression.strings << "\r\n"
+         << "compressed_strings_bytes_saved:" << compression.bytesSaved << "\r\n"
+         << "compression_skipped_poor_ratio:" << compression.skipped << "\r\n";
+    LettuceDefragStats defrag = db.defragStats();
+    info << "active_defrag_running:" << defrag.effort << "\r\n"
+         << "active_defrag_hits:" << defrag.hits << "\r\n"
+         << "active_defrag_misses:" << defrag.misses << "\r\n"
+         << "active_defrag_key_hits:" << defrag.keyHits << "\r\n"
+         << "active_defrag_key_misses:" << defrag.keyMisses << "\r\n";
+  }
+  if (all || section == "tiered")
+  {
+    LettuceTierStats tier = db.tierStats();
+    info << "# Tiered\r\n"
+         << "tiered_storage_enabled:" << (tier.enabled ? 1 : 0) << "\r\n"
+         << "tiered_keys:" << tier.keys << "\r\n"
+         << "tiered_bytes:" << tier.liveBytes << "\r\n"
+         << "tiered_file_bytes:" << tier.fileBytes << "\r\n"
+         << "tiered_segments:" << tier.segments << "\r\n"
+         << "tiered_spills:" << tier.spills << "\r\n"
+         << "tiered_reads:" << tier.reads << "\r\n"
+         << "tiered_compacted_bytes:" << tier.compactedBytes << "\r\n";
+  }
+  if (all || section == "lazyfree")
+  {
+    LettuceLazyFree &lazyFree = LettuceLazyFree::getInstance();
+    info << "# Lazyfree\r\n"
+         << "lazyfree_pending_objects:" << lazyFree.pending() << "\r\n"
+         << "lazyfreed_objects:" << lazyFree.freed() << "\r\n";
+  }
+  if (all || section == "persistence")
+  {
+    LettuceSaveStats stats = db.saveStats();
+    LettuceLoadStats load = db.loadStats();
+    char loadedPercent[16];
+    snprintf(loadedPercent, sizeof(loadedPercent), "%.2f", load.bytesTotal ? 100.0 * load.bytesLoaded / load.bytesTotal : 0.0);
+    info << "# Persistence\r\n"
+         << "loading:" << (load.loading ? 1 : 0) << "\r\n"
+         << "loading_start_time:" << load.startTime << "\r\n"
+         << "loading_total_bytes:" << load.bytesTotal << "\r\n"
+         << "loading_loaded_bytes:" << load.bytesLoaded << "\r\n"
+         << "loading_loaded_perc:" << loadedPercent << "\r\n"
+         << "loading_total_keys:" << load.keysTotal << "\r\n"
+         << "loading_loaded_keys:" << load.keysLoaded << "\r\n"
+         << "loading_eta_seconds:" << load.etaSeconds << "\r\n"
+         << "rdb_bgsave_in_progress:" << (stats.inProgress ? 1 : 0) << "\r\n"
+         << "rdb_changes_since_last_save:" << stats.changesSinceSave << "\r\n"
+         << "rdb_last_save_time:" << stats.lastSave << "\r\n"
+         << "rdb_last_bgsave_status:" << (stats.lastBgsaveOk ? "ok" : "err") << "\r\n"
+         << "rdb_last_bgsave_time_sec:" << stats.lastBgsaveSeconds << "\r\n"
+         << "rdb_current_bgsave_time_sec:" << stats.currentBgsaveSeconds << "\r\n"
+         << "rdb_bgsave_keys_saved:" << stats.keysSaved << "\r\n"
+         << "rdb_bgsave_keys_total:" << stats.keysTotal << "\r\n"
+         << "rdb_bgsave_bytes_written:" << stats.bytesWritten << "\r\n";
+    LettuceAofStats aof = LettuceAof::getInstance().stats();
+    info << "aof_enabled:" << (aof.enabled ? 1 : 0) << "\r\n"
+         << "aof_fsync:" << aof.fsync << "\r\n"
+         << "aof_current_size:" << aof.size << "\r\n"
+         << "aof_buffer_length:" << aof.bufferLength << "\r\n"
+         << "aof_fsyncs:" << aof.fsyncs << "\r\n"
+         << "aof_last_write_status:" << (aof.lastWriteOk ? "ok" : "err") << "\r\n"
+         << "aof_base_size:" << aof.baseSize << "\r\n"
+         << "aof_rewrite_in_progress:" << (aof.rewriteInProgress ? 1 : 0) << "\r\n"
+         << "aof_rewrite_buffer_length:" << aof.rewriteBufferLength << "\r\n"
+         << "aof_rewrites:" << aof.rewrites << "\r\n"
+         << "aof_last_bgrewrite_status:" << (aof.lastRewriteOk ? "ok" : "err") << "\r\n";
+  }
+  if (all || section == "tracking")
+  {
+    LettuceTrackingStats stats = LettuceTracking::getInstance().stats();
+    info << "# Tracking\r\n"
+         << "tracking_clients:" << stats.clients << "\r\n"
+         << "tracking_total_keys:" << stats.keys << "\r\n"
+         << "tracking_total_prefixes:" << stats.prefixes << "\r\n";
+  }
+  std::string body = info.str();
+  return "$" + std::to_string(body.size()) + "\r\n" + body + "\r\n";
+}
+
+std::string handleConfig(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: CONFIG requires a subcommand - GET pattern or SET name value\r\n";
+  }
+  std::string subcommand = tokens[1];
+  std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+  LettuceConfig &config = LettuceConfig::getInstance();
+
+  if (subcommand == "GET")
+  {
+    auto matches = config.getMatching(tokens[2]);
+    LettuceReply reply;
+    reply.map(matches.size());
+    for (const auto &[name, value] : matches)
+      reply.bulk(name).bulk(value);
+    return reply.take();
+  }
+  if (subcommand == "SET")
+  {
+    if (tokens.size() < 4)
+    {
+      return "-ERR: CONFIG SET expects a name and a value\r\n";
+    }
+    std::string error;
+    if (!config.set(tokens[2], tokens[3], error))
+      return "-ERR: " + error + "\r\n";
+    return "+OK\r\n";
+  }
+  return "-ERR: unknown CONFIG subcommand '" + tokens[1] + "'\r\n";
+}
+
+/* Persistence */
+std::string handleSave(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (!db.dump("dump.ldb"))
+    return "-ERR: failed to save dump.ldb\r\n";
   return "+OK\r\n";
 }
 
+std::string handleBgsave(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (db.saveStats().inProgress)
+    return "-ERR: Background save already in progress\r\n";
+  if (!db.bgsave("dump.ldb"))
+    return "-ERR: failed to start background save\r\n";
+  return "+Background saving started\r\n";
+}
+
+std::string handleBgrewriteaof(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  LettuceAofStats stats = LettuceAof::getInstance().stats();
+  if (!stats.enabled)
+    return "-ERR: the append only file is off, CONFIG SET appendonly yes first\r\n";
+  if (stats.rewriteInProgress)
+    return "-ERR: Background append only file rewriting already in progress\r\n";
+  if (!db.bgrewriteaof())
+    return "-ERR: failed to start the append only file rewrite\r\n";
+  return "+Background append only file rewriting started\r\n";
+}
+
+std::string handleLastsave(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  return ":" + std::to_string(db.lastSave()) + "\r\n";
+}
+
+// MEMORY USAGE key [SAMPLES count]
+std::string handleMemory(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+    return "-ERR: MEMORY requires a subcommand\r\n";
+  std::string subcommand = tokens[1];
+  std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+  if (subcommand != "USAGE")
+    return "-ERR: unknown MEMORY subcommand '" + tokens[1] + "'\r\n";
+  if (tokens.size() != 3 && tokens.size() != 5)
+    return "-ERR: MEMORY USAGE requires a KEY and optionally SAMPLES count\r\n";
+
+  size_t samples = 5;
+  if (tokens.size() == 5)
+  {
+    std::string option = tokens[3];
+    std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+    if (option != "SAMPLES")
+      return "-ERR: syntax error\r\n";
+    try
+    {
+      long long value = std::stoll(tokens[4]);
+      if (value < 0)
+        throw std::out_of_range("samples");
+      samples = static_cast<size_t>(value);
+    }
+    catch (const std::exception &)
+    {
+      return "-ERR: SAMPLES must be a non negative integer\r\n";
+    }
+  }
+  size_t bytes;
+  if (!db.memoryUsage(tokens[2], samples, bytes))
+    return LettuceReply().null().take();
+  return LettuceReply().integer(static_cast<int64_t>(bytes)).take();
+}
+
 /* Key value related operations */
 std::string handleSet(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
@@ -50,14 +293,15 @@ std::string handleGet(const std::vector<std::string> &tokens, LettuceDatabase &d
   std::string value;
   if (db.get(key, value))
   {
-    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    return LettuceReply().bulk(value).take();
   }
-  return "$-1\r\n";
+  return LettuceReply().null().take();
 }
 
 std::string handleKeys(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
-  std::vector<std::string> allKeys = db.keys();
+  // KEYS with no pattern still lists everything
+  std::vector<std::string> allKeys = tokens.size() >= 2 ? db.keys(tokens[1]) : db.keys();
   std::ostringstream response;
   response << "*" << allKeys.size() << "\r\n";
   for (const auto &key : allKeys)
@@ -68,6 +312,96 @@ std::string handleKeys(const std::vector<std::string> &tokens, LettuceDatabase &
   return response.str();
 }
 
+// parses the [MATCH pattern] [COUNT count] [TYPE type] options shared by the SCAN family
+static bool parseScanOptions(const std::vector<std::string> &tokens, size_t start, bool allowType, std::string &pattern, size_t &count, std::string &type, std::string &error)
+{
+  for (size_t i = start; i < tokens.size(); i += 2)
+  {
+    std::string option = tokens[i];
+    std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+    if (i + 1 >= tokens.size())
+    {
+      error = "-ERR: syntax error\r\n";
+      return false;
+    }
+    if (option == "MATCH")
+      pattern = tokens[i + 1];
+    else if (option == "COUNT")
+    {
+      try
+      {
+        long long value = std::stoll(tokens[i + 1]);
+        if (value < 1)
+          throw std::out_of_range("count");
+        count = static_cast<size_t>(value);
+      }
+      catch (const std::exception &)
+      {
+        error = "-ERR: COUNT must be a positive integer\r\n";
+        return false;
+      }
+    }
+    else if (option == "TYPE" && allowType)
+    {
+      type = tokens[i + 1];
+      std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+    }
+    else
+    {
+      error = "-ERR: syntax error\r\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool parseCursor(const std::string &token, uint64_t &cursor)
+{
+  if (token.empty() || token.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  try
+  {
+    cursor = std::stoull(token);
+    return true;
+  }
+  catch (const std::exception &)
+  {
+    return false;
+  }
+}
+
+static std::string formatScanReply(uint64_t cursor, const std::vector<std::string> &elements)
+{
+  std::string next = std::to_string(cursor);
+  std::ostringstream oss;
+  oss << "*2\r\n$" << next.size() << "\r\n"
+      << next << "\r\n";
+  oss << "*" << elements.size() << "\r\n";
+  for (const auto &element : elements)
+    oss << "$" << element.size() << "\r\n"
+        << element << "\r\n";
+  return oss.str();
+}
+
+std::string handleScan(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SCAN requires a CURSOR\r\n";
+  }
+  uint64_t cursor;
+  if (!parseCursor(tokens[1], cursor))
+    return "-ERR: invalid cursor\r\n";
+  std::string pattern, type, error;
+  size_t count = 10;
+  if (!parseScanOptions(tokens, 2, true, pattern, count, type, error))
+    return error;
+
+  std::vector<std::string> keys;
+  uint64_t next = db.scan(cursor, count, pattern, type, keys);
+  return formatScanReply(next, keys);
+}
+
 std::string handleType(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
   if (tokens.size() < 2)
@@ -90,6 +424,21 @@ std::string handleDel(const std::vector<std::string> &tokens, LettuceDatabase &d
   return ":" + std::to_string(deleted ? 1 : 0) + "\r\n";
 }
 
+std::string handleUnlink(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: UNLINK requires at least one KEY\r\n";
+  }
+  int unlinked = 0;
+  for (size_t i = 1; i < tokens.size(); i++)
+  {
+    if (db.unlink(tokens[i]))
+      unlinked++;
+  }
+  return ":" + std::to_string(unlinked) + "\r\n";
+}
+
 std::string handleExpire(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
   if (tokens.size() < 3)
@@ -102,6 +451,25 @@ std::string handleExpire(const std::vector<std::string> &tokens, LettuceDatabase
   return ":" + std::to_string(expired ? 1 : 0) + "\r\n";
 }
 
+std::string handlePexpireat(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3 || tokens[2].empty() || tokens[2].find_first_not_of("0123456789") != std::string::npos)
+  {
+    return "-ERR: PEXPIREAT requires a KEY and a unix TIME in milliseconds\r\n";
+  }
+  uint64_t unixMillis;
+  try
+  {
+    unixMillis = std::stoull(tokens[2]);
+  }
+  catch (const std::exception &)
+  {
+    return "-ERR: PEXPIREAT time is out of range\r\n";
+  }
+  bool expired = db.expireAt(tokens[1], unixMillis);
+  return ":" + std::to_string(expired ? 1 : 0) + "\r\n";
+}
+
 std::string handleRename(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
   if (tokens.size() < 3)
@@ -114,6 +482,83 @@ std::string handleRename(const std::vector<std::string> &tokens, LettuceDatabase
   return ":" + std::to_string(renamed ? 1 : 0) + "\r\n";
 }
 
+std::string handleCopy(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: COPY requires a SOURCE and DESTINATION key\r\n";
+  }
+  bool replace = false;
+  if (tokens.size() >= 4)
+  {
+    std::string option = tokens[3];
+    std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+    if (option != "REPLACE" || tokens.size() > 4)
+      return "-ERR: syntax error\r\n";
+    replace = true;
+  }
+  bool copied = db.copy(tokens[1], tokens[2], replace);
+  return ":" + std::to_string(copied ? 1 : 0) + "\r\n";
+}
+
+std::string handleMget(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: MGET requires at least one KEY\r\n";
+  }
+  std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+  auto values = db.mget(keys);
+
+  // size the reply up front so the whole multi bulk is a single buffer
+  size_t replySize = 16;
+  for (const auto &value : values)
+    replySize += value ? value->size() + 16 : 5;
+  LettuceReply reply;
+  reply.reserve(replySize);
+  reply.array(values.size());
+  for (const auto &value : values)
+  {
+    if (value)
+      reply.bulk(*value);
+    else
+      reply.null();
+  }
+  return reply.take();
+}
+
+static bool parseKeyValuePairs(const std::vector<std::string> &tokens, std::vector<std::pair<std::string, std::string>> &pairs)
+{
+  if (tokens.size() < 3 || tokens.size() % 2 == 0)
+    return false;
+  pairs.reserve((tokens.size() - 1) / 2);
+  for (size_t i = 1; i < tokens.size(); i += 2)
+    pairs.emplace_back(tokens[i], tokens[i + 1]);
+  return true;
+}
+
+std::string handleMset(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  std::vector<std::pair<std::string, std::string>> pairs;
+  if (!parseKeyValuePairs(tokens, pairs))
+  {
+    return "-ERR: MSET requires KEY and VALUE pairs\r\n";
+  }
+  db.mset(pairs);
+  return "+OK\r\n";
+}
+
+std::string handleMsetnx(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  std::vector<std::pair<std::string, std::string>> pairs;
+  if (!parseKeyValuePairs(tokens, pairs))
+  {
+    return "-ERR: MSETNX requires KEY and VALUE pairs\r\n";
+  }
+  bool set = db.msetnx(pairs);
+  return ":" + std::to_string(set ? 1 : 0) + "\r\n";
+}
+
 /* List related operations */
 std::string handleLget(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
@@ -146,11 +591,10 @@ std::string handleLpush(const std::vector<std::string> &tokens, LettuceDatabase
 {
   if (tokens.size() < 3)
   {
-    return "-ERR: LPUSH requires a KEY and VALUE\r\n";
+    return "-ERR: LPUSH requires a KEY and at least one VALUE\r\n";
   }
   const std::string &key = tokens[1];
-  const std::string &value = tokens[2];
-  db.lpush(key, value);
+  db.lpush(key, std::vector<std::string>(tokens.begin() + 2, tokens.end()));
   size_t len = db.llen(key);
   return ":" + std::to_string(len) + "\r\n";
 }
@@ -159,11 +603,10 @@ std::string handleRpush(const std::vector<std::string> &tokens, LettuceDatabase
 {
   if (tokens.size() < 3)
   {
-    return "-ERR: RPUSH requires a KEY and VALUE\r\n";
+    return "-ERR: RPUSH requires a KEY and at least one VALUE\r\n";
   }
   const std::string &key = tokens[1];
-  const std::string &value = tokens[2];
-  db.rpush(key, value);
+  db.rpush(key, std::vector<std::string>(tokens.begin() + 2, tokens.end()));
   size_t len = db.llen(key);
   return ":" + std::to_string(len) + "\r\n";
 }
@@ -177,8 +620,8 @@ std::string handleLpop(const std::vector<std::string> &tokens, LettuceDatabase &
   const std::string &key = tokens[1];
   std::string value{};
   if (db.lpop(key, value))
-    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-  return "$-1\r\n";
+    return LettuceReply().bulk(value).take();
+  return LettuceReply().null().take();
 }
 
 std::string handleRpop(const std::vector<std::string> &tokens, LettuceDatabase &db)
@@ -190,8 +633,8 @@ std::string handleRpop(const std::vector<std::string> &tokens, LettuceDatabase &
   const std::string &key = tokens[1];
   std::string value{};
   if (db.rpop(key, value))
-    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-  return "$-1\r\n";
+    return LettuceReply().bulk(value).take();
+  return LettuceReply().null().take();
 }
 
 std::string handleLrem(const std::vector<std::string> &tokens, LettuceDatabase &db)
@@ -226,8 +669,8 @@ std::string handleLindex(const std::vector<std::string> &tokens, LettuceDatabase
     const std::string &key = tokens[1];
     std::string value{};
     if (db.lindex(key, index, value))
-      return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-    return "$-1\r\n";
+      return LettuceReply().bulk(value).take();
+    return LettuceReply().null().take();
   }
   catch (const std::exception &)
   {
@@ -280,8 +723,8 @@ std::string handleHget(const std::vector<std::string> &tokens, LettuceDatabase &
   const std::string field = tokens[2];
   std::string value;
   if (db.hget(key, field, value))
-    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
-  return "$-1\r\n";
+    return LettuceReply().bulk(value).take();
+  return LettuceReply().null().take();
 }
 
 std::string handleHexists(const std::vector<std::string> &tokens, LettuceDatabase &db)
@@ -316,16 +759,12 @@ std::string handleHgetall(const std::vector<std::string> &tokens, LettuceDatabas
   }
   const std::string key = tokens[1];
   auto hash = db.hgetall(key);
-  std::ostringstream oss;
-  oss << "*" << hash.size() * 2 << "\r\n"; // two strings per hash
+  // a native map on RESP3, alternating fields and values on RESP2
+  LettuceReply reply;
+  reply.map(hash.size());
   for (const auto &[key, value] : hash)
-  {
-    oss << "$" << key.size() << "\r\n"
-        << key << "\r\n";
-    oss << "$" << value.size() << "\r\n"
-        << value << "\r\n";
-  }
-  return oss.str();
+    reply.bulk(key).bulk(value);
+  return reply.take();
 }
 
 std::string handleHkeys(const std::vector<std::string> &tokens, LettuceDatabase &db)
@@ -360,6 +799,32 @@ std::string handleHvals(const std::vector<std::string> &tokens, LettuceDatabase
   return oss.str();
 }
 
+std::string handleHscan(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: HSCAN requires a KEY and CURSOR\r\n";
+  }
+  uint64_t cursor;
+  if (!parseCursor(tokens[2], cursor))
+    return "-ERR: invalid cursor\r\n";
+  std::string pattern, type, error;
+  size_t count = 10;
+  if (!parseScanOptions(tokens, 3, false, pattern, count, type, error))
+    return error;
+
+  std::vector<std::pair<std::string, std::string>> fields;
+  uint64_t next = db.hscan(tokens[1], cursor, count, pattern, fields);
+  std::vector<std::string> flattened;
+  flattened.reserve(fields.size() * 2);
+  for (auto &[field, value] : fields)
+  {
+    flattened.push_back(std::move(field));
+    flattened.push_back(std::move(value));
+  }
+  return formatScanReply(next, flattened);
+}
+
 std::string handleHlen(const std::vector<std::string> &tokens, LettuceDatabase &db)
 {
   if (tokens.size() < 2)
@@ -388,4 +853,295 @@ std::string handleHmset(const std::vector<std::string> &tokens, LettuceDatabase
   }
   db.hmset(key, fieldValues);
   return "+OK\r\n";
+}
+
+/* Set operations */
+// set replies are a native set on RESP3
+static std::string formatSetReply(const std::vector<std::string> &members)
+{
+  LettuceReply reply;
+  reply.set(members.size());
+  for (const auto &member : members)
+    reply.bulk(member);
+  return reply.take();
+}
+
+std::string handleSadd(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: SADD requires a KEY and at least one MEMBER\r\n";
+  }
+  const std::string &key = tokens[1];
+  std::vector<std::string> members(tokens.begin() + 2, tokens.end());
+  int added = db.sadd(key, members);
+  return ":" + std::to_string(added) + "\r\n";
+}
+
+std::string handleSrem(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: SREM requires a KEY and at least one MEMBER\r\n";
+  }
+  const std::string &key = tokens[1];
+  std::vector<std::string> members(tokens.begin() + 2, tokens.end());
+  int removed = db.srem(key, members);
+  return ":" + std::to_string(removed) + "\r\n";
+}
+
+std::string handleSismember(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: SISMEMBER requires a KEY and MEMBER\r\n";
+  }
+  const std::string &key = tokens[1];
+  const std::string &member = tokens[2];
+  bool exists = db.sismember(key, member);
+  return ":" + std::to_string(exists ? 1 : 0) + "\r\n";
+}
+
+std::string handleScard(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SCARD requires a KEY\r\n";
+  }
+  const std::string &key = tokens[1];
+  size_t size = db.scard(key);
+  return ":" + std::to_string(size) + "\r\n";
+}
+
+std::string handleSmembers(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SMEMBERS requires a KEY\r\n";
+  }
+  const std::string &key = tokens[1];
+  return formatSetReply(db.smembers(key));
+}
+
+std::string handleSscan(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: SSCAN requires a KEY and CURSOR\r\n";
+  }
+  uint64_t cursor;
+  if (!parseCursor(tokens[2], cursor))
+    return "-ERR: invalid cursor\r\n";
+  std::string pattern, type, error;
+  size_t count = 10;
+  if (!parseScanOptions(tokens, 3, false, pattern, count, type, error))
+    return error;
+
+  std::vector<std::string> members;
+  uint64_t next = db.sscan(tokens[1], cursor, count, pattern, members);
+  return formatScanReply(next, members);
+}
+
+std::string handleSinter(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SINTER requires at least one KEY\r\n";
+  }
+  std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+  return formatSetReply(db.sinter(keys));
+}
+
+std::string handleSunion(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SUNION requires at least one KEY\r\n";
+  }
+  std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+  return formatSetReply(db.sunion(keys));
+}
+
+std::string handleSdiff(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: SDIFF requires at least one KEY\r\n";
+  }
+  std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+  return formatSetReply(db.sdiff(keys));
+}
+
+/* HyperLogLog operations */
+std::string handlePfadd(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: PFADD requires a KEY\r\n";
+  }
+  const std::string &key = tokens[1];
+  std::vector<std::string> elements(tokens.begin() + 2, tokens.end());
+  bool updated;
+  if (!db.pfadd(key, elements, updated))
+    return "-ERR: Key is not a valid HyperLogLog string value\r\n";
+  return ":" + std::to_string(updated ? 1 : 0) + "\r\n";
+}
+
+std::string handlePfcount(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: PFCOUNT requires at least one KEY\r\n";
+  }
+  std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+  uint64_t count;
+  if (!db.pfcount(keys, count))
+    return "-ERR: Key is not a valid HyperLogLog string value\r\n";
+  return ":" + std::to_string(count) + "\r\n";
+}
+
+std::string handlePfmerge(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 2)
+  {
+    return "-ERR: PFMERGE requires a DESTKEY\r\n";
+  }
+  const std::string &destKey = tokens[1];
+  std::vector<std::string> sourceKeys(tokens.begin() + 2, tokens.end());
+  if (!db.pfmerge(destKey, sourceKeys))
+    return "-ERR: Key is not a valid HyperLogLog string value\r\n";
+  return "+OK\r\n";
+}
+
+/* Bitmap operations */
+static const uint64_t maxBitOffset = (1ULL << 32) - 1; // 512MB strings, same limit as redis
+
+static bool parseBitUnit(const std::string &token, bool &bitUnit)
+{
+  std::string unit = token;
+  std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+  if (unit != "BYTE" && unit != "BIT")
+    return false;
+  bitUnit = unit == "BIT";
+  return true;
+}
+
+std::string handleSetbit(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 4)
+  {
+    return "-ERR: SETBIT requires a KEY, OFFSET and VALUE\r\n";
+  }
+  try
+  {
+    long long offset = std::stoll(tokens[2]);
+    if (offset < 0 || static_cast<uint64_t>(offset) > maxBitOffset)
+      return "-ERR: Bit offset is not an integer or out of range\r\n";
+    if (tokens[3] != "0" && tokens[3] != "1")
+      return "-ERR: Bit is not an integer or out of range\r\n";
+    int previous = db.setbit(tokens[1], offset, tokens[3] == "1" ? 1 : 0);
+    return ":" + std::to_string(previous) + "\r\n";
+  }
+  // only the parse errors, a value tiered storage couldn't read back goes up to the command handler
+  catch (const std::logic_error &)
+  {
+    return "-ERR: Bit offset is not an integer or out of range\r\n";
+  }
+}
+
+std::string handleGetbit(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3)
+  {
+    return "-ERR: GETBIT requires a KEY and OFFSET\r\n";
+  }
+  try
+  {
+    long long offset = std::stoll(tokens[2]);
+    if (offset < 0 || static_cast<uint64_t>(offset) > maxBitOffset)
+      return "-ERR: Bit offset is not an integer or out of range\r\n";
+    int bit = db.getbit(tokens[1], offset);
+    return ":" + std::to_string(bit) + "\r\n";
+  }
+  catch (const std::logic_error &)
+  {
+    return "-ERR: Bit offset is not an integer or out of range\r\n";
+  }
+}
+
+std::string handleBitcount(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() != 2 && tokens.size() != 4 && tokens.size() != 5)
+  {
+    return "-ERR: BITCOUNT requires a KEY and optionally START END [BYTE|BIT]\r\n";
+  }
+  const std::string &key = tokens[1];
+  if (tokens.size() == 2)
+    return ":" + std::to_string(db.bitcount(key)) + "\r\n";
+  try
+  {
+    long long start = std::stoll(tokens[2]);
+    long long end = std::stoll(tokens[3]);
+    bool bitUnit = false;
+    if (tokens.size() == 5 && !parseBitUnit(tokens[4], bitUnit))
+      return "-ERR: syntax error\r\n";
+    return ":" + std::to_string(db.bitcount(key, start, end, bitUnit)) + "\r\n";
+  }
+  catch (const std::logic_error &)
+  {
+    return "-ERR: Invalid range value\r\n";
+  }
+}
+
+std::string handleBitpos(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 3 || tokens.size() > 6)
+  {
+    return "-ERR: BITPOS requires a KEY, BIT and optionally START [END [BYTE|BIT]]\r\n";
+  }
+  if (tokens[2] != "0" && tokens[2] != "1")
+    return "-ERR: The bit argument must be 1 or 0\r\n";
+  try
+  {
+    int bit = tokens[2] == "1" ? 1 : 0;
+    long long start = tokens.size() > 3 ? std::stoll(tokens[3]) : 0;
+    long long end = tokens.size() > 4 ? std::stoll(tokens[4]) : -1;
+    bool bitUnit = false;
+    if (tokens.size() == 6 && !parseBitUnit(tokens[5], bitUnit))
+      return "-ERR: syntax error\r\n";
+    int64_t position = db.bitpos(tokens[1], bit, start, end, tokens.size() > 4, bitUnit);
+    return ":" + std::to_string(position) + "\r\n";
+  }
+  catch (const std::logic_error &)
+  {
+    return "-ERR: Invalid range value\r\n";
+  }
+}
+
+std::string handleBitop(const std::vector<std::string> &tokens, LettuceDatabase &db)
+{
+  if (tokens.size() < 4)
+  {
+    return "-ERR: BITOP requires an OPERATION, DESTKEY and at least one KEY\r\n";
+  }
+  std::string operation = tokens[1];
+  std::transform(operation.begin(), operation.end(), operation.begin(), ::toupper);
+  BitOp op;
+  if (operation == "AND")
+    op = BitOp::And;
+  else if (operation == "OR")
+    op = BitOp::Or;
+  else if (operation == "XOR")
+    op = BitOp::Xor;
+  else if (operation == "NOT")
+    op = BitOp::Not;
+  else
+    return "-ERR: BITOP supports AND, OR, XOR and NOT\r\n";
+
+  if (op == BitOp::Not && tokens.size() != 4)
+    return "-ERR: BITOP NOT must be called with a single source key\r\n";
+
+  std::vector<std::string> sourceKeys(tokens.begin() + 3, tokens.end());
+  size_t length = db.bitop(op, tokens[2], sourceKeys);
+  return ":" + std::to_string(length) + "\r\n";
 }
\ No newline at end of file
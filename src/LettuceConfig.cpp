@@ -0,0 +1,492 @@
+#include "../include/LettuceConfig.h"
+#include "../include/LettuceDatabase.h"
+#include "../include/LettuceGlob.h"
+#include "../include/LettuceTracking.h"
+#include "../include/LettuceAof.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iterator>
+#include <cstdint>
+
+static bool parseYesNo(const std::string &value, bool &result, std::string &error)
+{
+  std::string lower = value;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if (lower == "yes")
+    result = true;
+  else if (lower == "no")
+    result = false;
+  else
+  {
+    error = "argument must be 'yes' or 'no'";
+    return false;
+  }
+  return true;
+}
+
+static bool parseSize(const std::string &value, size_t &result, std::string &error)
+{
+  if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+  {
+    error = "argument must be a non negative integer";
+    return false;
+  }
+  try
+  {
+    result = std::stoull(value);
+  }
+  catch (const std::exception &)
+  {
+    error = "argument is out of range";
+    return false;
+  }
+  return true;
+}
+
+// a byte count with an optional k/kb/m/mb/g/gb suffix (1024 based, case insensitive)
+static bool parseMemory(const std::string &value, size_t &result, std::string &error)
+{
+  std::string lower = value;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  size_t digits = lower.find_first_not_of("0123456789");
+  std::string unit = digits == std::string::npos ? "" : lower.substr(digits);
+  size_t multiplier = 1;
+  if (unit == "k" || unit == "kb")
+    multiplier = 1024;
+  else if (unit == "m" || unit == "mb")
+    multiplier = 1024 * 1024;
+  else if (unit == "g" || unit == "gb")
+    multiplier = 1024 * 1024 * 1024;
+  else if (!unit.empty())
+  {
+    error = "argument must be a memory size like 100mb";
+    return false;
+  }
+  size_t count;
+  if (!parseSize(lower.substr(0, digits), count, error))
+    return false;
+  if (count > SIZE_MAX / multiplier)
+  {
+    error = "argument is out of range";
+    return false;
+  }
+  result = count * multiplier;
+  return true;
+}
+
+LettuceConfig &LettuceConfig::getInstance()
+{
+  static LettuceConfig instance;
+  return instance;
+}
+
+LettuceConfig::LettuceConfig()
+{
+  parameters.push_back({"keyindex",
+                        [](const std::string &value, std::string &error)
+                        {
+                          bool enabled;
+                          if (!parseYesNo(value, enabled, error))
+                            return false;
+                          LettuceDatabase::getInstance().setKeyIndexEnabled(enabled);
+                          return true;
+                        },
+                        []()
+                        { return std::string(LettuceDatabase::getInstance().keyIndexStats().enabled ? "yes" : "no"); }});
+  parameters.push_back({"save",
+                        [](const std::string &value, std::string &error)
+                        {
+                          // "<seconds> <changes> ..." pairs, an empty value turns automatic saves off
+                          std::istringstream stream(value);
+                          std::vector<std::string> words{std::istream_iterator<std::string>(stream), std::istream_iterator<std::string>()};
+                          if (words.size() % 2 != 0)
+                          {
+                            error = "save takes <seconds> <changes> pairs";
+                            return false;
+                          }
+                          std::vector<LettuceSaveRule> rules;
+                          for (size_t i = 0; i < words.size(); i += 2)
+                          {
+                            size_t seconds, changes;
+                            if (!parseSize(words[i], seconds, error) || !parseSize(words[i + 1], changes, error))
+                              return false;
+                            if (changes == 0)
+                            {
+                              error = "save needs at least one change per rule";
+                              return false;
+                            }
+                            rules.push_back({static_cast<int64_t>(seconds), changes});
+                          }
+                          LettuceDatabase::getInstance().setSaveRules(std::move(rules));
+                          return true;
+                        },
+                        []()
+                        {
+                          std::string value;
+                          for (const LettuceSaveRule &rule : LettuceDatabase::getInstance().getSaveRules())
+                            value += (value.empty() ? "" : " ") + std::to_string(rule.seconds) + " " + std::to_string(rule.changes);
+                          return value;
+                        }});
+  parameters.push_back({"snapshot-compression",
+                        [](const std::string &value, std::string &error)
+                        {
+                          bool enabled;
+                          if (!parseYesNo(value, enabled, error))
+                            return false;
+                          LettuceDatabase::getInstance().setSnapshotCompression(enabled);
+                          return true;
+                        },
+                        []()
+                        { return std::string(LettuceDatabase::getInstance().getSnapshotCompression() ? "yes" : "no"); }});
+  parameters.push_back({"string-compression-threshold",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t bytes;
+                          if (!parseMemory(value, bytes, error))
+                            return false;
+                          LettuceDatabase::getInstance().setStringCompressionThreshold(bytes);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getStringCompressionThreshold()); }});
+  parameters.push_back({"maxmemory",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t bytes;
+                          if (!parseMemory(value, bytes, error))
+                            return false;
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          db.setMaxMemory(bytes);
+                          // a lower limit takes effect now, not on the next write
+                          db.freeMemoryIfNeeded();
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getMaxMemory()); }});
+  parameters.push_back({"maxmemory-policy",
+                        [](const std::string &value, std::string &error)
+                        {
+                          std::string lower = value;
+                          std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                          LettuceEvictionPolicy policy;
+                          if (!parseEvictionPolicy(lower, policy))
+                          {
+                            error = "argument must be 'noeviction', 'allkeys-lru', 'allkeys-lfu', 'volatile-lru' or 'volatile-ttl'";
+                            return false;
+                          }
+                          LettuceDatabase::getInstance().setEvictionPolicy(policy);
+                          return true;
+                        },
+                        []()
+                        { return evictionPolicyName(LettuceDatabase::getInstance().getEvictionPolicy()); }});
+  parameters.push_back({"maxmemory-samples",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t samples;
+                          if (!parseSize(value, samples, error))
+                            return false;
+                          if (samples == 0 || samples > 64)
+                          {
+                            error = "argument must be between 1 and 64";
+                            return false;
+                          }
+                          LettuceDatabase::getInstance().setEvictionSamples(samples);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getEvictionSamples()); }});
+  parameters.push_back({"activedefrag",
+                        [](const std::string &value, std::string &error)
+                        {
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceDefragConfig config = db.getDefragConfig();
+                          if (!parseYesNo(value, config.enabled, error))
+                            return false;
+                          db.setDefragConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::string(LettuceDatabase::getInstance().getDefragConfig().enabled ? "yes" : "no"); }});
+  parameters.push_back({"active-defrag-ignore-bytes",
+                        [](const std::string &value, std::string &error)
+                        {
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceDefragConfig config = db.getDefragConfig();
+                          if (!parseMemory(value, config.ignoreBytes, error))
+                            return false;
+                          db.setDefragConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getDefragConfig().ignoreBytes); }});
+  // the active defrag settings are read and written as a whole, one field per parameter
+  auto addDefragPercent = [this](const std::string &name, int LettuceDefragConfig::*field)
+  {
+    parameters.push_back({name,
+                          [field](const std::string &value, std::string &error)
+                          {
+                            size_t percent;
+                            if (!parseSize(value, percent, error))
+                              return false;
+                            if (percent > 100)
+                            {
+                              error = "argument must be between 0 and 100";
+                              return false;
+                            }
+                            LettuceDatabase &db = LettuceDatabase::getInstance();
+                            LettuceDefragConfig config = db.getDefragConfig();
+                            config.*field = static_cast<int>(percent);
+                            db.setDefragConfig(config);
+                            return true;
+                          },
+                          [field]()
+                          { return std::to_string(LettuceDatabase::getInstance().getDefragConfig().*field); }});
+  };
+  addDefragPercent("active-defrag-threshold-lower", &LettuceDefragConfig::thresholdLower);
+  addDefragPercent("active-defrag-threshold-upper", &LettuceDefragConfig::thresholdUpper);
+  addDefragPercent("active-defrag-cycle-min", &LettuceDefragConfig::cycleMin);
+  addDefragPercent("active-defrag-cycle-max", &LettuceDefragConfig::cycleMax);
+  parameters.push_back({"tiered-storage",
+                        [](const std::string &value, std::string &error)
+                        {
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceTierConfig config = db.getTierConfig();
+                          if (!parseYesNo(value, config.enabled, error))
+                            return false;
+                          db.setTierConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::string(LettuceDatabase::getInstance().getTierConfig().enabled ? "yes" : "no"); }});
+  // the segment files are named <path>.1, <path>.2 and so on, a new path is used the next time it's turned on
+  parameters.push_back({"tiered-storage-path",
+                        [](const std::string &value, std::string &error)
+                        {
+                          if (value.empty())
+                          {
+                            error = "argument must be a file path";
+                            return false;
+                          }
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceTierConfig config = db.getTierConfig();
+                          config.prefix = value;
+                          db.setTierConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return LettuceDatabase::getInstance().getTierConfig().prefix; }});
+  parameters.push_back({"tiered-storage-idle-seconds",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t seconds;
+                          if (!parseSize(value, seconds, error))
+                            return false;
+                          if (seconds > LettuceKeyMeta::clockMax)
+                          {
+                            error = "argument is out of range";
+                            return false;
+                          }
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceTierConfig config = db.getTierConfig();
+                          config.idleSeconds = static_cast<uint32_t>(seconds);
+                          db.setTierConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getTierConfig().idleSeconds); }});
+  parameters.push_back({"tiered-storage-min-size",
+                        [](const std::string &value, std::string &error)
+                        {
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceTierConfig config = db.getTierConfig();
+                          if (!parseMemory(value, config.minSize, error))
+                            return false;
+                          db.setTierConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getTierConfig().minSize); }});
+  parameters.push_back({"tiered-storage-segment-size",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t bytes;
+                          if (!parseMemory(value, bytes, error))
+                            return false;
+                          if (bytes == 0)
+                          {
+                            error = "argument must be at least 1";
+                            return false;
+                          }
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          LettuceTierConfig config = db.getTierConfig();
+                          config.segmentSize = bytes;
+                          db.setTierConfig(config);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getTierConfig().segmentSize); }});
+  parameters.push_back({"lazyfree-threshold",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t threshold;
+                          if (!parseSize(value, threshold, error))
+                            return false;
+                          LettuceDatabase::getInstance().setLazyFreeThreshold(threshold);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getLazyFreeThreshold()); }});
+  parameters.push_back({"tracking-table-max-keys",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t keys;
+                          if (!parseSize(value, keys, error))
+                            return false;
+                          LettuceTracking::getInstance().setMaxKeys(keys);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceTracking::getInstance().getMaxKeys()); }});
+  parameters.push_back({"snapshot-key-delay",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t micros;
+                          if (!parseSize(value, micros, error))
+                            return false;
+                          LettuceDatabase::getInstance().setKeySaveDelay(micros);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceDatabase::getInstance().getKeySaveDelay()); }});
+  parameters.push_back({"appendonly",
+                        [](const std::string &value, std::string &error)
+                        {
+                          bool enabled;
+                          if (!parseYesNo(value, enabled, error))
+                            return false;
+                          LettuceAof &aof = LettuceAof::getInstance();
+                          LettuceDatabase &db = LettuceDatabase::getInstance();
+                          // a new log only holds what happens from now on, the snapshot is its base - a save
+                          // that's already running started before the log, so it can't be that snapshot
+                          if (enabled && !aof.appendOnly() && db.saveStats().inProgress)
+                          {
+                            error = "a background save is in progress, try again once it's done";
+                            return false;
+                          }
+                          bool startedFresh;
+                          aof.setAppendOnly(enabled, startedFresh);
+                          if (startedFresh && !db.bgsave("dump.ldb"))
+                          {
+                            // a log without its base would replay onto the wrong snapshot
+                            aof.setAppendOnly(false, startedFresh);
+                            error = db.saveStats().inProgress ? "a background save is in progress, try again once it's done"
+                                                              : "failed to start the background save the log starts from";
+                            return false;
+                          }
+                          return true;
+                        },
+                        []()
+                        { return std::string(LettuceAof::getInstance().appendOnly() ? "yes" : "no"); }});
+  parameters.push_back({"appendfsync",
+                        [](const std::string &value, std::string &error)
+                        {
+                          std::string lower = value;
+                          std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                          if (!LettuceAof::getInstance().setFsync(lower))
+                          {
+                            error = "argument must be 'always', 'everysec' or 'no'";
+                            return false;
+                          }
+                          return true;
+                        },
+                        []()
+                        { return LettuceAof::getInstance().getFsync(); }});
+  parameters.push_back({"auto-aof-rewrite-percentage",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t percentage;
+                          if (!parseSize(value, percentage, error))
+                            return false;
+                          LettuceAof::getInstance().setRewritePercentage(percentage);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceAof::getInstance().getRewritePercentage()); }});
+  parameters.push_back({"auto-aof-rewrite-min-size",
+                        [](const std::string &value, std::string &error)
+                        {
+                          size_t bytes;
+                          if (!parseMemory(value, bytes, error))
+                            return false;
+                          LettuceAof::getInstance().setRewriteMinSize(bytes);
+                          return true;
+                        },
+                        []()
+                        { return std::to_string(LettuceAof::getInstance().getRewriteMinSize()); }});
+}
+
+const LettuceConfig::Parameter *LettuceConfig::find(const std::string &name) const
+{
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for (const auto &parameter : parameters)
+  {
+    if (parameter.name == lower)
+      return &parameter;
+  }
+  return nullptr;
+}
+
+bool LettuceConfig::set(const std::string &name, const std::string &value, std::string &error)
+{
+  const Parameter *parameter = find(name);
+  if (parameter == nullptr)
+  {
+    error = "unknown config parameter '" + name + "'";
+    return false;
+  }
+  return parameter->set(value, error);
+}
+
+bool LettuceConfig::get(const std::string &name, std::string &value) const
+{
+  const Parameter *parameter = find(name);
+  if (parameter == nullptr)
+    return false;
+  value = parameter->get();
+  return true;
+}
+
+std::vector<std::pair<std::string, std::string>> LettuceConfig::getMatching(const std::string &pattern) const
+{
+  std::vector<std::pair<std::string, std::string>> matches;
+  for (const auto &parameter : parameters)
+  {
+    if (globMatch(pattern, parameter.name))
+      matches.emplace_back(parameter.name, parameter.get());
+  }
+  return matches;
+}
+
+bool LettuceConfig::parseArgs(int argc, char *argv[], int first, std::string &error)
+{
+  for (int i = first; i < argc; i += 2)
+  {
+    std::string name = argv[i];
+    if (name.rfind("--", 0) != 0 || i + 1 >= argc)
+    {
+      error = "expected --name value, got '" + name + "'";
+      return false;
+    }
+    std::string parameterError;
+    if (!set(name.substr(2), argv[i + 1], parameterError))
+    {
+      error = name + ": " + parameterError;
+      return false;
+    }
+  }
+  return true;
+}
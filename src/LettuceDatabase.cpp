@@ -1,12 +1,30 @@
 #include "../include/LettuceDatabase.h"
+#include "../include/LettuceHyperLogLog.h"
+#include "../include/LettuceScan.h"
+#include "../include/LettuceGlob.h"
+#include "../include/LettuceLazyFree.h"
+#include "../include/LettuceTracking.h"
+#include "../include/LettuceSnapshot.h"
+#include "../include/LettuceLz.h"
+#include "../include/LettuceMemory.h"
+#include "../include/LettuceDefrag.h"
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <mutex>
-#include <fstream>
-#include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 LettuceDatabase &LettuceDatabase::getInstance()
 {
@@ -14,13 +32,86 @@ LettuceDatabase &LettuceDatabase::getInstance()
   return instance;
 }
 
-bool LettuceDatabase::flushAll()
+// which LettuceMemory category a store's nodes and values are charged to
+static LettuceMemory::Category memoryCategory(const LettuceDict<std::string, std::string> &)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  return LettuceMemory::Strings;
+}
+
+static LettuceMemory::Category memoryCategory(const LettuceDict<std::string, LettuceCow<std::vector<std::string>>> &)
+{
+  return LettuceMemory::Lists;
+}
+
+static LettuceMemory::Category memoryCategory(const LettuceDict<std::string, LettuceCow<LettuceHash>> &)
+{
+  return LettuceMemory::Hashes;
+}
+
+static LettuceMemory::Category memoryCategory(const LettuceDict<std::string, LettuceCow<LettuceSet>> &)
+{
+  return LettuceMemory::Sets;
+}
+
+static LettuceMemory::Category memoryCategory(const std::unordered_map<std::string, std::chrono::steady_clock::time_point> &)
+{
+  return LettuceMemory::Expires;
+}
+
+// swapped out rather than cleared, so the bucket array is freed under the category as well
+template <typename Store>
+static void clearStore(Store &store)
+{
+  LettuceMemory::Scope scope(memoryCategory(store));
+  Store().swap(store);
+}
+
+template <typename Store>
+static void clearKey(Store &store, const std::string &key)
+{
+  LettuceMemory::Scope scope(memoryCategory(store));
+  store.erase(key);
+}
+
+bool LettuceDatabase::flushAll(bool async)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  keyValueStore.clear();
-  listStore.clear();
-  hashStore.clear();
+  // counted before the async branch moves the stores away
+  dirty += keyValueStore.size() + listStore.size() + hashStore.size() + setStore.size();
+  if (async)
+  {
+    // moving a map out is O(1), the reclaimer thread pays for the destructors
+    LettuceLazyFree &lazyFree = LettuceLazyFree::getInstance();
+    lazyFree.free(std::move(keyValueStore), LettuceMemory::Strings);
+    lazyFree.free(std::move(listStore), LettuceMemory::Lists);
+    lazyFree.free(std::move(hashStore), LettuceMemory::Hashes);
+    lazyFree.free(std::move(setStore), LettuceMemory::Sets);
+  }
+  clearStore(keyValueStore);
+  clearStore(listStore);
+  clearStore(hashStore);
+  clearStore(setStore);
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    std::unordered_map<std::string, size_t>().swap(compressedStrings);
+    compressionSavedBytes = 0;
+    for (const auto &[key, location] : tieredStrings)
+      tierStore->release(location);
+    LettuceDict<std::string, LettuceTierLocation>().swap(tieredStrings);
+  }
+  // an expiry left behind would hit a key of the same name created later
+  clearStore(expiryMap);
+  if (keyIndex)
+    keyIndex->clear();
+  keyMeta.clear();
+  evictionPool.clear();
+  // every watched and client cached key is gone now
+  for (auto &[key, watched] : watchedKeys)
+    watched.version = ++keyVersionCounter;
+  LettuceTracking &tracking = LettuceTracking::getInstance();
+  if (tracking.active())
+    tracking.invalidateAll();
   return true;
 }
 
@@ -31,9 +122,8 @@ void LettuceDatabase::purgeExpired()
   {
     if (now > it->second)
     {
-      keyValueStore.erase(it->first);
-      listStore.erase(it->first);
-      hashStore.erase(it->first);
+      detachKey(it->first, false);
+      LettuceMemory::Scope scope(LettuceMemory::Expires);
       it = expiryMap.erase(it);
     } else {
       it++;
@@ -41,210 +131,1977 @@ void LettuceDatabase::purgeExpired()
   }
 }
 
-/* Key Value operations*/
-void LettuceDatabase::set(const std::string &key, const std::string &value)
+// roughly how many allocations it takes to destroy a value
+static size_t freeEffort(const std::string &)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  keyValueStore[key] = value;
+  return 1;
 }
 
-bool LettuceDatabase::get(const std::string &key, std::string &value)
+static size_t freeEffort(const std::vector<std::string> &list)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  auto iterator = keyValueStore.find(key);
-  if (iterator != keyValueStore.end())
+  return list.size();
+}
+
+static size_t freeEffort(const LettuceHash &hash)
+{
+  return hash.size();
+}
+
+static size_t freeEffort(const LettuceSet &set)
+{
+  return set.isIntset() ? 1 : set.size();
+}
+
+// dropping one reference to a shared value doesn't free anything
+template <typename T>
+static size_t freeEffort(const LettuceCow<T> &value)
+{
+  return value.shared() ? 1 : freeEffort(*value);
+}
+
+template <typename Store>
+static bool detachValue(Store &store, const std::string &key, bool async, size_t threshold)
+{
+  auto it = store.find(key);
+  if (it == store.end())
+    return false;
+  LettuceMemory::Scope scope(memoryCategory(store));
+  // extract() unlinks the node without destroying it, so the reclaimer frees key and value together
+  if (async || (threshold > 0 && freeEffort(it->second) > threshold))
+    LettuceLazyFree::getInstance().free(store.extract(it), memoryCategory(store));
+  else
+    store.erase(it);
+  return true;
+}
+
+bool LettuceDatabase::detachKey(const std::string &key, bool async)
+{
+  bool erased = false;
+  forgetCompressed(key);
+  forgetTiered(key);
+  erased |= detachValue(keyValueStore, key, async, lazyFreeThreshold);
+  erased |= detachValue(listStore, key, async, lazyFreeThreshold);
+  erased |= detachValue(hashStore, key, async, lazyFreeThreshold);
+  erased |= detachValue(setStore, key, async, lazyFreeThreshold);
+  if (erased)
   {
-    value = iterator->second;
-    return true;
+    unindexKey(key);
+    signalModifiedKey(key);
   }
-  return false;
+  return erased;
 }
 
-std::string LettuceDatabase::type(const std::string &key)
+void LettuceDatabase::setLazyFreeThreshold(size_t threshold)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  if (keyValueStore.find(key) != keyValueStore.end())
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  lazyFreeThreshold = threshold;
+}
+
+size_t LettuceDatabase::getLazyFreeThreshold()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return lazyFreeThreshold;
+}
+
+bool LettuceDatabase::keyExists(const std::string &key) const
+{
+  return (keyValueStore.find(key) != keyValueStore.end()) ||
+         (listStore.find(key) != listStore.end()) ||
+         (hashStore.find(key) != hashStore.end()) ||
+         (setStore.find(key) != setStore.end());
+}
+
+// the index, eviction metadata and watch/tracking bookkeeping below aren't part of any value,
+// so they opt out of the category the calling write set
+void LettuceDatabase::indexKey(const std::string &key)
+{
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  if (keyIndex)
+    keyIndex->insert(key);
+  // emplace keeps the access data of a key that is only being overwritten
+  if (accessTracking.load(std::memory_order_relaxed))
+    keyMeta.emplace(key, newKeyMeta());
+}
+
+void LettuceDatabase::unindexKey(const std::string &key)
+{
+  if ((!keyIndex && keyMeta.empty()) || keyExists(key))
+    return;
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  if (keyIndex)
+    keyIndex->remove(key);
+  keyMeta.erase(key);
+}
+
+void LettuceDatabase::setKeyIndexEnabled(bool enabled)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  if (!enabled)
   {
-    return "string";
+    keyIndex.reset();
+    indexScanCursors.clear();
+    indexScanOrder.clear();
+    return;
   }
-  if (listStore.find(key) != listStore.end())
+  if (keyIndex)
+    return;
+  keyIndex = std::make_unique<LettuceRadixTree>();
+  for (const auto &pair : keyValueStore)
+    keyIndex->insert(pair.first);
+  for (const auto &pair : listStore)
+    keyIndex->insert(pair.first);
+  for (const auto &pair : hashStore)
+    keyIndex->insert(pair.first);
+  for (const auto &pair : setStore)
+    keyIndex->insert(pair.first);
+}
+
+void LettuceDatabase::signalModifiedKey(const std::string &key)
+{
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  dirty++;
+  if (!watchedKeys.empty())
   {
-    return "list";
+    auto it = watchedKeys.find(key);
+    if (it != watchedKeys.end())
+      it->second.version = ++keyVersionCounter;
   }
-  if (hashStore.find(key) != hashStore.end())
+  LettuceTracking &tracking = LettuceTracking::getInstance();
+  if (tracking.active())
+    tracking.invalidateKey(key);
+}
+
+uint64_t LettuceDatabase::watch(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  WatchedKey &watched = watchedKeys[key];
+  watched.watchers++;
+  return watched.version;
+}
+
+void LettuceDatabase::unwatch(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  auto it = watchedKeys.find(key);
+  if (it != watchedKeys.end() && --it->second.watchers == 0)
+    watchedKeys.erase(it);
+}
+
+bool LettuceDatabase::exec(const std::vector<std::pair<std::string, uint64_t>> &watched, const std::function<void()> &batch)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  for (const auto &[key, version] : watched)
   {
-    return "hash";
+    auto it = watchedKeys.find(key);
+    if (it == watchedKeys.end() || it->second.version != version)
+      return false;
   }
-  return "none";
+  // the commands lock db_mutex again, which is just a counter bump on the owning thread
+  batch();
+  return true;
 }
 
-std::vector<std::string> LettuceDatabase::keys()
+/* Eviction */
+void LettuceDatabase::setMaxMemory(uint64_t bytes)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  std::vector<std::string> keys{};
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  maxMemory = bytes;
+  updateAccessTracking();
+}
+
+void LettuceDatabase::setEvictionPolicy(LettuceEvictionPolicy policy)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  evictionPolicy = policy;
+  updateAccessTracking();
+}
+
+LettuceEvictionPolicy LettuceDatabase::getEvictionPolicy()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return evictionPolicy;
+}
+
+void LettuceDatabase::setEvictionSamples(size_t samples)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  evictionSamples = std::max<size_t>(samples, 1);
+}
+
+size_t LettuceDatabase::getEvictionSamples()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return evictionSamples;
+}
+
+void LettuceDatabase::updateAccessTracking()
+{
+  bool tracked = (maxMemory.load(std::memory_order_relaxed) > 0 &&
+                  (evictionPolicy == LettuceEvictionPolicy::AllKeysLru ||
+                   evictionPolicy == LettuceEvictionPolicy::AllKeysLfu ||
+                   evictionPolicy == LettuceEvictionPolicy::VolatileLru)) ||
+                 tierConfig.enabled;
+  bool lfu = evictionPolicy == LettuceEvictionPolicy::AllKeysLfu;
+  // a new limit keeps what is known about the keys, but lru and lfu pack different things into
+  // the same bits so a switch between them starts from scratch
+  if (tracked == accessTracking.load(std::memory_order_relaxed) && lfu == keyMetaLfu)
+    return;
+  keyMeta.clear();
+  evictionPool.clear();
+  accessTracking = tracked;
+  keyMetaLfu = lfu;
+  if (!tracked)
+    return;
+  uint32_t meta = newKeyMeta();
+  keyMeta.reserve(keyValueStore.size() + listStore.size() + hashStore.size() + setStore.size());
   for (const auto &pair : keyValueStore)
+    keyMeta.emplace(pair.first, meta);
+  for (const auto &pair : listStore)
+    keyMeta.emplace(pair.first, meta);
+  for (const auto &pair : hashStore)
+    keyMeta.emplace(pair.first, meta);
+  for (const auto &pair : setStore)
+    keyMeta.emplace(pair.first, meta);
+}
+
+uint32_t LettuceDatabase::newKeyMeta() const
+{
+  return evictionPolicy == LettuceEvictionPolicy::AllKeysLfu ? LettuceKeyMeta::lfuNew() : LettuceKeyMeta::lruClock();
+}
+
+void LettuceDatabase::touch(const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  bool lfu = evictionPolicy == LettuceEvictionPolicy::AllKeysLfu;
+  for (const auto &key : keys)
   {
-    const std::string &key = pair.first;
-    keys.push_back(key);
+    auto it = keyMeta.find(key);
+    if (it != keyMeta.end())
+      it->second = lfu ? LettuceKeyMeta::lfuTouch(it->second) : LettuceKeyMeta::lruClock();
   }
+}
 
-  for (const auto &pair : listStore)
+uint64_t LettuceDatabase::evictionScore(const std::string &key)
+{
+  if (evictionPolicy == LettuceEvictionPolicy::VolatileTtl)
   {
-    const std::string &key = pair.first;
-    keys.push_back(key);
+    // sooner expiry is a better candidate
+    auto it = expiryMap.find(key);
+    if (it == expiryMap.end())
+      return 0;
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(it->second - std::chrono::steady_clock::now()).count();
+    return UINT64_MAX - static_cast<uint64_t>(std::max<int64_t>(remaining, 0));
   }
+  auto it = keyMeta.find(key);
+  if (it == keyMeta.end())
+    return LettuceKeyMeta::clockMax;
+  if (evictionPolicy == LettuceEvictionPolicy::AllKeysLfu)
+    return 255 - LettuceKeyMeta::lfuCount(it->second);
+  return LettuceKeyMeta::lruIdleSeconds(it->second);
+}
 
-  for (const auto &pair : hashStore)
+// the pool carries the best candidates over from earlier rounds, so a handful of samples
+// per eviction still approximates the real lru/lfu order well
+void LettuceDatabase::considerForEviction(const std::string &key)
+{
+  uint64_t score = evictionScore(key);
+  auto existing = std::find_if(evictionPool.begin(), evictionPool.end(), [&key](const EvictionCandidate &candidate)
+                               { return candidate.key == key; });
+  if (existing != evictionPool.end())
+    evictionPool.erase(existing);
+  if (evictionPool.size() >= evictionPoolSize && score <= evictionPool.front().score)
+    return;
+  auto position = std::upper_bound(evictionPool.begin(), evictionPool.end(), score, [](uint64_t value, const EvictionCandidate &candidate)
+                                   { return value < candidate.score; });
+  evictionPool.insert(position, {score, key});
+  if (evictionPool.size() > evictionPoolSize)
+    evictionPool.erase(evictionPool.begin());
+}
+
+// a few entries from random buckets - unordered_map has no random element access, but its
+// buckets are indexable. the attempts cap keeps a sparse table (lots of deletes) from spinning
+template <typename Map>
+static void sampleKeys(const Map &map, size_t count, std::mt19937_64 &random, std::vector<std::string> &out)
+{
+  if (map.empty())
+    return;
+  std::uniform_int_distribution<size_t> pick(0, map.bucket_count() - 1);
+  for (size_t attempts = 0; out.size() < count && attempts < count * 16; attempts++)
   {
-    const std::string &key = pair.first;
-    keys.push_back(key);
+    size_t bucket = pick(random);
+    for (auto it = map.begin(bucket); it != map.end(bucket) && out.size() < count; ++it)
+      out.push_back(it->first);
   }
-  return keys;
 }
 
-bool LettuceDatabase::del(const std::string &key)
+void LettuceDatabase::evictKey(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  bool erased = false;
-  erased |= keyValueStore.erase(key) > 0;
-  erased |= listStore.erase(key) > 0;
-  erased |= hashStore.erase(key) > 0;
-  return erased;
+  // never lazily, the memory has to show up as free before the next check
+  forgetCompressed(key);
+  forgetTiered(key);
+  detachValue(keyValueStore, key, false, 0);
+  detachValue(listStore, key, false, 0);
+  detachValue(hashStore, key, false, 0);
+  detachValue(setStore, key, false, 0);
+  clearKey(expiryMap, key);
+  unindexKey(key);
+  signalModifiedKey(key);
+  evictedKeys++;
+  // replicated to the log like an expiry would be, so a replay ends up with the same keyspace
+  LettuceAof &aof = LettuceAof::getInstance();
+  if (aof.active())
+    aof.append({"DEL", key});
 }
 
-bool LettuceDatabase::expire(const std::string &key, int seconds)
+bool LettuceDatabase::freeMemoryIfNeeded()
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  uint64_t limit = maxMemory.load(std::memory_order_relaxed);
+  // the log replay and snapshot load must not lose keys, the limit applies once they're done
+  if (limit == 0 || LettuceMemory::used() <= limit || isLoading())
+    return true;
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  bool exists = (keyValueStore.find(key) != keyValueStore.end()) ||
-                (listStore.find(key) != listStore.end()) ||
-                (hashStore.find(key) != hashStore.end());
-  if (!exists)
+  if (evictionPolicy == LettuceEvictionPolicy::NoEviction)
+    return LettuceMemory::used() <= limit;
+
+  bool volatileOnly = evictionPolicy == LettuceEvictionPolicy::VolatileLru || evictionPolicy == LettuceEvictionPolicy::VolatileTtl;
+  std::vector<std::string> samples;
+  while (LettuceMemory::used() > limit)
+  {
+    samples.clear();
+    if (volatileOnly)
+      sampleKeys(expiryMap, evictionSamples, evictionRandom, samples);
+    else
+      sampleKeys(keyMeta, evictionSamples, evictionRandom, samples);
+    for (const auto &key : samples)
+      considerForEviction(key);
+
+    // pool entries can be stale, a key may have been deleted (or lost its ttl) since it was sampled
+    bool evicted = false;
+    while (!evictionPool.empty() && !evicted)
+    {
+      std::string key = std::move(evictionPool.back().key);
+      evictionPool.pop_back();
+      if (!keyExists(key) || (volatileOnly && expiryMap.find(key) == expiryMap.end()))
+        continue;
+      evictKey(key);
+      evicted = true;
+    }
+    if (!evicted)
+      return false;
+  }
+  return true;
+}
+
+/* Memory usage */
+// a node of a std::unordered_map with string keys - next pointer, the pair and the cached hash -
+// plus the bucket slot pointing at it (a full table has about one per element)
+template <typename Store>
+static size_t nodeUsage(const typename Store::value_type &entry)
+{
+  return LettuceMemory::allocationSize(sizeof(void *) + sizeof(entry) + sizeof(size_t)) + sizeof(void *) + LettuceMemory::heapSize(entry.first);
+}
+
+// visits at most samples elements (all of them for 0) and scales their sum up to the whole container
+template <typename Container, typename Measure>
+static size_t sampledUsage(const Container &container, size_t samples, Measure measure)
+{
+  size_t seen = 0, total = 0;
+  for (const auto &element : container)
+  {
+    if (samples > 0 && seen == samples)
+      break;
+    total += measure(element);
+    seen++;
+  }
+  return seen == 0 ? 0 : total * container.size() / seen;
+}
+
+static size_t valueUsage(const std::string &value, size_t)
+{
+  return LettuceMemory::heapSize(value);
+}
+
+static size_t valueUsage(const std::vector<std::string> &list, size_t samples)
+{
+  return LettuceMemory::heapSize(list.data()) + sampledUsage(list, samples, [](const std::string &item)
+                                                             { return LettuceMemory::heapSize(item); });
+}
+
+// an empty table hasn't allocated its buckets yet
+template <typename Table>
+static size_t bucketUsage(const Table &table)
+{
+  return table.bucket_count() > 0 ? LettuceMemory::allocationSize(table.bucket_count() * sizeof(void *)) : 0;
+}
+
+// a field's node holds a handle, the name itself is shared with every other hash using it
+static size_t valueUsage(const LettuceHash &hash, size_t samples)
+{
+  return bucketUsage(hash) + sampledUsage(hash, samples, [](const LettuceHash::value_type &field)
+                                          { return LettuceMemory::allocationSize(sizeof(void *) + sizeof(field) + sizeof(size_t)) + sizeof(void *) +
+                                                   field.first.memoryShare() + LettuceMemory::heapSize(field.second); });
+}
+
+static size_t valueUsage(const LettuceSet &set, size_t samples)
+{
+  if (set.isIntset())
+    return LettuceMemory::heapSize(set.intsetValues().data());
+  const auto &members = set.hashtableValues();
+  return bucketUsage(members) + sampledUsage(members, samples, [](const std::string &member)
+                                             { return LettuceMemory::allocationSize(sizeof(void *) + sizeof(member) + sizeof(size_t)) + sizeof(void *) + LettuceMemory::heapSize(member); });
+}
+
+// the shared_ptr control block and the value share one allocation (make_shared), a value shared by
+// COPY is counted in full for every key holding it
+template <typename T>
+static size_t valueUsage(const LettuceCow<T> &value, size_t samples)
+{
+  return LettuceMemory::allocationSize(sizeof(T) + 2 * sizeof(void *)) + valueUsage(*value, samples);
+}
+
+template <typename Store>
+static bool keyUsage(const Store &store, const std::string &key, size_t samples, size_t &bytes)
+{
+  auto it = store.find(key);
+  if (it == store.end())
     return false;
-  expiryMap[key] = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  bytes += nodeUsage<Store>(*it) + valueUsage(it->second, samples);
   return true;
 }
 
-bool LettuceDatabase::rename(const std::string &oldKey, const std::string &newKey)
+bool LettuceDatabase::memoryUsage(const std::string &key, size_t samples, size_t &bytes)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  bool found = false;
-  auto iteratorKv = keyValueStore.find(oldKey);
-  if (iteratorKv != keyValueStore.end())
+  bytes = 0;
+  if (!keyUsage(keyValueStore, key, samples, bytes) && !keyUsage(listStore, key, samples, bytes) &&
+      !keyUsage(hashStore, key, samples, bytes) && !keyUsage(setStore, key, samples, bytes))
+    return false;
+  auto expiry = expiryMap.find(key);
+  if (expiry != expiryMap.end())
+    bytes += nodeUsage<decltype(expiryMap)>(*expiry);
+  return true;
+}
+
+LettuceKeyIndexStats LettuceDatabase::keyIndexStats()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  if (!keyIndex)
+    return {false, 0, 0, 0};
+  return {true, keyIndex->size(), keyIndex->nodeCount(), keyIndex->memoryUsage()};
+}
+
+/* String compression */
+static const size_t compressionProbe = 4096;
+
+// lz compressed copy of value, false when it doesn't get under 3/4 of its size - a big value is
+// probed with its first few kb first, so an incompressible one only costs compressing the sample
+static bool compressString(const std::string &value, std::string &compressed)
+{
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(value.data());
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[lzBound(value.size())]);
+  if (value.size() > compressionProbe * 2)
+  {
+    size_t probe = lzCompress(in, compressionProbe, buffer.get(), lzBound(compressionProbe));
+    if (probe == 0 || probe * 4 > compressionProbe * 3)
+      return false;
+  }
+  size_t length = lzCompress(in, value.size(), buffer.get(), lzBound(value.size()));
+  if (length == 0 || length * 4 > value.size() * 3)
+    return false;
+  compressed.assign(reinterpret_cast<const char *>(buffer.get()), length);
+  return true;
+}
+
+void LettuceDatabase::setStringCompressionThreshold(size_t threshold)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  compressionThreshold = threshold;
+}
+
+size_t LettuceDatabase::getStringCompressionThreshold()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return compressionThreshold;
+}
+
+LettuceCompressionStats LettuceDatabase::compressionStats()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return {compressionThreshold, compressedStrings.size(), compressionSavedBytes, compressionSkipped};
+}
+
+// the callers below hold db_mutex
+void LettuceDatabase::storeString(const std::string &key, const std::string &value)
+{
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  forgetCompressed(key);
+  forgetTiered(key);
+  std::string compressed;
+  if (compressionThreshold == 0 || value.size() < compressionThreshold)
+  {
+    keyValueStore[key] = value;
+    return;
+  }
+  if (!compressString(value, compressed))
+  {
+    compressionSkipped++;
+    keyValueStore[key] = value;
+    return;
+  }
+  compressionSavedBytes += value.size() - compressed.size();
+  keyValueStore[key] = std::move(compressed);
+  compressedStrings[key] = value.size();
+}
+
+void LettuceDatabase::compressStoredString(const std::string &key, std::string &value)
+{
+  if (compressionThreshold == 0 || value.size() < compressionThreshold)
+    return;
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  std::string compressed;
+  if (!compressString(value, compressed))
+  {
+    compressionSkipped++;
+    return;
+  }
+  compressionSavedBytes += value.size() - compressed.size();
+  compressedStrings[key] = value.size();
+  value.swap(compressed);
+}
+
+void LettuceDatabase::forgetCompressed(const std::string &key)
+{
+  auto compressed = compressedStrings.find(key);
+  if (compressed == compressedStrings.end())
+    return;
+  auto it = keyValueStore.find(key);
+  if (it != keyValueStore.end())
+    compressionSavedBytes -= compressed->second - storedSize(*it);
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  compressedStrings.erase(compressed);
+}
+
+const std::string &LettuceDatabase::stringValue(const std::pair<const std::string, std::string> &entry, std::string &scratch) const
+{
+  const std::string *stored = &entry.second;
+  std::string fromDisk;
+  auto tiered = tieredStrings.empty() ? tieredStrings.end() : tieredStrings.find(entry.first);
+  if (tiered != tieredStrings.end())
+  {
+    // the segments are our own files, a failed read means the disk is failing - the command
+    // fails rather than handing out a value that isn't the one stored
+    if (!tierStore->read(tiered->second, fromDisk))
+      throw LettuceTierError();
+    stored = &fromDisk;
+  }
+  auto compressed = compressedStrings.find(entry.first);
+  if (compressed == compressedStrings.end() || stored->empty())
+  {
+    if (tiered == tieredStrings.end())
+      return entry.second;
+    scratch.swap(fromDisk);
+    return scratch;
+  }
+  // the store only ever holds what compressString produced, so this can't fail
+  scratch.resize(compressed->second);
+  lzDecompress(reinterpret_cast<const uint8_t *>(stored->data()), stored->size(),
+               reinterpret_cast<uint8_t *>(&scratch[0]), scratch.size());
+  return scratch;
+}
+
+std::string &LettuceDatabase::rawString(LettuceDict<std::string, std::string>::iterator it)
+{
+  auto tiered = tieredStrings.empty() ? tieredStrings.end() : tieredStrings.find(it->first);
+  if (tiered != tieredStrings.end())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    std::string stored;
+    if (!tierStore->read(tiered->second, stored))
+      throw LettuceTierError();
+    forgetTiered(it->first);
+    it->second.swap(stored);
+    tierReads++;
+  }
+  if (compressedStrings.empty() || compressedStrings.count(it->first) == 0)
+    return it->second;
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  std::string raw;
+  stringValue(*it, raw);
+  forgetCompressed(it->first);
+  it->second.swap(raw);
+  return it->second;
+}
+
+/* Tiered storage */
+void LettuceDatabase::setTierConfig(const LettuceTierConfig &config)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  tierConfig = config;
+  // turning it back on while the old values are still being read back carries on with their files
+  if (config.enabled && !tierStore)
+  {
+    LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+    tierStore = std::make_unique<LettuceTierStore>(config.prefix, config.segmentSize);
+    tierCursor = 0;
+    tierCompacting = 0;
+  }
+  else if (tierStore)
   {
-    const std::string &value = iteratorKv->second;
-    keyValueStore[newKey] = value;
-    keyValueStore.erase(oldKey);
-    found = true;
+    tierStore->setSegmentSize(config.segmentSize);
   }
-  auto iteratorList = listStore.find(oldKey);
-  if (iteratorList != listStore.end())
+  // turned off, tierCycle reads the values back a few at a time and the files go once it's done -
+  // reading them all here would hold the lock for as long as that takes
+  if (!config.enabled && tierStore && tieredStrings.empty())
   {
-    const std::vector<std::string> &value = iteratorList->second;
-    listStore[newKey] = value;
-    listStore.erase(oldKey);
-    found = true;
+    LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+    tierStore.reset();
   }
-  auto iteratorMap = hashStore.find(oldKey);
-  if (iteratorMap != hashStore.end())
+  tiering = tierStore != nullptr;
+  // spilling picks values by how long they've been idle, so it needs the access data too
+  updateAccessTracking();
+}
+
+LettuceTierConfig LettuceDatabase::getTierConfig()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return tierConfig;
+}
+
+LettuceTierStats LettuceDatabase::tierStats()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  LettuceTierFileStats files = tierStore ? tierStore->stats() : LettuceTierFileStats{0, 0, 0};
+  return {tierConfig.enabled, tieredStrings.size(), files.liveBytes, files.fileBytes, files.segments, tierSpills, tierReads, tierCompactedBytes};
+}
+
+// the callers below hold db_mutex
+size_t LettuceDatabase::storedSize(const std::pair<const std::string, std::string> &entry) const
+{
+  auto tiered = tieredStrings.empty() ? tieredStrings.end() : tieredStrings.find(entry.first);
+  return tiered != tieredStrings.end() ? tiered->second.length : entry.second.size();
+}
+
+void LettuceDatabase::forgetTiered(const std::string &key)
+{
+  if (tieredStrings.empty())
+    return;
+  auto tiered = tieredStrings.find(key);
+  if (tiered == tieredStrings.end())
+    return;
+  tierStore->release(tiered->second);
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  tieredStrings.erase(tiered);
+}
+
+void LettuceDatabase::promote(const std::vector<std::string> &keys)
+{
+  std::unique_lock<std::recursive_mutex> lock(db_mutex);
+  for (const auto &key : keys)
   {
-    const std::unordered_map<std::string, std::string> &value = iteratorMap->second;
-    hashStore[newKey] = value;
-    hashStore.erase(oldKey);
-    found = true;
+    // the value can be rewritten, moved by the compactor or deleted while the lock is released,
+    // so it's only installed if the key still points where it was read from
+    while (tierStore)
+    {
+      auto tiered = tieredStrings.find(key);
+      if (tiered == tieredStrings.end())
+        break;
+      LettuceTierLocation location = tiered->second;
+      std::shared_ptr<const LettuceTierStore::Segment> segment = tierStore->segment(location.segment);
+      if (!segment)
+        break;
+      LettuceMemory::Scope scope(LettuceMemory::Strings);
+      std::string stored;
+      // a thread already holding db_mutex (a transaction) still holds it after this, then
+      // the read is just done under the lock like any other
+      lock.unlock();
+      bool read = LettuceTierStore::read(*segment, location, stored);
+      lock.lock();
+      tiered = tierStore ? tieredStrings.find(key) : tieredStrings.end();
+      if (tiered == tieredStrings.end() || tiered->second != location || tierStore->segment(location.segment) != segment)
+        continue;
+      if (!read)
+        break;
+      auto it = keyValueStore.find(key);
+      it->second.swap(stored);
+      tierStore->release(location);
+      tieredStrings.erase(tiered);
+      tierReads++;
+      break;
+    }
+  }
+}
+
+void LettuceDatabase::compactSegment(uint32_t segment)
+{
+  std::vector<std::string> keys;
+  tierCompactCursor = scanBuckets(tieredStrings, tierCompactCursor, 16, [&](const auto &pair)
+                                  {
+    if (pair.second.segment == segment)
+      keys.push_back(pair.first); });
+  std::string bytes;
+  for (const auto &key : keys)
+  {
+    auto tiered = tieredStrings.find(key);
+    LettuceTierLocation location;
+    if (!tierStore->read(tiered->second, bytes) || !tierStore->append(bytes, location))
+      continue;
+    tierStore->release(tiered->second);
+    tiered->second = location;
+    tierCompactedBytes += bytes.size();
+  }
+}
+
+bool LettuceDatabase::drainTiered(std::chrono::steady_clock::time_point deadline)
+{
+  uint64_t limit = maxMemory.load(std::memory_order_relaxed);
+  std::string stored;
+  for (auto tiered = tieredStrings.begin(); tiered != tieredStrings.end();)
+  {
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+    // a value that won't fit under maxmemory stays on disk (still readable) until there's room for it
+    if (limit != 0 && LettuceMemory::used() + tiered->second.length > limit)
+      return true;
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    // one that can't be read stays where it is, the next pass tries it again
+    if (!tierStore->read(tiered->second, stored))
+    {
+      ++tiered;
+      continue;
+    }
+    keyValueStore.find(tiered->first)->second.swap(stored);
+    std::string().swap(stored);
+    tierStore->release(tiered->second);
+    tiered = tieredStrings.erase(tiered);
+    tierReads++;
+  }
+  if (!tieredStrings.empty())
+    return true;
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    LettuceDict<std::string, LettuceTierLocation>().swap(tieredStrings);
+  }
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  tierStore.reset();
+  tiering = false;
+  return true;
+}
+
+bool LettuceDatabase::tierStep(std::chrono::steady_clock::time_point deadline)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  if (!tierStore)
+    return true;
+  if (!tierConfig.enabled)
+    return drainTiered(deadline);
+  std::vector<std::string> keys;
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    // a pass over the strings is followed by moving the live values out of the segment with the most dead space
+    if (tierCompacting != 0)
+    {
+      compactSegment(tierCompacting);
+      if (tierCompactCursor == 0)
+      {
+        tierCompacting = 0;
+        return true;
+      }
+      continue;
+    }
+
+    keys.clear();
+    tierCursor = scanBuckets(keyValueStore, tierCursor, 16, [&keys](const auto &pair)
+                             { keys.push_back(pair.first); });
+    for (const auto &key : keys)
+    {
+      auto it = keyValueStore.find(key);
+      auto meta = keyMeta.find(key);
+      if (it->second.size() < tierConfig.minSize || it->second.empty() || meta == keyMeta.end() || tieredStrings.count(key))
+        continue;
+      uint32_t idle = keyMetaLfu ? LettuceKeyMeta::lfuIdleSeconds(meta->second) : LettuceKeyMeta::lruIdleSeconds(meta->second);
+      if (idle < tierConfig.idleSeconds)
+        continue;
+      LettuceTierLocation location;
+      // a full disk leaves the rest in memory, the next pass tries again
+      if (!tierStore->append(it->second, location))
+        return true;
+      LettuceMemory::Scope scope(LettuceMemory::Strings);
+      tieredStrings.emplace(key, location);
+      std::string().swap(it->second);
+      tierSpills++;
+    }
+    if (tierCursor == 0)
+    {
+      tierCompacting = tierStore->compactionCandidate();
+      tierCompactCursor = 0;
+      if (tierCompacting == 0)
+        return true;
+    }
+  }
+  return false;
+}
+
+void LettuceDatabase::tierCycle(std::chrono::milliseconds interval)
+{
+  if (!tieringEnabled() || isLoading())
+    return;
+  // at most a tenth of the interval, in short slices so clients waiting on the lock get in between them
+  auto now = std::chrono::steady_clock::now();
+  auto end = now + interval / 10;
+  bool done = false;
+  while (!done && now < end)
+  {
+    done = tierStep(std::min(now + std::chrono::milliseconds(1), end));
+    now = std::chrono::steady_clock::now();
+  }
+}
+
+/* Key Value operations*/
+void LettuceDatabase::set(const std::string &key, const std::string &value)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  storeString(key, value);
+  indexKey(key);
+  signalModifiedKey(key);
+}
+
+bool LettuceDatabase::get(const std::string &key, std::string &value)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto iterator = keyValueStore.find(key);
+  if (iterator != keyValueStore.end())
+  {
+    // a compressed value is decoded straight into value, assigning it to itself is a no-op
+    value = stringValue(*iterator, value);
+    return true;
+  }
+  return false;
+}
+
+std::string LettuceDatabase::type(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  if (keyValueStore.find(key) != keyValueStore.end())
+  {
+    return "string";
+  }
+  if (listStore.find(key) != listStore.end())
+  {
+    return "list";
+  }
+  if (hashStore.find(key) != hashStore.end())
+  {
+    return "hash";
+  }
+  if (setStore.find(key) != setStore.end())
+  {
+    return "set";
+  }
+  return "none";
+}
+
+std::vector<std::string> LettuceDatabase::keys()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  std::vector<std::string> keys{};
+  for (const auto &pair : keyValueStore)
+  {
+    const std::string &key = pair.first;
+    keys.push_back(key);
+  }
+
+  for (const auto &pair : listStore)
+  {
+    const std::string &key = pair.first;
+    keys.push_back(key);
+  }
+
+  for (const auto &pair : hashStore)
+  {
+    const std::string &key = pair.first;
+    keys.push_back(key);
+  }
+
+  for (const auto &pair : setStore)
+  {
+    const std::string &key = pair.first;
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+std::vector<std::string> LettuceDatabase::keys(const std::string &pattern)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  std::vector<std::string> keys{};
+  std::string prefix = globLiteralPrefix(pattern);
+  if (keyIndex && !prefix.empty())
+  {
+    // only the subtree under the literal prefix can match
+    keyIndex->forEachWithPrefix(prefix, [&](const std::string &key)
+                                {
+      if (globMatch(pattern, key))
+        keys.push_back(key);
+      return true; });
+    return keys;
+  }
+
+  auto collect = [&](const std::string &key)
+  {
+    if (globMatch(pattern, key))
+      keys.push_back(key);
+  };
+  for (const auto &pair : keyValueStore)
+    collect(pair.first);
+  for (const auto &pair : listStore)
+    collect(pair.first);
+  for (const auto &pair : hashStore)
+    collect(pair.first);
+  for (const auto &pair : setStore)
+    collect(pair.first);
+  return keys;
+}
+
+// the top bits of a SCAN cursor pick the store, the rest is the bucket cursor inside it. scans over
+// the key index use a store value of their own, with the id of their saved position below it
+static const int scanStoreShift = 60;
+static const uint64_t scanBucketMask = (1ULL << scanStoreShift) - 1;
+static const char *scanStoreTypes[] = {"string", "list", "hash", "set"};
+static const uint64_t scanStoreCount = 4;
+static const uint64_t scanIndexStore = 15;
+
+uint64_t LettuceDatabase::saveIndexScanCursor(std::string last)
+{
+  uint64_t id = ++indexScanCursorId & scanBucketMask;
+  if (id == 0)
+    id = ++indexScanCursorId & scanBucketMask;
+  indexScanCursors[id] = std::move(last);
+  indexScanOrder.push_back(id);
+  if (indexScanOrder.size() > indexScanCursorLimit)
+  {
+    indexScanCursors.erase(indexScanOrder.front());
+    indexScanOrder.pop_front();
+  }
+  return id;
+}
+
+uint64_t LettuceDatabase::scan(uint64_t cursor, size_t count, const std::string &pattern, const std::string &type, std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  uint64_t store = cursor >> scanStoreShift;
+  uint64_t bucketCursor = cursor & scanBucketMask;
+  size_t wanted = keys.size() + std::max<size_t>(count, 1);
+
+  // with the key index, a pattern with a literal prefix only walks the keys under it - COUNT of them
+  // per call, each call picking up after the last key the previous one walked
+  std::string prefix = globLiteralPrefix(pattern);
+  if (keyIndex && !prefix.empty() && (cursor == 0 || store == scanIndexStore))
+  {
+    std::string after;
+    bool resume = false;
+    auto saved = store == scanIndexStore ? indexScanCursors.find(bucketCursor) : indexScanCursors.end();
+    if (saved != indexScanCursors.end())
+    {
+      after = std::move(saved->second);
+      indexScanCursors.erase(saved);
+      resume = true;
+    }
+
+    size_t budget = std::max<size_t>(count, 1);
+    std::string last;
+    bool more = false;
+    keyIndex->forEachWithPrefix(prefix, resume ? &after : nullptr, [&](const std::string &key)
+                                {
+      if (budget == 0)
+      {
+        more = true;
+        return false;
+      }
+      budget--;
+      last = key;
+      if (!globMatch(pattern, key))
+        return true;
+      bool typeMatches = type.empty() ||
+                         (type == "string" && keyValueStore.count(key)) ||
+                         (type == "list" && listStore.count(key)) ||
+                         (type == "hash" && hashStore.count(key)) ||
+                         (type == "set" && setStore.count(key));
+      if (typeMatches)
+        keys.push_back(key);
+      return true; });
+    return more ? (scanIndexStore << scanStoreShift) | saveIndexScanCursor(std::move(last)) : 0;
+  }
+  if (store == scanIndexStore)
+  {
+    // the index was turned off or the pattern changed mid scan, start over on the buckets
+    store = 0;
+    bucketCursor = 0;
+  }
+
+  auto collect = [&](const std::string &key)
+  {
+    if (pattern.empty() || globMatch(pattern, key))
+      keys.push_back(key);
+  };
+
+  while (store < scanStoreCount && keys.size() < wanted)
+  {
+    // a TYPE filter skips whole stores instead of checking every key
+    if (!type.empty() && type != scanStoreTypes[store])
+    {
+      store++;
+      bucketCursor = 0;
+      continue;
+    }
+
+    size_t budget = wanted - keys.size();
+    switch (store)
+    {
+    case 0:
+      bucketCursor = scanBuckets(keyValueStore, bucketCursor, budget, [&](const auto &pair)
+                                 { collect(pair.first); });
+      break;
+    case 1:
+      bucketCursor = scanBuckets(listStore, bucketCursor, budget, [&](const auto &pair)
+                                 { collect(pair.first); });
+      break;
+    case 2:
+      bucketCursor = scanBuckets(hashStore, bucketCursor, budget, [&](const auto &pair)
+                                 { collect(pair.first); });
+      break;
+    case 3:
+      bucketCursor = scanBuckets(setStore, bucketCursor, budget, [&](const auto &pair)
+                                 { collect(pair.first); });
+      break;
+    }
+
+    if (bucketCursor != 0)
+      return (store << scanStoreShift) | bucketCursor;
+    store++;
+  }
+  return store < scanStoreCount ? store << scanStoreShift : 0;
+}
+
+/* Active defrag */
+void LettuceDatabase::setDefragConfig(const LettuceDefragConfig &config)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  defragConfig = config;
+}
+
+LettuceDefragConfig LettuceDatabase::getDefragConfig()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return defragConfig;
+}
+
+LettuceDefragStats LettuceDatabase::defragStats()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return {defragRunning, defragEffort, defragHits, defragMisses, defragKeyHits, defragKeyMisses, defragPasses};
+}
+
+uint64_t LettuceDatabase::defragValue(const std::string &key, uint64_t position, bool &moved)
+{
+  auto count = [&](bool relocated)
+  {
+    relocated ? defragHits++ : defragMisses++;
+    moved |= relocated;
+  };
+  auto string = keyValueStore.find(key);
+  if (string != keyValueStore.end())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    count(LettuceDefrag::relocate(string->second));
+    return 0;
+  }
+  // mutate() would clone a value shared by COPY, the opposite of what this is for
+  auto list = listStore.find(key);
+  if (list != listStore.end())
+  {
+    if (list->second.shared())
+      return 0;
+    LettuceMemory::Scope scope(LettuceMemory::Lists);
+    std::vector<std::string> &items = list->second.mutate();
+    if (position == 0)
+      count(LettuceDefrag::relocate(items));
+    size_t end = std::min<size_t>(items.size(), position + defragChunk);
+    for (size_t i = position; i < end; i++)
+      count(LettuceDefrag::relocate(items[i]));
+    return end < items.size() ? end : 0;
+  }
+  auto hash = hashStore.find(key);
+  if (hash != hashStore.end())
+  {
+    if (hash->second.shared())
+      return 0;
+    LettuceMemory::Scope scope(LettuceMemory::Hashes);
+    // field names are node keys and can't move without reallocating the node, the values can - the
+    // cast is fine since the map itself isn't const, scanBuckets just only hands out const elements
+    return scanBuckets(hash->second.mutate(), position, defragChunk, [&](const LettuceHash::value_type &field)
+                       { count(LettuceDefrag::relocate(const_cast<std::string &>(field.second))); });
+  }
+  auto set = setStore.find(key);
+  if (set != setStore.end() && !set->second.shared() && set->second->isIntset())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Sets);
+    count(set->second.mutate().defrag());
+  }
+  return 0;
+}
+
+bool LettuceDatabase::defragStep(std::chrono::steady_clock::time_point deadline)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  std::vector<std::string> keys;
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    // big values left over from earlier steps go first
+    if (!defragLater.empty())
+    {
+      DefragPending &pending = defragLater.front();
+      pending.position = defragValue(pending.key, pending.position, pending.moved);
+      if (pending.position == 0)
+      {
+        pending.moved ? defragKeyHits++ : defragKeyMisses++;
+        defragLater.pop_front();
+      }
+      continue;
+    }
+
+    uint64_t store = defragCursor >> scanStoreShift;
+    uint64_t bucketCursor = defragCursor & scanBucketMask;
+    if (store >= scanStoreCount)
+    {
+      defragCursor = 0;
+      return true;
+    }
+    keys.clear();
+    auto collect = [&keys](const auto &pair)
+    { keys.push_back(pair.first); };
+    switch (store)
+    {
+    case 0:
+      bucketCursor = scanBuckets(keyValueStore, bucketCursor, 16, collect);
+      break;
+    case 1:
+      bucketCursor = scanBuckets(listStore, bucketCursor, 16, collect);
+      break;
+    case 2:
+      bucketCursor = scanBuckets(hashStore, bucketCursor, 16, collect);
+      break;
+    case 3:
+      bucketCursor = scanBuckets(setStore, bucketCursor, 16, collect);
+      break;
+    }
+    defragCursor = bucketCursor != 0 ? (store << scanStoreShift) | bucketCursor : (store + 1) << scanStoreShift;
+
+    for (const auto &key : keys)
+    {
+      bool moved = false;
+      uint64_t next = defragValue(key, 0, moved);
+      if (next != 0)
+        defragLater.push_back({key, next, moved});
+      else
+        moved ? defragKeyHits++ : defragKeyMisses++;
+    }
+  }
+  return false;
+}
+
+void LettuceDatabase::activeDefragCycle(std::chrono::milliseconds interval)
+{
+  LettuceDefragConfig config;
+  bool running;
+  {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    config = defragConfig;
+    running = defragRunning;
+    if (!config.enabled && running)
+    {
+      // turned off half way, the next pass starts from scratch
+      defragRunning = false;
+      defragEffort = 0;
+      defragCursor = 0;
+      defragLater.clear();
+    }
+  }
+  if (!config.enabled || isLoading())
+    return;
+
+  size_t used = LettuceMemory::used();
+  size_t rss = LettuceMemory::rss();
+  size_t wasted = rss > used ? rss - used : 0;
+  int fragmentation = used ? static_cast<int>(std::min<size_t>(wasted * 100 / used, 1000)) : 0;
+  // a pass that has started runs to the end, otherwise fragmentation decides whether to start one
+  if (!running && (fragmentation < config.thresholdLower || wasted < config.ignoreBytes))
+    return;
+  int effort = config.cycleMax;
+  if (fragmentation < config.thresholdUpper && config.thresholdUpper > config.thresholdLower)
+  {
+    int over = std::max(fragmentation - config.thresholdLower, 0);
+    effort = config.cycleMin + over * (config.cycleMax - config.cycleMin) / (config.thresholdUpper - config.thresholdLower);
+  }
+  {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    defragRunning = true;
+    defragEffort = effort;
+  }
+
+  // short slices, so clients waiting on the lock get in between them
+  auto now = std::chrono::steady_clock::now();
+  auto end = now + std::chrono::duration_cast<std::chrono::microseconds>(interval) * effort / 100;
+  bool done = false;
+  while (!done && now < end)
+  {
+    done = defragStep(std::min(now + std::chrono::milliseconds(1), end));
+    now = std::chrono::steady_clock::now();
+  }
+  if (!done)
+    return;
+  // the pages the moves emptied go back to the os
+  LettuceDefrag::releaseFreePages();
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  defragRunning = false;
+  defragEffort = 0;
+  defragPasses++;
+}
+
+bool LettuceDatabase::del(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  return detachKey(key, false);
+}
+
+bool LettuceDatabase::unlink(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  return detachKey(key, true);
+}
+
+bool LettuceDatabase::expire(const std::string &key, int seconds)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Expires);
+  if (!keyExists(key))
+    return false;
+  expiryMap[key] = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  signalModifiedKey(key);
+  return true;
+}
+
+// moves the value over to the new key, it's never copied
+template <typename Store>
+static bool moveValue(Store &store, const std::string &oldKey, const std::string &newKey)
+{
+  // the old node is freed on the way out, so under the store's category as well
+  LettuceMemory::Scope scope(memoryCategory(store));
+  auto node = store.extract(oldKey);
+  if (node.empty())
+    return false;
+  store.emplace(newKey, std::move(node.mapped()));
+  return true;
+}
+
+// for the copy on write stores this only shares the value
+template <typename Store>
+static bool copyValue(Store &store, const std::string &sourceKey, const std::string &destKey)
+{
+  auto it = store.find(sourceKey);
+  if (it == store.end())
+    return false;
+  LettuceMemory::Scope scope(memoryCategory(store));
+  store.emplace(destKey, it->second);
+  return true;
+}
+
+bool LettuceDatabase::rename(const std::string &oldKey, const std::string &newKey)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  if (!keyExists(oldKey))
+    return false;
+  if (oldKey == newKey)
+    return true;
+  // whatever newKey held is overwritten, large values are freed in the background
+  detachKey(newKey, false);
+  clearKey(expiryMap, newKey);
+  moveValue(keyValueStore, oldKey, newKey);
+  auto compressed = compressedStrings.find(oldKey);
+  if (compressed != compressedStrings.end())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    compressedStrings.emplace(newKey, compressed->second);
+    compressedStrings.erase(compressed);
+  }
+  auto tiered = tieredStrings.find(oldKey);
+  if (tiered != tieredStrings.end())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    tieredStrings.emplace(newKey, tiered->second);
+    tieredStrings.erase(tiered);
+  }
+  moveValue(listStore, oldKey, newKey);
+  moveValue(hashStore, oldKey, newKey);
+  moveValue(setStore, oldKey, newKey);
+  moveValue(expiryMap, oldKey, newKey);
+  indexKey(newKey);
+  unindexKey(oldKey);
+  signalModifiedKey(oldKey);
+  signalModifiedKey(newKey);
+  return true;
+}
+
+bool LettuceDatabase::copy(const std::string &sourceKey, const std::string &destKey, bool replace)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  if (sourceKey == destKey || !keyExists(sourceKey))
+    return false;
+  if (keyExists(destKey))
+  {
+    if (!replace)
+      return false;
+    detachKey(destKey, false);
+  }
+  clearKey(expiryMap, destKey);
+  copyValue(keyValueStore, sourceKey, destKey);
+  auto tiered = tieredStrings.find(sourceKey);
+  if (tiered != tieredStrings.end())
+  {
+    // both keys point at the same bytes on disk, each holds a reference to them
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    tierStore->retain(tiered->second);
+    tieredStrings.emplace(destKey, tiered->second);
+  }
+  auto compressed = compressedStrings.find(sourceKey);
+  if (compressed != compressedStrings.end())
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    compressedStrings.emplace(destKey, compressed->second);
+    compressionSavedBytes += compressed->second - storedSize(*keyValueStore.find(destKey));
+  }
+  copyValue(listStore, sourceKey, destKey);
+  copyValue(hashStore, sourceKey, destKey);
+  copyValue(setStore, sourceKey, destKey);
+  copyValue(expiryMap, sourceKey, destKey);
+  indexKey(destKey);
+  signalModifiedKey(destKey);
+  return true;
+}
+
+std::vector<std::optional<std::string>> LettuceDatabase::mget(const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  std::vector<std::optional<std::string>> values;
+  values.reserve(keys.size());
+  for (const auto &key : keys)
+  {
+    auto iterator = keyValueStore.find(key);
+    std::string scratch;
+    if (iterator != keyValueStore.end())
+      values.emplace_back(stringValue(*iterator, scratch));
+    else
+      values.emplace_back(std::nullopt);
+  }
+  return values;
+}
+
+void LettuceDatabase::mset(const std::vector<std::pair<std::string, std::string>> &pairs)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  for (const auto &[key, value] : pairs)
+  {
+    storeString(key, value);
+    indexKey(key);
+    signalModifiedKey(key);
+  }
+}
+
+bool LettuceDatabase::msetnx(const std::vector<std::pair<std::string, std::string>> &pairs)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  for (const auto &pair : pairs)
+  {
+    if (keyExists(pair.first))
+      return false;
+  }
+  for (const auto &[key, value] : pairs)
+  {
+    storeString(key, value);
+    indexKey(key);
+    signalModifiedKey(key);
+  }
+  return true;
+}
+
+bool LettuceDatabase::dump(const std::string &filename)
+{
+  // use mutex for thread safety
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  // a half loaded keyspace would replace the complete snapshot on disk
+  if (isLoading())
+    return false;
+  if (!saveSnapshot(filename, LettuceAof::getInstance().position()))
+    return false;
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  // writers are blocked on db_mutex, so the file holds every change counted so far - that
+  // includes the ones a running BGSAVE was going to take off when it finishes
+  dirty = 0;
+  bgsaveDirtyAtFork = 0;
+  lastSaveTime = time(nullptr);
+  return true;
+}
+
+// a forked child inherits every socket, including the listening one - closing them keeps the
+// port free and lets clients see their connection close while a save is still running. keep has
+// the tiered storage segments, the child reads the values on disk from them
+static void closeInheritedFds(std::vector<int> keep)
+{
+  std::sort(keep.begin(), keep.end());
+  unsigned int first = 3;
+  bool closed = true;
+  for (int fd : keep)
+  {
+    if (fd < static_cast<int>(first))
+      continue;
+    if (fd > static_cast<int>(first))
+      closed = closed && close_range(first, fd - 1, 0) == 0;
+    first = fd + 1;
+  }
+  if (closed && close_range(first, ~0U, 0) == 0)
+    return;
+  long maxFd = sysconf(_SC_OPEN_MAX);
+  for (long fd = 3; fd < maxFd && fd < 65536; fd++)
+  {
+    if (!std::binary_search(keep.begin(), keep.end(), fd))
+      close(fd);
+  }
+}
+
+bool LettuceDatabase::bgsave(const std::string &filename)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  if (bgsaveChild != -1 || isLoading())
+    return false;
+  lastBgsaveTry = time(nullptr);
+  if (saveProgress == nullptr)
+  {
+    void *shared = mmap(nullptr, sizeof(LettuceSnapshotProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+      return false;
+    saveProgress = new (shared) LettuceSnapshotProgress();
+  }
+  saveProgress->keys = 0;
+  saveProgress->bytes = 0;
+  saveProgress->keyDelayMicros = keySaveDelay;
+  LettuceAofPosition aofPosition = LettuceAof::getInstance().position();
+  std::vector<int> tierFds = tierStore ? tierStore->fds() : std::vector<int>();
+
+  // fork while holding db_mutex, so the child's copy never has a store half way through a write
+  pid_t child = fork();
+  if (child == -1)
+    return false;
+  if (child == 0)
+  {
+    // only this thread exists in the child - _exit skips the destructors and atexit handlers
+    // that belong to the parent
+    closeInheritedFds(tierFds);
+    _exit(saveSnapshot(filename, aofPosition, saveProgress) ? 0 : 1);
+  }
+
+  bgsaveChild = child;
+  bgsaveStarted = std::chrono::steady_clock::now();
+  bgsaveKeysTotal = keyValueStore.size() + listStore.size() + hashStore.size() + setStore.size();
+  // changes made while the child runs aren't in its file, they still count after it finishes
+  bgsaveDirtyAtFork = dirty;
+  std::thread([this, child]()
+              {
+                int status = 0;
+                while (waitpid(child, &status, 0) == -1 && errno == EINTR)
+                  ;
+                std::lock_guard<std::mutex> saveLock(save_mutex);
+                lastBgsaveOk = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                if (lastBgsaveOk)
+                {
+                  lastSaveTime = time(nullptr);
+                  // writers bump dirty without save_mutex, so the read and the subtraction are one step
+                  uint64_t current = dirty.load();
+                  while (!dirty.compare_exchange_weak(current, current - std::min(bgsaveDirtyAtFork, current)))
+                    ;
+                }
+                lastBgsaveSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - bgsaveStarted).count();
+                bgsaveChild = -1;
+                bgsaveDone.notify_all(); })
+      .detach();
+  return true;
+}
+
+bool LettuceDatabase::bgrewriteaof()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceAof &aof = LettuceAof::getInstance();
+  // from here on every write also lands in the rewrite diff - nothing can be appended between
+  // this and the fork, writes need db_mutex
+  uint64_t generation;
+  std::string logPath;
+  if (!aof.beginRewrite(generation, logPath))
+    return false;
+  std::vector<int> tierFds = tierStore ? tierStore->fds() : std::vector<int>();
+  pid_t child = fork();
+  if (child == -1)
+  {
+    aof.abortRewrite();
+    return false;
+  }
+  if (child == 0)
+  {
+    closeInheritedFds(tierFds);
+    _exit(writeAofRewrite(LettuceAof::rewriteFilename(logPath, getpid()), generation) ? 0 : 1);
+  }
+
+  aof.rewriteStarted(child);
+  std::thread([child]()
+              {
+                int status = 0;
+                while (waitpid(child, &status, 0) == -1 && errno == EINTR)
+                  ;
+                LettuceAof::getInstance().finishRewrite(child, WIFEXITED(status) && WEXITSTATUS(status) == 0); })
+      .detach();
+  return true;
+}
+
+void LettuceDatabase::setSaveRules(std::vector<LettuceSaveRule> rules)
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  saveRules = std::move(rules);
+}
+
+std::vector<LettuceSaveRule> LettuceDatabase::getSaveRules()
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  return saveRules;
+}
+
+bool LettuceDatabase::saveIfDue(const std::string &filename)
+{
+  time_t now = time(nullptr);
+  uint64_t changes = dirty;
+  {
+    std::lock_guard<std::mutex> saveLock(save_mutex);
+    if (bgsaveChild != -1 || changes == 0)
+      return false;
+    // a failed BGSAVE (full disk, fork refused) is only retried every few seconds
+    if (!lastBgsaveOk && now - lastBgsaveTry < saveRetrySeconds)
+      return false;
+    bool due = std::any_of(saveRules.begin(), saveRules.end(), [&](const LettuceSaveRule &rule)
+                           { return changes >= rule.changes && now - lastSaveTime >= rule.seconds; });
+    if (!due)
+      return false;
+  }
+  return bgsave(filename);
+}
+
+void LettuceDatabase::setSnapshotCompression(bool enabled)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  snapshotCompression = enabled;
+}
+
+bool LettuceDatabase::getSnapshotCompression()
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  return snapshotCompression;
+}
+
+void LettuceDatabase::setKeySaveDelay(uint64_t micros)
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  keySaveDelay = micros;
+  // a running child sees the change through the shared progress
+  if (saveProgress != nullptr)
+    saveProgress->keyDelayMicros = micros;
+}
+
+uint64_t LettuceDatabase::getKeySaveDelay()
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  return keySaveDelay;
+}
+
+void LettuceDatabase::setLoading(bool loading)
+{
+  std::lock_guard<std::mutex> loadLock(load_mutex);
+  if (loading)
+  {
+    loadStartTime = time(nullptr);
+    loadStarted = std::chrono::steady_clock::now();
+    loadBytesTotal = loadBytesLoaded = loadKeysTotal = loadKeysLoaded = 0;
+  }
+  loadingFlag = loading;
+}
+
+LettuceLoadStats LettuceDatabase::loadStats()
+{
+  std::lock_guard<std::mutex> loadLock(load_mutex);
+  LettuceLoadStats stats;
+  stats.loading = isLoading();
+  stats.startTime = loadStartTime;
+  stats.bytesTotal = loadBytesTotal;
+  stats.bytesLoaded = loadBytesLoaded;
+  stats.keysTotal = loadKeysTotal;
+  stats.keysLoaded = loadKeysLoaded;
+  stats.etaSeconds = -1;
+  // assumes the rest of the file decodes as fast as what is done so far
+  if (stats.loading && loadBytesLoaded > 0 && loadBytesLoaded <= loadBytesTotal)
+  {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStarted).count();
+    stats.etaSeconds = static_cast<int64_t>(elapsed * (loadBytesTotal - loadBytesLoaded) / loadBytesLoaded);
+  }
+  return stats;
+}
+
+bool LettuceDatabase::waitForBgsave()
+{
+  std::unique_lock<std::mutex> saveLock(save_mutex);
+  bgsaveDone.wait(saveLock, [this]()
+                  { return bgsaveChild == -1; });
+  return lastBgsaveOk;
+}
+
+time_t LettuceDatabase::lastSave()
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  return lastSaveTime;
+}
+
+LettuceSaveStats LettuceDatabase::saveStats()
+{
+  std::lock_guard<std::mutex> saveLock(save_mutex);
+  LettuceSaveStats stats;
+  stats.inProgress = bgsaveChild != -1;
+  stats.lastSave = lastSaveTime;
+  stats.lastBgsaveOk = lastBgsaveOk;
+  stats.changesSinceSave = dirty;
+  stats.lastBgsaveSeconds = lastBgsaveSeconds;
+  stats.currentBgsaveSeconds = stats.inProgress ? std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - bgsaveStarted).count() : -1;
+  stats.keysSaved = saveProgress ? saveProgress->keys.load() : 0;
+  stats.keysTotal = bgsaveKeysTotal;
+  stats.bytesWritten = saveProgress ? saveProgress->bytes.load() : 0;
+  return stats;
+}
+
+// expiries are kept on the steady clock, but a snapshot can be loaded after a reboot so they go
+// to disk as absolute unix milliseconds
+static uint64_t toUnixMillis(std::chrono::steady_clock::time_point when)
+{
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(when - std::chrono::steady_clock::now());
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+  int64_t millis = (now + remaining).count();
+  return millis < 0 ? 0 : static_cast<uint64_t>(millis);
+}
+
+static std::chrono::steady_clock::time_point fromUnixMillis(uint64_t millis)
+{
+  auto steadyNow = std::chrono::steady_clock::now();
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  // the steady clock counts nanoseconds, so it runs out a couple of centuries from now - anything
+  // later than that is kept as the furthest time it can hold, which never comes
+  int64_t latest = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point::max() - steadyNow).count();
+  if (millis >= static_cast<uint64_t>(now) + static_cast<uint64_t>(latest))
+    return steadyNow + std::chrono::milliseconds(latest);
+  return steadyNow + std::chrono::milliseconds(static_cast<int64_t>(millis) - now);
+}
+
+bool LettuceDatabase::expireAt(const std::string &key, uint64_t unixMillis)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Expires);
+  if (!keyExists(key))
+    return false;
+  expiryMap[key] = fromUnixMillis(unixMillis);
+  signalModifiedKey(key);
+  // a time in the past deletes the key straight away
+  purgeExpired();
+  return true;
+}
+
+// the rewritten log starts with FLUSHALL, so replaying it on top of any snapshot gives the same keyspace,
+// and packs up to rewriteItemsPerCommand elements into each command
+static const size_t rewriteItemsPerCommand = 64;
+
+bool LettuceDatabase::writeAofRewrite(const std::string &filename, uint64_t generation)
+{
+  LettuceAofWriter writer;
+  if (!writer.open(filename, generation))
+    return false;
+  writer.append({"FLUSHALL"});
+
+  std::vector<std::string> command;
+  auto batched = [&](const char *name, const std::string &key, auto begin, auto end, auto add)
+  {
+    while (begin != end)
+    {
+      command.assign({name, key});
+      for (size_t items = 0; begin != end && items < rewriteItemsPerCommand; ++begin, items++)
+        add(*begin);
+      writer.append(command);
+    }
+  };
+
+  std::string scratch;
+  try
+  {
+    for (const auto &entry : keyValueStore)
+      writer.append({"SET", entry.first, stringValue(entry, scratch)});
+  }
+  catch (const LettuceTierError &)
+  {
+    // a log missing a value is no replacement for the current one
+    return false;
+  }
+  for (const auto &[key, list] : listStore)
+    batched("RPUSH", key, list->begin(), list->end(), [&](const std::string &item)
+            { command.push_back(item); });
+  for (const auto &[key, hash] : hashStore)
+    batched("HMSET", key, hash->begin(), hash->end(), [&](const LettuceHash::value_type &field)
+            { command.push_back(field.first);
+              command.push_back(field.second); });
+  for (const auto &[key, set] : setStore)
+  {
+    if (set->isIntset())
+      batched("SADD", key, set->intsetValues().begin(), set->intsetValues().end(), [&](int64_t value)
+              { command.push_back(std::to_string(value)); });
+    else
+      batched("SADD", key, set->hashtableValues().begin(), set->hashtableValues().end(), [&](const std::string &member)
+              { command.push_back(member); });
+  }
+  for (const auto &[key, when] : expiryMap)
+  {
+    if (keyExists(key))
+      writer.append({"PEXPIREAT", key, std::to_string(toUnixMillis(when))});
+  }
+  return writer.finish();
+}
+
+bool LettuceDatabase::saveSnapshot(const std::string &filename, const LettuceAofPosition &aofPosition, LettuceSnapshotProgress *progress)
+{
+  using namespace LettuceSnapshot;
+  LettuceSnapshotWriter writer;
+  if (!writer.open(filename))
+    return false;
+  writer.setCompression(snapshotCompression);
+
+  if (aofPosition.generation != 0)
+  {
+    writer.writeByte(opAux);
+    writer.writeString("aof-generation");
+    writer.writeString(std::to_string(aofPosition.generation));
+    writer.writeByte(opAux);
+    writer.writeString("aof-offset");
+    writer.writeString(std::to_string(aofPosition.offset));
+  }
+  writer.writeByte(opSizes);
+  writer.writeLength(keyValueStore.size());
+  writer.writeLength(listStore.size());
+  writer.writeLength(hashStore.size());
+  writer.writeLength(setStore.size());
+  writer.writeLength(expiryMap.size());
+  writer.beginSegments();
+
+  uint64_t saved = 0;
+  auto writeHeader = [&](uint8_t type, const std::string &key)
+  {
+    // snapshot-key-delay, waited out in short slices so the parent can cut it short
+    if (progress && progress->keyDelayMicros.load(std::memory_order_relaxed) != 0)
+    {
+      auto start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < std::chrono::microseconds(progress->keyDelayMicros.load(std::memory_order_relaxed)))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // publishing progress every key would bounce the shared cache line for nothing
+    if (progress && (++saved & 1023) == 0)
+    {
+      progress->keys = saved;
+      progress->bytes = writer.bytesWritten();
+    }
+    auto expiry = expiryMap.find(key);
+    if (expiry != expiryMap.end())
+    {
+      writer.writeByte(opExpiry);
+      writer.writeUint64(toUnixMillis(expiry->second));
+    }
+    writer.writeByte(type);
+    writer.writeString(key);
+  };
+
+  // compressed values are saved decoded, the segments have their own compression
+  std::string scratch;
+  try
+  {
+    for (const auto &entry : keyValueStore)
+    {
+      writeHeader(typeString, entry.first);
+      writer.writeString(stringValue(entry, scratch));
+      writer.endRecord();
+    }
+  }
+  catch (const LettuceTierError &)
+  {
+    // never finished, so the writer leaves the last good snapshot in place
+    return false;
   }
-  auto iteratorExpiry = expiryMap.find(oldKey);
-  if (iteratorExpiry != expiryMap.end())
+
+  for (const auto &[key, list] : listStore)
   {
-    const std::chrono::steady_clock::time_point &value = iteratorExpiry->second;
-    expiryMap[newKey] = value;
-    expiryMap.erase(oldKey);
+    writeHeader(typeList, key);
+    writer.writeLength(list->size());
+    for (const auto &item : *list)
+      writer.writeString(item);
+    writer.endRecord();
   }
-  return found;
-}
-
-bool LettuceDatabase::dump(const std::string &filename)
-{
-  // use mutex for thread safety
-  std::lock_guard<std::mutex> lock(db_mutex);
-  purgeExpired();
-  std::ofstream ofs(filename, std::ios::binary);
-  if (!ofs)
-    return false;
 
-  for (const auto &keyValue : keyValueStore)
+  for (const auto &[key, hash] : hashStore)
   {
-    ofs << "K " << keyValue.first << " " << keyValue.second << "\n";
+    writeHeader(typeHash, key);
+    writer.writeLength(hash->size());
+    for (const auto &[field, value] : *hash)
+    {
+      writer.writeString(field.str());
+      writer.writeString(value);
+    }
+    writer.endRecord();
   }
 
-  for (const auto &keyList : listStore)
+  for (const auto &[key, set] : setStore)
   {
-    ofs << "L " << keyList.first;
-    for (const auto &item : keyList.second)
-      ofs << " " << item;
-    ofs << "\n";
+    if (set->isIntset())
+    {
+      writeHeader(typeIntset, key);
+      writer.writeLength(set->size());
+      for (int64_t value : set->intsetValues())
+        writer.writeUint64(static_cast<uint64_t>(value));
+    }
+    else
+    {
+      writeHeader(typeHashset, key);
+      writer.writeLength(set->size());
+      for (const auto &member : set->hashtableValues())
+        writer.writeString(member);
+    }
+    writer.endRecord();
   }
 
-  for (const auto &keyMap : hashStore)
+  bool ok = writer.finish();
+  if (progress)
   {
-    ofs << "H " << keyMap.first;
-    for (const auto &mapKeyValue : keyMap.second)
-      ofs << " " << mapKeyValue.first << ":" << mapKeyValue.second;
-    ofs << "\n";
+    progress->keys = saved;
+    progress->bytes = writer.bytesWritten();
   }
-
-  return true;
+  return ok;
 }
 
 /* List operations*/
 std::vector<std::string> LettuceDatabase::lget(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  if (listStore.find(key) != listStore.end())
-    return listStore[key];
+  auto iterator = listStore.find(key);
+  if (iterator != listStore.end())
+    return *iterator->second;
   return {};
 }
 
 size_t LettuceDatabase::llen(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto iterator = listStore.find(key);
   if (iterator != listStore.end())
-    return iterator->second.size();
+    return iterator->second->size();
   return 0;
 }
 
 void LettuceDatabase::lpush(const std::string &key, const std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
+  std::vector<std::string> &list = listStore[key].mutate();
+  list.insert(list.begin(), value);
+  indexKey(key);
+  signalModifiedKey(key);
+}
+
+void LettuceDatabase::lpush(const std::string &key, const std::vector<std::string> &values)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  listStore[key].insert(listStore[key].begin(), value);
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
+  std::vector<std::string> &list = listStore[key].mutate();
+  list.insert(list.begin(), values.rbegin(), values.rend());
+  indexKey(key);
+  signalModifiedKey(key);
 }
 
 void LettuceDatabase::rpush(const std::string &key, const std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
+  listStore[key].mutate().push_back(value);
+  indexKey(key);
+  signalModifiedKey(key);
+}
+
+void LettuceDatabase::rpush(const std::string &key, const std::vector<std::string> &values)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  listStore[key].push_back(value);
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
+  std::vector<std::string> &list = listStore[key].mutate();
+  list.insert(list.end(), values.begin(), values.end());
+  indexKey(key);
+  signalModifiedKey(key);
 }
 
 bool LettuceDatabase::lpop(const std::string &key, std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto iterator = listStore.find(key);
   if (iterator != listStore.end() && !iterator->second.empty())
   {
-    value = iterator->second.front();                 // second is the actual vector of list
-    iterator->second.erase(iterator->second.begin()); // remove the first value of the vector (front)
+    // copied before the scope, the caller owns (and frees) it
+    value = iterator->second->front();
+    LettuceMemory::Scope scope(LettuceMemory::Lists);
+    std::vector<std::string> &list = iterator->second.mutate(); // the (unshared) vector behind the cow value
+    list.erase(list.begin());                                   // remove the first value of the vector (front)
+    signalModifiedKey(key);
     return true;
   }
   return false;
@@ -252,13 +2109,15 @@ bool LettuceDatabase::lpop(const std::string &key, std::string &value)
 
 bool LettuceDatabase::rpop(const std::string &key, std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto iterator = listStore.find(key);
   if (iterator != listStore.end() && !iterator->second.empty())
   {
-    value = iterator->second.back();
-    iterator->second.pop_back();
+    value = iterator->second->back();
+    LettuceMemory::Scope scope(LettuceMemory::Lists);
+    iterator->second.mutate().pop_back();
+    signalModifiedKey(key);
     return true;
   }
   return false;
@@ -266,14 +2125,19 @@ bool LettuceDatabase::rpop(const std::string &key, std::string &value)
 
 int LettuceDatabase::lrem(const std::string &key, int count, const std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
   int removed{0};
   auto iterator = listStore.find(key);
   if (iterator == listStore.end())
     return 0;
+  // mutate() clones a list shared by COPY, so it waits until there's something to remove
+  const auto &items = *iterator->second;
+  if (std::find(items.begin(), items.end(), value) == items.end())
+    return 0;
 
-  auto &list = iterator->second;
+  auto &list = iterator->second.mutate();
 
   if (count == 0)
   {
@@ -318,17 +2182,19 @@ int LettuceDatabase::lrem(const std::string &key, int count, const std::string &
     }
   }
 
+  if (removed > 0)
+    signalModifiedKey(key);
   return removed;
 }
 
 bool LettuceDatabase::lindex(const std::string &key, int index, std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto iter = listStore.find(key);
   if (iter == listStore.end())
     return false;
-  const auto &list = iter->second;
+  const auto &list = *iter->second;
   if (index < 0)
     index = list.size() + index;
   if (index < 0 || static_cast<size_t>(index) >= list.size())
@@ -340,39 +2206,51 @@ bool LettuceDatabase::lindex(const std::string &key, int index, std::string &val
 
 bool LettuceDatabase::lset(const std::string &key, int index, const std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Lists);
   auto iter = listStore.find(key);
   if (iter == listStore.end())
     return false;
-  auto &list = iter->second;
+  auto &list = iter->second.mutate();
   if (index < 0)
     index = list.size() + index;
   if (index < 0 || static_cast<size_t>(index) >= list.size())
     return false;
 
   list[index] = value;
+  signalModifiedKey(key);
   return true;
 }
 
 /* Hash operations */
+// looks a field up without interning its name - a name no hash has can't be in this one either
+static LettuceHash::const_iterator findField(const LettuceHash &hash, const std::string &field)
+{
+  LettuceField handle = LettuceField::find(field);
+  return handle ? hash.find(handle) : hash.end();
+}
+
 bool LettuceDatabase::hset(const std::string &key, const std::string &field, const std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  hashStore[key][field] = value;
+  LettuceMemory::Scope scope(LettuceMemory::Hashes);
+  hashStore[key].mutate()[field] = value;
+  indexKey(key);
+  signalModifiedKey(key);
   return true;
 }
 
 bool LettuceDatabase::hget(const std::string &key, const std::string &field, std::string &value)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto it = hashStore.find(key);
   if (it != hashStore.end())
   {
-    auto f = it->second.find(field);
-    if (f != it->second.end())
+    auto f = findField(*it->second, field);
+    if (f != it->second->end())
     {
       std::cerr << "HGET FOUND " << &field << " " << f->second << "\n";
       value = f->second;
@@ -384,47 +2262,61 @@ bool LettuceDatabase::hget(const std::string &key, const std::string &field, std
 
 bool LettuceDatabase::hexists(const std::string &key, const std::string &field)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto it = hashStore.find(key);
   if (it != hashStore.end())
   {
-    auto f = it->second.find(field);
-    return f != it->second.end();
+    return findField(*it->second, field) != it->second->end();
   }
   return false;
 }
 
 bool LettuceDatabase::hdel(const std::string &key, const std::string &field)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Hashes);
   auto it = hashStore.find(key);
   if (it != hashStore.end())
   {
-    return it->second.erase(field) > 0; // returns 1 on removing something
+    auto f = findField(*it->second, field);
+    if (f == it->second->end())
+      return false;
+    // the handle is copied first, erasing the node destroys the one in it
+    LettuceField handle = f->first;
+    if (it->second.mutate().erase(handle) == 0)
+      return false;
+    signalModifiedKey(key);
+    return true;
   }
   return false;
 }
 
 std::unordered_map<std::string, std::string> LettuceDatabase::hgetall(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  if (hashStore.find(key) != hashStore.end())
-    return hashStore[key];
-  return {};
+  std::unordered_map<std::string, std::string> fields;
+  auto it = hashStore.find(key);
+  if (it != hashStore.end())
+  {
+    fields.reserve(it->second.size());
+    for (const auto &[field, value] : *it->second)
+      fields.emplace(field, value);
+  }
+  return fields;
 }
 
 std::vector<std::string> LettuceDatabase::hkeys(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   std::vector<std::string> fields;
   auto it = hashStore.find(key);
   if (it != hashStore.end())
   {
-    for (const auto &[key, _] : it->second)
+    for (const auto &[key, _] : *it->second)
     {
       fields.push_back(key);
     }
@@ -434,13 +2326,13 @@ std::vector<std::string> LettuceDatabase::hkeys(const std::string &key)
 
 std::vector<std::string> LettuceDatabase::hvals(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   std::vector<std::string> values;
   auto it = hashStore.find(key);
   if (it != hashStore.end())
   {
-    for (const auto &[_, value] : it->second)
+    for (const auto &[_, value] : *it->second)
     {
       values.push_back(value);
     }
@@ -448,9 +2340,22 @@ std::vector<std::string> LettuceDatabase::hvals(const std::string &key)
   return values;
 }
 
+uint64_t LettuceDatabase::hscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern, std::vector<std::pair<std::string, std::string>> &fields)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = hashStore.find(key);
+  if (it == hashStore.end())
+    return 0;
+  return scanBuckets(*it->second, cursor, count, [&](const auto &pair)
+                     {
+    if (pattern.empty() || globMatch(pattern, pair.first))
+      fields.emplace_back(pair.first, pair.second); });
+}
+
 size_t LettuceDatabase::hlen(const std::string &key)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
   auto it = hashStore.find(key);
   return it != hashStore.end() ? it->second.size() : 0;
@@ -458,69 +2363,735 @@ size_t LettuceDatabase::hlen(const std::string &key)
 
 bool LettuceDatabase::hmset(const std::string &key, const std::vector<std::pair<std::string, std::string>> &pairs)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Hashes);
+  auto &hash = hashStore[key].mutate();
   for (const auto &[field, value] : pairs)
-    hashStore[key][field] = value;
+    hash[field] = value;
+  indexKey(key);
+  signalModifiedKey(key);
   return true;
 }
 
-/* Dump files*/
-bool LettuceDatabase::load(const std::string &filename)
+/* Set operations */
+int LettuceDatabase::sadd(const std::string &key, const std::vector<std::string> &members)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Sets);
+  LettuceSet &set = setStore[key].mutate();
+  int added{0};
+  for (const auto &member : members)
+  {
+    if (set.add(member))
+      added++;
+  }
+  indexKey(key);
+  if (added > 0)
+    signalModifiedKey(key);
+  return added;
+}
+
+int LettuceDatabase::srem(const std::string &key, const std::vector<std::string> &members)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Sets);
+  auto it = setStore.find(key);
+  if (it == setStore.end())
+    return 0;
+  int removed{0};
+  for (const auto &member : members)
+  {
+    // only clone a shared set when something is actually removed
+    if (it->second->contains(member) && it->second.mutate().remove(member))
+      removed++;
+  }
+  // an empty set is the same as a missing key
+  if (it->second.empty())
+  {
+    setStore.erase(it);
+    unindexKey(key);
+  }
+  if (removed > 0)
+    signalModifiedKey(key);
+  return removed;
+}
+
+bool LettuceDatabase::sismember(const std::string &key, const std::string &member)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = setStore.find(key);
+  return it != setStore.end() && it->second->contains(member);
+}
+
+size_t LettuceDatabase::scard(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = setStore.find(key);
+  return it != setStore.end() ? it->second->size() : 0;
+}
+
+std::vector<std::string> LettuceDatabase::smembers(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = setStore.find(key);
+  if (it != setStore.end())
+    return it->second->members();
+  return {};
+}
+
+uint64_t LettuceDatabase::sscan(const std::string &key, uint64_t cursor, size_t count, const std::string &pattern, std::vector<std::string> &members)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = setStore.find(key);
+  if (it == setStore.end())
+    return 0;
+  std::vector<std::string> candidates;
+  uint64_t next = it->second->scan(cursor, count, candidates);
+  for (auto &member : candidates)
+  {
+    if (pattern.empty() || globMatch(pattern, member))
+      members.push_back(std::move(member));
+  }
+  return next;
+}
+
+// missing keys are passed on as nullptr, which the set algebra treats as an empty set
+static std::vector<const LettuceSet *> lookupSets(const LettuceDict<std::string, LettuceCow<LettuceSet>> &setStore, const std::vector<std::string> &keys)
+{
+  std::vector<const LettuceSet *> sets;
+  sets.reserve(keys.size());
+  for (const auto &key : keys)
+  {
+    auto it = setStore.find(key);
+    sets.push_back(it != setStore.end() ? &*it->second : nullptr);
+  }
+  return sets;
+}
+
+std::vector<std::string> LettuceDatabase::sinter(const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  return LettuceSet::intersect(lookupSets(setStore, keys));
+}
+
+std::vector<std::string> LettuceDatabase::sunion(const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  return LettuceSet::unite(lookupSets(setStore, keys));
+}
+
+std::vector<std::string> LettuceDatabase::sdiff(const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  return LettuceSet::difference(lookupSets(setStore, keys));
+}
+
+/* HyperLogLog operations */
+bool LettuceDatabase::pfadd(const std::string &key, const std::vector<std::string> &elements, bool &updated)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  updated = false;
+  auto it = keyValueStore.find(key);
+  if (it == keyValueStore.end())
+  {
+    it = keyValueStore.emplace(key, LettuceHyperLogLog::create()).first;
+    indexKey(key);
+    updated = true;
+  }
+  else if (!LettuceHyperLogLog::isValid(rawString(it)))
+    return false;
+
+  for (const auto &element : elements)
+  {
+    if (LettuceHyperLogLog::add(it->second, element))
+      updated = true;
+  }
+  if (updated)
+    signalModifiedKey(key);
+  return true;
+}
+
+bool LettuceDatabase::pfcount(const std::vector<std::string> &keys, uint64_t &count)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  count = 0;
+  if (keys.size() == 1)
+  {
+    // single key can use and refresh the cached cardinality
+    auto it = keyValueStore.find(keys[0]);
+    if (it == keyValueStore.end())
+      return true;
+    if (!LettuceHyperLogLog::isValid(rawString(it)))
+      return false;
+    count = LettuceHyperLogLog::count(it->second);
+    return true;
+  }
+
+  std::vector<const std::string *> values;
+  for (const auto &key : keys)
+  {
+    auto it = keyValueStore.find(key);
+    if (it == keyValueStore.end())
+      continue;
+    if (!LettuceHyperLogLog::isValid(rawString(it)))
+      return false;
+    values.push_back(&it->second);
+  }
+  count = LettuceHyperLogLog::countUnion(values);
+  return true;
+}
+
+bool LettuceDatabase::pfmerge(const std::string &destKey, const std::vector<std::string> &sourceKeys)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  std::vector<const std::string *> sources;
+  for (const auto &key : sourceKeys)
+  {
+    auto it = keyValueStore.find(key);
+    if (it == keyValueStore.end())
+      continue;
+    if (!LettuceHyperLogLog::isValid(rawString(it)))
+      return false;
+    sources.push_back(&it->second);
+  }
+
+  auto dest = keyValueStore.find(destKey);
+  if (dest != keyValueStore.end() && !LettuceHyperLogLog::isValid(rawString(dest)))
+    return false;
+
+  std::string merged = dest != keyValueStore.end() ? dest->second : LettuceHyperLogLog::create();
+  LettuceHyperLogLog::merge(merged, sources);
+  keyValueStore[destKey] = std::move(merged);
+  indexKey(destKey);
+  signalModifiedKey(destKey);
+  return true;
+}
+
+/* Bitmap operations */
+int LettuceDatabase::setbit(const std::string &key, uint64_t offset, int bit)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  std::string &value = rawString(keyValueStore.try_emplace(key).first);
+  indexKey(key);
+  size_t byte = offset >> 3;
+  if (byte >= value.size())
+    value.resize(byte + 1, '\0');
+  uint8_t mask = 1 << (7 - (offset & 7));
+  int previous = (static_cast<uint8_t>(value[byte]) & mask) ? 1 : 0;
+  if (bit)
+    value[byte] = static_cast<char>(value[byte] | mask);
+  else
+    value[byte] = static_cast<char>(value[byte] & ~mask);
+  signalModifiedKey(key);
+  return previous;
+}
+
+int LettuceDatabase::getbit(const std::string &key, uint64_t offset)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = keyValueStore.find(key);
+  if (it == keyValueStore.end())
+    return 0;
+  size_t byte = offset >> 3;
+  const std::string &value = rawString(it);
+  if (byte >= value.size())
+    return 0;
+  return (static_cast<uint8_t>(value[byte]) >> (7 - (offset & 7))) & 1;
+}
+
+uint64_t LettuceDatabase::bitcount(const std::string &key)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = keyValueStore.find(key);
+  if (it == keyValueStore.end())
+    return 0;
+  const std::string &value = rawString(it);
+  return bitmapPopcount(reinterpret_cast<const uint8_t *>(value.data()), value.size());
+}
+
+uint64_t LettuceDatabase::bitcount(const std::string &key, int64_t start, int64_t end, bool bitUnit)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = keyValueStore.find(key);
+  if (it == keyValueStore.end())
+    return 0;
+  const std::string &value = rawString(it);
+  int64_t size = static_cast<int64_t>(value.size()) * (bitUnit ? 8 : 1);
+  int64_t first, last;
+  if (!bitmapRange(start, end, size, first, last))
+    return 0;
+  uint64_t firstBit = bitUnit ? first : first * 8;
+  uint64_t lastBit = bitUnit ? last : last * 8 + 7;
+  return bitmapPopcountBits(reinterpret_cast<const uint8_t *>(value.data()), value.size(), firstBit, lastBit);
+}
+
+int64_t LettuceDatabase::bitpos(const std::string &key, int bit, int64_t start, int64_t end, bool endGiven, bool bitUnit)
+{
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  purgeExpired();
+  auto it = keyValueStore.find(key);
+  if (it == keyValueStore.end())
+    return bit ? -1 : 0;
+  const std::string &value = rawString(it);
+  int64_t size = static_cast<int64_t>(value.size()) * (bitUnit ? 8 : 1);
+  int64_t first, last;
+  if (!bitmapRange(start, end, size, first, last))
+    return -1;
+  uint64_t firstBit = bitUnit ? first : first * 8;
+  uint64_t lastBit = bitUnit ? last : last * 8 + 7;
+  int64_t position = bitmapPos(reinterpret_cast<const uint8_t *>(value.data()), value.size(), bit, firstBit, lastBit);
+  // looking for a clear bit without an explicit end: the string is treated as padded with zeros
+  if (position == -1 && bit == 0 && !endGiven)
+    return static_cast<int64_t>(lastBit + 1);
+  return position;
+}
+
+size_t LettuceDatabase::bitop(BitOp op, const std::string &destKey, const std::vector<std::string> &sourceKeys)
 {
-  std::lock_guard<std::mutex> lock(db_mutex);
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
   purgeExpired();
-  std::ifstream ifs(filename, std::ios::binary);
-  if (!ifs)
+  LettuceMemory::Scope scope(LettuceMemory::Strings);
+  std::vector<const std::string *> sources;
+  size_t maxLength = 0;
+  for (const auto &key : sourceKeys)
+  {
+    auto it = keyValueStore.find(key);
+    const std::string *source = it != keyValueStore.end() ? &rawString(it) : nullptr;
+    sources.push_back(source);
+    if (source != nullptr)
+      maxLength = std::max(maxLength, source->size());
+  }
+
+  forgetCompressed(destKey);
+  forgetTiered(destKey);
+  if (maxLength == 0)
+  {
+    keyValueStore.erase(destKey);
+    unindexKey(destKey);
+    signalModifiedKey(destKey);
+    return 0;
+  }
+
+  // missing keys and the tail of shorter strings count as zero bytes
+  std::string result(maxLength, '\0');
+  uint8_t *dest = reinterpret_cast<uint8_t *>(&result[0]);
+  if (sources[0] != nullptr)
+    memcpy(dest, sources[0]->data(), sources[0]->size());
+
+  if (op == BitOp::Not)
+  {
+    bitmapOp(BitOp::Not, dest, nullptr, maxLength);
+  }
+  else
+  {
+    for (size_t i = 1; i < sources.size(); i++)
+    {
+      size_t length = sources[i] != nullptr ? sources[i]->size() : 0;
+      if (length > 0)
+        bitmapOp(op, dest, reinterpret_cast<const uint8_t *>(sources[i]->data()), length);
+      // x | 0 and x ^ 0 leave the tail alone, x & 0 clears it
+      if (op == BitOp::And && length < maxLength)
+        memset(dest + length, 0, maxLength - length);
+    }
+  }
+
+  keyValueStore[destKey] = std::move(result);
+  indexKey(destKey);
+  signalModifiedKey(destKey);
+  return maxLength;
+}
+
+/* Dump files*/
+// what one snapshot segment decodes to - built off the lock by a load thread, then moved into the
+// fresh stores in file order
+struct LoadedSegment
+{
+  std::vector<std::pair<std::string, std::string>> strings;
+  std::vector<std::pair<std::string, std::vector<std::string>>> lists;
+  std::vector<std::pair<std::string, LettuceHash>> hashes;
+  std::vector<std::pair<std::string, LettuceSet>> sets;
+  std::vector<std::pair<std::string, std::chrono::steady_clock::time_point>> expiries;
+  bool ok = false;
+};
+
+// the stores load fills before swapping them in - whatever they hold when load returns (the old
+// keyspace, or part of a corrupt file) is freed under its memory category
+struct LoadedStores
+{
+  LettuceDict<std::string, std::string> strings;
+  LettuceDict<std::string, LettuceCow<std::vector<std::string>>> lists;
+  LettuceDict<std::string, LettuceCow<LettuceHash>> hashes;
+  LettuceDict<std::string, LettuceCow<LettuceSet>> sets;
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point> expiries;
+
+  ~LoadedStores()
+  {
+    clearStore(strings);
+    clearStore(lists);
+    clearStore(hashes);
+    clearStore(sets);
+    clearStore(expiries);
+  }
+};
+
+template <typename Records, typename Value>
+static void keep(Records &records, std::string key, Value value)
+{
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  records.emplace_back(std::move(key), std::move(value));
+}
+
+static bool decodeSegment(const uint8_t *data, size_t length, std::chrono::steady_clock::time_point now, LoadedSegment &out)
+{
+  using namespace LettuceSnapshot;
+  LettuceSnapshotReader reader(data, length);
+  while (reader.remaining() > 0)
+  {
+    uint8_t type;
+    std::string key;
+    uint64_t count;
+    bool hasExpiry = false;
+    uint64_t expiresAt = 0;
+    if (!reader.readByte(type))
+      return false;
+    if (type == opExpiry)
+    {
+      hasExpiry = true;
+      if (!reader.readUint64(expiresAt) || !reader.readByte(type))
+        return false;
+    }
+    // the key and value are charged to their type here, the segment's own vectors are not
+    LettuceMemory::Category category = type == typeString ? LettuceMemory::Strings : type == typeList ? LettuceMemory::Lists
+                                       : type == typeHash                               ? LettuceMemory::Hashes
+                                                                                        : LettuceMemory::Sets;
+    LettuceMemory::Scope scope(category);
+    if (!reader.readString(key))
+      return false;
+    // expired while the server was down, still decoded to get past it
+    auto when = fromUnixMillis(expiresAt);
+    bool expired = hasExpiry && now > when;
+    std::string expiryKey;
+    if (hasExpiry && !expired)
+    {
+      LettuceMemory::Scope expires(LettuceMemory::Expires);
+      expiryKey = key;
+    }
+
+    // counts come from the file, so never reserve more than the remaining bytes could hold
+    if (type == typeString)
+    {
+      std::string value;
+      if (!reader.readString(value))
+        return false;
+      if (!expired)
+        keep(out.strings, std::move(key), std::move(value));
+    }
+    else if (type == typeList)
+    {
+      if (!reader.readLength(count) || count > reader.remaining())
+        return false;
+      std::vector<std::string> list(count);
+      for (auto &item : list)
+      {
+        if (!reader.readString(item))
+          return false;
+      }
+      if (!expired)
+        keep(out.lists, std::move(key), std::move(list));
+    }
+    else if (type == typeHash)
+    {
+      if (!reader.readLength(count) || count > reader.remaining() / 2)
+        return false;
+      LettuceHash hash;
+      hash.reserve(count);
+      for (uint64_t i = 0; i < count; i++)
+      {
+        std::string field, value;
+        if (!reader.readString(field) || !reader.readString(value))
+          return false;
+        hash[std::move(field)] = std::move(value);
+      }
+      if (!expired)
+        keep(out.hashes, std::move(key), std::move(hash));
+    }
+    else if (type == typeIntset)
+    {
+      if (!reader.readLength(count) || count > reader.remaining() / 8 || count > LettuceSet::maxIntsetEntries)
+        return false;
+      std::vector<int64_t> values(count);
+      for (uint64_t i = 0; i < count; i++)
+      {
+        uint64_t value;
+        reader.readUint64(value);
+        values[i] = static_cast<int64_t>(value);
+        if (i > 0 && values[i - 1] >= values[i])
+          return false;
+      }
+      if (!expired)
+        keep(out.sets, std::move(key), LettuceSet::fromIntset(std::move(values)));
+    }
+    else if (type == typeHashset)
+    {
+      if (!reader.readLength(count) || count > reader.remaining())
+        return false;
+      LettuceDictSet<std::string> members;
+      members.reserve(count);
+      for (uint64_t i = 0; i < count; i++)
+      {
+        std::string member;
+        if (!reader.readString(member))
+          return false;
+        members.insert(std::move(member));
+      }
+      if (!expired)
+        keep(out.sets, std::move(key), LettuceSet::fromHashtable(std::move(members)));
+    }
+    else
+    {
+      return false;
+    }
+
+    if (hasExpiry && !expired)
+      keep(out.expiries, std::move(expiryKey), when);
+  }
+  out.ok = true;
+  return true;
+}
+
+template <typename Store>
+static void reserveStore(Store &store, size_t count)
+{
+  LettuceMemory::Scope scope(memoryCategory(store));
+  store.reserve(count);
+}
+
+template <typename Store, typename Records>
+static void mergeRecords(Store &store, Records &records)
+{
+  LettuceMemory::Scope scope(memoryCategory(store));
+  for (auto &[key, value] : records)
+    store[std::move(key)] = std::move(value);
+}
+
+// everything is parsed into fresh stores first, so a corrupt or truncated file leaves the
+// current keyspace untouched. the file is mapped rather than read, checksummed in parallel chunks
+// and its segments are decoded by a pool of threads while this one moves finished segments into
+// the stores (sized up front from the opSizes record)
+bool LettuceDatabase::load(const std::string &filename, LettuceAofPosition *aofPosition)
+{
+  using namespace LettuceSnapshot;
+  LettuceMappedFile file;
+  size_t payloadEnd;
+  unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+  if (!file.open(filename) || !verifySnapshot(file.data(), file.size(), payloadEnd, threads))
     return false;
+  const uint8_t *data = file.data();
+  {
+    std::lock_guard<std::mutex> loadLock(load_mutex);
+    loadBytesTotal = file.size();
+    loadBytesLoaded = 0;
+    loadKeysTotal = 0;
+    loadKeysLoaded = 0;
+  }
 
-  keyValueStore.clear();
-  listStore.clear();
-  hashStore.clear();
+  LoadedStores fresh;
+  auto &strings = fresh.strings;
+  auto &lists = fresh.lists;
+  auto &hashes = fresh.hashes;
+  auto &sets = fresh.sets;
+  auto &expiries = fresh.expiries;
 
-  std::string line;
-  while (std::getline(ifs, line))
+  LettuceSnapshotReader reader(data + headerSize, payloadEnd - headerSize);
+  LettuceAofPosition snapshotAof;
+  uint8_t op;
+  while (reader.peekByte(op) && (op == opAux || op == opSizes))
   {
-    std::istringstream iss(line);
-    char type;
-    iss >> type;
-    if (type == 'K')
+    reader.readByte(op);
+    if (op == opSizes)
     {
-      std::string key, value;
-      iss >> key >> value;
-      keyValueStore[key] = value;
+      uint64_t sizes[5];
+      for (uint64_t &size : sizes)
+      {
+        if (!reader.readLength(size) || size > payloadEnd)
+          return false;
+      }
+      {
+        std::lock_guard<std::mutex> loadLock(load_mutex);
+        loadKeysTotal = sizes[0] + sizes[1] + sizes[2] + sizes[3];
+      }
+      reserveStore(strings, sizes[0]);
+      reserveStore(lists, sizes[1]);
+      reserveStore(hashes, sizes[2]);
+      reserveStore(sets, sizes[3]);
+      reserveStore(expiries, sizes[4]);
+      continue;
     }
+    std::string name, value;
+    if (!reader.readString(name) || !reader.readString(value))
+      return false;
+    // unknown names are skipped, so newer metadata doesn't break older servers
+    if (name == "aof-generation")
+      snapshotAof.generation = strtoull(value.c_str(), nullptr, 10);
+    else if (name == "aof-offset")
+      snapshotAof.offset = strtoull(value.c_str(), nullptr, 10);
+  }
 
-    if (type == 'L')
+  // version 1 has no framing, its records are one big segment
+  struct Segment
+  {
+    const uint8_t *data;
+    size_t length;
+    size_t rawLength; // 0 unless the segment is compressed
+  };
+  std::vector<Segment> segments;
+  if (data[magicSize] == 1)
+  {
+    segments.push_back({data + headerSize + reader.position(), reader.remaining(), 0});
+  }
+  else
+  {
+    while (reader.remaining() > 0)
     {
-      std::string key;
-      iss >> key;
-      std::string item;
-      std::vector<std::string> values;
-      while (iss >> item)
-        values.push_back(item);
-      listStore[key] = values;
+      uint64_t keys, length, rawLength = 0;
+      if (!reader.readByte(op) || (op != opSegment && op != opSegmentLz) || !reader.readLength(keys))
+        return false;
+      if (op == opSegmentLz && (!reader.readLength(rawLength) || rawLength == 0))
+        return false;
+      if (!reader.readLength(length))
+        return false;
+      size_t start = reader.position();
+      // an lz sequence expands to at most 255 + 19 bytes per input byte, anything more is corrupt
+      if (!reader.skip(length) || rawLength / 274 > length)
+        return false;
+      segments.push_back({data + headerSize + start, length, rawLength});
     }
+  }
 
-    if (type == 'H')
+  auto now = std::chrono::steady_clock::now();
+  std::vector<LoadedSegment> decoded(segments.size());
+  std::vector<char> ready(segments.size(), 0);
+  std::mutex readyMutex;
+  std::condition_variable readyChanged;
+  std::atomic<size_t> nextSegment{0};
+  std::atomic<bool> stop{false};
+  auto work = [&]()
+  {
+    size_t i;
+    std::vector<uint8_t> raw;
+    while (!stop.load(std::memory_order_relaxed) && (i = nextSegment.fetch_add(1)) < segments.size())
     {
-      std::string key;
-      iss >> key;
-      std::string pair;
-      std::unordered_map<std::string, std::string> map;
-      while (iss >> pair)
+      const Segment &segment = segments[i];
+      if (segment.rawLength == 0)
+        decodeSegment(segment.data, segment.length, now, decoded[i]);
+      else
       {
-        int position = pair.find(':');
-        if (position != std::string::npos)
-        {
-          std::string key = pair.substr(0, position);
-          std::string value = pair.substr(position + 1);
-          map[key] = value;
-        }
-        hashStore[key] = map;
+        raw.resize(segment.rawLength);
+        if (lzDecompress(segment.data, segment.length, raw.data(), raw.size()))
+          decodeSegment(raw.data(), raw.size(), now, decoded[i]);
       }
+      std::lock_guard<std::mutex> readyLock(readyMutex);
+      ready[i] = 1;
+      readyChanged.notify_all();
     }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::min<size_t>(threads, segments.size()); i++)
+    workers.emplace_back(work);
+
+  // segments are merged in file order, so a key that shows up twice ends up with its last value
+  bool ok = true;
+  for (size_t i = 0; i < segments.size() && ok; i++)
+  {
+    {
+      std::unique_lock<std::mutex> readyLock(readyMutex);
+      readyChanged.wait(readyLock, [&]()
+                        { return ready[i] != 0; });
+    }
+    LoadedSegment &segment = decoded[i];
+    ok = segment.ok;
+    mergeRecords(strings, segment.strings);
+    mergeRecords(lists, segment.lists);
+    mergeRecords(hashes, segment.hashes);
+    mergeRecords(sets, segment.sets);
+    mergeRecords(expiries, segment.expiries);
+    {
+      std::lock_guard<std::mutex> loadLock(load_mutex);
+      loadBytesLoaded += segments[i].length;
+      loadKeysLoaded += segment.strings.size() + segment.lists.size() + segment.hashes.size() + segment.sets.size();
+    }
+    segment = LoadedSegment();
+  }
+  stop = true;
+  for (auto &worker : workers)
+    worker.join();
+  if (!ok)
+    return false;
+  {
+    std::lock_guard<std::mutex> loadLock(load_mutex);
+    loadBytesLoaded = loadBytesTotal;
+  }
+
+  if (aofPosition)
+    *aofPosition = snapshotAof;
+  std::lock_guard<std::recursive_mutex> lock(db_mutex);
+  dirty = 0;
+  keyValueStore.swap(strings);
+  {
+    LettuceMemory::Scope scope(LettuceMemory::Strings);
+    std::unordered_map<std::string, size_t>().swap(compressedStrings);
+    for (const auto &[key, location] : tieredStrings)
+      tierStore->release(location);
+    LettuceDict<std::string, LettuceTierLocation>().swap(tieredStrings);
   }
+  compressionSavedBytes = 0;
+  for (auto &[key, value] : keyValueStore)
+    compressStoredString(key, value);
+  listStore.swap(lists);
+  hashStore.swap(hashes);
+  setStore.swap(sets);
+  expiryMap.swap(expiries);
+
+  if (keyIndex)
+  {
+    keyIndex->clear();
+    for (const auto &pair : keyValueStore)
+      keyIndex->insert(pair.first);
+    for (const auto &pair : listStore)
+      keyIndex->insert(pair.first);
+    for (const auto &pair : hashStore)
+      keyIndex->insert(pair.first);
+    for (const auto &pair : setStore)
+      keyIndex->insert(pair.first);
+  }
+  // every key is new, so their access data is too
+  accessTracking = false;
+  updateAccessTracking();
+  for (auto &[key, watched] : watchedKeys)
+    watched.version = ++keyVersionCounter;
+  LettuceTracking &tracking = LettuceTracking::getInstance();
+  if (tracking.active())
+    tracking.invalidateAll();
 
   return true;
-}
\ No newline at end of file
+}
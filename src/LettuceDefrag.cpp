@@ -0,0 +1,30 @@
+#include "../include/LettuceDefrag.h"
+#include "../include/LettuceMemory.h"
+
+#include <malloc.h>
+
+bool LettuceDefrag::movable(const void *block)
+{
+  size_t size = LettuceMemory::heapSize(block);
+  return size > 0 && size < largeBlock;
+}
+
+bool LettuceDefrag::relocate(std::string &value)
+{
+  if (LettuceMemory::heapSize(value) == 0 || !movable(value.data()))
+    return false;
+  std::string moved;
+  moved.reserve(value.size());
+  // a value that shrank back under the inline size leaves the heap altogether
+  bool fitsInline = LettuceMemory::heapSize(moved) == 0;
+  if (!fitsInline && moved.data() > value.data())
+    return false;
+  moved.assign(value);
+  value.swap(moved);
+  return true;
+}
+
+bool LettuceDefrag::releaseFreePages()
+{
+  return malloc_trim(0) != 0;
+}
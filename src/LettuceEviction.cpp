@@ -0,0 +1,98 @@
+#include "../include/LettuceEviction.h"
+
+#include <chrono>
+#include <random>
+
+static const double lfuLogFactor = 10; // ~1M accesses to saturate the counter
+static const uint32_t lfuDecayMinutes = 1;
+
+bool parseEvictionPolicy(const std::string &name, LettuceEvictionPolicy &policy)
+{
+  if (name == "noeviction")
+    policy = LettuceEvictionPolicy::NoEviction;
+  else if (name == "allkeys-lru")
+    policy = LettuceEvictionPolicy::AllKeysLru;
+  else if (name == "allkeys-lfu")
+    policy = LettuceEvictionPolicy::AllKeysLfu;
+  else if (name == "volatile-lru")
+    policy = LettuceEvictionPolicy::VolatileLru;
+  else if (name == "volatile-ttl")
+    policy = LettuceEvictionPolicy::VolatileTtl;
+  else
+    return false;
+  return true;
+}
+
+std::string evictionPolicyName(LettuceEvictionPolicy policy)
+{
+  switch (policy)
+  {
+  case LettuceEvictionPolicy::AllKeysLru:
+    return "allkeys-lru";
+  case LettuceEvictionPolicy::AllKeysLfu:
+    return "allkeys-lfu";
+  case LettuceEvictionPolicy::VolatileLru:
+    return "volatile-lru";
+  case LettuceEvictionPolicy::VolatileTtl:
+    return "volatile-ttl";
+  default:
+    return "noeviction";
+  }
+}
+
+static uint64_t steadySeconds()
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t LettuceKeyMeta::lruClock()
+{
+  return static_cast<uint32_t>(steadySeconds()) & clockMax;
+}
+
+uint32_t LettuceKeyMeta::lruIdleSeconds(uint32_t meta)
+{
+  uint32_t now = lruClock();
+  uint32_t then = meta & clockMax;
+  return now >= then ? now - then : now + (clockMax - then) + 1;
+}
+
+static uint16_t lfuMinutes()
+{
+  return static_cast<uint16_t>(steadySeconds() / 60);
+}
+
+uint32_t LettuceKeyMeta::lfuNew()
+{
+  return (static_cast<uint32_t>(lfuMinutes()) << 8) | lfuInitialCount;
+}
+
+uint8_t LettuceKeyMeta::lfuCount(uint32_t meta)
+{
+  uint16_t last = meta >> 8;
+  uint8_t count = meta & 0xff;
+  uint16_t elapsed = static_cast<uint16_t>(lfuMinutes() - last); // wraps like the stored minutes do
+  uint32_t periods = elapsed / lfuDecayMinutes;
+  return periods >= count ? 0 : count - periods;
+}
+
+uint32_t LettuceKeyMeta::lfuIdleSeconds(uint32_t meta)
+{
+  uint16_t last = meta >> 8;
+  return static_cast<uint16_t>(lfuMinutes() - last) * 60u;
+}
+
+uint32_t LettuceKeyMeta::lfuTouch(uint32_t meta)
+{
+  uint8_t count = lfuCount(meta);
+  if (count < 255)
+  {
+    // the more accesses a key already has the less likely another one counts
+    thread_local std::minstd_rand random(std::random_device{}());
+    double base = count > lfuInitialCount ? count - lfuInitialCount : 0;
+    double probability = 1.0 / (base * lfuLogFactor + 1);
+    if (std::uniform_real_distribution<double>(0, 1)(random) < probability)
+      count++;
+  }
+  return (static_cast<uint32_t>(lfuMinutes()) << 8) | count;
+}
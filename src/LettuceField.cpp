@@ -0,0 +1,143 @@
+#include "../include/LettuceField.h"
+#include "../include/LettuceMemory.h"
+
+#include <atomic>
+#include <mutex>
+#include <string_view>
+
+struct LettuceField::Entry
+{
+  std::string name;
+  std::atomic<size_t> refs{1};
+};
+
+// keyed by a view of the entry's own name, so each name is stored once. hashes are built and freed
+// off db_mutex too (load threads, lazy free), so the table has a lock of its own
+struct LettuceField::Table
+{
+  std::mutex mutex;
+  std::unordered_map<std::string_view, Entry *> entries;
+  size_t bytes = 0;
+};
+
+// leaked on purpose, handles held by the database singleton can be released after statics are destroyed
+LettuceField::Table &LettuceField::table()
+{
+  static Table *instance = []()
+  {
+    LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+    return new Table();
+  }();
+  return *instance;
+}
+
+LettuceField::Entry *LettuceField::intern(const std::string &name)
+{
+  Table &fields = table();
+  std::lock_guard<std::mutex> lock(fields.mutex);
+  auto it = fields.entries.find(name);
+  if (it != fields.entries.end())
+  {
+    it->second->refs.fetch_add(1, std::memory_order_relaxed);
+    return it->second;
+  }
+  // the names are part of what hashes use, whichever thread creates or frees them
+  LettuceMemory::Scope scope(LettuceMemory::Hashes);
+  Entry *entry = new Entry{name};
+  fields.entries.emplace(entry->name, entry);
+  fields.bytes += name.size();
+  return entry;
+}
+
+void LettuceField::release(Entry *entry)
+{
+  if (entry == nullptr)
+    return;
+  // dropping a reference that isn't the last needs no lock, the last one goes from 1 to 0 under
+  // the lock so intern can't hand the entry out again while it's being erased
+  size_t refs = entry->refs.load(std::memory_order_relaxed);
+  while (refs > 1)
+  {
+    if (entry->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel))
+      return;
+  }
+  Table &fields = table();
+  std::lock_guard<std::mutex> lock(fields.mutex);
+  if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+  LettuceMemory::Scope scope(LettuceMemory::Hashes);
+  fields.entries.erase(entry->name);
+  fields.bytes -= entry->name.size();
+  delete entry;
+  // a table never shrinks its buckets, once the last hash is gone they go too
+  if (fields.entries.empty())
+    decltype(fields.entries)().swap(fields.entries);
+}
+
+LettuceField::LettuceField(const std::string &name) : entry(intern(name)) {}
+
+LettuceField::LettuceField(const char *name) : entry(intern(name)) {}
+
+LettuceField::LettuceField(const LettuceField &other) : entry(other.entry)
+{
+  if (entry != nullptr)
+    entry->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+LettuceField::LettuceField(LettuceField &&other) noexcept : entry(other.entry)
+{
+  other.entry = nullptr;
+}
+
+LettuceField &LettuceField::operator=(LettuceField other) noexcept
+{
+  std::swap(entry, other.entry);
+  return *this;
+}
+
+LettuceField::~LettuceField()
+{
+  release(entry);
+}
+
+LettuceField LettuceField::find(const std::string &name)
+{
+  Table &fields = table();
+  std::lock_guard<std::mutex> lock(fields.mutex);
+  auto it = fields.entries.find(name);
+  if (it == fields.entries.end())
+    return LettuceField();
+  it->second->refs.fetch_add(1, std::memory_order_relaxed);
+  return LettuceField(it->second);
+}
+
+const std::string &LettuceField::str() const
+{
+  static const std::string empty;
+  return entry != nullptr ? entry->name : empty;
+}
+
+size_t LettuceField::memoryShare() const
+{
+  if (entry == nullptr)
+    return 0;
+  // the entry, the name's heap block, and the table's node (next pointer, view, entry pointer,
+  // cached hash) plus its bucket slot
+  size_t bytes = LettuceMemory::allocationSize(sizeof(Entry)) + LettuceMemory::heapSize(entry->name) +
+                 LettuceMemory::allocationSize(sizeof(void *) + sizeof(std::string_view) + sizeof(Entry *) + sizeof(size_t)) + sizeof(void *);
+  return bytes / entry->refs.load(std::memory_order_relaxed);
+}
+
+size_t LettuceField::interned()
+{
+  Table &fields = table();
+  std::lock_guard<std::mutex> lock(fields.mutex);
+  return fields.entries.size();
+}
+
+size_t LettuceField::internedBytes()
+{
+  Table &fields = table();
+  std::lock_guard<std::mutex> lock(fields.mutex);
+  return fields.bytes;
+}
@@ -0,0 +1,107 @@
+#include "../include/LettuceGlob.h"
+
+#include <string>
+
+// matches a single pattern token at pattern[p] against c, next is set to the index after the token
+static bool matchToken(const std::string &pattern, size_t p, char c, size_t &next)
+{
+  char token = pattern[p];
+  if (token == '?')
+  {
+    next = p + 1;
+    return true;
+  }
+
+  if (token == '\\' && p + 1 < pattern.size())
+  {
+    next = p + 2;
+    return pattern[p + 1] == c;
+  }
+
+  if (token != '[')
+  {
+    next = p + 1;
+    return token == c;
+  }
+
+  // character class, an unterminated class runs to the end of the pattern
+  p++;
+  bool negate = p < pattern.size() && pattern[p] == '^';
+  if (negate)
+    p++;
+  bool matched = false;
+  while (p < pattern.size() && pattern[p] != ']')
+  {
+    if (pattern[p] == '\\' && p + 1 < pattern.size())
+    {
+      matched |= pattern[p + 1] == c;
+      p += 2;
+    }
+    else if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']')
+    {
+      char low = pattern[p];
+      char high = pattern[p + 2];
+      if (low > high)
+        std::swap(low, high);
+      matched |= c >= low && c <= high;
+      p += 3;
+    }
+    else
+    {
+      matched |= pattern[p] == c;
+      p++;
+    }
+  }
+  next = p < pattern.size() ? p + 1 : p;
+  return matched != negate;
+}
+
+bool globMatch(const std::string &pattern, const std::string &str)
+{
+  size_t p = 0, s = 0;
+  size_t starPattern = std::string::npos, starString = 0;
+  while (s < str.size())
+  {
+    if (p < pattern.size() && pattern[p] == '*')
+    {
+      // remember the star and first try matching it against nothing
+      starPattern = p++;
+      starString = s;
+      continue;
+    }
+    size_t next;
+    if (p < pattern.size() && matchToken(pattern, p, str[s], next))
+    {
+      p = next;
+      s++;
+      continue;
+    }
+    if (starPattern == std::string::npos)
+      return false;
+    // backtrack: let the last star swallow one more char
+    p = starPattern + 1;
+    s = ++starString;
+  }
+  while (p < pattern.size() && pattern[p] == '*')
+    p++;
+  return p == pattern.size();
+}
+
+std::string globLiteralPrefix(const std::string &pattern)
+{
+  std::string prefix;
+  for (size_t i = 0; i < pattern.size(); i++)
+  {
+    char c = pattern[i];
+    if (c == '*' || c == '?' || c == '[')
+      break;
+    if (c == '\\')
+    {
+      if (i + 1 >= pattern.size())
+        break;
+      c = pattern[++i];
+    }
+    prefix.push_back(c);
+  }
+  return prefix;
+}
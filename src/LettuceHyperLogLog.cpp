@@ -0,0 +1,428 @@
+#include "../include/LettuceHyperLogLog.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char hllMagic[4] = {'H', 'Y', 'L', 'L'};
+static const int hllQ = 64 - LettuceHyperLogLog::precision; // bits of the hash left to count zeros in
+static const uint64_t hllSeed = 0xadc83b19ULL;
+static const double hllAlphaInf = 0.721347520444481703680; // 1 / (2 ln 2)
+
+/* Header helpers */
+static void setCachedCount(std::string &value, uint64_t count)
+{
+  for (int i = 0; i < 8; i++)
+    value[8 + i] = static_cast<char>((count >> (8 * i)) & 0xff);
+  value[5] = 1;
+}
+
+static bool getCachedCount(const std::string &value, uint64_t &count)
+{
+  if (value[5] == 0)
+    return false;
+  count = 0;
+  for (int i = 0; i < 8; i++)
+    count |= static_cast<uint64_t>(static_cast<uint8_t>(value[8 + i])) << (8 * i);
+  return true;
+}
+
+static void invalidateCache(std::string &value)
+{
+  value[5] = 0;
+}
+
+static std::string makeHeader(uint8_t encoding)
+{
+  std::string header(LettuceHyperLogLog::headerSize, '\0');
+  memcpy(&header[0], hllMagic, 4);
+  header[4] = static_cast<char>(encoding);
+  return header;
+}
+
+/* Dense register access - 6 bit registers packed lsb first */
+static uint8_t denseGet(const uint8_t *registers, size_t index)
+{
+  size_t byte = index * LettuceHyperLogLog::registerBits / 8;
+  unsigned firstBit = index * LettuceHyperLogLog::registerBits & 7;
+  unsigned low = registers[byte] >> firstBit;
+  unsigned high = firstBit > 2 ? registers[byte + 1] << (8 - firstBit) : 0;
+  return (low | high) & 63;
+}
+
+static void denseSet(uint8_t *registers, size_t index, uint8_t value)
+{
+  size_t byte = index * LettuceHyperLogLog::registerBits / 8;
+  unsigned firstBit = index * LettuceHyperLogLog::registerBits & 7;
+  registers[byte] &= ~(63 << firstBit);
+  registers[byte] |= value << firstBit;
+  if (firstBit > 2)
+  {
+    registers[byte + 1] &= ~(63 >> (8 - firstBit));
+    registers[byte + 1] |= value >> (8 - firstBit);
+  }
+}
+
+// every 3 packed bytes hold exactly 4 registers, so unpack/pack whole groups at a time
+static void denseUnpack(const uint8_t *packed, uint8_t *registers)
+{
+  for (size_t group = 0; group < LettuceHyperLogLog::registerCount / 4; group++)
+  {
+    const uint8_t *in = packed + group * 3;
+    uint8_t *out = registers + group * 4;
+    out[0] = in[0] & 63;
+    out[1] = ((in[0] >> 6) | (in[1] << 2)) & 63;
+    out[2] = ((in[1] >> 4) | (in[2] << 4)) & 63;
+    out[3] = in[2] >> 2;
+  }
+}
+
+static void densePack(const uint8_t *registers, uint8_t *packed)
+{
+  for (size_t group = 0; group < LettuceHyperLogLog::registerCount / 4; group++)
+  {
+    const uint8_t *in = registers + group * 4;
+    uint8_t *out = packed + group * 3;
+    out[0] = in[0] | (in[1] << 6);
+    out[1] = (in[1] >> 2) | (in[2] << 4);
+    out[2] = (in[2] >> 4) | (in[3] << 2);
+  }
+}
+
+static std::string encodeDense(const uint8_t *registers)
+{
+  std::string value = makeHeader(LettuceHyperLogLog::encodingDense);
+  value.resize(LettuceHyperLogLog::denseSize);
+  densePack(registers, reinterpret_cast<uint8_t *>(&value[LettuceHyperLogLog::headerSize]));
+  return value;
+}
+
+/* Sparse entries */
+static size_t sparseEntries(const std::string &value)
+{
+  return (value.size() - LettuceHyperLogLog::headerSize) / LettuceHyperLogLog::sparseEntrySize;
+}
+
+static size_t sparseIndexAt(const std::string &value, size_t entry)
+{
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(value.data()) + LettuceHyperLogLog::headerSize + entry * LettuceHyperLogLog::sparseEntrySize;
+  return (static_cast<size_t>(data[0]) << 8) | data[1];
+}
+
+static uint8_t sparseValueAt(const std::string &value, size_t entry)
+{
+  return static_cast<uint8_t>(value[LettuceHyperLogLog::headerSize + entry * LettuceHyperLogLog::sparseEntrySize + 2]);
+}
+
+static std::string encodeSparse(const uint8_t *registers)
+{
+  std::string value = makeHeader(LettuceHyperLogLog::encodingSparse);
+  for (size_t i = 0; i < LettuceHyperLogLog::registerCount; i++)
+  {
+    if (registers[i] == 0)
+      continue;
+    value.push_back(static_cast<char>(i >> 8));
+    value.push_back(static_cast<char>(i & 0xff));
+    value.push_back(static_cast<char>(registers[i]));
+  }
+  return value;
+}
+
+/* Hashing */
+uint64_t LettuceHyperLogLog::hash(const void *key, size_t length, uint64_t seed)
+{
+  // MurmurHash64A
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (length * m);
+  const uint8_t *data = static_cast<const uint8_t *>(key);
+  const uint8_t *end = data + (length - (length & 7));
+
+  while (data != end)
+  {
+    uint64_t k;
+    memcpy(&k, data, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+    data += 8;
+  }
+
+  switch (length & 7)
+  {
+  case 7:
+    h ^= static_cast<uint64_t>(data[6]) << 48;
+    [[fallthrough]];
+  case 6:
+    h ^= static_cast<uint64_t>(data[5]) << 40;
+    [[fallthrough]];
+  case 5:
+    h ^= static_cast<uint64_t>(data[4]) << 32;
+    [[fallthrough]];
+  case 4:
+    h ^= static_cast<uint64_t>(data[3]) << 24;
+    [[fallthrough]];
+  case 3:
+    h ^= static_cast<uint64_t>(data[2]) << 16;
+    [[fallthrough]];
+  case 2:
+    h ^= static_cast<uint64_t>(data[1]) << 8;
+    [[fallthrough]];
+  case 1:
+    h ^= static_cast<uint64_t>(data[0]);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// register index comes from the low bits, the run of zeros (+1) from the rest
+static void hashElement(const std::string &element, size_t &index, uint8_t &count)
+{
+  uint64_t hash = LettuceHyperLogLog::hash(element.data(), element.size(), hllSeed);
+  index = hash & (LettuceHyperLogLog::registerCount - 1);
+  hash >>= LettuceHyperLogLog::precision;
+  hash |= 1ULL << hllQ; // guarantees the loop terminates and caps the count at hllQ + 1
+  count = static_cast<uint8_t>(__builtin_ctzll(hash) + 1);
+}
+
+/* Public api */
+std::string LettuceHyperLogLog::create()
+{
+  std::string value = makeHeader(encodingSparse);
+  setCachedCount(value, 0);
+  return value;
+}
+
+bool LettuceHyperLogLog::isValid(const std::string &value)
+{
+  if (value.size() < headerSize || memcmp(value.data(), hllMagic, 4) != 0)
+    return false;
+  if (value[4] == encodingDense)
+    return value.size() == denseSize;
+  if (value[4] != encodingSparse)
+    return false;
+  if ((value.size() - headerSize) % sparseEntrySize != 0 || value.size() - headerSize > sparseMaxBytes)
+    return false;
+  // the entries are decoded straight into a registerCount array, so a crafted value must not be
+  // able to point outside it or hold a count the estimator has no bucket for
+  size_t entries = sparseEntries(value);
+  for (size_t entry = 0; entry < entries; entry++)
+  {
+    size_t index = sparseIndexAt(value, entry);
+    uint8_t count = sparseValueAt(value, entry);
+    if (index >= registerCount || count == 0 || count > hllQ + 1)
+      return false;
+    if (entry > 0 && index <= sparseIndexAt(value, entry - 1))
+      return false;
+  }
+  return true;
+}
+
+bool LettuceHyperLogLog::isSparse(const std::string &value)
+{
+  return value[4] == encodingSparse;
+}
+
+bool LettuceHyperLogLog::add(std::string &value, const std::string &element)
+{
+  size_t index;
+  uint8_t count;
+  hashElement(element, index, count);
+
+  if (!isSparse(value))
+  {
+    uint8_t *registers = reinterpret_cast<uint8_t *>(&value[headerSize]);
+    if (denseGet(registers, index) >= count)
+      return false;
+    denseSet(registers, index, count);
+    invalidateCache(value);
+    return true;
+  }
+
+  // binary search the sorted entries for the register
+  size_t low = 0, high = sparseEntries(value);
+  while (low < high)
+  {
+    size_t middle = (low + high) / 2;
+    if (sparseIndexAt(value, middle) < index)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  size_t offset = headerSize + low * sparseEntrySize;
+  if (low < sparseEntries(value) && sparseIndexAt(value, low) == index)
+  {
+    if (sparseValueAt(value, low) >= count)
+      return false;
+    value[offset + 2] = static_cast<char>(count);
+    invalidateCache(value);
+    return true;
+  }
+
+  const char entry[3] = {static_cast<char>(index >> 8), static_cast<char>(index & 0xff), static_cast<char>(count)};
+  value.insert(offset, entry, sparseEntrySize);
+  if (value.size() - headerSize > sparseMaxBytes)
+  {
+    std::vector<uint8_t> registers(registerCount);
+    toRegisters(value, registers.data());
+    value = encodeDense(registers.data());
+  }
+  invalidateCache(value);
+  return true;
+}
+
+void LettuceHyperLogLog::toRegisters(const std::string &value, uint8_t *registers)
+{
+  if (isSparse(value))
+  {
+    memset(registers, 0, registerCount);
+    for (size_t entry = 0; entry < sparseEntries(value); entry++)
+      registers[sparseIndexAt(value, entry)] = sparseValueAt(value, entry);
+    return;
+  }
+  denseUnpack(reinterpret_cast<const uint8_t *>(value.data()) + headerSize, registers);
+}
+
+uint64_t LettuceHyperLogLog::count(std::string &value)
+{
+  uint64_t cached;
+  if (getCachedCount(value, cached))
+    return cached;
+
+  std::vector<uint8_t> registers(registerCount);
+  toRegisters(value, registers.data());
+  uint64_t estimate = hllEstimate(registers.data());
+  setCachedCount(value, estimate);
+  return estimate;
+}
+
+uint64_t LettuceHyperLogLog::countUnion(const std::vector<const std::string *> &values)
+{
+  std::vector<uint8_t> registers(registerCount, 0);
+  std::vector<uint8_t> other(registerCount);
+  for (const std::string *value : values)
+  {
+    toRegisters(*value, other.data());
+    hllMergeRegisters(registers.data(), other.data());
+  }
+  return hllEstimate(registers.data());
+}
+
+void LettuceHyperLogLog::merge(std::string &dest, const std::vector<const std::string *> &sources)
+{
+  std::vector<uint8_t> registers(registerCount);
+  std::vector<uint8_t> other(registerCount);
+  toRegisters(dest, registers.data());
+  bool allSparse = isSparse(dest);
+  for (const std::string *source : sources)
+  {
+    allSparse &= isSparse(*source);
+    toRegisters(*source, other.data());
+    hllMergeRegisters(registers.data(), other.data());
+  }
+
+  if (allSparse)
+  {
+    size_t used = 0;
+    for (size_t i = 0; i < registerCount; i++)
+      used += registers[i] != 0;
+    if (used * sparseEntrySize <= sparseMaxBytes)
+    {
+      dest = encodeSparse(registers.data());
+      return;
+    }
+  }
+  dest = encodeDense(registers.data());
+}
+
+/* Register kernels */
+void hllMergeRegisters(uint8_t *registers, const uint8_t *other)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= LettuceHyperLogLog::registerCount; i += 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(registers + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(other + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(registers + i), _mm_max_epu8(a, b));
+  }
+#endif
+  for (; i < LettuceHyperLogLog::registerCount; i++)
+  {
+    if (other[i] > registers[i])
+      registers[i] = other[i];
+  }
+}
+
+static double hllTau(double x)
+{
+  if (x == 0. || x == 1.)
+    return 0.;
+  double zPrime;
+  double y = 1.0;
+  double z = 1 - x;
+  do
+  {
+    x = sqrt(x);
+    zPrime = z;
+    y *= 0.5;
+    z -= pow(1 - x, 2) * y;
+  } while (zPrime != z);
+  return z / 3;
+}
+
+static double hllSigma(double x)
+{
+  if (x == 1.)
+    return INFINITY;
+  double zPrime;
+  double y = 1;
+  double z = x;
+  do
+  {
+    x *= x;
+    zPrime = z;
+    z += x * y;
+    y += y;
+  } while (zPrime != z);
+  return z;
+}
+
+// Ertl's improved estimator, works from the register histogram so needs no bias tables
+uint64_t hllEstimate(const uint8_t *registers)
+{
+  // four partial histograms break the store to load dependency between neighbouring registers
+  uint32_t partial[4][64] = {};
+  for (size_t i = 0; i < LettuceHyperLogLog::registerCount; i += 4)
+  {
+    partial[0][registers[i]]++;
+    partial[1][registers[i + 1]]++;
+    partial[2][registers[i + 2]]++;
+    partial[3][registers[i + 3]]++;
+  }
+  uint32_t histogram[64];
+  for (int j = 0; j < 64; j++)
+    histogram[j] = partial[0][j] + partial[1][j] + partial[2][j] + partial[3][j];
+
+  double m = LettuceHyperLogLog::registerCount;
+  double z = m * hllTau((m - histogram[hllQ + 1]) / m);
+  for (int j = hllQ; j >= 1; j--)
+  {
+    z += histogram[j];
+    z *= 0.5;
+  }
+  z += m * hllSigma(histogram[0] / m);
+  return static_cast<uint64_t>(llroundl(hllAlphaInf * m * m / z));
+}
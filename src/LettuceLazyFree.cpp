@@ -0,0 +1,81 @@
+#include "../include/LettuceLazyFree.h"
+
+LettuceLazyFree &LettuceLazyFree::getInstance()
+{
+  static LettuceLazyFree instance;
+  return instance;
+}
+
+LettuceLazyFree::~LettuceLazyFree()
+{
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopping = true;
+  }
+  queueReady.notify_one();
+  if (worker.joinable())
+    worker.join();
+}
+
+void LettuceLazyFree::enqueue(Item item)
+{
+  {
+    // the queue's own nodes aren't part of any value
+    LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+    std::lock_guard<std::mutex> lock(queueMutex);
+    // the thread is only started the first time something is freed lazily
+    if (!worker.joinable())
+      worker = std::thread(&LettuceLazyFree::run, this);
+    queue.push_back(std::move(item));
+    pendingCount++;
+  }
+  queueReady.notify_one();
+}
+
+void LettuceLazyFree::run()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  while (true)
+  {
+    queueReady.wait(lock, [this]()
+                    { return stopping || !queue.empty(); });
+    if (queue.empty())
+      return;
+
+    // swap the whole batch out so the lock isn't held while destructors run
+    std::deque<Item> batch;
+    batch.swap(queue);
+    busy = true;
+    lock.unlock();
+    size_t count = batch.size();
+    for (Item &item : batch)
+    {
+      LettuceMemory::Scope scope(item.category);
+      item.value.reset();
+    }
+    batch.clear();
+    pendingCount -= count;
+    freedCount += count;
+    lock.lock();
+    busy = false;
+    if (queue.empty())
+      queueIdle.notify_all();
+  }
+}
+
+size_t LettuceLazyFree::pending() const
+{
+  return pendingCount;
+}
+
+size_t LettuceLazyFree::freed() const
+{
+  return freedCount;
+}
+
+void LettuceLazyFree::waitUntilIdle()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  queueIdle.wait(lock, [this]()
+                 { return queue.empty() && !busy; });
+}
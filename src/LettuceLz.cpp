@@ -0,0 +1,189 @@
+#include "../include/LettuceLz.h"
+
+#include <cstring>
+
+static const int hashBits = 14;
+static const size_t minMatch = 4;
+static const size_t lastLiterals = 5;   // a match never reaches into the last 5 bytes
+static const size_t matchStartLimit = 12; // and never starts in the last 12
+static const size_t maxOffset = 65535;
+
+static inline uint32_t read32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+static inline uint32_t hashSequence(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+// length of the common run of a and b, stopping at limit
+static inline size_t matchLength(const uint8_t *a, const uint8_t *b, const uint8_t *limit)
+{
+  const uint8_t *start = b;
+  while (b + 8 <= limit)
+  {
+    uint64_t x, y;
+    memcpy(&x, a, 8);
+    memcpy(&y, b, 8);
+    if (x != y)
+      return (b - start) + (__builtin_ctzll(x ^ y) >> 3); // little endian: the lowest differing byte
+    a += 8;
+    b += 8;
+  }
+  while (b < limit && *a == *b)
+  {
+    a++;
+    b++;
+  }
+  return b - start;
+}
+
+static inline bool writeLength(uint8_t *&op, const uint8_t *end, size_t length)
+{
+  while (length >= 255)
+  {
+    if (op >= end)
+      return false;
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op >= end)
+    return false;
+  *op++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+// literals [anchor, ip) then a match of matchLen at offset, or no match when matchLen is 0
+static inline bool writeSequence(uint8_t *&op, const uint8_t *end, const uint8_t *anchor, size_t literals, size_t offset, size_t matchLen)
+{
+  if (op >= end)
+    return false;
+  uint8_t *token = op++;
+  *token = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+  if (literals >= 15 && !writeLength(op, end, literals - 15))
+    return false;
+  if (static_cast<size_t>(end - op) < literals)
+    return false;
+  memcpy(op, anchor, literals);
+  op += literals;
+  if (matchLen == 0)
+    return true;
+
+  if (end - op < 2)
+    return false;
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  size_t extra = matchLen - minMatch;
+  *token |= static_cast<uint8_t>(extra >= 15 ? 15 : extra);
+  return extra < 15 || writeLength(op, end, extra - 15);
+}
+
+size_t lzCompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity)
+{
+  uint8_t *op = out;
+  const uint8_t *end = out + capacity;
+  const uint8_t *anchor = in;
+
+  if (length > matchStartLimit)
+  {
+    uint32_t table[1 << hashBits] = {};
+    const uint8_t *ip = in;
+    const uint8_t *matchLimit = in + length - lastLiterals;
+    const uint8_t *startLimit = in + length - matchStartLimit;
+    while (ip < startLimit)
+    {
+      uint32_t sequence = read32(ip);
+      uint32_t h = hashSequence(sequence);
+      const uint8_t *candidate = in + table[h];
+      table[h] = static_cast<uint32_t>(ip - in);
+      if (candidate >= ip || static_cast<size_t>(ip - candidate) > maxOffset || read32(candidate) != sequence)
+      {
+        // incompressible stretches are skipped faster the longer they get
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      // the match may start before the 4 bytes that found it
+      while (ip > anchor && candidate > in && ip[-1] == candidate[-1])
+      {
+        ip--;
+        candidate--;
+      }
+      size_t matchLen = minMatch + matchLength(candidate + minMatch, ip + minMatch, matchLimit);
+      if (!writeSequence(op, end, anchor, ip - anchor, ip - candidate, matchLen))
+        return 0;
+      ip += matchLen;
+      anchor = ip;
+      // a position inside the match keeps the table useful for runs
+      if (ip - 2 > in && ip < startLimit)
+        table[hashSequence(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - in);
+    }
+  }
+
+  if (!writeSequence(op, end, anchor, in + length - anchor, 0, 0))
+    return 0;
+  return op - out;
+}
+
+bool lzDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t outLength)
+{
+  size_t ip = 0, op = 0;
+  auto readLength = [&](size_t &value)
+  {
+    uint8_t byte;
+    do
+    {
+      if (ip >= length)
+        return false;
+      byte = in[ip++];
+      value += byte;
+    } while (byte == 255);
+    return true;
+  };
+
+  while (true)
+  {
+    if (ip >= length)
+      return false;
+    uint8_t token = in[ip++];
+    size_t literals = token >> 4;
+    if (literals == 15 && !readLength(literals))
+      return false;
+    if (literals > length - ip || literals > outLength - op)
+      return false;
+    memcpy(out + op, in + ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == length)
+      return op == outLength;
+
+    if (length - ip < 2)
+      return false;
+    size_t offset = in[ip] | (static_cast<size_t>(in[ip + 1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op)
+      return false;
+    size_t matchLen = token & 15;
+    if (matchLen == 15 && !readLength(matchLen))
+      return false;
+    matchLen += minMatch;
+    if (matchLen > outLength - op)
+      return false;
+
+    uint8_t *dest = out + op;
+    const uint8_t *source = dest - offset;
+    if (offset >= matchLen)
+      memcpy(dest, source, matchLen);
+    else
+    {
+      // overlapping copy repeats the last offset bytes, a run
+      for (size_t i = 0; i < matchLen; i++)
+        dest[i] = source[i];
+    }
+    op += matchLen;
+  }
+}
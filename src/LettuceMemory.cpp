@@ -0,0 +1,173 @@
+#include "../include/LettuceMemory.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <malloc.h>
+#include <unistd.h>
+
+// constant initialized, so allocations made before main (static constructors) are counted too
+static std::atomic<size_t> usedBytes{0};
+static std::atomic<size_t> peakBytes{0};
+static std::atomic<size_t> categoryBytes[LettuceMemory::Categories];
+static thread_local LettuceMemory::Category currentCategory = LettuceMemory::Untracked;
+
+LettuceMemory::Scope::Scope(Category category) : previous(currentCategory)
+{
+  currentCategory = category;
+}
+
+LettuceMemory::Scope::~Scope()
+{
+  currentCategory = previous;
+}
+
+size_t LettuceMemory::used()
+{
+  return usedBytes.load(std::memory_order_relaxed);
+}
+
+size_t LettuceMemory::used(Category category)
+{
+  return categoryBytes[category].load(std::memory_order_relaxed);
+}
+
+size_t LettuceMemory::peak()
+{
+  return peakBytes.load(std::memory_order_relaxed);
+}
+
+size_t LettuceMemory::rss()
+{
+  // second field of statm is the resident page count
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (!statm)
+    return 0;
+  unsigned long size = 0, resident = 0;
+  int fields = fscanf(statm, "%lu %lu", &size, &resident);
+  fclose(statm);
+  return fields == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+const char *LettuceMemory::categoryName(Category category)
+{
+  switch (category)
+  {
+  case Strings:
+    return "strings";
+  case Lists:
+    return "lists";
+  case Hashes:
+    return "hashes";
+  case Sets:
+    return "sets";
+  case Expires:
+    return "expires";
+  default:
+    return "untracked";
+  }
+}
+
+size_t LettuceMemory::allocationSize(size_t size)
+{
+  size_t chunk = (size + sizeof(size_t) + 15) & ~static_cast<size_t>(15);
+  return (chunk < 32 ? 32 : chunk) - sizeof(size_t);
+}
+
+size_t LettuceMemory::heapSize(const std::string &value)
+{
+  // a short string lives in the buffer inside the object itself
+  const char *data = value.data();
+  const char *object = reinterpret_cast<const char *>(&value);
+  if (data >= object && data < object + sizeof(value))
+    return 0;
+  return malloc_usable_size(const_cast<char *>(data));
+}
+
+size_t LettuceMemory::heapSize(const void *pointer)
+{
+  return pointer ? malloc_usable_size(const_cast<void *>(pointer)) : 0;
+}
+
+static void *allocate(size_t size) noexcept
+{
+  void *pointer = malloc(size ? size : 1);
+  if (!pointer)
+    return nullptr;
+  size_t usable = malloc_usable_size(pointer);
+  size_t now = usedBytes.fetch_add(usable, std::memory_order_relaxed) + usable;
+  if (currentCategory != LettuceMemory::Untracked)
+    categoryBytes[currentCategory].fetch_add(usable, std::memory_order_relaxed);
+  // the peak only moves while memory grows past it, so this rarely loops
+  size_t peak = peakBytes.load(std::memory_order_relaxed);
+  while (now > peak && !peakBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+    ;
+  return pointer;
+}
+
+static void release(void *pointer) noexcept
+{
+  if (!pointer)
+    return;
+  size_t usable = malloc_usable_size(pointer);
+  usedBytes.fetch_sub(usable, std::memory_order_relaxed);
+  if (currentCategory != LettuceMemory::Untracked)
+    categoryBytes[currentCategory].fetch_sub(usable, std::memory_order_relaxed);
+  free(pointer);
+}
+void *operator new(size_t size)
+{
+  void *pointer = allocate(size);
+  if (!pointer)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new[](size_t size)
+{
+  void *pointer = allocate(size);
+  if (!pointer)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+  release(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+  release(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  release(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+  release(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+  release(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+  release(pointer);
+}
@@ -0,0 +1,261 @@
+#include "../include/LettuceRadixTree.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+LettuceRadixTree::LettuceRadixTree() : root(std::make_unique<Node>()) {}
+
+LettuceRadixTree::~LettuceRadixTree()
+{
+  destroy(std::move(root));
+}
+
+// frees a subtree one node at a time - letting unique_ptr do it recurses once per level
+void LettuceRadixTree::destroy(std::unique_ptr<Node> node)
+{
+  std::vector<std::unique_ptr<Node>> pending;
+  pending.push_back(std::move(node));
+  while (!pending.empty())
+  {
+    std::unique_ptr<Node> current = std::move(pending.back());
+    pending.pop_back();
+    for (auto &child : current->children)
+      pending.push_back(std::move(child));
+  }
+}
+
+std::vector<std::unique_ptr<LettuceRadixTree::Node>>::iterator LettuceRadixTree::findChild(Node *node, char c)
+{
+  return std::lower_bound(node->children.begin(), node->children.end(), c,
+                          [](const std::unique_ptr<Node> &child, char value)
+                          { return static_cast<unsigned char>(child->label[0]) < static_cast<unsigned char>(value); });
+}
+
+static size_t commonPrefixLength(const std::string &label, const std::string &key, size_t position)
+{
+  size_t length = 0;
+  while (length < label.size() && position + length < key.size() && label[length] == key[position + length])
+    length++;
+  return length;
+}
+
+bool LettuceRadixTree::insert(const std::string &key)
+{
+  Node *node = root.get();
+  size_t position = 0;
+  while (true)
+  {
+    if (position == key.size())
+    {
+      if (node->isKey)
+        return false;
+      node->isKey = true;
+      keys++;
+      return true;
+    }
+
+    auto it = findChild(node, key[position]);
+    if (it == node->children.end() || (*it)->label[0] != key[position])
+    {
+      auto leaf = std::make_unique<Node>();
+      leaf->label = key.substr(position);
+      leaf->isKey = true;
+      labelBytes += leaf->label.size();
+      node->children.insert(it, std::move(leaf));
+      nodes++;
+      keys++;
+      return true;
+    }
+
+    Node *child = it->get();
+    size_t common = commonPrefixLength(child->label, key, position);
+    if (common < child->label.size())
+    {
+      // split the edge: the shared part becomes a new node above the old child
+      auto middle = std::make_unique<Node>();
+      middle->label = child->label.substr(0, common);
+      child->label.erase(0, common);
+      middle->children.push_back(std::move(*it));
+      *it = std::move(middle);
+      nodes++;
+      child = it->get();
+    }
+    node = child;
+    position += common;
+  }
+}
+
+void LettuceRadixTree::mergeWithOnlyChild(Node *node)
+{
+  std::unique_ptr<Node> child = std::move(node->children.front());
+  node->label += child->label;
+  node->isKey = child->isKey;
+  node->children = std::move(child->children);
+  nodes--;
+}
+
+bool LettuceRadixTree::remove(const std::string &key)
+{
+  // remember the path so empty nodes can be pruned on the way back up
+  std::vector<Node *> path{root.get()};
+  Node *node = root.get();
+  size_t position = 0;
+  while (position < key.size())
+  {
+    auto it = findChild(node, key[position]);
+    if (it == node->children.end() || (*it)->label[0] != key[position])
+      return false;
+    Node *child = it->get();
+    if (key.compare(position, child->label.size(), child->label) != 0)
+      return false;
+    position += child->label.size();
+    node = child;
+    path.push_back(node);
+  }
+  if (!node->isKey)
+    return false;
+  node->isKey = false;
+  keys--;
+
+  if (node == root.get())
+    return true;
+
+  Node *parent = path[path.size() - 2];
+  if (node->children.empty())
+  {
+    auto it = findChild(parent, node->label[0]);
+    labelBytes -= node->label.size();
+    parent->children.erase(it);
+    nodes--;
+    // the parent may now be a pass through node with a single child
+    if (parent != root.get() && !parent->isKey && parent->children.size() == 1)
+      mergeWithOnlyChild(parent);
+  }
+  else if (node->children.size() == 1)
+  {
+    mergeWithOnlyChild(node);
+  }
+  return true;
+}
+
+bool LettuceRadixTree::contains(const std::string &key) const
+{
+  const Node *node = root.get();
+  size_t position = 0;
+  while (position < key.size())
+  {
+    auto it = findChild(const_cast<Node *>(node), key[position]);
+    if (it == node->children.end() || (*it)->label[0] != key[position])
+      return false;
+    const Node *child = it->get();
+    if (key.compare(position, child->label.size(), child->label) != 0)
+      return false;
+    position += child->label.size();
+    node = child;
+  }
+  return node->isKey;
+}
+
+void LettuceRadixTree::clear()
+{
+  destroy(std::move(root));
+  root = std::make_unique<Node>();
+  keys = 0;
+  nodes = 1;
+  labelBytes = 0;
+}
+
+// depth first with an explicit stack, a tree of nested key names can be as deep as the keys are long
+// with after set, only keys sorting strictly after it are visited - a subtree whose path already
+// sorts below after is skipped whole, one whose path sorts above it is visited without comparing
+void LettuceRadixTree::collect(const Node *start, std::string &path, const std::string *after, const std::function<bool(const std::string &)> &visit)
+{
+  struct Frame
+  {
+    const Node *node;
+    size_t pathLength;
+    bool bounded; // path is a prefix of after, so the subtree can hold keys on both sides of it
+    size_t next = 0;
+  };
+  std::vector<Frame> stack;
+
+  // path holds the node's full key, false once visit asked to stop
+  auto enter = [&](const Node *node, bool bounded)
+  {
+    if (bounded)
+    {
+      if (path.size() <= after->size() && after->compare(0, path.size(), path) == 0)
+      {
+        // the node's own key is after itself or one of its prefixes, only children can come later
+        stack.push_back({node, path.size(), true});
+        return true;
+      }
+      if (path.compare(*after) < 0)
+        return true;
+    }
+    if (node->isKey && !visit(path))
+      return false;
+    stack.push_back({node, path.size(), false});
+    return true;
+  };
+
+  if (!enter(start, after != nullptr))
+    return;
+  while (!stack.empty())
+  {
+    Frame &frame = stack.back();
+    if (frame.next == frame.node->children.size())
+    {
+      stack.pop_back();
+      continue;
+    }
+    const Node *child = frame.node->children[frame.next++].get();
+    path.resize(frame.pathLength);
+    path += child->label;
+    if (!enter(child, frame.bounded))
+      return;
+  }
+}
+
+void LettuceRadixTree::forEachWithPrefix(const std::string &prefix, const std::function<bool(const std::string &)> &visit) const
+{
+  forEachWithPrefix(prefix, nullptr, visit);
+}
+
+void LettuceRadixTree::forEachWithPrefix(const std::string &prefix, const std::string *after, const std::function<bool(const std::string &)> &visit) const
+{
+  const Node *node = root.get();
+  std::string path;
+  size_t position = 0;
+  while (position < prefix.size())
+  {
+    auto it = findChild(const_cast<Node *>(node), prefix[position]);
+    if (it == node->children.end() || (*it)->label[0] != prefix[position])
+      return;
+    const Node *child = it->get();
+    size_t common = commonPrefixLength(child->label, prefix, position);
+    // the prefix can end part way along an edge, everything below it still matches
+    if (position + common < prefix.size() && common < child->label.size())
+      return;
+    path += child->label;
+    position += common;
+    node = child;
+  }
+  collect(node, path, after, visit);
+}
+
+size_t LettuceRadixTree::size() const
+{
+  return keys;
+}
+
+size_t LettuceRadixTree::nodeCount() const
+{
+  return nodes;
+}
+
+size_t LettuceRadixTree::memoryUsage() const
+{
+  return nodes * (sizeof(Node) + sizeof(std::unique_ptr<Node>)) + labelBytes;
+}
@@ -0,0 +1,151 @@
+#include "../include/LettuceReply.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+
+static thread_local int threadProtocol = 2;
+
+int LettuceReply::currentProtocol()
+{
+  return threadProtocol;
+}
+
+void LettuceReply::setCurrentProtocol(int protocol)
+{
+  threadProtocol = protocol;
+}
+
+LettuceReply::LettuceReply(int protocol) : version(protocol) {}
+
+// integers are formatted on the stack so nothing but the reply buffer itself allocates
+void LettuceReply::number(int64_t value)
+{
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  buffer.append(digits, result.ptr - digits);
+}
+
+void LettuceReply::header(char type, size_t count)
+{
+  buffer += type;
+  number(static_cast<int64_t>(count));
+  buffer += "\r\n";
+}
+
+LettuceReply &LettuceReply::simple(std::string_view value)
+{
+  buffer += '+';
+  buffer += value;
+  buffer += "\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::error(std::string_view message)
+{
+  buffer += '-';
+  buffer += message;
+  buffer += "\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::integer(int64_t value)
+{
+  buffer += ':';
+  number(value);
+  buffer += "\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::bulk(std::string_view value)
+{
+  header('$', value.size());
+  buffer += value;
+  buffer += "\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::null()
+{
+  buffer += version >= 3 ? "_\r\n" : "$-1\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::nullArray()
+{
+  buffer += version >= 3 ? "_\r\n" : "*-1\r\n";
+  return *this;
+}
+
+LettuceReply &LettuceReply::array(size_t count)
+{
+  header('*', count);
+  return *this;
+}
+
+LettuceReply &LettuceReply::map(size_t pairs)
+{
+  if (version >= 3)
+    header('%', pairs);
+  else
+    header('*', pairs * 2);
+  return *this;
+}
+
+LettuceReply &LettuceReply::set(size_t count)
+{
+  header(version >= 3 ? '~' : '*', count);
+  return *this;
+}
+
+LettuceReply &LettuceReply::push(size_t count)
+{
+  header(version >= 3 ? '>' : '*', count);
+  return *this;
+}
+
+LettuceReply &LettuceReply::doubleValue(double value)
+{
+  char digits[32];
+  int length;
+  if (std::isinf(value))
+    length = snprintf(digits, sizeof(digits), "%s", value > 0 ? "inf" : "-inf");
+  else if (std::isnan(value))
+    length = snprintf(digits, sizeof(digits), "nan");
+  else
+    length = snprintf(digits, sizeof(digits), "%.17g", value);
+  std::string_view text(digits, length);
+  if (version >= 3)
+  {
+    buffer += ',';
+    buffer += text;
+    buffer += "\r\n";
+  }
+  else
+    bulk(text);
+  return *this;
+}
+
+LettuceReply &LettuceReply::boolean(bool value)
+{
+  if (version >= 3)
+    buffer += value ? "#t\r\n" : "#f\r\n";
+  else
+    buffer += value ? ":1\r\n" : ":0\r\n";
+  return *this;
+}
+
+void LettuceReply::reserve(size_t bytes)
+{
+  buffer.reserve(bytes);
+}
+
+std::string LettuceReply::take()
+{
+  return std::move(buffer);
+}
+
+int LettuceReply::protocol() const
+{
+  return version;
+}
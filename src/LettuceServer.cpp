@@ -1,6 +1,5 @@
 #include "../include/LettuceServer.h"
 #include "../include/LettuceCommandHandler.h"
-#include "../include/LettuceDatabase.h"
 
 #include <iostream>
 #include <sys/socket.h>
@@ -9,6 +8,8 @@
 #include <thread>
 #include <vector>
 #include <signal.h>
+#include <poll.h>
+#include <cstring>
 
 static LettuceServer *globalServer = nullptr;
 
@@ -38,6 +39,8 @@ void LettuceServer::shutdown()
   isRunning = false;
   if (serverSocket != -1)
   {
+    // close alone doesn't wake a thread blocked in accept
+    ::shutdown(serverSocket, SHUT_RDWR);
     close(serverSocket);
   }
   std::cout << "Server shutdown." << std::endl;
@@ -84,7 +87,6 @@ void LettuceServer::run()
   std::cout << "Lettuce server listening on port " << port << std::endl;
 
   std::vector<std::thread> threads;
-  LettuceCommandHandler commandHandler;
   while (isRunning)
   {
     int clientSocket = accept(serverSocket, nullptr, nullptr);
@@ -101,15 +103,25 @@ void LettuceServer::run()
 
     // start new thread and add to thread vector
     // take clientsocket by value so each thread owns its copy of socket
-    // commandhandler as reference, because we want to share it between threads
-    threads.emplace_back([clientSocket, &commandHandler]()
+    // each connection gets its own commandhandler, it holds the MULTI/WATCH state for that client
+    threads.emplace_back([clientSocket]()
                          {
+        LettuceCommandHandler commandHandler;
         char buffer[1024];
+        std::cout << "Waiting for command..." << std::endl;
         while (true)
         {
-          memset(buffer, 0, sizeof(buffer)); // clear the buffer
+          // wake up every 100ms so client tracking invalidations reach idle clients too
+          pollfd pollClient{clientSocket, POLLIN, 0};
+          if (poll(&pollClient, 1, 100) == 0)
+          {
+            std::string pushes = commandHandler.pendingPushes();
+            if (!pushes.empty())
+              send(clientSocket, pushes.c_str(), pushes.size(), 0);
+            continue;
+          }
 
-          std::cout << "Waiting for command..." << std::endl;
+          memset(buffer, 0, sizeof(buffer)); // clear the buffer
           int receivedBytes = recv(clientSocket, buffer, sizeof(buffer)-1, 0); // read up to 1023 bytes from the client
 
           if (receivedBytes <= 0)
@@ -131,14 +143,5 @@ void LettuceServer::run()
       if (thread.joinable())
         thread.join();
     }
-
-    if (LettuceDatabase::getInstance().dump("dump.ldb"))
-    {
-      std::cout << "Database dumped to dump.ldb" << std::endl;
-    }
-    else
-    {
-      std::cout << "-ERR: failed to dump database" << std::endl;
-    }
   }
 }
\ No newline at end of file
@@ -0,0 +1,422 @@
+#include "../include/LettuceSet.h"
+#include "../include/LettuceScan.h"
+#include "../include/LettuceDefrag.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LETTUCE_X86 1
+#endif
+
+bool LettuceSet::parseInteger(const std::string &member, int64_t &value)
+{
+  if (member.empty() || member.size() > 20)
+    return false;
+  size_t pos = 0;
+  bool negative = member[0] == '-';
+  if (negative)
+    pos++;
+  if (pos >= member.size())
+    return false;
+  // no leading zeros, and "-0" is not canonical either
+  if (member[pos] == '0' && (member.size() - pos > 1 || negative))
+    return false;
+
+  uint64_t magnitude = 0;
+  for (; pos < member.size(); pos++)
+  {
+    char c = member[pos];
+    if (c < '0' || c > '9')
+      return false;
+    uint64_t digit = c - '0';
+    if (magnitude > (UINT64_MAX - digit) / 10)
+      return false;
+    magnitude = magnitude * 10 + digit;
+  }
+
+  if (negative)
+  {
+    if (magnitude > static_cast<uint64_t>(INT64_MAX) + 1)
+      return false;
+    value = static_cast<int64_t>(0 - magnitude);
+  }
+  else
+  {
+    if (magnitude > static_cast<uint64_t>(INT64_MAX))
+      return false;
+    value = static_cast<int64_t>(magnitude);
+  }
+  return true;
+}
+
+void LettuceSet::convertToHashtable()
+{
+  hashtable.reserve(intset.size());
+  for (int64_t value : intset)
+    hashtable.insert(std::to_string(value));
+  intset.clear();
+  intset.shrink_to_fit();
+  intsetEncoded = false;
+}
+
+bool LettuceSet::add(const std::string &member)
+{
+  if (intsetEncoded)
+  {
+    int64_t value;
+    if (parseInteger(member, value))
+    {
+      auto position = std::lower_bound(intset.begin(), intset.end(), value);
+      if (position != intset.end() && *position == value)
+        return false;
+      if (intset.size() < maxIntsetEntries)
+      {
+        intset.insert(position, value);
+        return true;
+      }
+    }
+    convertToHashtable();
+  }
+  return hashtable.insert(member).second;
+}
+
+bool LettuceSet::remove(const std::string &member)
+{
+  if (intsetEncoded)
+  {
+    int64_t value;
+    if (!parseInteger(member, value))
+      return false;
+    auto position = std::lower_bound(intset.begin(), intset.end(), value);
+    if (position == intset.end() || *position != value)
+      return false;
+    intset.erase(position);
+    return true;
+  }
+  return hashtable.erase(member) > 0;
+}
+
+bool LettuceSet::contains(const std::string &member) const
+{
+  if (intsetEncoded)
+  {
+    int64_t value;
+    if (!parseInteger(member, value))
+      return false;
+    return std::binary_search(intset.begin(), intset.end(), value);
+  }
+  return hashtable.find(member) != hashtable.end();
+}
+
+size_t LettuceSet::size() const
+{
+  return intsetEncoded ? intset.size() : hashtable.size();
+}
+
+bool LettuceSet::empty() const
+{
+  return size() == 0;
+}
+
+bool LettuceSet::isIntset() const
+{
+  return intsetEncoded;
+}
+
+const std::vector<int64_t> &LettuceSet::intsetValues() const
+{
+  return intset;
+}
+
+const LettuceDictSet<std::string> &LettuceSet::hashtableValues() const
+{
+  return hashtable;
+}
+
+LettuceSet LettuceSet::fromIntset(std::vector<int64_t> values)
+{
+  LettuceSet set;
+  set.intset = std::move(values);
+  return set;
+}
+
+LettuceSet LettuceSet::fromHashtable(LettuceDictSet<std::string> values)
+{
+  LettuceSet set;
+  set.intsetEncoded = false;
+  set.hashtable = std::move(values);
+  return set;
+}
+
+bool LettuceSet::defrag()
+{
+  return intsetEncoded && LettuceDefrag::relocate(intset);
+}
+
+std::vector<std::string> LettuceSet::members() const
+{
+  std::vector<std::string> result;
+  result.reserve(size());
+  if (intsetEncoded)
+  {
+    for (int64_t value : intset)
+      result.push_back(std::to_string(value));
+  }
+  else
+  {
+    for (const auto &member : hashtable)
+      result.push_back(member);
+  }
+  return result;
+}
+
+uint64_t LettuceSet::scan(uint64_t cursor, size_t count, std::vector<std::string> &out) const
+{
+  if (intsetEncoded)
+  {
+    // a position in the intset would shift under inserts and removes and mean nothing once the set
+    // turns into a hashtable, so (like redis does for its small encodings) it all goes in one reply -
+    // intsets are capped at maxIntsetEntries
+    for (int64_t value : intset)
+      out.push_back(std::to_string(value));
+    return 0;
+  }
+  return scanBuckets(hashtable, cursor, count, [&out](const std::string &member)
+                     { out.push_back(member); });
+}
+
+/* Set algebra - a nullptr in sets is treated as an empty (missing) set */
+std::vector<std::string> LettuceSet::intersect(const std::vector<const LettuceSet *> &sets)
+{
+  if (sets.empty())
+    return {};
+  for (const LettuceSet *set : sets)
+  {
+    if (set == nullptr || set->empty())
+      return {};
+  }
+
+  // smallest first so every step shrinks the candidate set as fast as possible
+  std::vector<const LettuceSet *> ordered(sets.begin(), sets.end());
+  std::sort(ordered.begin(), ordered.end(), [](const LettuceSet *a, const LettuceSet *b)
+            { return a->size() < b->size(); });
+
+  // intersect all the intsets with the sorted kernels first
+  std::vector<int64_t> integers;
+  bool haveIntegers = false;
+  for (const LettuceSet *set : ordered)
+  {
+    if (!set->intsetEncoded)
+      continue;
+    if (!haveIntegers)
+    {
+      integers = set->intset;
+      haveIntegers = true;
+      continue;
+    }
+    std::vector<int64_t> next;
+    intersectSorted(integers, set->intset, next);
+    integers.swap(next);
+    if (integers.empty())
+      return {};
+  }
+
+  std::vector<std::string> result;
+  if (haveIntegers)
+  {
+    // probe the remaining hashtable sets with the integer candidates
+    for (int64_t value : integers)
+    {
+      std::string member = std::to_string(value);
+      bool inAll = true;
+      for (const LettuceSet *set : ordered)
+      {
+        if (!set->intsetEncoded && set->hashtable.find(member) == set->hashtable.end())
+        {
+          inAll = false;
+          break;
+        }
+      }
+      if (inAll)
+        result.push_back(member);
+    }
+    return result;
+  }
+
+  const LettuceSet *smallest = ordered.front();
+  for (const auto &member : smallest->hashtable)
+  {
+    bool inAll = true;
+    for (size_t i = 1; i < ordered.size() && inAll; i++)
+      inAll = ordered[i]->hashtable.find(member) != ordered[i]->hashtable.end();
+    if (inAll)
+      result.push_back(member);
+  }
+  return result;
+}
+
+std::vector<std::string> LettuceSet::unite(const std::vector<const LettuceSet *> &sets)
+{
+  bool allIntsets = true;
+  for (const LettuceSet *set : sets)
+  {
+    if (set != nullptr && !set->intsetEncoded)
+      allIntsets = false;
+  }
+
+  if (allIntsets)
+  {
+    std::vector<int64_t> integers;
+    for (const LettuceSet *set : sets)
+    {
+      if (set == nullptr)
+        continue;
+      std::vector<int64_t> next;
+      next.reserve(integers.size() + set->intset.size());
+      std::set_union(integers.begin(), integers.end(), set->intset.begin(), set->intset.end(), std::back_inserter(next));
+      integers.swap(next);
+    }
+    std::vector<std::string> result;
+    result.reserve(integers.size());
+    for (int64_t value : integers)
+      result.push_back(std::to_string(value));
+    return result;
+  }
+
+  std::unordered_set<std::string> seen;
+  for (const LettuceSet *set : sets)
+  {
+    if (set == nullptr)
+      continue;
+    for (auto &member : set->members())
+      seen.insert(std::move(member));
+  }
+  return std::vector<std::string>(seen.begin(), seen.end());
+}
+
+std::vector<std::string> LettuceSet::difference(const std::vector<const LettuceSet *> &sets)
+{
+  if (sets.empty() || sets[0] == nullptr)
+    return {};
+  std::vector<std::string> result;
+  for (auto &member : sets[0]->members())
+  {
+    bool inOther = false;
+    for (size_t i = 1; i < sets.size() && !inOther; i++)
+      inOther = sets[i] != nullptr && sets[i]->contains(member);
+    if (!inOther)
+      result.push_back(std::move(member));
+  }
+  return result;
+}
+
+/* Intersection kernels */
+static void intersectSortedMergeScalar(const int64_t *a, size_t aSize, const int64_t *b, size_t bSize, size_t i, size_t j, std::vector<int64_t> &out)
+{
+  while (i < aSize && j < bSize)
+  {
+    if (a[i] < b[j])
+      i++;
+    else if (b[j] < a[i])
+      j++;
+    else
+    {
+      out.push_back(a[i]);
+      i++;
+      j++;
+    }
+  }
+}
+
+#ifdef LETTUCE_X86
+// compares blocks of 4 against 4 - every lane of a is checked against every lane of b
+// by rotating b three times, then the block with the smaller max is advanced
+__attribute__((target("avx2"))) static void intersectSortedMergeAvx2(const int64_t *a, size_t aSize, const int64_t *b, size_t bSize, std::vector<int64_t> &out)
+{
+  size_t i = 0, j = 0;
+  while (i + 4 <= aSize && j + 4 <= bSize)
+  {
+    __m256i blockA = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i blockB = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+
+    __m256i matches = _mm256_cmpeq_epi64(blockA, blockB);
+    blockB = _mm256_permute4x64_epi64(blockB, _MM_SHUFFLE(0, 3, 2, 1));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi64(blockA, blockB));
+    blockB = _mm256_permute4x64_epi64(blockB, _MM_SHUFFLE(0, 3, 2, 1));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi64(blockA, blockB));
+    blockB = _mm256_permute4x64_epi64(blockB, _MM_SHUFFLE(0, 3, 2, 1));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi64(blockA, blockB));
+
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(matches));
+    while (mask)
+    {
+      out.push_back(a[i + __builtin_ctz(mask)]);
+      mask &= mask - 1;
+    }
+
+    int64_t maxA = a[i + 3];
+    int64_t maxB = b[j + 3];
+    if (maxA <= maxB)
+      i += 4;
+    if (maxB <= maxA)
+      j += 4;
+  }
+  intersectSortedMergeScalar(a, aSize, b, bSize, i, j, out);
+}
+#endif
+
+void intersectSortedMerge(const int64_t *a, size_t aSize, const int64_t *b, size_t bSize, std::vector<int64_t> &out)
+{
+#ifdef LETTUCE_X86
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  if (hasAvx2)
+  {
+    intersectSortedMergeAvx2(a, aSize, b, bSize, out);
+    return;
+  }
+#endif
+  intersectSortedMergeScalar(a, aSize, b, bSize, 0, 0, out);
+}
+
+void intersectSortedGallop(const int64_t *small, size_t smallSize, const int64_t *large, size_t largeSize, std::vector<int64_t> &out)
+{
+  size_t low = 0;
+  for (size_t i = 0; i < smallSize && low < largeSize; i++)
+  {
+    int64_t target = small[i];
+    // exponential search from the last position, then binary search inside the bracket
+    size_t step = 1;
+    size_t high = low;
+    while (high < largeSize && large[high] < target)
+    {
+      low = high + 1;
+      high += step;
+      step <<= 1;
+    }
+    if (high > largeSize)
+      high = largeSize;
+    const int64_t *found = std::lower_bound(large + low, large + high, target);
+    low = found - large;
+    if (low < largeSize && large[low] == target)
+    {
+      out.push_back(target);
+      low++;
+    }
+  }
+}
+
+void intersectSorted(const std::vector<int64_t> &a, const std::vector<int64_t> &b, std::vector<int64_t> &out)
+{
+  const std::vector<int64_t> &small = a.size() <= b.size() ? a : b;
+  const std::vector<int64_t> &large = a.size() <= b.size() ? b : a;
+  out.reserve(small.size());
+  // galloping wins once one side is much larger than the other
+  if (small.size() * 32 < large.size())
+    intersectSortedGallop(small.data(), small.size(), large.data(), large.size(), out);
+  else
+    intersectSortedMerge(small.data(), small.size(), large.data(), large.size(), out);
+}
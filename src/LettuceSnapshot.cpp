@@ -0,0 +1,486 @@
+#include "../include/LettuceSnapshot.h"
+#include "../include/LettuceLz.h"
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* CRC64 */
+// reflected jones polynomial, slicing by 8 so the checksum keeps up with the disk
+static const uint64_t crcPolynomial = 0x95ac9329ac4bc9b5ULL;
+
+struct Crc64Tables
+{
+  uint64_t table[8][256];
+  Crc64Tables()
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      uint64_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc & 1) ? (crc >> 1) ^ crcPolynomial : crc >> 1;
+      table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+      for (int slice = 1; slice < 8; slice++)
+        table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+    }
+  }
+};
+
+static const Crc64Tables crcTables;
+
+uint64_t crc64(uint64_t crc, const uint8_t *data, size_t length)
+{
+  const auto &t = crcTables.table;
+  while (length >= 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, 8); // little endian hosts only, like the rest of the file format
+    crc ^= word;
+    crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^ t[4][(crc >> 24) & 0xff] ^
+          t[3][(crc >> 32) & 0xff] ^ t[2][(crc >> 40) & 0xff] ^ t[1][(crc >> 48) & 0xff] ^ t[0][crc >> 56];
+    data += 8;
+    length -= 8;
+  }
+  while (length--)
+    crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+// crc combination the zlib way: appending n zero bytes to a crc is a linear map over GF(2),
+// built for one zero bit and squared up to cover lengthB bytes
+static uint64_t gf2MatrixTimes(const uint64_t *matrix, uint64_t vector)
+{
+  uint64_t sum = 0;
+  for (; vector; vector >>= 1, matrix++)
+  {
+    if (vector & 1)
+      sum ^= *matrix;
+  }
+  return sum;
+}
+
+static void gf2MatrixSquare(uint64_t *square, const uint64_t *matrix)
+{
+  for (int n = 0; n < 64; n++)
+    square[n] = gf2MatrixTimes(matrix, matrix[n]);
+}
+
+uint64_t crc64Combine(uint64_t crcA, uint64_t crcB, size_t lengthB)
+{
+  if (lengthB == 0)
+    return crcA;
+  uint64_t even[64], odd[64];
+  odd[0] = crcPolynomial;
+  uint64_t row = 1;
+  for (int n = 1; n < 64; n++)
+  {
+    odd[n] = row;
+    row <<= 1;
+  }
+  gf2MatrixSquare(even, odd); // two zero bits
+  gf2MatrixSquare(odd, even); // four zero bits
+  // the first square below makes one zero byte
+  do
+  {
+    gf2MatrixSquare(even, odd);
+    if (lengthB & 1)
+      crcA = gf2MatrixTimes(even, crcA);
+    lengthB >>= 1;
+    if (lengthB == 0)
+      break;
+    gf2MatrixSquare(odd, even);
+    if (lengthB & 1)
+      crcA = gf2MatrixTimes(odd, crcA);
+    lengthB >>= 1;
+  } while (lengthB);
+  return crcA ^ crcB;
+}
+
+uint64_t crc64Parallel(const uint8_t *data, size_t length, unsigned threads)
+{
+  // below a few MB per thread starting threads costs more than it saves
+  const size_t minChunk = 4 << 20;
+  size_t chunks = std::min<size_t>(std::max(threads, 1u), std::max<size_t>(length / minChunk, 1));
+  if (chunks == 1)
+    return crc64(0, data, length);
+
+  size_t chunkSize = length / chunks;
+  std::vector<uint64_t> crcs(chunks);
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks; i++)
+  {
+    size_t start = i * chunkSize;
+    size_t size = i == chunks - 1 ? length - start : chunkSize;
+    workers.emplace_back([&crcs, data, i, start, size]()
+                         { crcs[i] = crc64(0, data + start, size); });
+  }
+  crcs[0] = crc64(0, data, chunkSize);
+  for (auto &worker : workers)
+    worker.join();
+
+  uint64_t crc = crcs[0];
+  for (size_t i = 1; i < chunks; i++)
+    crc = crc64Combine(crc, crcs[i], i == chunks - 1 ? length - i * chunkSize : chunkSize);
+  return crc;
+}
+
+/* Writer */
+LettuceSnapshotWriter::~LettuceSnapshotWriter()
+{
+  // never finished, so the old snapshot stays in place
+  if (fd != -1)
+  {
+    close(fd);
+    unlink(tempPath.c_str());
+  }
+}
+
+bool LettuceSnapshotWriter::open(const std::string &filename)
+{
+  path = filename;
+  // the pid keeps a BGSAVE child and a foreground SAVE from sharing a temp file
+  tempPath = filename + ".tmp." + std::to_string(getpid());
+  fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return false;
+  buffer.resize(bufferSize);
+  used = 0;
+  written = 0;
+  crc = 0;
+  failed = false;
+  segmenting = false;
+  segment.clear();
+  segmentKeys = 0;
+  writeBytes(LettuceSnapshot::magic, LettuceSnapshot::magicSize);
+  writeByte(LettuceSnapshot::version);
+  return true;
+}
+
+void LettuceSnapshotWriter::flush()
+{
+  if (used == 0 || failed)
+    return;
+  crc = crc64(crc, buffer.data(), used);
+  size_t offset = 0;
+  while (offset < used)
+  {
+    ssize_t result = ::write(fd, buffer.data() + offset, used - offset);
+    if (result <= 0)
+    {
+      failed = true;
+      return;
+    }
+    offset += result;
+  }
+  written += used;
+  used = 0;
+}
+
+void LettuceSnapshotWriter::writeBytes(const void *data, size_t length)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  if (segmenting)
+  {
+    segment.insert(segment.end(), bytes, bytes + length);
+    return;
+  }
+  while (length > 0)
+  {
+    if (used == buffer.size())
+      flush();
+    if (failed)
+      return;
+    size_t chunk = std::min(length, buffer.size() - used);
+    memcpy(buffer.data() + used, bytes, chunk);
+    used += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+void LettuceSnapshotWriter::writeByte(uint8_t value)
+{
+  if (segmenting)
+  {
+    segment.push_back(value);
+    return;
+  }
+  if (used == buffer.size())
+    flush();
+  // a failed flush leaves the buffer full
+  if (failed)
+    return;
+  buffer[used++] = value;
+}
+
+void LettuceSnapshotWriter::writeLength(uint64_t length)
+{
+  uint8_t bytes[10];
+  size_t count = 0;
+  do
+  {
+    uint8_t byte = length & 0x7f;
+    length >>= 7;
+    bytes[count++] = length ? byte | 0x80 : byte;
+  } while (length);
+  writeBytes(bytes, count);
+}
+
+void LettuceSnapshotWriter::writeString(std::string_view value)
+{
+  writeLength(value.size());
+  writeBytes(value.data(), value.size());
+}
+
+void LettuceSnapshotWriter::writeUint64(uint64_t value)
+{
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; i++)
+    bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+  writeBytes(bytes, 8);
+}
+
+void LettuceSnapshotWriter::beginSegments()
+{
+  segmenting = true;
+  segment.reserve(segmentSize + segmentSize / 4);
+}
+
+void LettuceSnapshotWriter::endRecord()
+{
+  segmentKeys++;
+  if (segment.size() >= segmentSize)
+    flushSegment();
+}
+
+void LettuceSnapshotWriter::setCompression(bool enabled)
+{
+  compression = enabled;
+}
+
+void LettuceSnapshotWriter::flushSegment()
+{
+  if (segmentKeys == 0)
+    return;
+  segmenting = false;
+  size_t compressedSize = 0;
+  if (compression)
+  {
+    compressed.resize(segment.size());
+    // not worth a decompression pass at load for less than an eighth
+    compressedSize = lzCompress(segment.data(), segment.size(), compressed.data(), segment.size() - segment.size() / 8);
+  }
+  if (compressedSize > 0)
+  {
+    writeByte(LettuceSnapshot::opSegmentLz);
+    writeLength(segmentKeys);
+    writeLength(segment.size());
+    writeLength(compressedSize);
+    writeBytes(compressed.data(), compressedSize);
+  }
+  else
+  {
+    writeByte(LettuceSnapshot::opSegment);
+    writeLength(segmentKeys);
+    writeLength(segment.size());
+    writeBytes(segment.data(), segment.size());
+  }
+  segment.clear();
+  segmentKeys = 0;
+  segmenting = true;
+}
+
+bool LettuceSnapshotWriter::finish()
+{
+  if (fd == -1)
+    return false;
+  if (segmenting)
+  {
+    flushSegment();
+    segmenting = false;
+  }
+  writeByte(LettuceSnapshot::opEof);
+  flush();
+  // the checksum covers everything up to here, so it goes out as its own final write
+  uint64_t checksum = crc;
+  writeUint64(checksum);
+  flush();
+  bool ok = !failed && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  fd = -1;
+  if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+  {
+    unlink(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+size_t LettuceSnapshotWriter::bytesWritten() const
+{
+  return written + used + segment.size();
+}
+
+/* Reader */
+LettuceSnapshotReader::LettuceSnapshotReader(const uint8_t *data, size_t length) : data(data), length(length) {}
+
+bool LettuceSnapshotReader::readByte(uint8_t &value)
+{
+  if (offset >= length)
+    return false;
+  value = data[offset++];
+  return true;
+}
+
+bool LettuceSnapshotReader::readLength(uint64_t &value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (offset >= length)
+      return false;
+    uint8_t byte = data[offset++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool LettuceSnapshotReader::readString(std::string &value)
+{
+  uint64_t size;
+  if (!readLength(size) || size > length - offset)
+    return false;
+  value.assign(reinterpret_cast<const char *>(data + offset), size);
+  offset += size;
+  return true;
+}
+
+bool LettuceSnapshotReader::readUint64(uint64_t &value)
+{
+  if (length - offset < 8)
+    return false;
+  value = 0;
+  for (int i = 0; i < 8; i++)
+    value |= static_cast<uint64_t>(data[offset + i]) << (8 * i);
+  offset += 8;
+  return true;
+}
+
+bool LettuceSnapshotReader::readBytes(void *out, size_t count)
+{
+  if (length - offset < count)
+    return false;
+  memcpy(out, data + offset, count);
+  offset += count;
+  return true;
+}
+
+bool LettuceSnapshotReader::peekByte(uint8_t &value) const
+{
+  if (offset >= length)
+    return false;
+  value = data[offset];
+  return true;
+}
+
+bool LettuceSnapshotReader::skip(size_t count)
+{
+  if (length - offset < count)
+    return false;
+  offset += count;
+  return true;
+}
+
+size_t LettuceSnapshotReader::position() const
+{
+  return offset;
+}
+
+size_t LettuceSnapshotReader::remaining() const
+{
+  return length - offset;
+}
+
+/* Files */
+LettuceMappedFile::~LettuceMappedFile()
+{
+  if (mapped)
+    munmap(mapped, length);
+}
+
+bool LettuceMappedFile::open(const std::string &filename)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+  void *address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED)
+    return false;
+  mapped = static_cast<uint8_t *>(address);
+  length = info.st_size;
+  // segments are decoded by several threads at once, so ask for all of it rather than readahead
+  madvise(mapped, length, MADV_WILLNEED);
+  return true;
+}
+
+bool readSnapshotFile(const std::string &filename, std::vector<uint8_t> &contents)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  contents.resize(info.st_size);
+  size_t offset = 0;
+  while (offset < contents.size())
+  {
+    ssize_t result = ::read(fd, contents.data() + offset, contents.size() - offset);
+    if (result <= 0)
+    {
+      close(fd);
+      return false;
+    }
+    offset += result;
+  }
+  close(fd);
+  return true;
+}
+
+bool verifySnapshot(const uint8_t *data, size_t length, size_t &payloadEnd, unsigned threads)
+{
+  using namespace LettuceSnapshot;
+  if (length < headerSize + footerSize)
+    return false;
+  if (memcmp(data, magic, magicSize) != 0 || data[magicSize] < oldestVersion || data[magicSize] > version)
+    return false;
+  if (data[length - footerSize] != opEof)
+    return false;
+  LettuceSnapshotReader footer(data + length - 8, 8);
+  uint64_t expected;
+  footer.readUint64(expected);
+  if (crc64Parallel(data, length - 8, threads) != expected)
+    return false;
+  payloadEnd = length - footerSize;
+  return true;
+}
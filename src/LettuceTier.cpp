@@ -0,0 +1,184 @@
+#include "../include/LettuceTier.h"
+#include "../include/LettuceMemory.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+class LettuceTierStore::Segment
+{
+public:
+  uint32_t id;
+  int fd;
+  std::string path;
+  uint64_t size = 0;
+  uint64_t live = 0;
+
+  Segment(uint32_t id, int fd, std::string path) : id(id), fd(fd), path(std::move(path)) {}
+  ~Segment() { close(fd); }
+};
+
+LettuceTierStore::LettuceTierStore(const std::string &prefix, uint64_t segmentSize) : prefix(prefix), segmentSize(segmentSize)
+{
+  // whatever a previous run left behind is stale, the snapshot and the log have those values
+  size_t slash = prefix.rfind('/');
+  std::string directory = slash == std::string::npos ? "." : prefix.substr(0, slash + 1);
+  std::string name = (slash == std::string::npos ? prefix : prefix.substr(slash + 1)) + ".";
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr)
+    return;
+  while (dirent *entry = readdir(dir))
+  {
+    std::string file = entry->d_name;
+    if (file.size() > name.size() && file.compare(0, name.size(), name) == 0 &&
+        file.find_first_not_of("0123456789", name.size()) == std::string::npos)
+      unlink((directory + "/" + file).c_str());
+  }
+  closedir(dir);
+}
+
+LettuceTierStore::~LettuceTierStore()
+{
+  for (const auto &[id, segment] : segments)
+    unlink(segment->path.c_str());
+}
+
+bool LettuceTierStore::startSegment()
+{
+  // the store's own bookkeeping isn't part of any value
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  std::string path = prefix + "." + std::to_string(nextId);
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return false;
+  std::shared_ptr<Segment> previous = std::move(active);
+  active = std::make_shared<Segment>(nextId, fd, path);
+  segments.emplace(nextId, active);
+  nextId++;
+  // release only drops closed segments, one that's all dead by the time it's closed goes now
+  if (previous && previous->live == 0)
+    drop(previous->id);
+  return true;
+}
+
+bool LettuceTierStore::append(const std::string &bytes, LettuceTierLocation &location)
+{
+  if (bytes.size() > UINT32_MAX)
+    return false;
+  if ((!active || active->size >= segmentSize) && !startSegment())
+    return false;
+  // pwrite at our own offset rather than O_APPEND, readers use pread so nobody shares a file position
+  size_t written = 0;
+  while (written < bytes.size())
+  {
+    ssize_t n = pwrite(active->fd, bytes.data() + written, bytes.size() - written, active->size + written);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  location = {active->id, static_cast<uint32_t>(bytes.size()), active->size};
+  active->size += bytes.size();
+  active->live += bytes.size();
+  return true;
+}
+
+void LettuceTierStore::retain(const LettuceTierLocation &location)
+{
+  auto it = segments.find(location.segment);
+  if (it != segments.end())
+    it->second->live += location.length;
+}
+
+void LettuceTierStore::release(const LettuceTierLocation &location)
+{
+  auto it = segments.find(location.segment);
+  if (it == segments.end())
+    return;
+  it->second->live -= location.length;
+  if (it->second->live == 0 && it->second != active)
+    drop(location.segment);
+}
+
+void LettuceTierStore::drop(uint32_t id)
+{
+  auto it = segments.find(id);
+  if (it == segments.end())
+    return;
+  unlink(it->second->path.c_str());
+  LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+  segments.erase(it);
+}
+
+std::shared_ptr<const LettuceTierStore::Segment> LettuceTierStore::segment(uint32_t id) const
+{
+  auto it = segments.find(id);
+  return it != segments.end() ? it->second : nullptr;
+}
+
+bool LettuceTierStore::read(const Segment &segment, const LettuceTierLocation &location, std::string &bytes)
+{
+  bytes.resize(location.length);
+  size_t done = 0;
+  while (done < bytes.size())
+  {
+    ssize_t n = pread(segment.fd, &bytes[done], bytes.size() - done, location.offset + done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool LettuceTierStore::read(const LettuceTierLocation &location, std::string &bytes) const
+{
+  auto it = segments.find(location.segment);
+  return it != segments.end() && read(*it->second, location, bytes);
+}
+
+uint32_t LettuceTierStore::compactionCandidate() const
+{
+  uint32_t best = 0;
+  uint64_t bestDead = 0;
+  for (const auto &[id, segment] : segments)
+  {
+    // live can be over size, COPY makes two keys point at the same bytes
+    if (segment == active || segment->live * 2 >= segment->size)
+      continue;
+    uint64_t dead = segment->size - segment->live;
+    if (dead > bestDead)
+    {
+      best = id;
+      bestDead = dead;
+    }
+  }
+  return best;
+}
+
+void LettuceTierStore::setSegmentSize(uint64_t bytes)
+{
+  segmentSize = bytes;
+}
+
+std::vector<int> LettuceTierStore::fds() const
+{
+  std::vector<int> result;
+  for (const auto &[id, segment] : segments)
+    result.push_back(segment->fd);
+  return result;
+}
+
+LettuceTierFileStats LettuceTierStore::stats() const
+{
+  LettuceTierFileStats result{segments.size(), 0, 0};
+  for (const auto &[id, segment] : segments)
+  {
+    result.fileBytes += segment->size;
+    result.liveBytes += segment->live;
+  }
+  return result;
+}
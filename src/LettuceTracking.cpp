@@ -0,0 +1,169 @@
+#include "../include/LettuceTracking.h"
+#include "../include/LettuceReply.h"
+
+LettuceTracking &LettuceTracking::getInstance()
+{
+  static LettuceTracking instance;
+  return instance;
+}
+
+void LettuceTracking::enable(uint64_t clientId, bool broadcast, const std::vector<std::string> &prefixes)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  Client &client = clients[clientId];
+  // broadcast mode doesn't use the table, anything remembered before the switch would be told twice
+  if (broadcast)
+    forgetKeysLocked(clientId, client);
+  client.broadcast = broadcast;
+  client.prefixes = prefixes;
+  activeClients = clients.size();
+}
+
+void LettuceTracking::disable(uint64_t clientId)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  auto it = clients.find(clientId);
+  if (it == clients.end())
+    return;
+  // its entries would otherwise sit in the table counting toward maxKeys until the keys change
+  forgetKeysLocked(clientId, it->second);
+  clients.erase(it);
+  activeClients = clients.size();
+}
+
+void LettuceTracking::forgetKeysLocked(uint64_t clientId, Client &client)
+{
+  for (const auto &key : client.keys)
+  {
+    auto entry = table.find(key);
+    if (entry == table.end())
+      continue;
+    entry->second.erase(clientId);
+    if (entry->second.empty())
+      table.erase(entry);
+  }
+  client.keys.clear();
+}
+
+bool LettuceTracking::isTracking(uint64_t clientId)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  return clients.find(clientId) != clients.end();
+}
+
+void LettuceTracking::rememberKeys(uint64_t clientId, const std::vector<std::string> &keys)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  auto it = clients.find(clientId);
+  if (it == clients.end() || it->second.broadcast)
+    return;
+  for (const auto &key : keys)
+  {
+    table[key].insert(clientId);
+    it->second.keys.insert(key);
+  }
+  evictLocked();
+}
+
+void LettuceTracking::evictLocked()
+{
+  // over the limit an arbitrary key is invalidated early, its clients just fetch it again
+  while (table.size() > maxKeys)
+    invalidateLocked(table.begin()->first);
+}
+
+void LettuceTracking::invalidateLocked(const std::string &key)
+{
+  for (auto &[clientId, client] : clients)
+  {
+    if (!client.broadcast)
+      continue;
+    bool matches = client.prefixes.empty();
+    for (size_t i = 0; i < client.prefixes.size() && !matches; i++)
+      matches = key.compare(0, client.prefixes[i].size(), client.prefixes[i]) == 0;
+    if (matches)
+      client.pendingKeys.push_back(key);
+  }
+
+  auto it = table.find(key);
+  if (it == table.end())
+    return;
+  // every client gets told once, it has to read the key again to be tracked again
+  for (uint64_t clientId : it->second)
+  {
+    auto client = clients.find(clientId);
+    if (client == clients.end())
+      continue;
+    client->second.pendingKeys.push_back(key);
+    client->second.keys.erase(key);
+  }
+  table.erase(it);
+}
+
+void LettuceTracking::invalidateKey(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  invalidateLocked(key);
+}
+
+void LettuceTracking::invalidateAll()
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  table.clear();
+  for (auto &[clientId, client] : clients)
+  {
+    client.pendingKeys.clear();
+    client.keys.clear();
+    client.pendingFlush = true;
+  }
+}
+
+std::string LettuceTracking::takePending(uint64_t clientId)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  auto it = clients.find(clientId);
+  if (it == clients.end())
+    return "";
+  Client &client = it->second;
+  if (!client.pendingFlush && client.pendingKeys.empty())
+    return "";
+
+  // tracking needs RESP3, so these are always written as push messages
+  LettuceReply reply(3);
+  if (client.pendingFlush)
+  {
+    // a null key list means "drop everything you cached"
+    reply.push(2).bulk("invalidate").null();
+    client.pendingFlush = false;
+  }
+  if (!client.pendingKeys.empty())
+  {
+    reply.push(2).bulk("invalidate").array(client.pendingKeys.size());
+    for (const auto &key : client.pendingKeys)
+      reply.bulk(key);
+    client.pendingKeys.clear();
+  }
+  return reply.take();
+}
+
+void LettuceTracking::setMaxKeys(size_t keys)
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  maxKeys = keys;
+  evictLocked();
+}
+
+size_t LettuceTracking::getMaxKeys()
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  return maxKeys;
+}
+
+LettuceTrackingStats LettuceTracking::stats()
+{
+  std::lock_guard<std::mutex> lock(trackingMutex);
+  size_t prefixes = 0;
+  for (const auto &[clientId, client] : clients)
+    prefixes += client.prefixes.size();
+  return {clients.size(), table.size(), prefixes};
+}
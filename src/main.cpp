@@ -1,47 +1,108 @@
 #include <iostream>
 #include "../include/LettuceServer.h"
 #include "../include/LettuceDatabase.h"
+#include "../include/LettuceConfig.h"
+#include "../include/LettuceAof.h"
+#include "../include/LettuceCommandHandler.h"
 #include <thread>
 #include <chrono>
+#include <cstdlib>
 
 int main(int argc, char *argv[])
 {
   int port = 6379;
 
+  int firstOption = 1;
+
   // if custom port is defined
-  if (argc >= 2)
+  if (argc >= 2 && std::string(argv[1]).rfind("--", 0) != 0)
   {
     port = std::stoi(argv[1]);
+    firstOption = 2;
   }
 
-  std::string databaseFilename = "dump.ldb";
+  // --appendonly yes only takes effect once the snapshot is loaded and the log replayed on top of it
+  LettuceAof &aof = LettuceAof::getInstance();
+  aof.beginStartup();
 
-  if (LettuceDatabase::getInstance().load(databaseFilename))
-  {
-    std::cout << "Database loaded from dump.ldb\n";
-  }
-  else
+  // anything after the port is --name value config, e.g. --keyindex yes
+  std::string configError;
+  if (!LettuceConfig::getInstance().parseArgs(argc, argv, firstOption, configError))
   {
-    std::cout << "No dump.ldb file found\n";
+    std::cerr << "-ERR: " << configError << std::endl;
+    return 1;
   }
 
+  std::string databaseFilename = "dump.ldb";
+
+  // the listener comes up right away, clients get -LOADING (and INFO shows progress) until the
+  // snapshot is loaded and the log replayed on this thread
+  LettuceDatabase::getInstance().setLoading(true);
+  std::thread startupThread([databaseFilename]()
+                            {
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    LettuceAof &aof = LettuceAof::getInstance();
+    LettuceAofPosition snapshotPosition;
+    if (db.load(databaseFilename, &snapshotPosition))
+    {
+      std::cout << "Database loaded from dump.ldb\n";
+    }
+    else
+    {
+      std::cout << "No dump.ldb file found\n";
+    }
+
+    LettuceCommandHandler replayHandler;
+    size_t replayed;
+    std::string aofError;
+    if (!aof.finishStartup(LettuceAof::defaultFilename, snapshotPosition, [&](std::vector<std::string> &tokens)
+                           { replayHandler.execute(std::move(tokens)); }, replayed, aofError))
+    {
+      std::cerr << "-ERR: " << aofError << std::endl;
+      std::exit(1);
+    }
+    if (aof.appendOnly())
+      std::cout << "Replayed " << replayed << " commands from " << LettuceAof::defaultFilename << "\n";
+    db.setLoading(false); });
+  startupThread.detach();
+
   LettuceServer server(port);
 
-  // every 5 mins save database
-  std::thread persistenceThread([](){
+  // snapshots follow the save rules, so an idle server doesn't rewrite the same data and a busy
+  // one saves as often as its write rate asks for
+  std::thread persistenceThread([]()
+                                {
     while (true)
     {
-      std::this_thread::sleep_for(std::chrono::minutes(5));
-      if (!LettuceDatabase::getInstance().dump("dump.ldb"))
-      {
-        std::cerr << "-ERR: Failed to dump database." << std::endl;
-        continue;
-      }
-      std::cout << "Database dumped to dump.ldb" << std::endl; 
-    }
-  });
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      if (LettuceDatabase::getInstance().saveIfDue("dump.ldb"))
+        std::cout << "Background save of dump.ldb started" << std::endl;
+    } });
   persistenceThread.detach();
 
+  // active defrag decides for itself whether fragmentation is worth a pass, and how much of each
+  // interval it gets
+  std::thread defragThread([]()
+                           {
+    const std::chrono::milliseconds interval(100);
+    while (true)
+    {
+      std::this_thread::sleep_for(interval);
+      LettuceDatabase::getInstance().activeDefragCycle(interval);
+    } });
+  defragThread.detach();
+
+  // tiered storage moves cold values to disk and compacts the segments, a slice of every interval
+  std::thread tierThread([]()
+                         {
+    const std::chrono::milliseconds interval(100);
+    while (true)
+    {
+      std::this_thread::sleep_for(interval);
+      LettuceDatabase::getInstance().tierCycle(interval);
+    } });
+  tierThread.detach();
+
   server.run();
 
   return 0;
@@ -0,0 +1,201 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceAof.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::vector<std::vector<std::string>> replayAll(const std::string &filename, const LettuceAofPosition &snapshot)
+{
+    std::vector<std::vector<std::string>> commands;
+    size_t replayed;
+    std::string error;
+    REQUIRE(LettuceAof::getInstance().replay(filename, snapshot, [&](std::vector<std::string> &tokens)
+                                             { commands.push_back(tokens); }, replayed, error));
+    REQUIRE(replayed == commands.size());
+    return commands;
+}
+
+TEST_CASE("LettuceAof logs commands and replays them in order", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    std::remove(filename.c_str());
+    LettuceAof &aof = LettuceAof::getInstance();
+    std::string error;
+
+    REQUIRE(aof.open(filename, error));
+    REQUIRE(aof.active());
+    aof.append({"SET", "a", "1"});
+    LettuceAofPosition middle = aof.position();
+    aof.append({"SET", "binary\r\nkey", std::string("v\0v", 3)});
+    aof.append({"DEL", "a"});
+    aof.close();
+    REQUIRE_FALSE(aof.active());
+
+    auto commands = replayAll(filename, {});
+    REQUIRE(commands.size() == 3);
+    REQUIRE(commands[0] == std::vector<std::string>{"SET", "a", "1"});
+    REQUIRE(commands[1][2] == std::string("v\0v", 3));
+
+    // a snapshot taken part way through only needs what came after it
+    commands = replayAll(filename, middle);
+    REQUIRE(commands.size() == 2);
+    REQUIRE(commands[0][1] == "binary\r\nkey");
+
+    // a snapshot from another log doesn't skip anything
+    commands = replayAll(filename, {middle.generation + 1, middle.offset});
+    REQUIRE(commands.size() == 3);
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceAof drops a torn last command and continues the same file", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    std::remove(filename.c_str());
+    LettuceAof &aof = LettuceAof::getInstance();
+    std::string error;
+
+    REQUIRE(aof.open(filename, error));
+    aof.append({"SET", "a", "1"});
+    uint64_t generation = aof.position().generation;
+    aof.close();
+    {
+        std::ofstream file(filename, std::ios::app | std::ios::binary);
+        file << "*3\r\n$3\r\nSET\r\n$1\r\nb"; // crashed part way through a write
+    }
+
+    REQUIRE(replayAll(filename, {}).size() == 1);
+    REQUIRE(aof.open(filename, error));
+    REQUIRE(aof.position().generation == generation);
+    aof.append({"SET", "c", "3"});
+    aof.close();
+
+    auto commands = replayAll(filename, {});
+    REQUIRE(commands.size() == 2);
+    REQUIRE(commands[1] == std::vector<std::string>{"SET", "c", "3"});
+
+    {
+        std::ofstream file(filename, std::ios::app | std::ios::binary);
+        file << "garbage\r\n";
+    }
+    size_t replayed;
+    REQUIRE_FALSE(aof.replay(filename, {}, [](std::vector<std::string> &) {}, replayed, error));
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceAof fsync policies", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    std::remove(filename.c_str());
+    LettuceAof &aof = LettuceAof::getInstance();
+    std::string error;
+
+    REQUIRE_FALSE(aof.setFsync("sometimes"));
+    REQUIRE(aof.setFsync("always"));
+    REQUIRE(aof.getFsync() == "always");
+    REQUIRE(aof.open(filename, error));
+    uint64_t offset = aof.append({"SET", "a", "1"});
+    aof.waitDurable(offset);
+    LettuceAofStats stats = aof.stats();
+    REQUIRE(stats.fsyncs >= 1);
+    REQUIRE(stats.bufferLength == 0);
+    // offsets handed to waitDurable count every byte ever logged, the file only holds this log
+    REQUIRE(offset >= stats.size);
+    REQUIRE(std::ifstream(filename, std::ios::binary | std::ios::ate).tellg() == static_cast<std::streamoff>(stats.size));
+
+    REQUIRE(aof.setFsync("no"));
+    aof.append({"SET", "b", "2"});
+    aof.close();
+    REQUIRE(replayAll(filename, {}).size() == 2);
+
+    REQUIRE(aof.setFsync("everysec"));
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceAofWriter writes a log the replay understands", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    LettuceAofWriter writer;
+    REQUIRE(writer.open(filename, 42));
+    for (int i = 0; i < 20000; i++) // more than one buffer worth
+        writer.append({"RPUSH", "l", std::string(64, 'x')});
+    writer.append({"SET", "a", "1"});
+    REQUIRE(writer.finish());
+
+    auto commands = replayAll(filename, {});
+    REQUIRE(commands.size() == 20001);
+    REQUIRE(commands.back() == std::vector<std::string>{"SET", "a", "1"});
+    // the generation in the header is the one the writer was given
+    REQUIRE(replayAll(filename, {42, 1 << 30}).empty());
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceAof asks for a rewrite once the log has grown enough", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    std::remove(filename.c_str());
+    LettuceAof &aof = LettuceAof::getInstance();
+    std::string error;
+
+    aof.setRewriteMinSize(4096);
+    REQUIRE(aof.open(filename, error));
+    REQUIRE_FALSE(aof.takeRewriteRequest());
+    while (aof.stats().size < 4096)
+        aof.append({"SET", "a", std::string(100, 'x')});
+    REQUIRE(aof.takeRewriteRequest());
+    REQUIRE_FALSE(aof.takeRewriteRequest()); // only handed out once
+
+    aof.setRewritePercentage(0);
+    aof.append({"SET", "a", "1"});
+    REQUIRE_FALSE(aof.takeRewriteRequest());
+
+    aof.close();
+    aof.setRewritePercentage(100);
+    aof.setRewriteMinSize(64 * 1024 * 1024);
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceAof keeps writes made during a rewrite exactly once", "[aof]")
+{
+    const std::string filename = "test_appendonly.aof";
+    std::remove(filename.c_str());
+    LettuceAof &aof = LettuceAof::getInstance();
+    std::string error;
+
+    REQUIRE(aof.open(filename, error));
+    aof.append({"RPUSH", "l", "0"});
+    uint64_t generation;
+    std::string logPath;
+    REQUIRE(aof.beginRewrite(generation, logPath));
+
+    // stands in for the forked child, which would write the dataset as it was at the fork
+    const pid_t child = 999999;
+    LettuceAofWriter writer;
+    REQUIRE(writer.open(LettuceAof::rewriteFilename(logPath, child), generation));
+    writer.append({"RPUSH", "l", "0"});
+    REQUIRE(writer.finish());
+    aof.rewriteStarted(child);
+
+    // with everysec these are still buffered for the old file when the writer thread switches
+    for (int i = 1; i <= 100; i++)
+        aof.append({"RPUSH", "l", std::to_string(i)});
+    aof.finishRewrite(child, true);
+    REQUIRE(aof.waitForRewrite());
+    // give the writer a few rounds to flush anything it still holds
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    aof.append({"RPUSH", "l", "101"});
+    aof.close();
+
+    auto commands = replayAll(filename, {});
+    REQUIRE(commands.size() == 102);
+    for (size_t i = 0; i < commands.size(); i++)
+        REQUIRE(commands[i][2] == std::to_string(i));
+
+    std::remove(filename.c_str());
+}
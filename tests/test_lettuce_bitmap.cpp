@@ -0,0 +1,61 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceBitmap.h"
+
+#include <string>
+#include <vector>
+
+static const uint8_t *bytes(const std::string &value)
+{
+    return reinterpret_cast<const uint8_t *>(value.data());
+}
+
+TEST_CASE("bitmapPopcount counts bits across word and tail boundaries", "[bitmap]")
+{
+    std::string value(77, '\xff');
+    value[76] = '\x01';
+    REQUIRE(bitmapPopcount(bytes(value), value.size()) == 76 * 8 + 1);
+    REQUIRE(bitmapPopcount(bytes(value), 0) == 0);
+}
+
+TEST_CASE("bitmapPopcountBits masks the edge bytes", "[bitmap]")
+{
+    std::string value = "\xff\xff\xff";
+    REQUIRE(bitmapPopcountBits(bytes(value), value.size(), 3, 5) == 3);
+    REQUIRE(bitmapPopcountBits(bytes(value), value.size(), 5, 17) == 13);
+    REQUIRE(bitmapPopcountBits(bytes(value), value.size(), 0, 1000) == 24);
+}
+
+TEST_CASE("bitmapOp applies AND, OR, XOR and NOT over long buffers", "[bitmap]")
+{
+    std::string a(100, '\x0f');
+    std::string b(100, '\x3c');
+
+    std::string result = a;
+    bitmapOp(BitOp::And, reinterpret_cast<uint8_t *>(&result[0]), bytes(b), result.size());
+    REQUIRE(result == std::string(100, '\x0c'));
+
+    result = a;
+    bitmapOp(BitOp::Or, reinterpret_cast<uint8_t *>(&result[0]), bytes(b), result.size());
+    REQUIRE(result == std::string(100, '\x3f'));
+
+    result = a;
+    bitmapOp(BitOp::Xor, reinterpret_cast<uint8_t *>(&result[0]), bytes(b), result.size());
+    REQUIRE(result == std::string(100, '\x33'));
+
+    result = a;
+    bitmapOp(BitOp::Not, reinterpret_cast<uint8_t *>(&result[0]), nullptr, result.size());
+    REQUIRE(result == std::string(100, '\xf0'));
+}
+
+TEST_CASE("bitmapPos finds set and clear bits", "[bitmap]")
+{
+    std::string value(40, '\0');
+    value[33] = '\x10';
+    REQUIRE(bitmapPos(bytes(value), value.size(), 1, 0, value.size() * 8 - 1) == 33 * 8 + 3);
+    REQUIRE(bitmapPos(bytes(value), value.size(), 1, 0, 100) == -1);
+
+    std::string full(16, '\xff');
+    REQUIRE(bitmapPos(bytes(full), full.size(), 0, 0, full.size() * 8 - 1) == -1);
+    full[9] = '\xfe';
+    REQUIRE(bitmapPos(bytes(full), full.size(), 0, 3, full.size() * 8 - 1) == 79);
+}
@@ -1,7 +1,11 @@
 #include <../external/catch2/catch.hpp>
 #include "../include/LettuceCommandHandler.h"
+#include "../include/LettuceDatabase.h"
+#include "test_utils.h"
 
 #include <iostream>
+#include <ctime>
+#include <unistd.h>
 
 TEST_CASE("parseRespCommand handles RESP arrays", "[resp]")
 {
@@ -31,7 +35,7 @@ TEST_CASE("LettuceCommandHandler returns PONG from PING request", "[handler]")
 TEST_CASE("LettuceCommandHandler returns ERROR from UNKNOWN request", "[handler]")
 {
     LettuceCommandHandler handler;
-    std::string resp = handler.handleCommand("*1\r\n$5\r\nHELLO\r\n");
+    std::string resp = handler.handleCommand("*1\r\n$5\r\nHOWDY\r\n");
     REQUIRE(resp.find("-ERR: Unknown command") != std::string::npos);
 }
 
@@ -204,4 +208,526 @@ TEST_CASE("LettuceCommandHandler HMSET sets multiple fields", "[handler]")
     REQUIRE(hmset_resp.find("+OK") != std::string::npos);
     std::string hget_resp = handler.handleCommand("*3\r\n$4\r\nHGET\r\n$6\r\nmyhash\r\n$2\r\nf2\r\n");
     REQUIRE(hget_resp.find("$2\r\nv2\r\n") != std::string::npos);
-}
\ No newline at end of file
+}
+
+TEST_CASE("LettuceCommandHandler SADD, SISMEMBER and SINTER", "[handler]")
+{
+    LettuceCommandHandler handler;
+    std::string sadd_resp = handler.handleCommand("*4\r\n$4\r\nSADD\r\n$2\r\ns1\r\n$1\r\n1\r\n$1\r\n2\r\n");
+    REQUIRE(sadd_resp == ":2\r\n");
+    handler.handleCommand("*4\r\n$4\r\nSADD\r\n$2\r\ns2\r\n$1\r\n2\r\n$1\r\n3\r\n");
+    std::string ismember_resp = handler.handleCommand("*3\r\n$9\r\nSISMEMBER\r\n$2\r\ns1\r\n$1\r\n1\r\n");
+    REQUIRE(ismember_resp == ":1\r\n");
+    std::string sinter_resp = handler.handleCommand("*3\r\n$6\r\nSINTER\r\n$2\r\ns1\r\n$2\r\ns2\r\n");
+    REQUIRE(sinter_resp == "*1\r\n$1\r\n2\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler PFADD and PFCOUNT", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*2\r\n$3\r\nDEL\r\n$3\r\nhll\r\n");
+    std::string pfadd_resp = handler.handleCommand("*4\r\n$5\r\nPFADD\r\n$3\r\nhll\r\n$1\r\na\r\n$1\r\nb\r\n");
+    REQUIRE(pfadd_resp == ":1\r\n");
+    std::string pfcount_resp = handler.handleCommand("*2\r\n$7\r\nPFCOUNT\r\n$3\r\nhll\r\n");
+    REQUIRE(pfcount_resp == ":2\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler SETBIT, GETBIT, BITCOUNT and BITPOS", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*2\r\n$3\r\nDEL\r\n$4\r\nbits\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nSETBIT\r\n$4\r\nbits\r\n$2\r\n10\r\n$1\r\n1\r\n") == ":0\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nGETBIT\r\n$4\r\nbits\r\n$2\r\n10\r\n") == ":1\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$8\r\nBITCOUNT\r\n$4\r\nbits\r\n") == ":1\r\n");
+    REQUIRE(handler.handleCommand("*5\r\n$8\r\nBITCOUNT\r\n$4\r\nbits\r\n$1\r\n0\r\n$1\r\n0\r\n$3\r\nBIT\r\n") == ":0\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nBITPOS\r\n$4\r\nbits\r\n$1\r\n1\r\n") == ":10\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nSETBIT\r\n$4\r\nbits\r\n$2\r\n-1\r\n$1\r\n1\r\n").find("-ERR") == 0);
+}
+
+TEST_CASE("LettuceCommandHandler MSET and MGET", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*2\r\n$3\r\nDEL\r\n$2\r\nm3\r\n");
+    std::string mset_resp = handler.handleCommand("*5\r\n$4\r\nMSET\r\n$2\r\nm1\r\n$1\r\na\r\n$2\r\nm2\r\n$2\r\nbb\r\n");
+    REQUIRE(mset_resp == "+OK\r\n");
+    std::string mget_resp = handler.handleCommand("*4\r\n$4\r\nMGET\r\n$2\r\nm1\r\n$2\r\nm3\r\n$2\r\nm2\r\n");
+    REQUIRE(mget_resp == "*3\r\n$1\r\na\r\n$-1\r\n$2\r\nbb\r\n");
+    std::string msetnx_resp = handler.handleCommand("*3\r\n$6\r\nMSETNX\r\n$2\r\nm1\r\n$1\r\nz\r\n");
+    REQUIRE(msetnx_resp == ":0\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler SCAN returns a cursor and keys", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$1\r\nv\r\n");
+    std::string scan_resp = handler.handleCommand("*6\r\n$4\r\nSCAN\r\n$1\r\n0\r\n$5\r\nMATCH\r\n$2\r\nk*\r\n$5\r\nCOUNT\r\n$3\r\n100\r\n");
+    REQUIRE(scan_resp == "*2\r\n$1\r\n0\r\n*1\r\n$3\r\nkey\r\n");
+    std::string bad_resp = handler.handleCommand("*2\r\n$4\r\nSCAN\r\n$3\r\nabc\r\n");
+    REQUIRE(bad_resp.find("-ERR") == 0);
+}
+
+TEST_CASE("LettuceCommandHandler KEYS pattern, CONFIG and INFO", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$5\r\nuser1\r\n$1\r\nv\r\n");
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$4\r\nitem\r\n$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$4\r\nKEYS\r\n$5\r\nuser*\r\n") == "*1\r\n$5\r\nuser1\r\n");
+
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$8\r\nkeyindex\r\n$3\r\nyes\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$4\r\nkey*\r\n") == "*2\r\n$8\r\nkeyindex\r\n$3\r\nyes\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$8\r\nkeyindex\r\n$5\r\nmaybe\r\n").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("*2\r\n$4\r\nKEYS\r\n$5\r\nuser*\r\n") == "*1\r\n$5\r\nuser1\r\n");
+
+    std::string info = handler.handleCommand("*2\r\n$4\r\nINFO\r\n$8\r\nkeyindex\r\n");
+    REQUIRE(info.find("keyindex_enabled:1\r\n") != std::string::npos);
+    REQUIRE(info.find("keyindex_keys:2\r\n") != std::string::npos);
+
+    handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$8\r\nkeyindex\r\n$2\r\nno\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler MULTI and EXEC run queued commands", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    REQUIRE(handler.handleCommand("*1\r\n$5\r\nMULTI\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$4\r\nHSET\r\n$1\r\nh\r\n$1\r\nf\r\n$1\r\nv\r\n") == "+QUEUED\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$5\r\nLPUSH\r\n$1\r\nl\r\n$1\r\na\r\n") == "+QUEUED\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$4\r\nHGET\r\n$1\r\nh\r\n$1\r\nf\r\n") == "+QUEUED\r\n");
+    REQUIRE(handler.handleCommand("*1\r\n$4\r\nEXEC\r\n") == "*3\r\n:1\r\n:1\r\n$1\r\nv\r\n");
+
+    REQUIRE(handler.handleCommand("*1\r\n$4\r\nEXEC\r\n").find("-ERR") == 0);
+    handler.handleCommand("*1\r\n$5\r\nMULTI\r\n");
+    handler.handleCommand("*2\r\n$3\r\nDEL\r\n$1\r\nh\r\n");
+    REQUIRE(handler.handleCommand("*1\r\n$7\r\nDISCARD\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$4\r\nTYPE\r\n$1\r\nh\r\n") == "+hash\r\n");
+
+    handler.handleCommand("*1\r\n$5\r\nMULTI\r\n");
+    REQUIRE(handler.handleCommand("*1\r\n$5\r\nBOGUS\r\n").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("*1\r\n$4\r\nEXEC\r\n").find("-EXECABORT") == 0);
+}
+
+TEST_CASE("LettuceCommandHandler WATCH aborts EXEC after another client writes", "[handler]")
+{
+    LettuceCommandHandler client;
+    LettuceCommandHandler other;
+    client.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nw\r\n$1\r\n1\r\n");
+    REQUIRE(client.handleCommand("*2\r\n$5\r\nWATCH\r\n$1\r\nw\r\n") == "+OK\r\n");
+    other.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nw\r\n$1\r\n2\r\n");
+    client.handleCommand("*1\r\n$5\r\nMULTI\r\n");
+    client.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nw\r\n$1\r\n3\r\n");
+    REQUIRE(client.handleCommand("*1\r\n$4\r\nEXEC\r\n") == "*-1\r\n");
+    REQUIRE(client.handleCommand("*2\r\n$3\r\nGET\r\n$1\r\nw\r\n") == "$1\r\n2\r\n");
+
+    // EXEC unwatches, so the next transaction goes through
+    client.handleCommand("*1\r\n$5\r\nMULTI\r\n");
+    client.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nw\r\n$1\r\n3\r\n");
+    REQUIRE(client.handleCommand("*1\r\n$4\r\nEXEC\r\n") == "*1\r\n+OK\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler UNLINK and FLUSHALL ASYNC", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$2\r\nu1\r\n$1\r\nv\r\n");
+    handler.handleCommand("*3\r\n$5\r\nRPUSH\r\n$2\r\nu2\r\n$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nUNLINK\r\n$2\r\nu1\r\n$2\r\nu2\r\n$2\r\nu3\r\n") == ":2\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$8\r\nFLUSHALL\r\n$5\r\nASYNC\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$8\r\nFLUSHALL\r\n$4\r\nLATE\r\n").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$18\r\nlazyfree-threshold\r\n") == "*2\r\n$18\r\nlazyfree-threshold\r\n$2\r\n64\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler COPY", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$3\r\nsrc\r\n$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$4\r\nCOPY\r\n$3\r\nsrc\r\n$3\r\ndst\r\n") == ":1\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$4\r\nCOPY\r\n$3\r\nsrc\r\n$3\r\ndst\r\n") == ":0\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$4\r\nCOPY\r\n$3\r\nsrc\r\n$3\r\ndst\r\n$7\r\nREPLACE\r\n") == ":1\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$3\r\nGET\r\n$3\r\ndst\r\n") == "$1\r\nv\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler HELLO switches the connection to RESP3", "[handler]")
+{
+    LettuceCommandHandler resp3;
+    LettuceCommandHandler resp2;
+    resp3.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    resp3.handleCommand("*4\r\n$4\r\nHSET\r\n$1\r\nh\r\n$1\r\nf\r\n$1\r\nv\r\n");
+
+    std::string hello = resp3.handleCommand("*2\r\n$5\r\nHELLO\r\n$1\r\n3\r\n");
+    REQUIRE(hello.rfind("%7\r\n", 0) == 0);
+    REQUIRE(hello.find("$5\r\nproto\r\n:3\r\n") != std::string::npos);
+    REQUIRE(resp3.handleCommand("*2\r\n$5\r\nHELLO\r\n$1\r\n4\r\n").find("-NOPROTO") == 0);
+
+    REQUIRE(resp3.handleCommand("*2\r\n$7\r\nHGETALL\r\n$1\r\nh\r\n") == "%1\r\n$1\r\nf\r\n$1\r\nv\r\n");
+    REQUIRE(resp3.handleCommand("*2\r\n$3\r\nGET\r\n$7\r\nmissing\r\n") == "_\r\n");
+    // the other connection is still on RESP2
+    REQUIRE(resp2.handleCommand("*2\r\n$7\r\nHGETALL\r\n$1\r\nh\r\n") == "*2\r\n$1\r\nf\r\n$1\r\nv\r\n");
+    REQUIRE(resp2.handleCommand("*2\r\n$3\r\nGET\r\n$7\r\nmissing\r\n") == "$-1\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler CLIENT TRACKING pushes invalidations", "[handler]")
+{
+    LettuceCommandHandler reader;
+    LettuceCommandHandler writer;
+    writer.handleCommand("*3\r\n$3\r\nSET\r\n$3\r\nhot\r\n$1\r\n1\r\n");
+
+    REQUIRE(reader.handleCommand("*3\r\n$6\r\nCLIENT\r\n$8\r\nTRACKING\r\n$2\r\nON\r\n").find("-ERR") == 0);
+    reader.handleCommand("*2\r\n$5\r\nHELLO\r\n$1\r\n3\r\n");
+    REQUIRE(reader.handleCommand("*3\r\n$6\r\nCLIENT\r\n$8\r\nTRACKING\r\n$2\r\nON\r\n") == "+OK\r\n");
+    REQUIRE(reader.handleCommand("*2\r\n$3\r\nGET\r\n$3\r\nhot\r\n") == "$1\r\n1\r\n");
+
+    writer.handleCommand("*3\r\n$3\r\nSET\r\n$3\r\nhot\r\n$1\r\n2\r\n");
+    REQUIRE(reader.pendingPushes() == ">2\r\n$10\r\ninvalidate\r\n*1\r\n$3\r\nhot\r\n");
+
+    // pending invalidations are sent ahead of the next reply
+    reader.handleCommand("*2\r\n$3\r\nGET\r\n$3\r\nhot\r\n");
+    writer.handleCommand("*2\r\n$3\r\nDEL\r\n$3\r\nhot\r\n");
+    REQUIRE(reader.handleCommand("*1\r\n$4\r\nPING\r\n") == ">2\r\n$10\r\ninvalidate\r\n*1\r\n$3\r\nhot\r\n+PONG\r\n");
+    REQUIRE(reader.handleCommand("*3\r\n$6\r\nCLIENT\r\n$8\r\nTRACKING\r\n$3\r\nOFF\r\n") == "+OK\r\n");
+}
+
+TEST_CASE("LettuceCommandHandler SAVE, BGSAVE and LASTSAVE", "[handler]")
+{
+    LettuceCommandHandler handler;
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n");
+
+    REQUIRE(handler.handleCommand("*1\r\n$4\r\nSAVE\r\n") == "+OK\r\n");
+    std::string lastsave = handler.handleCommand("*1\r\n$8\r\nLASTSAVE\r\n");
+    REQUIRE(lastsave[0] == ':');
+    REQUIRE(std::stoll(lastsave.substr(1)) >= std::time(nullptr) - 5);
+
+    REQUIRE(handler.handleCommand("*1\r\n$6\r\nBGSAVE\r\n") == "+Background saving started\r\n");
+    REQUIRE(db.waitForBgsave());
+    std::string info = handler.handleCommand("*2\r\n$4\r\nINFO\r\n$11\r\npersistence\r\n");
+    REQUIRE(info.find("rdb_bgsave_in_progress:0\r\n") != std::string::npos);
+    REQUIRE(info.find("rdb_last_bgsave_status:ok\r\n") != std::string::npos);
+    REQUIRE(info.find("rdb_bgsave_keys_saved:1\r\n") != std::string::npos);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler logs writes to the append only file", "[handler]")
+{
+    LettuceCommandHandler handler;
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$11\r\nappendfsync\r\n$6\r\nalways\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$10\r\nappendonly\r\n$3\r\nyes\r\n") == "+OK\r\n");
+    REQUIRE(db.waitForBgsave());
+
+    handler.handleCommand("*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n");
+    handler.handleCommand("*2\r\n$3\r\nGET\r\n$1\r\nk\r\n");
+    handler.handleCommand("*3\r\n$6\r\nEXPIRE\r\n$1\r\nk\r\n$3\r\n100\r\n");
+    handler.handleCommand("*2\r\n$3\r\nDEL\r\n$7\r\nmissing\r\n");
+    handler.handleCommand("*1\r\n$5\r\nMULTI\r\n");
+    handler.handleCommand("*3\r\n$5\r\nRPUSH\r\n$1\r\nl\r\n$1\r\na\r\n");
+    handler.handleCommand("*1\r\n$4\r\nEXEC\r\n");
+    std::string info = handler.handleCommand("*2\r\n$4\r\nINFO\r\n$11\r\npersistence\r\n");
+    REQUIRE(info.find("aof_enabled:1\r\n") != std::string::npos);
+    REQUIRE(info.find("aof_buffer_length:0\r\n") != std::string::npos);
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$10\r\nappendonly\r\n$2\r\nno\r\n") == "+OK\r\n");
+    handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$11\r\nappendfsync\r\n$8\r\neverysec\r\n");
+
+    // reads aren't logged, EXPIRE is made absolute and the transaction stays wrapped
+    std::vector<std::string> commands;
+    size_t replayed;
+    std::string error;
+    REQUIRE(LettuceAof::getInstance().replay(LettuceAof::defaultFilename, {}, [&](std::vector<std::string> &tokens)
+                                             { commands.push_back(tokens[0]); }, replayed, error));
+    REQUIRE(commands == std::vector<std::string>{"SET", "PEXPIREAT", "DEL", "MULTI", "RPUSH", "EXEC"});
+
+    // replaying through a handler rebuilds the keyspace
+    handler.handleCommand("*1\r\n$8\r\nFLUSHALL\r\n");
+    LettuceCommandHandler replayHandler;
+    REQUIRE(LettuceAof::getInstance().replay(LettuceAof::defaultFilename, {}, [&](std::vector<std::string> &tokens)
+                                             { replayHandler.execute(std::move(tokens)); }, replayed, error));
+    REQUIRE(handler.handleCommand("*2\r\n$3\r\nGET\r\n$1\r\nk\r\n") == "$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("*2\r\n$4\r\nLLEN\r\n$1\r\nl\r\n") == ":1\r\n");
+    REQUIRE(db.expiryMap.count("k") == 1);
+
+    std::remove(LettuceAof::defaultFilename);
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler won't start the append only file during a background save", "[handler]")
+{
+    LettuceCommandHandler handler;
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    handler.handleCommand("FLUSHALL");
+    db.set("k", "v");
+    // the child waits on its first key until the delay is lowered again
+    REQUIRE(handler.handleCommand("CONFIG SET snapshot-key-delay 3600000000") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("BGSAVE") == "+Background saving started\r\n");
+    // that save started before the log would, so it can't be the log's base
+    REQUIRE(handler.handleCommand("CONFIG SET appendonly yes").rfind("-ERR", 0) == 0);
+    REQUIRE(handler.handleCommand("CONFIG GET appendonly") == "*2\r\n$10\r\nappendonly\r\n$2\r\nno\r\n");
+    REQUIRE(handler.handleCommand("INFO persistence").find("aof_enabled:0\r\n") != std::string::npos);
+
+    REQUIRE(handler.handleCommand("CONFIG SET snapshot-key-delay 0") == "+OK\r\n");
+    REQUIRE(db.waitForBgsave());
+    REQUIRE(handler.handleCommand("CONFIG SET appendonly yes") == "+OK\r\n");
+    REQUIRE(db.waitForBgsave());
+    REQUIRE(handler.handleCommand("CONFIG SET appendonly no") == "+OK\r\n");
+    std::remove(LettuceAof::defaultFilename);
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler PEXPIREAT rejects times it can't parse", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    handler.handleCommand("SET k v");
+    REQUIRE(handler.handleCommand("PEXPIREAT k 123456789012345678901234").rfind("-ERR", 0) == 0);
+    REQUIRE(handler.handleCommand("PEXPIREAT k -5").rfind("-ERR", 0) == 0);
+    REQUIRE(handler.handleCommand("PEXPIREAT k 99999999999999999") == ":1\r\n");
+    REQUIRE(handler.handleCommand("GET k") == "$1\r\nv\r\n");
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler RPUSH and LPUSH take several values", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    REQUIRE(handler.handleCommand("RPUSH l b c") == ":2\r\n");
+    REQUIRE(handler.handleCommand("LPUSH l a z") == ":4\r\n");
+    REQUIRE(handler.handleCommand("LINDEX l 0") == "$1\r\nz\r\n");
+    REQUIRE(handler.handleCommand("LINDEX l 3") == "$1\r\nc\r\n");
+    REQUIRE(handler.handleCommand("RPUSH l").rfind("-ERR", 0) == 0);
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler BGREWRITEAOF compacts the append only file", "[handler]")
+{
+    LettuceCommandHandler handler;
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    LettuceAof &aof = LettuceAof::getInstance();
+    handler.handleCommand("FLUSHALL");
+    REQUIRE(handler.handleCommand("BGREWRITEAOF").rfind("-ERR", 0) == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET appendonly yes") == "+OK\r\n");
+    REQUIRE(db.waitForBgsave());
+
+    for (int i = 0; i < 300; i++)
+    {
+        handler.handleCommand("SET counter " + std::to_string(i));
+        handler.handleCommand("RPUSH list " + std::to_string(i));
+    }
+    handler.handleCommand("SADD ints 1 2 3");
+    handler.handleCommand("SADD words a b");
+    handler.handleCommand("HSET h f v");
+    handler.handleCommand("EXPIRE counter 1000");
+    uint64_t generation = aof.position().generation;
+
+    REQUIRE(handler.handleCommand("BGREWRITEAOF") == "+Background append only file rewriting started\r\n");
+    // whether these land in the rewrite diff or after the switch, they must survive it
+    handler.handleCommand("SET during 1");
+    handler.handleCommand("RPUSH list last");
+    REQUIRE(aof.waitForRewrite());
+    handler.handleCommand("SET after 2");
+
+    std::string info = handler.handleCommand("INFO persistence");
+    REQUIRE(info.find("aof_rewrite_in_progress:0\r\n") != std::string::npos);
+    REQUIRE(info.find("aof_last_bgrewrite_status:ok\r\n") != std::string::npos);
+    REQUIRE(aof.position().generation != generation);
+    REQUIRE(handler.handleCommand("CONFIG SET appendonly no") == "+OK\r\n");
+
+    // one command per key instead of one per write, and it starts from an empty keyspace
+    std::vector<std::string> commands;
+    size_t replayed;
+    std::string error;
+    REQUIRE(aof.replay(LettuceAof::defaultFilename, {}, [&](std::vector<std::string> &tokens)
+                       { commands.push_back(tokens[0]); }, replayed, error));
+    REQUIRE(commands.front() == "FLUSHALL");
+    REQUIRE(commands.size() < 30);
+
+    handler.handleCommand("FLUSHALL");
+    LettuceCommandHandler replayHandler;
+    REQUIRE(aof.replay(LettuceAof::defaultFilename, {}, [&](std::vector<std::string> &tokens)
+                       { replayHandler.execute(std::move(tokens)); }, replayed, error));
+    REQUIRE(handler.handleCommand("GET counter") == "$3\r\n299\r\n");
+    REQUIRE(db.expiryMap.count("counter") == 1);
+    REQUIRE(handler.handleCommand("LLEN list") == ":301\r\n");
+    REQUIRE(handler.handleCommand("LINDEX list 300") == "$4\r\nlast\r\n");
+    REQUIRE(handler.handleCommand("SCARD ints") == ":3\r\n");
+    REQUIRE(handler.handleCommand("SISMEMBER words b") == ":1\r\n");
+    REQUIRE(handler.handleCommand("HGET h f") == "$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("GET during") == "$1\r\n1\r\n");
+    REQUIRE(handler.handleCommand("GET after") == "$1\r\n2\r\n");
+
+    std::remove(LettuceAof::defaultFilename);
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler answers -LOADING while the dataset loads", "[handler]")
+{
+    LettuceCommandHandler handler;
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    handler.handleCommand("FLUSHALL");
+    db.setLoading(true);
+
+    REQUIRE(handler.handleCommand("GET k").rfind("-LOADING", 0) == 0);
+    REQUIRE(handler.handleCommand("SET k v").rfind("-LOADING", 0) == 0);
+    REQUIRE(handler.handleCommand("MULTI").rfind("-LOADING", 0) == 0);
+    REQUIRE(handler.handleCommand("PING") == "+PONG\r\n");
+    REQUIRE(handler.handleCommand("INFO persistence").find("loading:1\r\n") != std::string::npos);
+
+    // the startup replay still gets through
+    REQUIRE(handler.execute({"SET", "k", "v"}) == "+OK\r\n");
+    db.setLoading(false);
+    REQUIRE(handler.handleCommand("GET k") == "$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("INFO persistence").find("loading:0\r\n") != std::string::npos);
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler CONFIG save sets the save rules", "[handler]")
+{
+    LettuceCommandHandler handler;
+    std::string defaults = "*2\r\n$4\r\nsave\r\n$23\r\n3600 1 300 100 60 10000\r\n";
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$4\r\nsave\r\n") == defaults);
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$4\r\nsave\r\n$9\r\n900 1 5 2\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$4\r\nsave\r\n") == "*2\r\n$4\r\nsave\r\n$9\r\n900 1 5 2\r\n");
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$4\r\nsave\r\n$3\r\n900\r\n").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$4\r\nsave\r\n$5\r\n900 0\r\n").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$4\r\nsave\r\n$0\r\n\r\n") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$4\r\nsave\r\n") == "*2\r\n$4\r\nsave\r\n$0\r\n\r\n");
+
+    handler.handleCommand("SET k v");
+    REQUIRE(handler.handleCommand("INFO persistence").find("rdb_changes_since_last_save:") != std::string::npos);
+    handler.handleCommand("*4\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$4\r\nsave\r\n$23\r\n3600 1 300 100 60 10000\r\n");
+    cleanup();
+}
+
+TEST_CASE("LettuceCommandHandler refuses writes over maxmemory with noeviction", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    REQUIRE(handler.handleCommand("SET k v") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET maxmemory 1kb") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG GET maxmemory") == "*2\r\n$9\r\nmaxmemory\r\n$4\r\n1024\r\n");
+    REQUIRE(handler.handleCommand("CONFIG GET maxmemory-policy") == "*2\r\n$16\r\nmaxmemory-policy\r\n$10\r\nnoeviction\r\n");
+    REQUIRE(handler.handleCommand("SET other v").find("-OOM") == 0);
+    REQUIRE(handler.handleCommand("RPUSH list v").find("-OOM") == 0);
+    // reads and deletes still work, they are how a client gets out of this
+    REQUIRE(handler.handleCommand("GET k") == "$1\r\nv\r\n");
+    REQUIRE(handler.handleCommand("DEL k") == ":1\r\n");
+    REQUIRE(handler.handleCommand("INFO memory").find("maxmemory:1024\r\n") != std::string::npos);
+
+    REQUIRE(handler.handleCommand("CONFIG SET maxmemory-policy allkeys-random").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET maxmemory 10xb").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET maxmemory-samples 0").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET maxmemory 0") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("SET other v") == "+OK\r\n");
+    handler.handleCommand("FLUSHALL");
+}
+
+TEST_CASE("LettuceCommandHandler MEMORY USAGE and INFO memory", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    handler.handleCommand("SET k " + std::string(1000, 'v'));
+    std::string reply = handler.handleCommand("MEMORY USAGE k");
+    REQUIRE(reply[0] == ':');
+    REQUIRE(std::stoll(reply.substr(1)) > 1000);
+    REQUIRE(handler.handleCommand("MEMORY USAGE k SAMPLES 0") == reply);
+    REQUIRE(handler.handleCommand("MEMORY USAGE missing") == "$-1\r\n");
+    REQUIRE(handler.handleCommand("MEMORY USAGE k SAMPLES -1").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("MEMORY USAGE k COUNT 1").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("MEMORY DOCTOR").find("-ERR") == 0);
+
+    std::string info = handler.handleCommand("INFO memory");
+    for (const char *field : {"used_memory:", "used_memory_peak:", "used_memory_rss:", "mem_fragmentation_ratio:",
+                              "used_memory_strings:", "used_memory_lists:", "used_memory_hashes:", "used_memory_sets:", "used_memory_expires:",
+                              "active_defrag_running:", "active_defrag_hits:", "active_defrag_key_misses:",
+                              "compressed_strings:", "compressed_strings_bytes_saved:", "hash_field_names_interned:"})
+        REQUIRE(info.find(field) != std::string::npos);
+    handler.handleCommand("FLUSHALL");
+}
+
+TEST_CASE("LettuceCommandHandler GET decodes compressed strings", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    REQUIRE(handler.handleCommand("CONFIG SET string-compression-threshold 1kb") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG GET string-compression-threshold") == "*2\r\n$28\r\nstring-compression-threshold\r\n$4\r\n1024\r\n");
+    std::string value;
+    for (int i = 0; i < 200; i++)
+        value += "chunk" + std::to_string(i % 10);
+    REQUIRE(handler.handleCommand("SET k " + value) == "+OK\r\n");
+    REQUIRE(handler.handleCommand("GET k") == "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n");
+    REQUIRE(handler.handleCommand("INFO memory").find("compressed_strings:1\r\n") != std::string::npos);
+    REQUIRE(handler.handleCommand("CONFIG SET string-compression-threshold 0") == "+OK\r\n");
+    handler.handleCommand("FLUSHALL");
+}
+
+TEST_CASE("LettuceCommandHandler reads values back from tiered storage", "[handler]")
+{
+    LettuceCommandHandler handler;
+    handler.handleCommand("FLUSHALL");
+    REQUIRE(handler.handleCommand("CONFIG GET tiered-storage") == "*2\r\n$14\r\ntiered-storage\r\n$2\r\nno\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-path test-handler-tier") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-idle-seconds 0") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-min-size 1kb") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-segment-size 0").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-idle-seconds x").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage yes") == "+OK\r\n");
+
+    std::string value(5000, 'v');
+    REQUIRE(handler.handleCommand("SET k " + value) == "+OK\r\n");
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(handler.handleCommand("INFO tiered").find("tiered_keys:1\r\n") != std::string::npos);
+    // the command reads it back into memory first
+    REQUIRE(handler.handleCommand("GET k") == "$5000\r\n" + value + "\r\n");
+    REQUIRE(handler.handleCommand("INFO tiered").find("tiered_keys:0\r\n") != std::string::npos);
+    uint64_t reads = db.tierStats().reads;
+    REQUIRE(reads == 1);
+
+    // commands that replace or drop the value never read it
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(handler.handleCommand("SET k " + std::string(5000, 'w')) == "+OK\r\n");
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(handler.handleCommand("EXPIRE k 100") == ":1\r\n");
+    REQUIRE(handler.handleCommand("DEL k") == ":1\r\n");
+    REQUIRE(db.tierStats().reads == reads);
+    REQUIRE(db.tierStats().keys == 0);
+
+    // a value that can't be read back fails the command and stays on disk
+    REQUIRE(handler.handleCommand("SET k " + value) == "+OK\r\n");
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(truncate("test-handler-tier.1", 0) == 0);
+    const std::string failed = "-ERR: can't read the value back from tiered storage\r\n";
+    REQUIRE(handler.handleCommand("GET k") == failed);
+    REQUIRE(handler.handleCommand("SETBIT k 0 1") == failed);
+    REQUIRE(db.tierStats().keys == 1);
+    REQUIRE(handler.handleCommand("DEL k") == ":1\r\n");
+
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage no") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-path lettuce-tier") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-idle-seconds 600") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET tiered-storage-min-size 1024") == "+OK\r\n");
+    handler.handleCommand("FLUSHALL");
+}
+
+TEST_CASE("LettuceCommandHandler CONFIG sets the active defrag parameters", "[handler]")
+{
+    LettuceCommandHandler handler;
+    REQUIRE(handler.handleCommand("CONFIG GET activedefrag") == "*2\r\n$12\r\nactivedefrag\r\n$2\r\nno\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET activedefrag yes") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-ignore-bytes 1mb") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-threshold-lower 20") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-cycle-max 101").find("-ERR") == 0);
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-cycle-min x").find("-ERR") == 0);
+
+    LettuceDefragConfig config = LettuceDatabase::getInstance().getDefragConfig();
+    REQUIRE(config.enabled);
+    REQUIRE(config.ignoreBytes == 1024 * 1024);
+    REQUIRE(config.thresholdLower == 20);
+    REQUIRE(config.cycleMax == 25);
+
+    REQUIRE(handler.handleCommand("CONFIG SET activedefrag no") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-ignore-bytes 100mb") == "+OK\r\n");
+    REQUIRE(handler.handleCommand("CONFIG SET active-defrag-threshold-lower 10") == "+OK\r\n");
+}
@@ -0,0 +1,28 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceCow.h"
+
+#include <string>
+#include <vector>
+
+TEST_CASE("LettuceCow shares on copy and clones on first write", "[cow]")
+{
+    LettuceCow<std::vector<std::string>> original;
+    original = {"a", "b"};
+    REQUIRE_FALSE(original.shared());
+
+    LettuceCow<std::vector<std::string>> copy = original;
+    REQUIRE(original.shared());
+    REQUIRE(&*copy == &*original);
+
+    copy.mutate().push_back("c");
+    REQUIRE_FALSE(original.shared());
+    REQUIRE_FALSE(copy.shared());
+    REQUIRE(original.size() == 2);
+    REQUIRE(copy.size() == 3);
+    REQUIRE(copy[2] == "c");
+
+    // writing an unshared value doesn't clone it
+    const std::vector<std::string> *before = &*copy;
+    copy.mutate().pop_back();
+    REQUIRE(&*copy == before);
+}
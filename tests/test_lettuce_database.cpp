@@ -1,10 +1,26 @@
 #include <catch2/catch.hpp>
 #include "../include/LettuceDatabase.h"
+#include "../include/LettuceHyperLogLog.h"
+#include "../include/LettuceLazyFree.h"
+#include "../include/LettuceMemory.h"
 #include "test_utils.h"
 
 #include <cstdio> // for std::remove
 #include <chrono>
 #include <thread>
+#include <set>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static long fileSize(const std::string &filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? info.st_size : -1;
+}
 
 TEST_CASE("LettuceDatabase is a singleton", "[database]")
 {
@@ -43,6 +59,625 @@ TEST_CASE("LettuceDatabase dump and load for key-value, list, and hash", "[datab
     cleanup();
 }
 
+TEST_CASE("LettuceDatabase snapshot is binary safe and keeps expiries and encodings", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    std::string binary("line one\r\nline two\0 with: colons", 32);
+    db.set("key with spaces", binary);
+    db.set("", "empty key");
+    db.rpush("list", "a b");
+    db.rpush("list", "");
+    db.hset("hash", "field:1", "value 1\n");
+    db.sadd("ints", {"1", "-5", "300"});
+    db.sadd("words", {"x y", "z"});
+    db.set("temporary", "soon gone");
+    db.expire("temporary", 100);
+
+    REQUIRE(db.dump(test_db_filename));
+    db.flushAll();
+    REQUIRE(db.load(test_db_filename));
+
+    std::string value;
+    REQUIRE(db.get("key with spaces", value));
+    REQUIRE(value == binary);
+    REQUIRE(db.get("", value));
+    REQUIRE(value == "empty key");
+    REQUIRE(db.lget("list") == std::vector<std::string>{"a b", ""});
+    REQUIRE(db.hget("hash", "field:1", value));
+    REQUIRE(value == "value 1\n");
+    REQUIRE(db.setStore["ints"]->isIntset());
+    REQUIRE(db.sismember("ints", "-5"));
+    REQUIRE_FALSE(db.setStore["words"]->isIntset());
+    REQUIRE(db.sismember("words", "x y"));
+
+    // the expiry comes back within a second or so of what it was
+    REQUIRE(db.expiryMap.count("temporary") == 1);
+    auto remaining = std::chrono::duration_cast<std::chrono::seconds>(db.expiryMap["temporary"] - std::chrono::steady_clock::now()).count();
+    REQUIRE(remaining >= 98);
+    REQUIRE(remaining <= 100);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase load rejects a corrupt snapshot and keeps the keyspace", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    db.set("saved", "1");
+    REQUIRE(db.dump(test_db_filename));
+    db.set("live", "2");
+
+    FILE *file = std::fopen(test_db_filename.c_str(), "r+b");
+    REQUIRE(file != nullptr);
+    std::fseek(file, 10, SEEK_SET);
+    std::fputc('#', file);
+    std::fclose(file);
+
+    REQUIRE_FALSE(db.load(test_db_filename));
+    std::string value;
+    REQUIRE(db.get("live", value));
+
+    REQUIRE_FALSE(db.load("missing.ldb"));
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase loads a multi segment snapshot in parallel", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    // a few MB, so the file has several segments for the load threads to share
+    std::string padding(100, 'p');
+    for (int i = 0; i < 40000; i++)
+        db.set("key:" + std::to_string(i), padding + std::to_string(i));
+    for (int i = 0; i < 100; i++)
+    {
+        db.rpush("list:" + std::to_string(i), std::vector<std::string>(50, "item"));
+        db.hset("hash:" + std::to_string(i), "f", std::to_string(i));
+        db.sadd("set:" + std::to_string(i), {"1", std::to_string(i + 2)});
+    }
+    db.expire("key:123", 100);
+    REQUIRE(db.dump(test_db_filename));
+    db.flushAll();
+
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(db.keyValueStore.size() == 40000);
+    REQUIRE(db.listStore.size() == 100);
+    REQUIRE(db.hashStore.size() == 100);
+    REQUIRE(db.setStore.size() == 100);
+    std::string value;
+    REQUIRE(db.get("key:39999", value));
+    REQUIRE(value == padding + "39999");
+    REQUIRE(db.llen("list:99") == 50);
+    REQUIRE(db.hget("hash:42", "f", value));
+    REQUIRE(value == "42");
+    REQUIRE(db.sismember("set:7", "9"));
+    REQUIRE(db.expiryMap.count("key:123") == 1);
+
+    // damage near the end, in a later segment - nothing of the file may be applied
+    db.flushAll();
+    db.set("live", "1");
+    FILE *file = std::fopen(test_db_filename.c_str(), "r+b");
+    REQUIRE(file != nullptr);
+    std::fseek(file, -100, SEEK_END);
+    std::fputc('#', file);
+    std::fclose(file);
+    REQUIRE_FALSE(db.load(test_db_filename));
+    REQUIRE(db.keyValueStore.size() == 1);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase compressed snapshots load the same keyspace", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    for (int i = 0; i < 20000; i++)
+        db.set("user:" + std::to_string(i), "{\"id\":" + std::to_string(i) + ",\"plan\":\"free\",\"verified\":false}");
+    db.rpush("list", std::vector<std::string>(1000, "repeated item"));
+
+    db.setSnapshotCompression(false);
+    REQUIRE(db.dump(test_db_filename));
+    long plainSize = fileSize(test_db_filename);
+    db.setSnapshotCompression(true);
+    REQUIRE(db.dump(test_db_filename));
+    REQUIRE(fileSize(test_db_filename) < plainSize / 2);
+
+    db.flushAll();
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(db.keyValueStore.size() == 20000);
+    std::string value;
+    REQUIRE(db.get("user:19999", value));
+    REQUIRE(value == "{\"id\":19999,\"plan\":\"free\",\"verified\":false}");
+    REQUIRE(db.llen("list") == 1000);
+
+    cleanup();
+}
+
+// not run by default: ./test_runner "[benchmark]"
+TEST_CASE("LettuceDatabase snapshot compression benchmark", "[.][benchmark]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    for (int i = 0; i < 1000000; i++)
+        db.set("session:" + std::to_string(i), "{\"user\":" + std::to_string(i % 5000) + ",\"cart\":[\"sku-" + std::to_string(i % 97) +
+                                                   "\"],\"locale\":\"en-US\",\"expires\":1700000000}");
+
+    for (bool compression : {false, true})
+    {
+        db.setSnapshotCompression(compression);
+        auto start = std::chrono::steady_clock::now();
+        REQUIRE(db.dump(test_db_filename));
+        auto dumped = std::chrono::steady_clock::now();
+        REQUIRE(db.load(test_db_filename));
+        auto loaded = std::chrono::steady_clock::now();
+        std::cout << (compression ? "compressed  " : "uncompressed") << " size " << fileSize(test_db_filename)
+                  << " dump " << std::chrono::duration<double, std::milli>(dumped - start).count() << "ms"
+                  << " load " << std::chrono::duration<double, std::milli>(loaded - dumped).count() << "ms" << std::endl;
+    }
+    db.setSnapshotCompression(true);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase reports load progress and refuses saves while loading", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    for (int i = 0; i < 100; i++)
+        db.set("key:" + std::to_string(i), "v");
+    db.rpush("list", "a");
+    REQUIRE(db.dump(test_db_filename));
+
+    db.setLoading(true);
+    REQUIRE(db.isLoading());
+    REQUIRE_FALSE(db.dump("test_loading.ldb"));
+    REQUIRE_FALSE(db.bgsave("test_loading.ldb"));
+    REQUIRE(db.load(test_db_filename));
+
+    LettuceLoadStats stats = db.loadStats();
+    REQUIRE(stats.loading);
+    REQUIRE(stats.startTime >= std::time(nullptr) - 5);
+    REQUIRE(stats.bytesTotal > 0);
+    REQUIRE(stats.bytesLoaded == stats.bytesTotal);
+    REQUIRE(stats.keysTotal == 101);
+    REQUIRE(stats.keysLoaded == 101);
+    REQUIRE(stats.etaSeconds == 0);
+
+    db.setLoading(false);
+    REQUIRE_FALSE(db.loadStats().loading);
+    REQUIRE(db.dump(test_db_filename));
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase still loads version 1 snapshots", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    // header, one string record and the footer, without sizes or segments
+    std::vector<uint8_t> contents{'L', 'E', 'T', 'T', 'U', 'C', 'E', 1,
+                                  LettuceSnapshot::typeString, 3, 'o', 'l', 'd', 2, 'v', '1',
+                                  LettuceSnapshot::opEof};
+    uint64_t crc = crc64(0, contents.data(), contents.size());
+    for (int i = 0; i < 8; i++)
+        contents.push_back(static_cast<uint8_t>(crc >> (8 * i)));
+    FILE *file = std::fopen(test_db_filename.c_str(), "wb");
+    REQUIRE(file != nullptr);
+    std::fwrite(contents.data(), 1, contents.size(), file);
+    std::fclose(file);
+
+    REQUIRE(db.load(test_db_filename));
+    std::string value;
+    REQUIRE(db.get("old", value));
+    REQUIRE(value == "v1");
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase bgsave writes a point in time snapshot", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    for (int i = 0; i < 2000; i++)
+        db.set("key:" + std::to_string(i), "before");
+    db.rpush("list", "a");
+
+    REQUIRE(db.bgsave(test_db_filename));
+    // the child has its own copy of memory, writes made after the fork can't leak into the file
+    db.set("key:0", "after");
+    db.set("late", "1");
+    REQUIRE(db.waitForBgsave());
+
+    LettuceSaveStats stats = db.saveStats();
+    REQUIRE_FALSE(stats.inProgress);
+    REQUIRE(stats.lastBgsaveOk);
+    REQUIRE(stats.keysSaved == 2001);
+    REQUIRE(stats.keysTotal == 2001);
+    REQUIRE(stats.bytesWritten > 0);
+    REQUIRE(db.lastSave() >= std::time(nullptr) - 5);
+
+    db.flushAll();
+    REQUIRE(db.load(test_db_filename));
+    std::string value;
+    REQUIRE(db.get("key:0", value));
+    REQUIRE(value == "before");
+    REQUIRE_FALSE(db.get("late", value));
+    REQUIRE(db.llen("list") == 1);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase save rules follow the number of changes", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    REQUIRE(db.dump(test_db_filename));
+    REQUIRE(db.saveStats().changesSinceSave == 0);
+    auto defaults = db.getSaveRules();
+
+    db.setSaveRules({{0, 3}});
+    REQUIRE_FALSE(db.saveIfDue(test_db_filename)); // nothing changed
+    db.set("a", "1");
+    db.rpush("list", std::vector<std::string>{"x", "y"});
+    REQUIRE(db.saveStats().changesSinceSave == 2);
+    REQUIRE_FALSE(db.saveIfDue(test_db_filename));
+
+    db.del("a");
+    REQUIRE(db.saveIfDue(test_db_filename));
+    REQUIRE(db.waitForBgsave());
+    REQUIRE(db.saveStats().changesSinceSave == 0);
+
+    // a rule only fires once its seconds have passed since the last save
+    db.setSaveRules({{3600, 1}});
+    db.set("b", "2");
+    REQUIRE_FALSE(db.saveIfDue(test_db_filename));
+    db.setSaveRules({});
+    REQUIRE_FALSE(db.saveIfDue(test_db_filename));
+
+    // FLUSHALL ASYNC counts the keys it dropped the same as the synchronous one
+    uint64_t changes = db.saveStats().changesSinceSave;
+    db.flushAll(true);
+    REQUIRE(db.saveStats().changesSinceSave == changes + 2);
+
+    // a SAVE while a BGSAVE child runs leaves nothing for the child's finish to take off
+    db.setKeySaveDelay(3600000000ULL);
+    REQUIRE(db.bgsave(test_db_filename));
+    db.set("c", "3");
+    REQUIRE(db.dump(test_db_filename));
+    db.set("d", "4");
+    db.setKeySaveDelay(0);
+    REQUIRE(db.waitForBgsave());
+    REQUIRE(db.saveStats().changesSinceSave == 1);
+
+    db.setSaveRules(defaults);
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase evicts the least recently used keys over maxmemory", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.setEvictionPolicy(LettuceEvictionPolicy::AllKeysLru);
+    db.setMaxMemory(SIZE_MAX);
+    REQUIRE(db.accessTracked());
+    for (int i = 0; i < 200; i++)
+        db.set("key" + std::to_string(i), std::string(10000, 'x'));
+    // the lru clock ticks in seconds
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    std::vector<std::string> hot{"key1", "key2", "key3", "key4", "key5"};
+    db.touch(hot);
+
+    uint64_t evictedBefore = db.evictedKeyCount();
+    db.setMaxMemory(LettuceMemory::used() - 1000000);
+    REQUIRE(db.freeMemoryIfNeeded());
+    REQUIRE(LettuceMemory::used() <= db.getMaxMemory());
+    uint64_t evicted = db.evictedKeyCount() - evictedBefore;
+    REQUIRE(evicted >= 50);
+    REQUIRE(evicted < 200);
+    REQUIRE(db.keys().size() == 200 - evicted);
+    std::string value;
+    for (const auto &key : hot)
+        REQUIRE(db.get(key, value));
+
+    db.setMaxMemory(0);
+    db.setEvictionPolicy(LettuceEvictionPolicy::NoEviction);
+    REQUIRE_FALSE(db.accessTracked());
+    db.flushAll();
+}
+
+TEST_CASE("LettuceDatabase volatile-ttl only evicts keys with an expiry", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.setEvictionPolicy(LettuceEvictionPolicy::VolatileTtl);
+    for (int i = 0; i < 20; i++)
+        db.set("persistent" + std::to_string(i), std::string(10000, 'p'));
+    for (int i = 0; i < 20; i++)
+    {
+        db.set("volatile" + std::to_string(i), std::string(10000, 'v'));
+        db.expire("volatile" + std::to_string(i), 1000 + i);
+    }
+
+    // a limit no amount of eviction can meet empties the volatile keys and gives up
+    db.setMaxMemory(1);
+    REQUIRE_FALSE(db.freeMemoryIfNeeded());
+    auto keys = db.keys();
+    REQUIRE(keys.size() == 20);
+    for (const auto &key : keys)
+        REQUIRE(key.rfind("persistent", 0) == 0);
+
+    db.setMaxMemory(0);
+    db.setEvictionPolicy(LettuceEvictionPolicy::NoEviction);
+    db.flushAll();
+}
+
+TEST_CASE("LettuceDatabase charges memory to the type of the value", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    LettuceLazyFree::getInstance().waitUntilIdle();
+    using LettuceMemory::used;
+    size_t strings = used(LettuceMemory::Strings), lists = used(LettuceMemory::Lists), hashes = used(LettuceMemory::Hashes);
+    size_t sets = used(LettuceMemory::Sets), expires = used(LettuceMemory::Expires);
+
+    for (int i = 0; i < 100; i++)
+    {
+        db.set("string" + std::to_string(i), std::string(1000, 's'));
+        db.rpush("list", std::string(100, 'l'));
+        db.hset("hash", "field" + std::to_string(i), std::string(100, 'h'));
+        db.sadd("set", {"member" + std::to_string(i) + std::string(50, 'm')});
+        db.sadd("intset", {std::to_string(i)});
+    }
+    db.expire("list", 1000);
+    REQUIRE(used(LettuceMemory::Strings) - strings >= 100 * 1000);
+    REQUIRE(used(LettuceMemory::Lists) - lists >= 100 * 100);
+    REQUIRE(used(LettuceMemory::Hashes) - hashes >= 100 * 100);
+    REQUIRE(used(LettuceMemory::Sets) - sets >= 100 * 50);
+    REQUIRE(used(LettuceMemory::Expires) != expires);
+
+    // popping, renaming, copying and overwriting all move the counters the right way
+    std::string value;
+    db.lpop("list", value);
+    db.rename("string0", "renamed");
+    db.copy("hash", "hashcopy", false);
+    db.hset("hashcopy", "field0", "changed");
+    db.set("string1", std::string(5000, 'S'));
+    db.unlink("string2");
+    db.lpush("biglist", std::vector<std::string>(1000, std::string(20, 'b')));
+    db.del("biglist"); // over the lazy free threshold
+
+    // the snapshot load replaces everything under the same categories
+    REQUIRE(db.dump(test_db_filename));
+    REQUIRE(db.load(test_db_filename));
+
+    db.flushAll();
+    LettuceLazyFree::getInstance().waitUntilIdle();
+    REQUIRE(used(LettuceMemory::Strings) == strings);
+    REQUIRE(used(LettuceMemory::Lists) == lists);
+    REQUIRE(used(LettuceMemory::Hashes) == hashes);
+    REQUIRE(used(LettuceMemory::Sets) == sets);
+    REQUIRE(used(LettuceMemory::Expires) == expires);
+
+    db.set("string", std::string(1000, 's'));
+    db.flushAll(true);
+    LettuceLazyFree::getInstance().waitUntilIdle();
+    REQUIRE(used(LettuceMemory::Strings) == strings);
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase defrag passes keep every value intact", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    // interleave short lived garbage with the values so the heap has holes to fill
+    for (int i = 0; i < 200; i++)
+    {
+        std::string garbage(500, 'g');
+        db.set("garbage:" + std::to_string(i), garbage);
+        db.set("string:" + std::to_string(i), std::string(300, 's') + std::to_string(i));
+    }
+    for (int i = 0; i < 200; i++)
+        db.del("garbage:" + std::to_string(i));
+    // bigger than a chunk, so it's finished over several steps
+    std::vector<std::string> items;
+    for (int i = 0; i < 2500; i++)
+        items.push_back(std::string(50, 'l') + std::to_string(i));
+    db.rpush("list", items);
+    std::vector<std::pair<std::string, std::string>> fields;
+    for (int i = 0; i < 100; i++)
+        fields.emplace_back("field" + std::to_string(i), std::string(100, 'v') + std::to_string(i));
+    db.hmset("hash", fields);
+    db.sadd("set", {"1", "2", "3"});
+    // values shared by COPY are skipped rather than cloned
+    db.rpush("small", std::vector<std::string>(10, std::string(100, 'c')));
+    db.copy("small", "shared", false);
+
+    size_t strings = LettuceMemory::used(LettuceMemory::Strings);
+    LettuceDefragStats before = db.defragStats();
+    auto farAway = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    REQUIRE(db.defragStep(farAway));
+    LettuceDefragStats after = db.defragStats();
+    REQUIRE(after.hits + after.misses > before.hits + before.misses + 2500);
+    REQUIRE(after.keyHits + after.keyMisses == before.keyHits + before.keyMisses + 205);
+    // moves charge and release the same category
+    REQUIRE(LettuceMemory::used(LettuceMemory::Strings) == strings);
+
+    std::string value;
+    for (int i = 0; i < 200; i++)
+    {
+        REQUIRE(db.get("string:" + std::to_string(i), value));
+        REQUIRE(value == std::string(300, 's') + std::to_string(i));
+    }
+    REQUIRE(db.lget("list") == items);
+    REQUIRE(db.lget("shared") == db.lget("small"));
+    REQUIRE(db.hget("hash", "field42", value));
+    REQUIRE(value == std::string(100, 'v') + "42");
+    REQUIRE(db.scard("set") == 3);
+
+    // an expired deadline does nothing
+    REQUIRE_FALSE(db.defragStep(std::chrono::steady_clock::now() - std::chrono::seconds(1)));
+    db.flushAll();
+}
+
+TEST_CASE("LettuceDatabase hashes share their field names", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    size_t names = LettuceField::interned();
+    size_t before = LettuceMemory::used(LettuceMemory::Hashes);
+    const std::vector<std::string> fields{"name_of_the_user", "email_address_of_the_user", "created_at_timestamp"};
+    for (int i = 0; i < 1000; i++)
+        db.hmset("user:" + std::to_string(i), {{fields[0], "u" + std::to_string(i)}, {fields[1], "e"}, {fields[2], "c"}});
+    REQUIRE(LettuceField::interned() == names + 3);
+    // a node per field and small values, none of the names are copied per hash
+    size_t charged = LettuceMemory::used(LettuceMemory::Hashes) - before;
+    REQUIRE(charged < 1000 * 3 * (64 + 32) + 1000 * 200);
+
+    std::string value;
+    REQUIRE(db.hget("user:7", fields[0], value));
+    REQUIRE(value == "u7");
+    REQUIRE_FALSE(db.hget("user:7", "missing", value));
+    REQUIRE(db.hexists("user:7", fields[1]));
+    REQUIRE(LettuceField::interned() == names + 3); // lookups never intern
+    REQUIRE(db.hgetall("user:7") == std::unordered_map<std::string, std::string>{{fields[0], "u7"}, {fields[1], "e"}, {fields[2], "c"}});
+
+    // a name lives as long as some hash has it
+    REQUIRE(db.hset("user:7", "nickname", "seven"));
+    REQUIRE(LettuceField::interned() == names + 4);
+    REQUIRE(db.hdel("user:7", "nickname"));
+    REQUIRE_FALSE(db.hdel("user:7", "nickname"));
+    REQUIRE(LettuceField::interned() == names + 3);
+
+    REQUIRE(db.dump(test_db_filename));
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(LettuceField::interned() == names + 3);
+    REQUIRE(db.hget("user:999", fields[0], value));
+    REQUIRE(value == "u999");
+
+    db.flushAll();
+    LettuceLazyFree::getInstance().waitUntilIdle();
+    REQUIRE(LettuceField::interned() == names);
+    REQUIRE(LettuceMemory::used(LettuceMemory::Hashes) == before);
+    std::remove(test_db_filename.c_str());
+}
+
+TEST_CASE("LettuceDatabase memoryUsage matches what a key allocated", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    size_t bytes;
+    REQUIRE_FALSE(db.memoryUsage("missing", 5, bytes));
+
+    db.set("short", "abc");
+    REQUIRE(db.memoryUsage("short", 5, bytes));
+    REQUIRE(bytes > 0);
+    REQUIRE(bytes < 200);
+
+    // each aggregate is compared with what its writes charged to the type
+    size_t before = LettuceMemory::used(LettuceMemory::Hashes);
+    std::vector<std::pair<std::string, std::string>> fields;
+    for (int i = 0; i < 1000; i++)
+        fields.emplace_back("field:" + std::to_string(i) + std::string(20, 'f'), std::string(60, 'v'));
+    db.hmset("hash", fields);
+    size_t charged = LettuceMemory::used(LettuceMemory::Hashes) - before;
+    REQUIRE(db.memoryUsage("hash", 0, bytes));
+    REQUIRE(bytes > charged * 9 / 10);
+    REQUIRE(bytes < charged * 11 / 10);
+    // the fields are all alike, so a sample gets close too
+    size_t sampled;
+    REQUIRE(db.memoryUsage("hash", 5, sampled));
+    REQUIRE(sampled > charged * 8 / 10);
+    REQUIRE(sampled < charged * 12 / 10);
+
+    before = LettuceMemory::used(LettuceMemory::Lists);
+    db.rpush("list", std::vector<std::string>(1000, std::string(100, 'l')));
+    charged = LettuceMemory::used(LettuceMemory::Lists) - before;
+    REQUIRE(db.memoryUsage("list", 0, bytes));
+    REQUIRE(bytes > charged * 9 / 10);
+    REQUIRE(bytes < charged * 11 / 10);
+
+    before = LettuceMemory::used(LettuceMemory::Strings);
+    db.set("big", std::string(100000, 'b'));
+    charged = LettuceMemory::used(LettuceMemory::Strings) - before;
+    REQUIRE(db.memoryUsage("big", 5, bytes));
+    REQUIRE(bytes >= 100000);
+    REQUIRE(bytes <= charged + 64);
+    db.flushAll();
+}
+
+TEST_CASE("LettuceDatabase noeviction refuses to free memory", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.set("a", "1");
+    REQUIRE(db.freeMemoryIfNeeded()); // no limit
+    db.setMaxMemory(1);
+    REQUIRE_FALSE(db.freeMemoryIfNeeded());
+    REQUIRE(db.keys().size() == 1);
+    db.setMaxMemory(0);
+    db.flushAll();
+}
+
+TEST_CASE("LettuceDatabase snapshot records the append only file position", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    LettuceAof &aof = LettuceAof::getInstance();
+    db.flushAll();
+    std::string error;
+    REQUIRE(aof.open("test_appendonly.aof", error));
+    aof.append({"SET", "k", "v"});
+    LettuceAofPosition expected = aof.position();
+
+    REQUIRE(db.dump(test_db_filename));
+    aof.close();
+    LettuceAofPosition loaded;
+    REQUIRE(db.load(test_db_filename, &loaded));
+    REQUIRE(loaded.generation == expected.generation);
+    REQUIRE(loaded.offset == expected.offset);
+
+    // without a log nothing is recorded
+    REQUIRE(db.dump(test_db_filename));
+    REQUIRE(db.load(test_db_filename, &loaded));
+    REQUIRE(loaded.generation == 0);
+
+    std::remove("test_appendonly.aof");
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase expireAt takes an absolute unix time", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.set("later", "v");
+    db.set("past", "v");
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    REQUIRE(db.expireAt("later", now + 60000));
+    REQUIRE(db.expiryMap.count("later") == 1);
+    REQUIRE(db.expireAt("past", now - 1000));
+    std::string value;
+    REQUIRE_FALSE(db.get("past", value));
+    REQUIRE_FALSE(db.expireAt("missing", now));
+
+    // further out than the steady clock reaches is as good as never
+    db.set("far", "v");
+    REQUIRE(db.expireAt("far", 99999999999999999ULL));
+    REQUIRE_FALSE(db.expireAt("farthest", UINT64_MAX));
+    db.set("farthest", "v");
+    REQUIRE(db.expireAt("farthest", UINT64_MAX));
+    REQUIRE(db.get("far", value));
+    REQUIRE(db.get("farthest", value));
+    REQUIRE(db.expiryMap["far"] > std::chrono::steady_clock::now() + std::chrono::hours(24 * 365 * 100));
+
+    cleanup();
+}
+
 TEST_CASE("LettuceDatabase flushall clears all stores", "[database]")
 {
     LettuceDatabase &db = LettuceDatabase::getInstance();
@@ -183,6 +818,14 @@ TEST_CASE("LettuceDatabase lrem removes correct elements", "[database]")
     REQUIRE(db.lrem("mylist", 0, "a") == 3);
     REQUIRE(db.llen("mylist") == 2);
 
+    // nothing to remove leaves a list shared by COPY shared
+    REQUIRE(db.copy("mylist", "copied", false));
+    REQUIRE(db.lrem("mylist", 0, "missing") == 0);
+    REQUIRE(db.listStore["mylist"].shared());
+    REQUIRE(db.lrem("mylist", 0, "b") == 1);
+    REQUIRE_FALSE(db.listStore["mylist"].shared());
+    REQUIRE(db.llen("copied") == 2);
+
     cleanup();
 }
 
@@ -322,4 +965,710 @@ TEST_CASE("LettuceDatabase purgeExpired removes expired keys", "[database]") {
     REQUIRE_FALSE(db.get("foo", value)); // Should be gone
 
     cleanup();
-}
\ No newline at end of file
+}
+
+TEST_CASE("LettuceDatabase sadd, srem, sismember and scard work", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    REQUIRE(db.sadd("myset", {"a", "b", "a"}) == 2);
+    REQUIRE(db.scard("myset") == 2);
+    REQUIRE(db.sismember("myset", "a"));
+    REQUIRE(db.type("myset") == "set");
+    REQUIRE(db.srem("myset", {"a", "missing"}) == 1);
+    REQUIRE_FALSE(db.sismember("myset", "a"));
+    REQUIRE(db.srem("myset", {"b"}) == 1);
+    REQUIRE(db.type("myset") == "none");
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase sinter, sunion and sdiff work", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    db.sadd("tags:red", {"1", "2", "3", "4"});
+    db.sadd("tags:big", {"3", "4", "5"});
+
+    auto inter = db.sinter({"tags:red", "tags:big"});
+    std::sort(inter.begin(), inter.end());
+    REQUIRE(inter == std::vector<std::string>{"3", "4"});
+    REQUIRE(db.sinter({"tags:red", "tags:none"}).empty());
+    REQUIRE(db.sunion({"tags:red", "tags:big"}).size() == 5);
+    auto diff = db.sdiff({"tags:red", "tags:big"});
+    std::sort(diff.begin(), diff.end());
+    REQUIRE(diff == std::vector<std::string>{"1", "2"});
+
+    REQUIRE(db.dump(test_db_filename));
+    db.setStore.clear();
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(db.scard("tags:big") == 3);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase pfadd, pfcount and pfmerge work", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    bool updated;
+    REQUIRE(db.pfadd("visits:a", {"u1", "u2", "u3"}, updated));
+    REQUIRE(updated);
+    REQUIRE(db.pfadd("visits:a", {"u1"}, updated));
+    REQUIRE_FALSE(updated);
+    REQUIRE(db.pfadd("visits:b", {"u3", "u4"}, updated));
+
+    uint64_t count;
+    REQUIRE(db.pfcount({"visits:a"}, count));
+    REQUIRE(count == 3);
+    REQUIRE(db.pfcount({"visits:a", "visits:b"}, count));
+    REQUIRE(count == 4);
+
+    REQUIRE(db.pfmerge("visits:all", {"visits:a", "visits:b"}));
+    REQUIRE(db.pfcount({"visits:all"}, count));
+    REQUIRE(count == 4);
+
+    db.set("plain", "value");
+    REQUIRE_FALSE(db.pfadd("plain", {"u1"}, updated));
+    REQUIRE_FALSE(db.pfcount({"plain"}, count));
+
+    // a hand made sparse counter pointing past the registers is refused, not decoded
+    std::string forged = LettuceHyperLogLog::create() + std::string("\xff\xff\x05", 3);
+    db.set("forged", forged);
+    REQUIRE_FALSE(db.pfadd("forged", {"u1"}, updated));
+    REQUIRE_FALSE(db.pfcount({"forged"}, count));
+    REQUIRE_FALSE(db.pfmerge("visits:all", {"forged"}));
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase setbit, getbit and bitcount work", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    REQUIRE(db.setbit("active", 7, 1) == 0);
+    REQUIRE(db.setbit("active", 7, 1) == 1);
+    db.setbit("active", 100, 1);
+    REQUIRE(db.getbit("active", 7) == 1);
+    REQUIRE(db.getbit("active", 8) == 0);
+    REQUIRE(db.getbit("active", 100000) == 0);
+    REQUIRE(db.bitcount("active") == 2);
+    REQUIRE(db.bitcount("active", 0, 0, false) == 1);
+    REQUIRE(db.bitcount("active", 8, -1, true) == 1);
+    REQUIRE(db.bitpos("active", 1, 0, -1, false, false) == 7);
+    REQUIRE(db.bitpos("missing", 1, 0, -1, false, false) == -1);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase bitop combines bitmaps", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    db.set("day1", "\xf0\xff");
+    db.set("day2", "\x3c");
+    REQUIRE(db.bitop(BitOp::And, "both", {"day1", "day2"}) == 2);
+    std::string value;
+    REQUIRE(db.get("both", value));
+    REQUIRE(value == std::string("\x30\x00", 2));
+
+    REQUIRE(db.bitop(BitOp::Or, "either", {"day1", "day2"}) == 2);
+    REQUIRE(db.get("either", value));
+    REQUIRE(value == "\xfc\xff");
+
+    REQUIRE(db.bitop(BitOp::Not, "inverse", {"day2"}) == 1);
+    REQUIRE(db.get("inverse", value));
+    REQUIRE(value == "\xc3");
+
+    REQUIRE(db.bitop(BitOp::Or, "nothing", {"missing"}) == 0);
+    REQUIRE_FALSE(db.get("nothing", value));
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase mget, mset and msetnx work", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    db.mset({{"k1", "v1"}, {"k2", "v2"}});
+    auto values = db.mget({"k1", "missing", "k2"});
+    REQUIRE(values.size() == 3);
+    REQUIRE(values[0] == std::optional<std::string>("v1"));
+    REQUIRE_FALSE(values[1].has_value());
+    REQUIRE(values[2] == std::optional<std::string>("v2"));
+
+    REQUIRE_FALSE(db.msetnx({{"k3", "v3"}, {"k1", "other"}}));
+    std::string value;
+    REQUIRE_FALSE(db.get("k3", value));
+    REQUIRE(db.msetnx({{"k3", "v3"}, {"k4", "v4"}}));
+    REQUIRE(db.get("k4", value));
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase scan visits every key exactly through the cursor", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    for (int i = 0; i < 500; i++)
+        db.set("str:" + std::to_string(i), "v");
+    db.rpush("list:1", "x");
+    db.hset("hash:1", "f", "v");
+    db.sadd("set:1", {"m"});
+
+    std::set<std::string> seen;
+    uint64_t cursor = 0;
+    int calls = 0;
+    do
+    {
+        std::vector<std::string> keys;
+        cursor = db.scan(cursor, 20, "", "", keys);
+        seen.insert(keys.begin(), keys.end());
+        calls++;
+    } while (cursor != 0);
+    REQUIRE(seen.size() == 503);
+    REQUIRE(calls > 1);
+
+    std::vector<std::string> hashes;
+    cursor = 0;
+    do
+        cursor = db.scan(cursor, 1000, "", "hash", hashes);
+    while (cursor != 0);
+    REQUIRE(hashes == std::vector<std::string>{"hash:1"});
+
+    std::vector<std::string> matched;
+    cursor = 0;
+    do
+        cursor = db.scan(cursor, 1000, "str:4?", "", matched);
+    while (cursor != 0);
+    REQUIRE(matched.size() == 10);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase scan cursors survive the tables growing", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    for (int i = 0; i < 200; i++)
+    {
+        db.set("old:" + std::to_string(i), "v");
+        db.hset("h", "old" + std::to_string(i), "v");
+    }
+
+    std::set<std::string> keys, fields;
+    std::vector<std::string> keyBatch;
+    std::vector<std::pair<std::string, std::string>> fieldBatch;
+    uint64_t keyCursor = db.scan(0, 20, "", "", keyBatch);
+    uint64_t fieldCursor = db.hscan("h", 0, 20, "", fieldBatch);
+    REQUIRE(keyCursor != 0);
+    REQUIRE(fieldCursor != 0);
+
+    // several rehashes between two calls
+    size_t buckets = db.keyValueStore.bucket_count();
+    for (int i = 0; i < 5000; i++)
+    {
+        db.set("new:" + std::to_string(i), "v");
+        db.hset("h", "new" + std::to_string(i), "v");
+    }
+    REQUIRE(db.keyValueStore.bucket_count() >= buckets * 8);
+    REQUIRE((db.keyValueStore.bucket_count() & (db.keyValueStore.bucket_count() - 1)) == 0);
+
+    while (keyCursor != 0)
+        keyCursor = db.scan(keyCursor, 100, "", "", keyBatch);
+    while (fieldCursor != 0)
+        fieldCursor = db.hscan("h", fieldCursor, 100, "", fieldBatch);
+    for (const auto &key : keyBatch)
+        keys.insert(key);
+    for (const auto &field : fieldBatch)
+        fields.insert(field.first);
+    for (int i = 0; i < 200; i++)
+    {
+        REQUIRE(keys.count("old:" + std::to_string(i)) == 1);
+        REQUIRE(fields.count("old" + std::to_string(i)) == 1);
+    }
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase hscan and sscan iterate members", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    for (int i = 0; i < 100; i++)
+        db.hset("big", "field" + std::to_string(i), std::to_string(i));
+    std::vector<std::pair<std::string, std::string>> fields;
+    uint64_t cursor = 0;
+    do
+        cursor = db.hscan("big", cursor, 10, "", fields);
+    while (cursor != 0);
+    std::set<std::string> uniqueFields;
+    for (const auto &field : fields)
+        uniqueFields.insert(field.first);
+    REQUIRE(uniqueFields.size() == 100);
+
+    // an intset has no stable cursor position, it comes back in one go
+    std::vector<std::string> members;
+    db.sadd("ids", {"1", "2", "3", "4", "5"});
+    REQUIRE(db.sscan("ids", 0, 2, "", members) == 0);
+    REQUIRE(members.size() == 5);
+
+    db.sadd("ids", {"six"});
+    members.clear();
+    cursor = 0;
+    do
+        cursor = db.sscan("ids", cursor, 2, "", members);
+    while (cursor != 0);
+    REQUIRE(std::set<std::string>(members.begin(), members.end()).size() == 6);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase keys filters by glob pattern", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.set("session:user42:cart", "1");
+    db.set("session:user7:cart", "2");
+    db.hset("session:user42:profile", "name", "x");
+    db.set("other", "3");
+
+    auto matched = db.keys("session:user42:*");
+    std::sort(matched.begin(), matched.end());
+    REQUIRE(matched == std::vector<std::string>{"session:user42:cart", "session:user42:profile"});
+    REQUIRE(db.keys("*:cart").size() == 2);
+    REQUIRE(db.keys("*").size() == 4);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase key index is maintained incrementally", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.set("pre:existing", "1");
+    db.setKeyIndexEnabled(true);
+    REQUIRE(db.keyIndexStats().keys == 1);
+
+    db.set("pre:a", "1");
+    db.rpush("pre:list", "x");
+    db.sadd("pre:set", {"m"});
+    db.hset("other", "f", "v");
+    REQUIRE(db.keyIndexStats().keys == 5);
+
+    auto matched = db.keys("pre:*");
+    std::sort(matched.begin(), matched.end());
+    REQUIRE(matched == std::vector<std::string>{"pre:a", "pre:existing", "pre:list", "pre:set"});
+
+    db.rename("pre:a", "moved");
+    db.del("pre:list");
+    db.srem("pre:set", {"m"});
+    REQUIRE(db.keys("pre:*") == std::vector<std::string>{"pre:existing"});
+    REQUIRE(db.keys("moved") == std::vector<std::string>{"moved"});
+
+    db.expire("pre:existing", -1);
+    REQUIRE(db.keys("pre:*").empty());
+    REQUIRE(db.keyIndexStats().keys == 2);
+    REQUIRE(db.keyIndexStats().memoryBytes > 0);
+
+    std::vector<std::string> scanned;
+    REQUIRE(db.scan(0, 10, "mov*", "", scanned) == 0);
+    REQUIRE(scanned == std::vector<std::string>{"moved"});
+
+    db.setKeyIndexEnabled(false);
+    REQUIRE_FALSE(db.keyIndexStats().enabled);
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase scan over the key index honours COUNT", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    for (int i = 0; i < 100; i++)
+        db.set("page:" + std::to_string(i), "v");
+    db.set("other", "v");
+    db.setKeyIndexEnabled(true);
+
+    std::set<std::string> seen;
+    uint64_t cursor = 0;
+    int calls = 0;
+    do
+    {
+        std::vector<std::string> batch;
+        cursor = db.scan(cursor, 10, "page:*", "", batch);
+        REQUIRE(batch.size() <= 10);
+        seen.insert(batch.begin(), batch.end());
+        calls++;
+        // keys added behind or ahead of the cursor don't disturb the ones already there
+        if (calls == 3)
+        {
+            db.set("page:new", "v");
+            db.del("page:0");
+        }
+    } while (cursor != 0);
+    REQUIRE(calls >= 10);
+    for (int i = 1; i < 100; i++)
+        REQUIRE(seen.count("page:" + std::to_string(i)) == 1);
+    REQUIRE(seen.count("other") == 0);
+
+    // a cursor the index no longer knows (or one left over after turning it off) starts over
+    std::vector<std::string> batch;
+    cursor = db.scan(0, 10, "page:*", "", batch);
+    REQUIRE(cursor != 0);
+    db.setKeyIndexEnabled(false);
+    batch.clear();
+    do
+        cursor = db.scan(cursor, 1000, "page:*", "", batch);
+    while (cursor != 0);
+    REQUIRE(batch.size() == 100);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase exec aborts when a watched key changes", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.set("balance", "10");
+
+    uint64_t version = db.watch("balance");
+    bool ran = false;
+    REQUIRE(db.exec({{"balance", version}}, [&]()
+                    { ran = true; db.set("balance", "20"); }));
+    REQUIRE(ran);
+    db.unwatch("balance");
+
+    version = db.watch("balance");
+    db.set("balance", "30");
+    ran = false;
+    REQUIRE_FALSE(db.exec({{"balance", version}}, [&]()
+                          { ran = true; }));
+    REQUIRE_FALSE(ran);
+    db.unwatch("balance");
+
+    // expiring and flushing count as modifications too
+    version = db.watch("balance");
+    db.flushAll();
+    REQUIRE_FALSE(db.exec({{"balance", version}}, []() {}));
+    db.unwatch("balance");
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase unlink and flushAll async detach values", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    LettuceLazyFree &lazyFree = LettuceLazyFree::getInstance();
+    db.flushAll();
+    size_t freedBefore = lazyFree.freed();
+
+    db.listStore["big"] = std::vector<std::string>(1000, "x");
+    db.set("small", "1");
+    REQUIRE(db.unlink("big"));
+    REQUIRE_FALSE(db.unlink("big"));
+    REQUIRE(db.type("big") == "none");
+
+    // large values go to the background thread on del too, small ones are freed inline
+    db.listStore["big"] = std::vector<std::string>(1000, "x");
+    REQUIRE(db.del("big"));
+    REQUIRE(db.del("small"));
+    lazyFree.waitUntilIdle();
+    REQUIRE(lazyFree.freed() == freedBefore + 2);
+
+    db.set("a", "1");
+    db.hset("h", "f", "v");
+    db.flushAll(true);
+    REQUIRE(db.keys().empty());
+    lazyFree.waitUntilIdle();
+    REQUIRE(lazyFree.freed() == freedBefore + 6);
+
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase compresses large string values", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    db.setStringCompressionThreshold(1024);
+
+    std::string json;
+    for (int i = 0; json.size() < 20000; i++)
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"user\",\"active\":true},";
+    std::string noise;
+    std::mt19937 random(42);
+    for (int i = 0; i < 20000; i++)
+        noise.push_back(static_cast<char>(random()));
+
+    size_t before = LettuceMemory::used(LettuceMemory::Strings);
+    db.set("json", json);
+    REQUIRE(LettuceMemory::used(LettuceMemory::Strings) - before < json.size() / 3);
+    db.set("noise", noise);
+    db.set("small", std::string(1000, 'a'));
+    LettuceCompressionStats stats = db.compressionStats();
+    REQUIRE(stats.strings == 1);
+    REQUIRE(stats.bytesSaved > json.size() * 2 / 3);
+    REQUIRE(stats.skipped == 1);
+
+    std::string value;
+    REQUIRE(db.get("json", value));
+    REQUIRE(value == json);
+    REQUIRE(db.get("noise", value));
+    REQUIRE(value == noise);
+    REQUIRE(db.mget({"json", "small"})[0] == json);
+
+    // the raw length follows the value around
+    REQUIRE(db.rename("json", "renamed"));
+    REQUIRE(db.copy("renamed", "copied", false));
+    REQUIRE(db.compressionStats().strings == 2);
+    REQUIRE(db.compressionStats().bytesSaved == stats.bytesSaved * 2);
+    REQUIRE(db.dump(test_db_filename));
+    db.flushAll();
+    REQUIRE(db.compressionStats().strings == 0);
+    REQUIRE(db.compressionStats().bytesSaved == 0);
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(db.compressionStats().strings == 2);
+    REQUIRE(db.get("renamed", value));
+    REQUIRE(value == json);
+
+    // used as a bitmap the value is decompressed for good
+    REQUIRE(db.setbit("copied", 0, 1) == 0);
+    REQUIRE(db.get("copied", value));
+    REQUIRE(value.size() == json.size());
+    REQUIRE(value.substr(1) == json.substr(1));
+    REQUIRE(db.compressionStats().strings == 1);
+
+    db.set("renamed", "short now");
+    REQUIRE(db.compressionStats().strings == 0);
+    REQUIRE(db.compressionStats().bytesSaved == 0);
+
+    db.setStringCompressionThreshold(0);
+    db.set("json", json);
+    REQUIRE(db.compressionStats().strings == 0);
+    db.flushAll();
+    std::remove(test_db_filename.c_str());
+}
+
+TEST_CASE("LettuceDatabase moves cold strings to disk", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    LettuceTierConfig config;
+    config.enabled = true;
+    config.prefix = "test-db-tier";
+    config.idleSeconds = 0; // everything counts as cold
+    config.minSize = 1000;
+    config.segmentSize = 1 << 20;
+    db.setTierConfig(config);
+    LettuceTierStats initial = db.tierStats();
+    size_t baseline = LettuceMemory::used(LettuceMemory::Strings);
+
+    auto valueOf = [](int i)
+    { return std::string(50000, static_cast<char>('a' + i)) + std::to_string(i); };
+    for (int i = 0; i < 20; i++)
+        db.set("cold:" + std::to_string(i), valueOf(i));
+    db.set("small", std::string(999, 's'));
+    std::string json;
+    for (int i = 0; json.size() < 20000; i++)
+        json += "{\"id\":" + std::to_string(i) + "},";
+    db.setStringCompressionThreshold(1024);
+    db.set("json", json);
+
+    size_t before = LettuceMemory::used(LettuceMemory::Strings);
+    auto farAway = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    REQUIRE(db.tierStep(farAway));
+    LettuceTierStats stats = db.tierStats();
+    REQUIRE(stats.keys == 21);
+    REQUIRE(stats.spills - initial.spills == 21);
+    REQUIRE(stats.liveBytes > 20 * 50000);
+    REQUIRE(stats.liveBytes < 21 * 50000);
+    REQUIRE(before - LettuceMemory::used(LettuceMemory::Strings) > 20 * 50000);
+
+    // reads go to disk, only promote brings a value back
+    std::string value;
+    REQUIRE(db.get("cold:0", value));
+    REQUIRE(value == valueOf(0));
+    REQUIRE(db.get("json", value));
+    REQUIRE(value == json);
+    REQUIRE(db.mget({"cold:1", "small"})[0] == valueOf(1));
+    REQUIRE(db.tierStats().keys == 21);
+    db.promote({"cold:1", "small", "missing"});
+    REQUIRE(db.tierStats().keys == 20);
+    REQUIRE(db.tierStats().reads == stats.reads + 1);
+    REQUIRE(db.get("cold:1", value));
+    REQUIRE(value == valueOf(1));
+
+    REQUIRE(db.rename("cold:2", "renamed"));
+    REQUIRE(db.copy("cold:3", "copied", false));
+    REQUIRE(db.del("cold:4"));
+    db.set("cold:5", "overwritten");
+    REQUIRE(db.setbit("cold:6", 0, 1) == 0); // bitmaps work on the value in memory
+    REQUIRE(db.tierStats().keys == 18);
+    REQUIRE(db.get("renamed", value));
+    REQUIRE(value == valueOf(2));
+    REQUIRE(db.get("copied", value));
+    REQUIRE(value == valueOf(3));
+    REQUIRE(db.get("cold:6", value));
+    REQUIRE(value.substr(1) == valueOf(6).substr(1));
+
+    // a forked save reads the values on disk through the segments it kept open
+    REQUIRE(db.bgsave(test_db_filename));
+    REQUIRE(db.waitForBgsave());
+    db.flushAll();
+    REQUIRE(db.tierStats().keys == 0);
+    REQUIRE(db.load(test_db_filename));
+    REQUIRE(db.get("cold:7", value));
+    REQUIRE(value == valueOf(7));
+    REQUIRE(db.get("json", value));
+    REQUIRE(value == json);
+
+    // spilled one at a time so the layout is known: a, b and c fill a segment, d starts the next
+    db.flushAll();
+    db.setStringCompressionThreshold(0);
+    config.segmentSize = 120000;
+    db.setTierConfig(config);
+    for (int i = 0; i < 4; i++)
+    {
+        db.set(std::string(1, static_cast<char>('a' + i)), valueOf(i));
+        REQUIRE(db.tierStep(farAway));
+    }
+    stats = db.tierStats();
+    REQUIRE(stats.keys == 4);
+    REQUIRE(stats.segments == 2);
+    // once the full segment is less than half live, c moves next to d and the segment goes
+    REQUIRE(db.del("a"));
+    REQUIRE(db.del("b"));
+    REQUIRE(db.tierStep(farAway));
+    stats = db.tierStats();
+    REQUIRE(stats.compactedBytes - initial.compactedBytes == valueOf(2).size());
+    REQUIRE(stats.segments == 1);
+    REQUIRE(stats.fileBytes == stats.liveBytes);
+    REQUIRE(db.get("c", value));
+    REQUIRE(value == valueOf(2));
+
+    // turned off the values stay readable while they're read back, then the files go
+    db.setTierConfig(LettuceTierConfig());
+    REQUIRE(db.tieringEnabled());
+    REQUIRE(db.tierStats().keys == 2);
+    REQUIRE(db.get("d", value));
+    REQUIRE(value == valueOf(3));
+    // over maxmemory nothing comes back
+    db.setMaxMemory(1);
+    REQUIRE(db.tierStep(farAway));
+    REQUIRE(db.tierStats().keys == 2);
+    db.setMaxMemory(0);
+    REQUIRE(db.tierStep(farAway));
+    REQUIRE(!db.tieringEnabled());
+    REQUIRE(db.tierStats().keys == 0);
+    REQUIRE(fileSize("test-db-tier.1") == -1);
+    REQUIRE(fileSize("test-db-tier.3") == -1);
+    REQUIRE(db.get("c", value));
+    REQUIRE(value == valueOf(2));
+    REQUIRE(db.get("d", value));
+    REQUIRE(value == valueOf(3));
+    db.flushAll();
+    LettuceLazyFree::getInstance().waitUntilIdle();
+    REQUIRE(LettuceMemory::used(LettuceMemory::Strings) == baseline);
+    std::remove(test_db_filename.c_str());
+}
+
+TEST_CASE("LettuceDatabase keeps tiered values it can't read back", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+    LettuceTierConfig config;
+    config.enabled = true;
+    config.prefix = "test-db-tier-fail";
+    config.idleSeconds = 0;
+    config.minSize = 1000;
+    db.setTierConfig(config);
+    std::string big(5000, 'v');
+    db.set("k", big);
+    db.set("bits", big);
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(db.tierStats().keys == 2);
+
+    // an emptied segment makes every read fail, as a failing disk would
+    const std::string segment = config.prefix + ".1";
+    std::string contents;
+    {
+        std::ifstream in(segment, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    REQUIRE(contents.size() >= 2 * big.size());
+    REQUIRE(truncate(segment.c_str(), 0) == 0);
+
+    std::string value;
+    REQUIRE_THROWS_AS(db.get("k", value), LettuceTierError);
+    REQUIRE_THROWS_AS(db.setbit("bits", 0, 0), LettuceTierError);
+    db.promote({"k", "bits"});
+    // turned off, the drain leaves them on disk and keeps the files
+    db.setTierConfig(LettuceTierConfig());
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE(db.tieringEnabled());
+    REQUIRE(db.tierStats().keys == 2);
+
+    // once the disk is back nothing was lost
+    {
+        std::ofstream out(segment, std::ios::binary | std::ios::trunc);
+        out << contents;
+    }
+    REQUIRE(db.get("k", value));
+    REQUIRE(value == big);
+    REQUIRE(db.setbit("bits", 0, 1) == 0);
+    REQUIRE(db.tierStep(std::chrono::steady_clock::now() + std::chrono::hours(1)));
+    REQUIRE_FALSE(db.tieringEnabled());
+    REQUIRE(db.get("k", value));
+    REQUIRE(value == big);
+    REQUIRE(fileSize(segment) == -1);
+    cleanup();
+}
+
+TEST_CASE("LettuceDatabase rename moves and copy shares values", "[database]")
+{
+    LettuceDatabase &db = LettuceDatabase::getInstance();
+    db.flushAll();
+
+    db.listStore["staging"] = std::vector<std::string>(100, "x");
+    const std::vector<std::string> *stagingList = &*db.listStore["staging"];
+    db.set("live", "old");
+    db.expire("staging", 100);
+    REQUIRE(db.rename("staging", "live"));
+    // the string that used to be at live is gone, and the list itself was not copied
+    REQUIRE(db.type("live") == "list");
+    REQUIRE(&*db.listStore["live"] == stagingList);
+    REQUIRE(db.expiryMap.count("live") == 1);
+    REQUIRE(db.expiryMap.count("staging") == 0);
+
+    REQUIRE(db.copy("live", "snapshot", false));
+    REQUIRE(db.listStore["live"].shared());
+    REQUIRE_FALSE(db.copy("live", "snapshot", false));
+    db.rpush("live", "y");
+    REQUIRE(db.llen("live") == 101);
+    REQUIRE(db.llen("snapshot") == 100);
+
+    db.hset("h", "f", "1");
+    REQUIRE(db.copy("h", "snapshot", true));
+    REQUIRE(db.type("snapshot") == "hash");
+    db.hset("snapshot", "f", "2");
+    std::string value;
+    REQUIRE(db.hget("h", "f", value));
+    REQUIRE(value == "1");
+
+    db.sadd("s", {"1", "2"});
+    REQUIRE(db.copy("s", "s2", false));
+    db.srem("s2", {"1"});
+    REQUIRE(db.scard("s") == 2);
+    REQUIRE(db.scard("s2") == 1);
+    REQUIRE_FALSE(db.copy("missing", "x", true));
+
+    cleanup();
+}
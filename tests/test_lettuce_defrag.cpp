@@ -0,0 +1,70 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceDefrag.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// whether the allocator has a lower block free depends on everything the process did before, so
+// these only check what holds either way: a move goes down and keeps the contents, a refusal leaves
+// the value where it was. every move lands strictly lower, so repeating it has to stop
+template <typename Value, typename Check>
+static void relocateUntilSettled(Value &value, Check check)
+{
+    for (int moves = 0;; moves++)
+    {
+        REQUIRE(moves < 100000);
+        auto before = value.data();
+        bool moved = LettuceDefrag::relocate(value);
+        check(value);
+        if (!moved)
+        {
+            REQUIRE(value.data() == before);
+            return;
+        }
+        REQUIRE(value.data() < before);
+    }
+}
+
+TEST_CASE("defrag only moves values down and keeps their contents", "[defrag]")
+{
+    // holes freed below the value make a move likely, nothing depends on it
+    auto holes = std::make_unique<std::vector<std::string>>();
+    for (int i = 0; i < 100; i++)
+        holes->emplace_back(1000, 'h');
+    std::string value(1000, 'v');
+    value[0] = 'x';
+    holes.reset();
+    relocateUntilSettled(value, [](const std::string &current)
+                         {
+                             REQUIRE(current.size() == 1000);
+                             REQUIRE(current[0] == 'x');
+                             REQUIRE(current.find_first_not_of('v', 1) == std::string::npos); });
+
+    auto more = std::make_unique<std::vector<std::vector<int64_t>>>();
+    for (int i = 0; i < 100; i++)
+        more->emplace_back(100, 0);
+    std::vector<int64_t> integers(100);
+    for (int64_t i = 0; i < 100; i++)
+        integers[i] = i * 3;
+    more.reset();
+    relocateUntilSettled(integers, [](const std::vector<int64_t> &current)
+                         {
+                             REQUIRE(current.size() == 100);
+                             for (int64_t i = 0; i < 100; i++)
+                                 REQUIRE(current[i] == i * 3); });
+}
+
+TEST_CASE("defrag leaves inline and mmapped values alone", "[defrag]")
+{
+    std::string shortString = "abc";
+    REQUIRE_FALSE(LettuceDefrag::relocate(shortString));
+    REQUIRE(shortString == "abc");
+
+    std::string huge(LettuceDefrag::largeBlock * 2, 'h');
+    REQUIRE_FALSE(LettuceDefrag::movable(huge.data()));
+    REQUIRE_FALSE(LettuceDefrag::relocate(huge));
+
+    std::vector<std::string> empty;
+    REQUIRE_FALSE(LettuceDefrag::relocate(empty));
+}
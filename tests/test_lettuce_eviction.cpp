@@ -0,0 +1,39 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceEviction.h"
+
+TEST_CASE("eviction policies parse and print", "[eviction]")
+{
+    for (const char *name : {"noeviction", "allkeys-lru", "allkeys-lfu", "volatile-lru", "volatile-ttl"})
+    {
+        LettuceEvictionPolicy policy;
+        REQUIRE(parseEvictionPolicy(name, policy));
+        REQUIRE(evictionPolicyName(policy) == name);
+    }
+    LettuceEvictionPolicy policy;
+    REQUIRE_FALSE(parseEvictionPolicy("allkeys-random", policy));
+}
+
+TEST_CASE("lru metadata measures idle time", "[eviction]")
+{
+    uint32_t meta = LettuceKeyMeta::lruClock();
+    REQUIRE(LettuceKeyMeta::lruIdleSeconds(meta) <= 1);
+    REQUIRE(LettuceKeyMeta::lruIdleSeconds((meta - 100) & LettuceKeyMeta::clockMax) >= 100);
+    // the clock wraps at 24 bits, an access just before the wrap is still recent after it
+    REQUIRE(LettuceKeyMeta::lruIdleSeconds((meta + 1) & LettuceKeyMeta::clockMax) >= LettuceKeyMeta::clockMax - 1);
+}
+
+TEST_CASE("lfu counter grows logarithmically", "[eviction]")
+{
+    uint32_t meta = LettuceKeyMeta::lfuNew();
+    REQUIRE(LettuceKeyMeta::lfuCount(meta) == LettuceKeyMeta::lfuInitialCount);
+    for (int i = 0; i < 1000; i++)
+        meta = LettuceKeyMeta::lfuTouch(meta);
+    uint8_t count = LettuceKeyMeta::lfuCount(meta);
+    REQUIRE(count > LettuceKeyMeta::lfuInitialCount);
+    // with a log factor of 10 a thousand hits are worth a few dozen counts, nowhere near saturation
+    REQUIRE(count < 100);
+
+    // a counter last decremented long ago decays by a count per minute
+    uint32_t stale = (static_cast<uint32_t>((meta >> 8) - 30) & 0xffff) << 8 | count;
+    REQUIRE(LettuceKeyMeta::lfuCount(stale) == (count > 30 ? count - 30 : 0));
+}
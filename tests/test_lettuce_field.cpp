@@ -0,0 +1,69 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceField.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("field names are interned while a handle holds them", "[field]")
+{
+    size_t before = LettuceField::interned();
+    REQUIRE_FALSE(LettuceField::find("field-test-name"));
+    {
+        LettuceField a("field-test-name");
+        LettuceField b(std::string("field-test-name"));
+        REQUIRE(a == b);
+        REQUIRE(&a.str() == &b.str());
+        REQUIRE(a.str() == "field-test-name");
+        REQUIRE(LettuceField::interned() == before + 1);
+        REQUIRE(LettuceField::find("field-test-name") == a);
+        REQUIRE(a != LettuceField("other-test-name"));
+
+        LettuceField copy = a;
+        LettuceField moved = std::move(b);
+        REQUIRE(copy == moved);
+        REQUIRE_FALSE(b);
+        // three handles share the name
+        REQUIRE(a.memoryShare() * 3 <= LettuceField("field-test-name").memoryShare() * 4);
+    }
+    REQUIRE(LettuceField::interned() == before);
+    REQUIRE_FALSE(LettuceField::find("field-test-name"));
+    REQUIRE(LettuceField().str().empty());
+}
+
+TEST_CASE("hashes keyed by interned fields behave like string maps", "[field]")
+{
+    LettuceHash first = {{"name", "ann"}, {"email", "ann@example.com"}};
+    LettuceHash second;
+    second["name"] = "bob";
+    REQUIRE(first.begin() != first.end());
+    REQUIRE(first.find(LettuceField::find("name"))->second == "ann");
+    REQUIRE(second.find(LettuceField::find("name"))->second == "bob");
+    REQUIRE(first.find(LettuceField::find("name"))->first == second.begin()->first);
+    REQUIRE(second.count(LettuceField::find("email")) == 0);
+    first.erase(LettuceField::find("email"));
+    REQUIRE_FALSE(LettuceField::find("email"));
+}
+
+TEST_CASE("field handles can be shared between threads", "[field]")
+{
+    size_t before = LettuceField::interned();
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&mismatches]()
+                             {
+            for (int i = 0; i < 10000; i++)
+            {
+                std::string name = "shared-" + std::to_string(i % 7);
+                LettuceField field(name);
+                LettuceField copy = field;
+                if (copy.str() != name)
+                    mismatches++;
+            } });
+    for (auto &thread : threads)
+        thread.join();
+    REQUIRE(mismatches == 0);
+    REQUIRE(LettuceField::interned() == before);
+}
@@ -0,0 +1,25 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceGlob.h"
+
+TEST_CASE("globMatch handles stars and single chars", "[glob]")
+{
+    REQUIRE(globMatch("*", "anything"));
+    REQUIRE(globMatch("session:*", "session:user42:cart"));
+    REQUIRE_FALSE(globMatch("session:*", "sessions"));
+    REQUIRE(globMatch("h?llo", "hello"));
+    REQUIRE_FALSE(globMatch("h?llo", "hllo"));
+    REQUIRE(globMatch("*:cart", "session:user42:cart"));
+    REQUIRE(globMatch("a*b*c", "aXXbYYbZc"));
+    REQUIRE_FALSE(globMatch("a*b*c", "aXXbYY"));
+}
+
+TEST_CASE("globMatch handles classes and escapes", "[glob]")
+{
+    REQUIRE(globMatch("h[ae]llo", "hallo"));
+    REQUIRE_FALSE(globMatch("h[ae]llo", "hillo"));
+    REQUIRE(globMatch("h[^e]llo", "hallo"));
+    REQUIRE_FALSE(globMatch("h[^e]llo", "hello"));
+    REQUIRE(globMatch("user[0-9]", "user7"));
+    REQUIRE(globMatch("what\\?", "what?"));
+    REQUIRE_FALSE(globMatch("what\\?", "whats"));
+}
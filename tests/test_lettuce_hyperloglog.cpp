@@ -0,0 +1,75 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceHyperLogLog.h"
+
+#include <array>
+#include <cmath>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+TEST_CASE("LettuceHyperLogLog starts sparse and counts small sets exactly enough", "[hyperloglog]")
+{
+    std::string hll = LettuceHyperLogLog::create();
+    REQUIRE(LettuceHyperLogLog::isValid(hll));
+    REQUIRE(LettuceHyperLogLog::count(hll) == 0);
+
+    REQUIRE(LettuceHyperLogLog::add(hll, "a"));
+    REQUIRE_FALSE(LettuceHyperLogLog::add(hll, "a"));
+    LettuceHyperLogLog::add(hll, "b");
+    LettuceHyperLogLog::add(hll, "c");
+    REQUIRE(LettuceHyperLogLog::isSparse(hll));
+    REQUIRE(LettuceHyperLogLog::count(hll) == 3);
+}
+
+TEST_CASE("LettuceHyperLogLog promotes to a fixed size dense encoding", "[hyperloglog]")
+{
+    std::string hll = LettuceHyperLogLog::create();
+    for (int i = 0; i < 100000; i++)
+        LettuceHyperLogLog::add(hll, "visitor:" + std::to_string(i));
+
+    REQUIRE_FALSE(LettuceHyperLogLog::isSparse(hll));
+    REQUIRE(hll.size() == LettuceHyperLogLog::denseSize);
+    double estimate = static_cast<double>(LettuceHyperLogLog::count(hll));
+    REQUIRE(std::fabs(estimate - 100000) / 100000 < 0.03);
+}
+
+TEST_CASE("LettuceHyperLogLog merge is the union of counters", "[hyperloglog]")
+{
+    std::string left = LettuceHyperLogLog::create();
+    std::string right = LettuceHyperLogLog::create();
+    for (int i = 0; i < 20000; i++)
+        LettuceHyperLogLog::add(left, std::to_string(i));
+    for (int i = 10000; i < 30000; i++)
+        LettuceHyperLogLog::add(right, std::to_string(i));
+
+    double unionCount = static_cast<double>(LettuceHyperLogLog::countUnion({&left, &right}));
+    REQUIRE(std::fabs(unionCount - 30000) / 30000 < 0.03);
+
+    LettuceHyperLogLog::merge(left, {&right});
+    REQUIRE(LettuceHyperLogLog::count(left) == static_cast<uint64_t>(unionCount));
+}
+
+TEST_CASE("LettuceHyperLogLog rejects values that are not counters", "[hyperloglog]")
+{
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid("plain string"));
+    std::string truncated = LettuceHyperLogLog::create() + "xy";
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(truncated));
+}
+
+TEST_CASE("LettuceHyperLogLog rejects corrupt sparse entries", "[hyperloglog]")
+{
+    auto sparse = [](std::initializer_list<std::array<uint8_t, 3>> entries)
+    {
+        std::string value = LettuceHyperLogLog::create();
+        for (const auto &entry : entries)
+            value.append(reinterpret_cast<const char *>(entry.data()), entry.size());
+        return value;
+    };
+
+    REQUIRE(LettuceHyperLogLog::isValid(sparse({{0x00, 0x01, 3}, {0x3f, 0xff, 51}})));
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(sparse({{0xff, 0xff, 3}})));               // register past the end
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(sparse({{0x00, 0x01, 255}})));             // count no hash can produce
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(sparse({{0x00, 0x01, 0}})));               // empty registers aren't stored
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(sparse({{0x00, 0x05, 1}, {0x00, 0x02, 1}}))); // out of order
+    REQUIRE_FALSE(LettuceHyperLogLog::isValid(sparse({{0x00, 0x05, 1}, {0x00, 0x05, 2}}))); // duplicate
+}
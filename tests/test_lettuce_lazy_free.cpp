@@ -0,0 +1,37 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceLazyFree.h"
+
+#include <memory>
+#include <vector>
+#include <string>
+
+namespace
+{
+    // flips a flag when destroyed so the test can see which thread did it
+    struct Tracker
+    {
+        std::shared_ptr<bool> destroyed;
+        explicit Tracker(std::shared_ptr<bool> flag) : destroyed(std::move(flag)) {}
+        Tracker(Tracker &&other) = default;
+        ~Tracker()
+        {
+            if (destroyed)
+                *destroyed = true;
+        }
+    };
+}
+
+TEST_CASE("LettuceLazyFree destroys values in the background", "[lazyfree]")
+{
+    LettuceLazyFree &lazyFree = LettuceLazyFree::getInstance();
+    size_t freedBefore = lazyFree.freed();
+
+    auto destroyed = std::make_shared<bool>(false);
+    lazyFree.free(Tracker(destroyed));
+    lazyFree.free(std::vector<std::string>(1000, "value"));
+    lazyFree.waitUntilIdle();
+
+    REQUIRE(*destroyed);
+    REQUIRE(lazyFree.pending() == 0);
+    REQUIRE(lazyFree.freed() == freedBefore + 2);
+}
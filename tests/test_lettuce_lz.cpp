@@ -0,0 +1,74 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceLz.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+static std::string roundTrip(const std::string &input, size_t &compressedSize)
+{
+    std::vector<uint8_t> compressed(lzBound(input.size()));
+    compressedSize = lzCompress(reinterpret_cast<const uint8_t *>(input.data()), input.size(), compressed.data(), compressed.size());
+    REQUIRE(compressedSize > 0);
+    std::string output(input.size(), '\0');
+    REQUIRE(lzDecompress(compressed.data(), compressedSize, reinterpret_cast<uint8_t *>(&output[0]), output.size()));
+    return output;
+}
+
+TEST_CASE("lz round trips short, repetitive and random input", "[lz]")
+{
+    std::mt19937 random(7);
+    std::string noise(100000, '\0');
+    for (auto &c : noise)
+        c = static_cast<char>(random());
+    std::string json;
+    for (int i = 0; i < 2000; i++)
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i % 37) + "\",\"active\":true},";
+
+    size_t compressedSize;
+    for (const std::string &input : {std::string(), std::string("a"), std::string("hello world"), std::string(13, 'x'),
+                                     std::string(100000, 'r'), noise, json, json + noise + json})
+        REQUIRE(roundTrip(input, compressedSize) == input);
+
+    // runs and repeated records shrink a lot, noise only grows by the framing
+    roundTrip(std::string(100000, 'r'), compressedSize);
+    REQUIRE(compressedSize < 1000);
+    roundTrip(json, compressedSize);
+    REQUIRE(compressedSize < json.size() / 3);
+    roundTrip(noise, compressedSize);
+    REQUIRE(compressedSize <= lzBound(noise.size()));
+}
+
+TEST_CASE("lz gives up when the output doesn't fit", "[lz]")
+{
+    std::string input(1000, '\0');
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = static_cast<char>(i * 131 + (i >> 3));
+    std::vector<uint8_t> out(input.size() / 2);
+    REQUIRE(lzCompress(reinterpret_cast<const uint8_t *>(input.data()), input.size(), out.data(), out.size()) == 0);
+}
+
+TEST_CASE("lz rejects malformed input instead of reading or writing out of bounds", "[lz]")
+{
+    std::string input(5000, 'a');
+    for (size_t i = 0; i < input.size(); i += 7)
+        input[i] = 'b';
+    std::vector<uint8_t> compressed(lzBound(input.size()));
+    size_t size = lzCompress(reinterpret_cast<const uint8_t *>(input.data()), input.size(), compressed.data(), compressed.size());
+    REQUIRE(size > 0);
+    std::vector<uint8_t> out(input.size());
+
+    // wrong expected length, cut short, and a match pointing before the start
+    REQUIRE_FALSE(lzDecompress(compressed.data(), size, out.data(), out.size() - 1));
+    REQUIRE_FALSE(lzDecompress(compressed.data(), size - 1, out.data(), out.size()));
+    std::vector<uint8_t> badOffset{0x10, 'a', 0xff, 0x00};
+    REQUIRE_FALSE(lzDecompress(badOffset.data(), badOffset.size(), out.data(), out.size()));
+
+    // flipping bytes anywhere never crashes
+    for (size_t i = 0; i < size; i++)
+    {
+        std::vector<uint8_t> damaged(compressed.begin(), compressed.begin() + size);
+        damaged[i] ^= 0x5a;
+        lzDecompress(damaged.data(), damaged.size(), out.data(), out.size());
+    }
+}
@@ -0,0 +1,65 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceMemory.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("used memory follows allocations", "[memory]")
+{
+    size_t before = LettuceMemory::used();
+    auto block = std::make_unique<std::vector<char>>(1 << 20);
+    REQUIRE(LettuceMemory::used() >= before + (1 << 20));
+    REQUIRE(LettuceMemory::peak() >= LettuceMemory::used());
+    block.reset();
+    REQUIRE(LettuceMemory::used() < before + (1 << 20));
+    REQUIRE(LettuceMemory::peak() >= before + (1 << 20));
+    REQUIRE(LettuceMemory::rss() > 0);
+}
+
+TEST_CASE("memory scopes charge allocations to a category", "[memory]")
+{
+    size_t before = LettuceMemory::used(LettuceMemory::Lists);
+    std::unique_ptr<std::string> value;
+    {
+        LettuceMemory::Scope scope(LettuceMemory::Lists);
+        value = std::make_unique<std::string>(1000, 'x');
+        {
+            // nested scopes win, and restore the outer one when they end
+            LettuceMemory::Scope untracked(LettuceMemory::Untracked);
+            std::string ignored(5000, 'y');
+            REQUIRE(LettuceMemory::used(LettuceMemory::Lists) - before < 5000);
+        }
+        std::string temporary(3000, 'z');
+        REQUIRE(LettuceMemory::used(LettuceMemory::Lists) - before >= 4000);
+    }
+    size_t charged = LettuceMemory::used(LettuceMemory::Lists) - before;
+    REQUIRE(charged >= 1000 + sizeof(std::string));
+    REQUIRE(charged < 1200);
+
+    // scopes are per thread
+    std::thread([]()
+                { std::string other(10000, 'o'); })
+        .join();
+    REQUIRE(LettuceMemory::used(LettuceMemory::Lists) - before == charged);
+
+    LettuceMemory::Scope scope(LettuceMemory::Lists);
+    value.reset();
+    REQUIRE(LettuceMemory::used(LettuceMemory::Lists) == before);
+}
+
+TEST_CASE("heap sizes include allocator rounding", "[memory]")
+{
+    REQUIRE(LettuceMemory::allocationSize(1) == 24);
+    REQUIRE(LettuceMemory::allocationSize(24) == 24);
+    REQUIRE(LettuceMemory::allocationSize(25) == 40);
+    REQUIRE(LettuceMemory::allocationSize(1000) >= 1000);
+
+    std::string shortString = "abc";
+    REQUIRE(LettuceMemory::heapSize(shortString) == 0);
+    std::string longString(100, 'x');
+    REQUIRE(LettuceMemory::heapSize(longString) >= 101);
+    REQUIRE(LettuceMemory::heapSize(longString) == LettuceMemory::allocationSize(101));
+    REQUIRE(LettuceMemory::heapSize(nullptr) == 0);
+}
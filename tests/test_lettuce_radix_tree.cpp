@@ -0,0 +1,118 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceRadixTree.h"
+
+#include <string>
+#include <vector>
+
+static std::vector<std::string> withPrefix(const LettuceRadixTree &tree, const std::string &prefix)
+{
+    std::vector<std::string> keys;
+    tree.forEachWithPrefix(prefix, [&keys](const std::string &key)
+                           { keys.push_back(key); return true; });
+    return keys;
+}
+
+TEST_CASE("LettuceRadixTree insert, contains and remove", "[radix]")
+{
+    LettuceRadixTree tree;
+    REQUIRE(tree.insert("session:user1"));
+    REQUIRE(tree.insert("session:user2"));
+    REQUIRE(tree.insert("session"));
+    REQUIRE_FALSE(tree.insert("session:user1"));
+    REQUIRE(tree.size() == 3);
+
+    REQUIRE(tree.contains("session"));
+    REQUIRE(tree.contains("session:user2"));
+    REQUIRE_FALSE(tree.contains("session:user"));
+    REQUIRE_FALSE(tree.contains("sess"));
+
+    REQUIRE(tree.remove("session:user1"));
+    REQUIRE_FALSE(tree.remove("session:user1"));
+    REQUIRE_FALSE(tree.contains("session:user1"));
+    REQUIRE(tree.contains("session:user2"));
+    REQUIRE(tree.size() == 2);
+
+    // removing everything collapses back to just the root
+    REQUIRE(tree.remove("session:user2"));
+    REQUIRE(tree.remove("session"));
+    REQUIRE(tree.size() == 0);
+    REQUIRE(tree.nodeCount() == 1);
+}
+
+TEST_CASE("LettuceRadixTree prefix walk is ordered and stops early", "[radix]")
+{
+    LettuceRadixTree tree;
+    for (const char *key : {"user:3", "user:1", "user:2", "users", "admin:1", "u"})
+        tree.insert(key);
+
+    REQUIRE(withPrefix(tree, "user:") == std::vector<std::string>{"user:1", "user:2", "user:3"});
+    // the prefix can end part way along an edge
+    REQUIRE(withPrefix(tree, "use") == std::vector<std::string>{"user:1", "user:2", "user:3", "users"});
+    REQUIRE(withPrefix(tree, "nobody").empty());
+    REQUIRE(withPrefix(tree, "").size() == 6);
+
+    std::vector<std::string> firstTwo;
+    tree.forEachWithPrefix("user", [&firstTwo](const std::string &key)
+                           { firstTwo.push_back(key); return firstTwo.size() < 2; });
+    REQUIRE(firstTwo.size() == 2);
+}
+
+TEST_CASE("LettuceRadixTree prefix walk resumes after a key", "[radix]")
+{
+    LettuceRadixTree tree;
+    for (const char *key : {"user", "user:1", "user:10", "user:2", "user:3", "users", "admin"})
+        tree.insert(key);
+
+    auto after = [&tree](const std::string &prefix, const std::string &last)
+    {
+        std::vector<std::string> keys;
+        tree.forEachWithPrefix(prefix, &last, [&keys](const std::string &key)
+                               { keys.push_back(key); return true; });
+        return keys;
+    };
+    REQUIRE(after("user", "user:1") == std::vector<std::string>{"user:10", "user:2", "user:3", "users"});
+    REQUIRE(after("user", "user") == std::vector<std::string>{"user:1", "user:10", "user:2", "user:3", "users"});
+    REQUIRE(after("user:", "user:10") == std::vector<std::string>{"user:2", "user:3"});
+    // the last key doesn't have to exist any more
+    REQUIRE(after("user", "user:15") == std::vector<std::string>{"user:2", "user:3", "users"});
+    REQUIRE(after("user", "users").empty());
+    REQUIRE(after("user", "a") == withPrefix(tree, "user"));
+}
+
+TEST_CASE("LettuceRadixTree walks and frees deep trees", "[radix]")
+{
+    // every key extends the previous one, so the tree is as deep as there are keys
+    LettuceRadixTree tree;
+    std::string key;
+    for (int i = 0; i < 5000; i++)
+    {
+        key.push_back('a');
+        tree.insert(key);
+    }
+    REQUIRE(tree.nodeCount() == 5001);
+    size_t visited = 0;
+    size_t lastLength = 0;
+    bool ordered = true;
+    tree.forEachWithPrefix("aaa", [&](const std::string &visitedKey)
+                           {
+                               ordered &= visitedKey.size() == lastLength + 1 || lastLength == 0;
+                               lastLength = visitedKey.size();
+                               visited++;
+                               return true; });
+    REQUIRE(visited == 5000 - 2);
+    REQUIRE(ordered);
+    tree.clear();
+    REQUIRE(tree.size() == 0);
+}
+
+TEST_CASE("LettuceRadixTree reports memory usage", "[radix]")
+{
+    LettuceRadixTree tree;
+    size_t empty = tree.memoryUsage();
+    for (int i = 0; i < 100; i++)
+        tree.insert("key:" + std::to_string(i));
+    REQUIRE(tree.memoryUsage() > empty);
+    tree.clear();
+    REQUIRE(tree.size() == 0);
+    REQUIRE(tree.memoryUsage() == empty);
+}
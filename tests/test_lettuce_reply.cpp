@@ -0,0 +1,20 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceReply.h"
+
+TEST_CASE("LettuceReply writes RESP2 fallbacks", "[reply]")
+{
+    LettuceReply reply(2);
+    reply.map(1).bulk("f").bulk("v");
+    reply.set(1).integer(-5);
+    reply.null().nullArray().boolean(true).doubleValue(1.5);
+    REQUIRE(reply.take() == "*2\r\n$1\r\nf\r\n$1\r\nv\r\n*1\r\n:-5\r\n$-1\r\n*-1\r\n:1\r\n$3\r\n1.5\r\n");
+}
+
+TEST_CASE("LettuceReply writes native RESP3 types", "[reply]")
+{
+    LettuceReply reply(3);
+    reply.map(1).bulk("f").bulk("v");
+    reply.set(2).simple("a").error("ERR: nope");
+    reply.null().nullArray().boolean(false).doubleValue(1.5).push(0);
+    REQUIRE(reply.take() == "%1\r\n$1\r\nf\r\n$1\r\nv\r\n~2\r\n+a\r\n-ERR: nope\r\n_\r\n_\r\n#f\r\n,1.5\r\n>0\r\n");
+}
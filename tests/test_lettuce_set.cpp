@@ -0,0 +1,90 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceSet.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+TEST_CASE("LettuceSet stays intset encoded for integer members", "[set]")
+{
+    LettuceSet set;
+    REQUIRE(set.add("3"));
+    REQUIRE(set.add("-7"));
+    REQUIRE(set.add("42"));
+    REQUIRE_FALSE(set.add("3"));
+    REQUIRE(set.isIntset());
+    REQUIRE(set.size() == 3);
+    REQUIRE(set.contains("-7"));
+    REQUIRE_FALSE(set.contains("007"));
+
+    auto members = set.members();
+    REQUIRE(members == std::vector<std::string>{"-7", "3", "42"});
+}
+
+TEST_CASE("LettuceSet converts to hashtable for non canonical integers", "[set]")
+{
+    LettuceSet set;
+    set.add("1");
+    set.add("01");
+    REQUIRE_FALSE(set.isIntset());
+    REQUIRE(set.size() == 2);
+    REQUIRE(set.contains("1"));
+    REQUIRE(set.contains("01"));
+    REQUIRE(set.remove("01"));
+    REQUIRE_FALSE(set.contains("01"));
+}
+
+TEST_CASE("LettuceSet parseInteger only accepts canonical integers", "[set]")
+{
+    int64_t value;
+    REQUIRE(LettuceSet::parseInteger("-9223372036854775808", value));
+    REQUIRE(value == INT64_MIN);
+    REQUIRE_FALSE(LettuceSet::parseInteger("9223372036854775808", value));
+    REQUIRE_FALSE(LettuceSet::parseInteger("-0", value));
+    REQUIRE_FALSE(LettuceSet::parseInteger("+1", value));
+    REQUIRE_FALSE(LettuceSet::parseInteger("1a", value));
+}
+
+TEST_CASE("LettuceSet intersection kernels match std::set_intersection", "[set]")
+{
+    std::vector<int64_t> a, b;
+    for (int64_t i = 0; i < 5000; i += 3)
+        a.push_back(i);
+    for (int64_t i = 0; i < 5000; i += 5)
+        b.push_back(i);
+    std::vector<int64_t> expected;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+
+    std::vector<int64_t> merged;
+    intersectSortedMerge(a.data(), a.size(), b.data(), b.size(), merged);
+    REQUIRE(merged == expected);
+
+    std::vector<int64_t> galloped;
+    intersectSortedGallop(b.data(), b.size(), a.data(), a.size(), galloped);
+    REQUIRE(galloped == expected);
+
+    std::vector<int64_t> small{-5, 15, 2999, 4995, 7000};
+    std::vector<int64_t> viaDispatch;
+    intersectSorted(small, a, viaDispatch);
+    REQUIRE(viaDispatch == std::vector<int64_t>{15, 4995});
+}
+
+TEST_CASE("LettuceSet intersect, unite and difference across encodings", "[set]")
+{
+    LettuceSet ints, mixed;
+    for (int i = 0; i < 10; i++)
+        ints.add(std::to_string(i));
+    mixed.add("2");
+    mixed.add("4");
+    mixed.add("apple");
+
+    auto inter = LettuceSet::intersect({&ints, &mixed});
+    std::sort(inter.begin(), inter.end());
+    REQUIRE(inter == std::vector<std::string>{"2", "4"});
+
+    REQUIRE(LettuceSet::intersect({&ints, nullptr}).empty());
+    REQUIRE(LettuceSet::unite({&ints, &mixed}).size() == 11);
+
+    auto diff = LettuceSet::difference({&mixed, &ints});
+    REQUIRE(diff == std::vector<std::string>{"apple"});
+}
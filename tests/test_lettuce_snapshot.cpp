@@ -0,0 +1,226 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceSnapshot.h"
+
+#include <cstdio>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+TEST_CASE("crc64 matches the jones reference value", "[snapshot]")
+{
+    const std::string check = "123456789";
+    REQUIRE(crc64(0, reinterpret_cast<const uint8_t *>(check.data()), check.size()) == 0xe9c6d914c4b8d9caULL);
+
+    // chunked updates give the same result as one call
+    std::string data(1000, 'x');
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<char>(i * 31);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    uint64_t whole = crc64(0, bytes, data.size());
+    uint64_t chunked = crc64(crc64(0, bytes, 13), bytes + 13, data.size() - 13);
+    REQUIRE(whole == chunked);
+}
+
+TEST_CASE("crc64 of chunks combines into the crc of the whole", "[snapshot]")
+{
+    std::vector<uint8_t> data(9 << 20);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint8_t>(i * 2654435761u >> 13);
+    uint64_t whole = crc64(0, data.data(), data.size());
+
+    for (size_t split : {size_t(0), size_t(1), size_t(7), size_t(4096), data.size() - 3})
+    {
+        uint64_t a = crc64(0, data.data(), split);
+        uint64_t b = crc64(0, data.data() + split, data.size() - split);
+        REQUIRE(crc64Combine(a, b, data.size() - split) == whole);
+    }
+    REQUIRE(crc64Parallel(data.data(), data.size(), 1) == whole);
+    REQUIRE(crc64Parallel(data.data(), data.size(), 3) == whole);
+    REQUIRE(crc64Parallel(data.data(), 100, 8) == crc64(0, data.data(), 100));
+}
+
+TEST_CASE("LettuceSnapshotWriter output reads back and verifies", "[snapshot]")
+{
+    const std::string filename = "test_snapshot.ldb";
+    std::string binary("a\0b\r\n c:d", 9);
+    std::string large(3 * LettuceSnapshotWriter::bufferSize / 2, 'z'); // spans a buffer flush
+    {
+        LettuceSnapshotWriter writer;
+        REQUIRE(writer.open(filename));
+        writer.writeByte(7);
+        writer.writeLength(0);
+        writer.writeLength(300);
+        writer.writeLength(UINT64_MAX);
+        writer.writeUint64(0x0102030405060708ULL);
+        writer.writeString(binary);
+        writer.writeString(large);
+        REQUIRE(writer.finish());
+    }
+
+    std::vector<uint8_t> contents;
+    REQUIRE(readSnapshotFile(filename, contents));
+    size_t payloadEnd;
+    REQUIRE(verifySnapshot(contents.data(), contents.size(), payloadEnd));
+
+    LettuceSnapshotReader reader(contents.data() + LettuceSnapshot::headerSize, payloadEnd - LettuceSnapshot::headerSize);
+    uint8_t byte;
+    uint64_t length, value;
+    std::string text;
+    REQUIRE(reader.readByte(byte));
+    REQUIRE(byte == 7);
+    REQUIRE(reader.readLength(length));
+    REQUIRE(length == 0);
+    REQUIRE(reader.readLength(length));
+    REQUIRE(length == 300);
+    REQUIRE(reader.readLength(length));
+    REQUIRE(length == UINT64_MAX);
+    REQUIRE(reader.readUint64(value));
+    REQUIRE(value == 0x0102030405060708ULL);
+    REQUIRE(reader.readString(text));
+    REQUIRE(text == binary);
+    REQUIRE(reader.readString(text));
+    REQUIRE(text == large);
+    REQUIRE(reader.remaining() == 0);
+    REQUIRE_FALSE(reader.readByte(byte));
+
+    // the mapped file holds the same bytes and verifies in parallel too
+    {
+        LettuceMappedFile mapped;
+        REQUIRE(mapped.open(filename));
+        REQUIRE(mapped.size() == contents.size());
+        REQUIRE(std::equal(contents.begin(), contents.end(), mapped.data()));
+        REQUIRE(verifySnapshot(mapped.data(), mapped.size(), payloadEnd, 4));
+    }
+
+    // any flipped byte fails the checksum
+    contents[LettuceSnapshot::headerSize + 3] ^= 1;
+    REQUIRE_FALSE(verifySnapshot(contents.data(), contents.size(), payloadEnd));
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceSnapshotWriter stops writing once the file can't grow", "[snapshot]")
+{
+    const std::string filename = "test_snapshot_full.ldb";
+    std::remove(filename.c_str());
+    // the file size limit applies to the whole process, so the write runs in a child
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        // past the limit write fails with EFBIG instead of the signal killing the process
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit limit = {64 << 10, 64 << 10};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        LettuceSnapshotWriter writer;
+        if (!writer.open(filename))
+            _exit(2);
+        // single bytes keep coming after the failed flush, they must not run past the buffer
+        for (size_t i = 0; i < 2 * LettuceSnapshotWriter::bufferSize; i++)
+            writer.writeByte(static_cast<uint8_t>(i));
+        _exit(writer.finish() ? 1 : 0);
+    }
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    // a failed snapshot never replaces the file
+    std::vector<uint8_t> contents;
+    REQUIRE_FALSE(readSnapshotFile(filename, contents));
+}
+
+TEST_CASE("LettuceSnapshotWriter cuts records into segments", "[snapshot]")
+{
+    const std::string filename = "test_snapshot.ldb";
+    std::string value(1000, 'v');
+    const size_t records = 3 * LettuceSnapshotWriter::segmentSize / value.size();
+    {
+        LettuceSnapshotWriter writer;
+        REQUIRE(writer.open(filename));
+        writer.beginSegments();
+        for (size_t i = 0; i < records; i++)
+        {
+            writer.writeString(value);
+            writer.endRecord();
+        }
+        REQUIRE(writer.finish());
+    }
+
+    std::vector<uint8_t> contents;
+    REQUIRE(readSnapshotFile(filename, contents));
+    size_t payloadEnd;
+    REQUIRE(verifySnapshot(contents.data(), contents.size(), payloadEnd));
+
+    // every segment ends on a record boundary and together they hold every record
+    LettuceSnapshotReader reader(contents.data() + LettuceSnapshot::headerSize, payloadEnd - LettuceSnapshot::headerSize);
+    size_t segments = 0, seen = 0;
+    while (reader.remaining() > 0)
+    {
+        uint8_t op;
+        uint64_t keys, length;
+        REQUIRE(reader.readByte(op));
+        REQUIRE(op == LettuceSnapshot::opSegment);
+        REQUIRE(reader.readLength(keys));
+        REQUIRE(reader.readLength(length));
+        LettuceSnapshotReader segment(contents.data() + LettuceSnapshot::headerSize + reader.position(), length);
+        std::string text;
+        for (uint64_t i = 0; i < keys; i++)
+        {
+            REQUIRE(segment.readString(text));
+            REQUIRE(text == value);
+        }
+        REQUIRE(segment.remaining() == 0);
+        REQUIRE(reader.skip(length));
+        seen += keys;
+        segments++;
+    }
+    REQUIRE(seen == records);
+    REQUIRE(segments >= 3);
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceSnapshotWriter compresses segments that shrink", "[snapshot]")
+{
+    const std::string filename = "test_snapshot.ldb";
+    std::string value = "{\"name\":\"lettuce\",\"tags\":[\"a\",\"b\"],\"count\":12}";
+    const size_t records = 2 * LettuceSnapshotWriter::segmentSize / value.size();
+    {
+        LettuceSnapshotWriter writer;
+        REQUIRE(writer.open(filename));
+        writer.setCompression(true);
+        writer.beginSegments();
+        for (size_t i = 0; i < records; i++)
+        {
+            writer.writeString(value);
+            writer.endRecord();
+        }
+        REQUIRE(writer.finish());
+    }
+
+    std::vector<uint8_t> contents;
+    REQUIRE(readSnapshotFile(filename, contents));
+    REQUIRE(contents.size() < records * value.size() / 4);
+    size_t payloadEnd;
+    REQUIRE(verifySnapshot(contents.data(), contents.size(), payloadEnd));
+    REQUIRE(contents[LettuceSnapshot::headerSize] == LettuceSnapshot::opSegmentLz);
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("LettuceSnapshotReader rejects lengths past the end", "[snapshot]")
+{
+    // a string claiming 100 bytes with only 2 behind it
+    std::vector<uint8_t> data{100, 'a', 'b'};
+    LettuceSnapshotReader reader(data.data(), data.size());
+    std::string text;
+    REQUIRE_FALSE(reader.readString(text));
+
+    uint64_t value;
+    LettuceSnapshotReader shortReader(data.data(), data.size());
+    REQUIRE_FALSE(shortReader.readUint64(value));
+}
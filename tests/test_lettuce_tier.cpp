@@ -0,0 +1,98 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceTier.h"
+
+#include <string>
+#include <unistd.h>
+
+static bool fileExists(const std::string &path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+TEST_CASE("LettuceTierStore appends and reads values back", "[tier]")
+{
+    LettuceTierStore store("test-tier", 1 << 20);
+    LettuceTierLocation a, b;
+    REQUIRE(store.append("first value", a));
+    REQUIRE(store.append(std::string(5000, 'b'), b));
+    REQUIRE(a.segment == b.segment);
+    REQUIRE(b.offset == a.length);
+
+    std::string bytes;
+    REQUIRE(store.read(a, bytes));
+    REQUIRE(bytes == "first value");
+    // a reader holding the segment can read without the store
+    auto segment = store.segment(b.segment);
+    REQUIRE(segment != nullptr);
+    REQUIRE(LettuceTierStore::read(*segment, b, bytes));
+    REQUIRE(bytes == std::string(5000, 'b'));
+
+    LettuceTierFileStats stats = store.stats();
+    REQUIRE(stats.segments == 1);
+    REQUIRE(stats.fileBytes == 5011);
+    REQUIRE(stats.liveBytes == 5011);
+    store.release(a);
+    REQUIRE(store.stats().liveBytes == 5000);
+    REQUIRE(fileExists("test-tier.1"));
+}
+
+TEST_CASE("LettuceTierStore rolls segments and drops dead ones", "[tier]")
+{
+    {
+        LettuceTierStore store("test-tier", 1000);
+        LettuceTierLocation first, second, third;
+        REQUIRE(store.append(std::string(1000, '1'), first));
+        REQUIRE(store.append(std::string(300, '2'), second));
+        REQUIRE(store.append(std::string(300, '3'), third));
+        REQUIRE(first.segment == 1);
+        REQUIRE(second.segment == 2);
+        REQUIRE(third.segment == 2);
+        REQUIRE(store.stats().segments == 2);
+
+        // the active segment is never a candidate, a closed one is once it's less than half live
+        REQUIRE(store.compactionCandidate() == 0);
+        store.retain(first);
+        store.release(first);
+        REQUIRE(store.compactionCandidate() == 0);
+        store.release(first);
+        REQUIRE(store.stats().segments == 1);
+        REQUIRE_FALSE(fileExists("test-tier.1"));
+
+        LettuceTierLocation fourth, fifth;
+        REQUIRE(store.append(std::string(500, '4'), fourth));
+        REQUIRE(fourth.segment == 2);
+        REQUIRE(store.append(std::string(10, '5'), fifth));
+        REQUIRE(fifth.segment == 3);
+        store.release(second);
+        store.release(third);
+        REQUIRE(store.compactionCandidate() == 2);
+        store.release(fourth);
+        REQUIRE(store.stats().segments == 1);
+        REQUIRE_FALSE(fileExists("test-tier.2"));
+        REQUIRE(fileExists("test-tier.3"));
+    }
+    // the files only live as long as the store
+    REQUIRE_FALSE(fileExists("test-tier.3"));
+}
+
+TEST_CASE("LettuceTierStore picks the segment with the most dead space", "[tier]")
+{
+    LettuceTierStore store("test-tier", 100);
+    LettuceTierLocation a1, a2, b1, b2, c;
+    REQUIRE(store.append(std::string(60, 'a'), a1));
+    REQUIRE(store.append(std::string(60, 'a'), a2));
+    REQUIRE(store.append(std::string(80, 'b'), b1));
+    REQUIRE(store.append(std::string(30, 'b'), b2));
+    REQUIRE(store.append(std::string(10, 'c'), c));
+    REQUIRE(a1.segment == 1);
+    REQUIRE(b1.segment == 2);
+    REQUIRE(c.segment == 3);
+
+    store.release(a1); // 60 of 120 live, not under half
+    REQUIRE(store.compactionCandidate() == 0);
+    store.release(b1); // 30 of 110 live
+    REQUIRE(store.compactionCandidate() == 2);
+    store.setSegmentSize(1000);
+    REQUIRE(store.append("more", c));
+    REQUIRE(c.segment == 3);
+}
@@ -0,0 +1,71 @@
+#include <catch2/catch.hpp>
+#include "../include/LettuceTracking.h"
+
+TEST_CASE("LettuceTracking invalidates remembered keys once", "[tracking]")
+{
+    LettuceTracking &tracking = LettuceTracking::getInstance();
+    tracking.enable(9001, false, {});
+    tracking.rememberKeys(9001, {"user:1", "user:2"});
+
+    tracking.invalidateKey("user:1");
+    tracking.invalidateKey("other");
+    REQUIRE(tracking.takePending(9001) == ">2\r\n$10\r\ninvalidate\r\n*1\r\n$6\r\nuser:1\r\n");
+    REQUIRE(tracking.takePending(9001).empty());
+
+    // not re-read, so no second message
+    tracking.invalidateKey("user:1");
+    REQUIRE(tracking.takePending(9001).empty());
+
+    tracking.invalidateAll();
+    REQUIRE(tracking.takePending(9001) == ">2\r\n$10\r\ninvalidate\r\n_\r\n");
+    tracking.disable(9001);
+    REQUIRE_FALSE(tracking.isTracking(9001));
+}
+
+TEST_CASE("LettuceTracking broadcast mode matches prefixes", "[tracking]")
+{
+    LettuceTracking &tracking = LettuceTracking::getInstance();
+    tracking.enable(9002, true, {"session:", "cart:"});
+    tracking.invalidateKey("session:42");
+    tracking.invalidateKey("user:42");
+    tracking.invalidateKey("cart:7");
+    REQUIRE(tracking.takePending(9002) == ">2\r\n$10\r\ninvalidate\r\n*2\r\n$10\r\nsession:42\r\n$6\r\ncart:7\r\n");
+    tracking.disable(9002);
+}
+
+TEST_CASE("LettuceTracking table is bounded", "[tracking]")
+{
+    LettuceTracking &tracking = LettuceTracking::getInstance();
+    size_t previousMax = tracking.getMaxKeys();
+    tracking.setMaxKeys(2);
+    tracking.enable(9003, false, {});
+    tracking.rememberKeys(9003, {"a", "b", "c"});
+    REQUIRE(tracking.stats().keys == 2);
+    // the evicted key was invalidated early rather than silently forgotten
+    REQUIRE_FALSE(tracking.takePending(9003).empty());
+    tracking.disable(9003);
+    tracking.setMaxKeys(previousMax);
+}
+
+TEST_CASE("LettuceTracking forgets a client's keys when it stops tracking", "[tracking]")
+{
+    LettuceTracking &tracking = LettuceTracking::getInstance();
+    size_t keys = tracking.stats().keys;
+    tracking.enable(9004, false, {});
+    tracking.enable(9005, false, {});
+    tracking.rememberKeys(9004, {"shared", "mine"});
+    tracking.rememberKeys(9005, {"shared"});
+    REQUIRE(tracking.stats().keys == keys + 2);
+
+    // a key another client still reads stays in the table
+    tracking.disable(9004);
+    REQUIRE(tracking.stats().keys == keys + 1);
+    tracking.invalidateKey("shared");
+    REQUIRE(tracking.takePending(9005) == ">2\r\n$10\r\ninvalidate\r\n*1\r\n$6\r\nshared\r\n");
+
+    // switching to broadcast drops them too
+    tracking.rememberKeys(9005, {"shared"});
+    tracking.enable(9005, true, {"none:"});
+    REQUIRE(tracking.stats().keys == keys);
+    tracking.disable(9005);
+}